@@ -165,13 +165,29 @@
 
 #define TAG "app_driver"
 
+#define DIM_RATE_PERCENT 25   /* Percent of the brightness range a second while the button is held */
+
 static bool g_output_state = true;
+static bool g_dim_up = false;
 
 static void push_btn_cb(void *arg)
 {
     app_driver_set_state(!g_output_state);
 }
 
+static void push_btn_dim_start_cb(void *arg)
+{
+    /* Each hold dims the other way from the last one */
+    g_dim_up = !g_dim_up;
+    light_driver_dim_start(g_dim_up ? LIGHT_DIM_UP : LIGHT_DIM_DOWN, DIM_RATE_PERCENT);
+}
+
+static void push_btn_dim_stop_cb(void *arg)
+{
+    /* Does nothing if no ramp is running */
+    light_driver_dim_stop();
+}
+
 void app_driver_init()
 {
     /* Configure push button */
@@ -186,6 +202,9 @@ void app_driver_init()
     if (btn_handle) {
         /* Register a callback for a button short press event */
         iot_button_register_cb(btn_handle, BUTTON_SINGLE_CLICK, push_btn_cb);
+        /* Hold to dim, the ramp runs in the light driver until the button is released */
+        iot_button_register_cb(btn_handle, BUTTON_LONG_PRESS_START, push_btn_dim_start_cb);
+        iot_button_register_cb(btn_handle, BUTTON_PRESS_UP, push_btn_dim_stop_cb);
     }
 
     /**
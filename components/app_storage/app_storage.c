@@ -15,61 +15,317 @@
 #include "string.h"
 #include "stdio.h"
 #include "stdlib.h"
+#include "inttypes.h"
+#include "sys/lock.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include "nvs.h"
-#include "nvs_flash.h"
 
 #include "app_storage.h"
+#include "app_storage_backend.h"
 
 static const char *TAG = "app_storage";
 
-esp_err_t app_storage_init()
+/**
+ * The namespace is opened once on the backend and the handle kept until the
+ * device restarts. The values of the keys used last are kept in RAM: a read is
+ * served from there once the key has been read or written, and every write
+ * goes to flash first and to the cache only if it succeeded.
+ *
+ * A batch holds the storage from begin to commit and stages its writes in
+ * RAM. The commit writes a marker of the batch started, the staged keys, the
+ * marker again with the batch committed, and commits to NVS once. A marker
+ * left with fewer batches committed than started is a torn batch.
+ */
+
+#define APP_STORAGE_BATCH_KEY "batch_gen"
+
+#ifdef CONFIG_APP_STORAGE_BACKEND_FILE
+#define APP_STORAGE_BACKEND_DEFAULT (&app_storage_backend_file)
+#else
+#define APP_STORAGE_BACKEND_DEFAULT (&app_storage_backend_nvs)
+#endif
+
+typedef struct {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t *value;         /**< NULL if the slot is free */
+    size_t length;
+    uint32_t used;          /**< Stamp of the last use, the slot used least recently is replaced */
+} app_storage_cache_t;
+
+/**
+ * @brief A write staged by a batch, in the order of the calls
+ */
+typedef struct app_storage_staged {
+    struct app_storage_staged *next;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    bool erase;             /**< Erase the key rather than set it */
+    size_t length;
+    uint8_t value[];
+} app_storage_staged_t;
+
+typedef struct {
+    uint32_t started;       /**< Batches of more than one key begun */
+    uint32_t committed;     /**< Batches of more than one key fully written */
+} app_storage_batch_marker_t;
+
+static const app_storage_backend_t *g_storage_backend = NULL;
+static void *g_storage_handle           = NULL;
+static SemaphoreHandle_t g_storage_lock = NULL;
+static uint32_t g_storage_stamp         = 0;
+static app_storage_cache_t g_storage_cache[CONFIG_APP_STORAGE_CACHE_NUM];
+static bool g_storage_batch             = false;
+static app_storage_staged_t *g_storage_staged = NULL;
+static app_storage_batch_marker_t g_storage_marker = {0};
+static _lock_t g_storage_init_lock;     /**< Serialises the opening, app_storage_lock() may do it from any task */
+
+static app_storage_cache_t *app_storage_cache_find(const char *key)
+{
+    for (int i = 0; i < CONFIG_APP_STORAGE_CACHE_NUM; i++) {
+        if (g_storage_cache[i].value && !strncmp(g_storage_cache[i].key, key, NVS_KEY_NAME_MAX_SIZE)) {
+            return g_storage_cache + i;
+        }
+    }
+
+    return NULL;
+}
+
+static void app_storage_cache_free(app_storage_cache_t *entry)
+{
+    free(entry->value);
+    memset(entry, 0, sizeof(app_storage_cache_t));
+}
+
+/**
+ * @brief Drop the value of a key, or of every key if key is NULL
+ */
+static void app_storage_cache_drop(const char *key)
+{
+    for (int i = 0; i < CONFIG_APP_STORAGE_CACHE_NUM; i++) {
+        if (!key || (g_storage_cache[i].value && !strncmp(g_storage_cache[i].key, key, NVS_KEY_NAME_MAX_SIZE))) {
+            app_storage_cache_free(g_storage_cache + i);
+        }
+    }
+}
+
+/**
+ * @brief Keep the value a key has in flash, replacing the slot used least recently
+ */
+static void app_storage_cache_put(const char *key, const void *value, size_t length)
+{
+    app_storage_cache_t *entry = app_storage_cache_find(key);
+
+    if (length > CONFIG_APP_STORAGE_CACHE_VALUE_MAX) {
+        if (entry) {
+            app_storage_cache_free(entry);
+        }
+
+        return;
+    }
+
+    /**< A free slot has a stamp of 0 and goes first */
+    if (!entry) {
+        entry = g_storage_cache;
+
+        for (int i = 1; i < CONFIG_APP_STORAGE_CACHE_NUM; i++) {
+            entry = (g_storage_cache[i].used < entry->used) ? g_storage_cache + i : entry;
+        }
+    }
+
+    if (!entry->value || entry->length != length || strncmp(entry->key, key, NVS_KEY_NAME_MAX_SIZE)) {
+        uint8_t *buffer = realloc(entry->value, length);
+
+        if (!buffer) {
+            app_storage_cache_free(entry);
+            return;
+        }
+
+        entry->value = buffer;
+    }
+
+    strncpy(entry->key, key, NVS_KEY_NAME_MAX_SIZE - 1);
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    entry->used   = ++g_storage_stamp;
+}
+
+/**
+ * @brief Take the storage, initialising it on the first call
+ */
+static esp_err_t app_storage_lock(void)
+{
+    /**< Set last by the opening, the lock is there once it is seen */
+    if (!__atomic_load_n(&g_storage_backend, __ATOMIC_ACQUIRE)) {
+        esp_err_t ret = app_storage_init();
+        APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Initialise storage");
+    }
+
+    xSemaphoreTakeRecursive(g_storage_lock, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Write a value, or erase the key if value is NULL, and keep the cache in step, without a commit
+ */
+static esp_err_t app_storage_write(const char *key, const void *value, size_t length)
 {
-    static bool init_flag = false;
+    esp_err_t ret = value ? g_storage_backend->set(g_storage_handle, key, value, length)
+                    : g_storage_backend->erase(g_storage_handle, key);
 
-    if (!init_flag) {
-        esp_err_t ret = nvs_flash_init();
+    /**< What flash holds after a failed write is not known, it is read again next time */
+    if (ret == ESP_OK && value) {
+        app_storage_cache_put(key, value, length);
+    } else {
+        app_storage_cache_drop(key);
+    }
+
+    return ret;
+}
 
-        if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-            // NVS partition was truncated and needs to be erased
-            // Retry nvs_flash_init
-            ESP_ERROR_CHECK(nvs_flash_erase());
-            ret = nvs_flash_init();
+static app_storage_staged_t *app_storage_staged_find(const char *key)
+{
+    for (app_storage_staged_t *staged = g_storage_staged; staged; staged = staged->next) {
+        if (!strncmp(staged->key, key, NVS_KEY_NAME_MAX_SIZE)) {
+            return staged;
         }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Stage a write of the batch, replacing an earlier one of the same key
+ */
+static esp_err_t app_storage_stage(const char *key, const void *value, size_t length)
+{
+    app_storage_staged_t **tail = &g_storage_staged;
+
+    APP_STORAGE_ERROR_CHECK(strlen(key) >= NVS_KEY_NAME_MAX_SIZE, ESP_ERR_NVS_KEY_TOO_LONG,
+                            "Stage value for given key, key: %s", key);
+
+    app_storage_staged_t *staged = calloc(1, sizeof(app_storage_staged_t) + (value ? length : 0));
+    APP_STORAGE_ERROR_CHECK(!staged, ESP_ERR_NO_MEM, "Stage value for given key, key: %s", key);
+
+    strcpy(staged->key, key);
+    staged->erase  = !value;
+    staged->length = value ? length : 0;
+
+    if (value) {
+        memcpy(staged->value, value, length);
+    }
+
+    while (*tail) {
+        if (!strncmp((*tail)->key, key, NVS_KEY_NAME_MAX_SIZE)) {
+            app_storage_staged_t *replaced = *tail;
+            *tail = replaced->next;
+            free(replaced);
+            continue;
+        }
+
+        tail = &(*tail)->next;
+    }
+
+    *tail = staged;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Drop the staged writes and end the batch, giving the storage back
+ */
+static void app_storage_batch_end(void)
+{
+    while (g_storage_staged) {
+        app_storage_staged_t *staged = g_storage_staged;
+        g_storage_staged = staged->next;
+        free(staged);
+    }
+
+    g_storage_batch = false;
+
+    /**< Taken by app_storage_batch_begin() */
+    xSemaphoreGiveRecursive(g_storage_lock);
+}
+
+esp_err_t app_storage_init()
+{
+    return app_storage_init_backend(APP_STORAGE_BACKEND_DEFAULT, NULL);
+}
 
-        ESP_ERROR_CHECK(ret);
+/**
+ * @brief Open the namespace on the backend, once for good, with g_storage_init_lock held
+ */
+static esp_err_t app_storage_open(const app_storage_backend_t *backend, const void *config)
+{
+    if (g_storage_backend) {
+        APP_STORAGE_ERROR_CHECK(g_storage_backend != backend, ESP_ERR_INVALID_STATE,
+                                "Storage already open on %s", g_storage_backend->name);
+        return ESP_OK;
+    }
 
-        init_flag = true;
+    esp_err_t ret = backend->open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, config, &g_storage_handle);
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Open storage on %s", backend->name);
+
+    g_storage_lock = xSemaphoreCreateRecursiveMutex();
+
+    if (!g_storage_lock) {
+        backend->close(g_storage_handle);
+        APP_STORAGE_ERROR_CHECK(true, ESP_ERR_NO_MEM, "Create the storage lock");
     }
 
+    /**< A missing marker is no batch written yet */
+    size_t length = sizeof(app_storage_batch_marker_t);
+    backend->get(g_storage_handle, APP_STORAGE_BATCH_KEY, &g_storage_marker, &length);
+
+    __atomic_store_n(&g_storage_backend, backend, __ATOMIC_RELEASE);
+
     return ESP_OK;
 }
 
+esp_err_t app_storage_init_backend(const app_storage_backend_t *backend, const void *config)
+{
+    APP_STORAGE_PARAM_CHECK(backend);
+
+    /**< Tasks racing to the first access all wait for a single opening */
+    _lock_acquire(&g_storage_init_lock);
+    esp_err_t ret = app_storage_open(backend, config);
+    _lock_release(&g_storage_init_lock);
+
+    return ret;
+}
+
 esp_err_t app_storage_erase(const char *key)
 {
     APP_STORAGE_PARAM_CHECK(key);
 
-    esp_err_t ret    = ESP_OK;
-    nvs_handle handle = 0;
-
-    /**< Open non-volatile storage with a given namespace from the default NVS partition */
-    ret = nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle);
-    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Open non-volatile storage");
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
 
     /**
      * @brief If key is CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, erase all info in CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE
      */
     if (!strcmp(key, CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE)) {
-        ret = nvs_erase_all(handle);
+        ret = g_storage_batch ? ESP_ERR_INVALID_STATE : g_storage_backend->erase_all(g_storage_handle);
+
+        if (ret == ESP_OK) {
+            app_storage_cache_drop(NULL);
+            memset(&g_storage_marker, 0, sizeof(app_storage_batch_marker_t));
+        }
+    } else if (g_storage_batch) {
+        ret = app_storage_stage(key, NULL, 0);
     } else {
-        ret = nvs_erase_key(handle, key);
+        ret = app_storage_write(key, NULL, 0);
     }
 
     /**< Write any pending changes to non-volatile storage */
-    nvs_commit(handle);
+    if (!g_storage_batch) {
+        g_storage_backend->commit(g_storage_handle);
+    }
 
-    /**< Close the storage handle and free any allocated resources */
-    nvs_close(handle);
+    xSemaphoreGiveRecursive(g_storage_lock);
 
     APP_STORAGE_ERROR_CHECK(ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND,
                     ret, "Erase key-value pair, key: %s", key);
@@ -83,21 +339,20 @@ esp_err_t app_storage_set(const char *key, const void *value, size_t length)
     APP_STORAGE_PARAM_CHECK(value);
     APP_STORAGE_PARAM_CHECK(length > 0);
 
-    esp_err_t ret     = ESP_OK;
-    nvs_handle handle = 0;
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
 
-    /**< Open non-volatile storage with a given namespace from the default NVS partition */
-    ret = nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle);
-    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Open non-volatile storage");
-
-    /**< set variable length binary value for given key */
-    ret = nvs_set_blob(handle, key, value, length);
+    if (g_storage_batch) {
+        ret = app_storage_stage(key, value, length);
+    } else {
+        /**< set variable length binary value for given key */
+        ret = app_storage_write(key, value, length);
 
-    /**< Write any pending changes to non-volatile storage */
-    nvs_commit(handle);
+        /**< Write any pending changes to non-volatile storage */
+        g_storage_backend->commit(g_storage_handle);
+    }
 
-    /**< Close the storage handle and free any allocated resources */
-    nvs_close(handle);
+    xSemaphoreGiveRecursive(g_storage_lock);
 
     APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Set value for given key, key: %s", key);
 
@@ -110,18 +365,37 @@ esp_err_t app_storage_get(const char *key, void *value, size_t length)
     APP_STORAGE_PARAM_CHECK(value);
     APP_STORAGE_PARAM_CHECK(length > 0);
 
-    esp_err_t ret     = ESP_OK;
-    nvs_handle handle = 0;
-
-    /**< Open non-volatile storage with a given namespace from the default NVS partition */
-    ret = nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle);
-    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Open non-volatile storage");
+    app_storage_cache_t *entry = NULL;
+    app_storage_staged_t *staged = NULL;
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    /**< Inside a batch its own writes are read back */
+    staged = g_storage_batch ? app_storage_staged_find(key) : NULL;
+    entry  = staged ? NULL : app_storage_cache_find(key);
+
+    if (staged && staged->erase) {
+        ret = ESP_ERR_NVS_NOT_FOUND;
+    } else if (staged && length < staged->length) {
+        ret = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (staged) {
+        memcpy(value, staged->value, staged->length);
+    } else if (entry && length < entry->length) {
+        /**< As nvs_get_blob(), a buffer too small for the value is refused */
+        ret = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (entry) {
+        memcpy(value, entry->value, entry->length);
+        entry->used = ++g_storage_stamp;
+    } else {
+        /**< get variable length binary value for given key */
+        ret = g_storage_backend->get(g_storage_handle, key, value, &length);
 
-    /**< get variable length binary value for given key */
-    ret = nvs_get_blob(handle, key, value, &length);
+        if (ret == ESP_OK) {
+            app_storage_cache_put(key, value, length);
+        }
+    }
 
-    /**< Close the storage handle and free any allocated resources */
-    nvs_close(handle);
+    xSemaphoreGiveRecursive(g_storage_lock);
 
     if (ret == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGD(TAG, "<ESP_ERR_NVS_NOT_FOUND> Get value for given key, key: %s", key);
@@ -132,3 +406,101 @@ esp_err_t app_storage_get(const char *key, void *value, size_t length)
 
     return ESP_OK;
 }
+
+esp_err_t app_storage_batch_begin(void)
+{
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    if (g_storage_batch) {
+        xSemaphoreGiveRecursive(g_storage_lock);
+        APP_STORAGE_ERROR_CHECK(true, ESP_ERR_INVALID_STATE, "A batch is already open");
+    }
+
+    /**< The storage stays taken until the batch ends */
+    g_storage_batch = true;
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_commit(void)
+{
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    if (!g_storage_batch) {
+        xSemaphoreGiveRecursive(g_storage_lock);
+        APP_STORAGE_ERROR_CHECK(true, ESP_ERR_INVALID_STATE, "No batch open");
+    }
+
+    app_storage_batch_marker_t marker = {
+        .started   = g_storage_marker.started + 1,
+        .committed = g_storage_marker.committed,
+    };
+
+    /**< A single key is written at once anyway, it needs no marker */
+    bool marked = g_storage_staged && g_storage_staged->next;
+
+    if (marked) {
+        ret = app_storage_write(APP_STORAGE_BATCH_KEY, &marker, sizeof(app_storage_batch_marker_t));
+        g_storage_marker = (ret == ESP_OK) ? marker : g_storage_marker;
+    }
+
+    for (app_storage_staged_t *staged = g_storage_staged; staged && ret == ESP_OK; staged = staged->next) {
+        ret = app_storage_write(staged->key, staged->erase ? NULL : staged->value, staged->length);
+        ret = (staged->erase && ret == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : ret;
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> Write staged key, key: %s", esp_err_to_name(ret), staged->key);
+        }
+    }
+
+    if (marked && ret == ESP_OK) {
+        marker.committed = marker.started;
+        ret = app_storage_write(APP_STORAGE_BATCH_KEY, &marker, sizeof(app_storage_batch_marker_t));
+        g_storage_marker = (ret == ESP_OK) ? marker : g_storage_marker;
+    }
+
+    /**< Write all the changes of the batch to non-volatile storage */
+    if (g_storage_staged) {
+        g_storage_backend->commit(g_storage_handle);
+    }
+
+    app_storage_batch_end();
+    xSemaphoreGiveRecursive(g_storage_lock);
+
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Commit batch %" PRIu32, marker.started);
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_abort(void)
+{
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    if (!g_storage_batch) {
+        xSemaphoreGiveRecursive(g_storage_lock);
+        APP_STORAGE_ERROR_CHECK(true, ESP_ERR_INVALID_STATE, "No batch open");
+    }
+
+    app_storage_batch_end();
+    xSemaphoreGiveRecursive(g_storage_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_generation(uint32_t *generation)
+{
+    APP_STORAGE_PARAM_CHECK(generation);
+
+    esp_err_t ret = app_storage_lock();
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    *generation = g_storage_marker.committed;
+    bool torn   = g_storage_marker.started != g_storage_marker.committed;
+
+    xSemaphoreGiveRecursive(g_storage_lock);
+
+    return torn ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <esp_err.h>
 #include <esp_log.h>
 
@@ -94,6 +95,57 @@ esp_err_t app_storage_get(const char *key, void *value, size_t length);
  */
 esp_err_t app_storage_erase(const char *key);
 
+/**
+ * @brief  Start a batch of writes to be committed together
+ *
+ * @note   Until app_storage_batch_commit() or app_storage_batch_abort(),
+ *         app_storage_set() and app_storage_erase() of the calling task are
+ *         staged in RAM, and app_storage_get() reads them back. Other tasks
+ *         wait for the batch to end, so keep it short. The key "batch_gen" is
+ *         used by the batches and must not be set by the application.
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_STATE if this task already has a batch open
+ */
+esp_err_t app_storage_batch_begin(void);
+
+/**
+ * @brief  Write the staged keys with a single NVS commit and end the batch
+ *
+ * @note   A batch of more than one key bumps the generation counter around
+ *         its writes. A power cut or a failed write in the middle leaves the
+ *         batch torn, which app_storage_batch_generation() reports until the
+ *         next batch of more than one key is committed. A batch of one key is
+ *         written as app_storage_set() would, it can not be torn.
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_STATE if no batch is open
+ *     - The error of the first write that failed, the keys after it are not written
+ */
+esp_err_t app_storage_batch_commit(void);
+
+/**
+ * @brief  Drop the staged writes and end the batch, nothing is written
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_STATE if no batch is open
+ */
+esp_err_t app_storage_batch_abort(void);
+
+/**
+ * @brief  Generation of the last batch fully written
+ *
+ * @param  generation Batches of more than one key committed since the namespace was erased
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_STATE if a later batch was torn, the keys it staged may hold old or new values
+ */
+esp_err_t app_storage_batch_generation(uint32_t *generation);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,99 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief  Where app_storage keeps its keys, with the semantics of NVS
+ *
+ * @note   The calls mirror nvs_open(), nvs_set_blob(), nvs_get_blob(),
+ *         nvs_erase_key(), nvs_erase_all() and nvs_commit(), and return the
+ *         same ESP_ERR_NVS_* errors. app_storage serialises them, a backend
+ *         needs no lock of its own.
+ */
+typedef struct {
+    const char *name;
+
+    /**
+     * @brief Open a namespace
+     *
+     * @param name_space The namespace, at most 15 characters
+     * @param config Backend specific, NULL for the defaults
+     * @param handle Set to the opened namespace
+     */
+    esp_err_t (*open)(const char *name_space, const void *config, void **handle);
+    void (*close)(void *handle);
+
+    esp_err_t (*set)(void *handle, const char *key, const void *value, size_t length);
+
+    /**
+     * @brief Read a value, or only its length if value is NULL
+     *
+     * @param length The size of the buffer, set to the length of the value
+     *
+     * @return
+     *     - ESP_OK
+     *     - ESP_ERR_NVS_NOT_FOUND
+     *     - ESP_ERR_NVS_INVALID_LENGTH if the buffer is too small
+     */
+    esp_err_t (*get)(void *handle, const char *key, void *value, size_t *length);
+
+    /**
+     * @return ESP_ERR_NVS_NOT_FOUND if the key was not there
+     */
+    esp_err_t (*erase)(void *handle, const char *key);
+    esp_err_t (*erase_all)(void *handle);
+    esp_err_t (*commit)(void *handle);
+} app_storage_backend_t;
+
+/**
+ * @brief  The keys in the default NVS partition
+ */
+extern const app_storage_backend_t app_storage_backend_nvs;
+
+/**
+ * @brief  The keys in a memory mapped file, one file per namespace, for Linux
+ *
+ * @note   config is the directory of the files, NULL for
+ *         CONFIG_APP_STORAGE_FILE_DIR. See app_storage_file.h.
+ */
+extern const app_storage_backend_t app_storage_backend_file;
+
+/**
+ * @brief  Initialise the storage on a given backend instead of the one chosen in menuconfig
+ *
+ * @note   Call it before any other app_storage call, app_storage_init() and
+ *         the first get, set or erase would open the default backend.
+ *
+ * @param  backend The backend
+ * @param  config  Passed to the open call of the backend
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_STATE if the storage is already open on another backend
+ *     - The error of the backend opening the namespace
+ */
+esp_err_t app_storage_init_backend(const app_storage_backend_t *backend, const void *config);
+
+#ifdef __cplusplus
+}
+#endif
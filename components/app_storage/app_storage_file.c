@@ -0,0 +1,496 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nvs.h"
+
+#include "app_storage.h"
+#include "app_storage_backend.h"
+#include "app_storage_file.h"
+
+static const char *TAG = "app_storage_file";
+
+/**
+ * A namespace is a file of CONFIG_APP_STORAGE_FILE_SIZE bytes mapped in
+ * memory and laid out as an NVS partition is: 32-byte entries, a record of
+ * one entry of header followed by the entries of its value, appended at the
+ * end of the log. Bits only go from 1 to 0 as on flash: a free entry is
+ * 0xff, a record is marked written once all of it is in place, and a record
+ * replaced or erased is marked erased. Setting a key writes the new record
+ * before erasing the old one, so a record torn by a crash fails its CRC and
+ * the old one is kept, and of two complete records of a key the later wins.
+ *
+ * When the log is full the live records are copied to a new file that is
+ * renamed over the old one, as NVS moves them to its spare page. The keys
+ * are looked up in an index in RAM built when the file is opened.
+ */
+
+#define FILE_MAGIC          (0x4e565346)    /**< "FSVN" */
+#define FILE_VERSION        (1)
+#define FILE_ENTRY_SIZE     (32)
+#define FILE_STATE_EMPTY    (0xff)
+#define FILE_STATE_WRITTEN  (0xfe)
+#define FILE_STATE_ERASED   (0xfc)
+
+#define FILE_SPAN(length)   (FILE_ENTRY_SIZE + ((length) + FILE_ENTRY_SIZE - 1) / FILE_ENTRY_SIZE * FILE_ENTRY_SIZE)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t size;                          /**< Of the whole file */
+    uint32_t reserved;
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+} app_storage_file_header_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t reserved[3];
+    uint32_t length;                        /**< Of the value, which follows in whole entries */
+    uint32_t crc;                           /**< Of the key and the value */
+    uint32_t reserved2;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+} app_storage_file_record_t;
+
+_Static_assert(sizeof(app_storage_file_header_t) == FILE_ENTRY_SIZE, "file header is one entry");
+_Static_assert(sizeof(app_storage_file_record_t) == FILE_ENTRY_SIZE, "record header is one entry");
+
+typedef struct {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t offset;                          /**< Of the live record of the key */
+} app_storage_file_key_t;
+
+typedef struct {
+    char path[PATH_MAX];
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+    int fd;
+    uint8_t *map;
+    size_t end;                             /**< Where the next record goes */
+    app_storage_file_key_t *keys;
+    size_t num;
+    size_t capacity;
+} app_storage_file_t;
+
+static app_storage_file_stats_t g_file_stats = {0};
+
+static uint32_t app_storage_file_crc(const char *key, const void *value, size_t length)
+{
+    const uint8_t *data[2] = {(const uint8_t *)key, value};
+    const size_t sizes[2]  = {NVS_KEY_NAME_MAX_SIZE, length};
+    uint32_t crc = UINT32_MAX;
+
+    for (int i = 0; i < 2; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            crc ^= data[i][j];
+
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+            }
+        }
+    }
+
+    return ~crc;
+}
+
+static app_storage_file_record_t *app_storage_file_record(app_storage_file_t *file, size_t offset)
+{
+    return (app_storage_file_record_t *)(file->map + offset);
+}
+
+static app_storage_file_key_t *app_storage_file_find(app_storage_file_t *file, const char *key)
+{
+    for (size_t i = 0; i < file->num; i++) {
+        if (!strncmp(file->keys[i].key, key, NVS_KEY_NAME_MAX_SIZE)) {
+            return file->keys + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Mark a record erased, one byte written as NVS writes the state bits of its entry
+ */
+static void app_storage_file_mark_erased(app_storage_file_t *file, size_t offset)
+{
+    app_storage_file_record(file, offset)->state = FILE_STATE_ERASED;
+    g_file_stats.bytes_written++;
+}
+
+/**
+ * @brief Point a key at its record, marking the record it replaces erased
+ */
+static esp_err_t app_storage_file_index(app_storage_file_t *file, const char *key, size_t offset)
+{
+    app_storage_file_key_t *entry = app_storage_file_find(file, key);
+
+    if (entry) {
+        app_storage_file_mark_erased(file, entry->offset);
+        entry->offset = offset;
+        return ESP_OK;
+    }
+
+    if (file->num == file->capacity) {
+        size_t capacity = file->capacity ? file->capacity * 2 : 16;
+        app_storage_file_key_t *keys = realloc(file->keys, capacity * sizeof(app_storage_file_key_t));
+        APP_STORAGE_ERROR_CHECK(!keys, ESP_ERR_NO_MEM, "Grow the key index");
+
+        file->keys     = keys;
+        file->capacity = capacity;
+    }
+
+    entry = file->keys + file->num++;
+    memcpy(entry->key, key, NVS_KEY_NAME_MAX_SIZE);
+    entry->offset = offset;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Map a file of CONFIG_APP_STORAGE_FILE_SIZE bytes, creating it if needed
+ */
+static uint8_t *app_storage_file_map(const char *path, int *fd)
+{
+    struct stat st;
+
+    *fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (*fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(*fd, &st) || (st.st_size != CONFIG_APP_STORAGE_FILE_SIZE
+                            && ftruncate(*fd, CONFIG_APP_STORAGE_FILE_SIZE))) {
+        close(*fd);
+        return NULL;
+    }
+
+    uint8_t *map = mmap(NULL, CONFIG_APP_STORAGE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+
+    if (map == MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+
+    return map;
+}
+
+static void app_storage_file_format(app_storage_file_t *file)
+{
+    app_storage_file_header_t *header = (app_storage_file_header_t *)file->map;
+
+    memset(file->map, FILE_STATE_EMPTY, CONFIG_APP_STORAGE_FILE_SIZE);
+    header->magic      = FILE_MAGIC;
+    header->version    = FILE_VERSION;
+    header->entry_size = FILE_ENTRY_SIZE;
+    header->size       = CONFIG_APP_STORAGE_FILE_SIZE;
+    header->reserved   = 0;
+    memcpy(header->name_space, file->name_space, NVS_KEY_NAME_MAX_SIZE);
+
+    file->end = FILE_ENTRY_SIZE;
+    file->num = 0;
+    g_file_stats.bytes_written += FILE_ENTRY_SIZE;
+}
+
+/**
+ * @brief Build the index from the log, dropping torn records
+ */
+static esp_err_t app_storage_file_scan(app_storage_file_t *file)
+{
+    size_t offset = FILE_ENTRY_SIZE;
+
+    file->num = 0;
+
+    while (offset + FILE_ENTRY_SIZE <= CONFIG_APP_STORAGE_FILE_SIZE) {
+        app_storage_file_record_t *record = app_storage_file_record(file, offset);
+
+        if (record->state == FILE_STATE_EMPTY || record->length > CONFIG_APP_STORAGE_FILE_SIZE
+                || offset + FILE_SPAN(record->length) > CONFIG_APP_STORAGE_FILE_SIZE) {
+            break;
+        }
+
+        if (record->state == FILE_STATE_WRITTEN) {
+            if (record->crc == app_storage_file_crc(record->key, record + 1, record->length)) {
+                esp_err_t ret = app_storage_file_index(file, record->key, offset);
+                APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+            } else {
+                ESP_LOGW(TAG, "Drop torn record at %zu, key: %.15s", offset, record->key);
+                app_storage_file_mark_erased(file, offset);
+            }
+        }
+
+        offset += FILE_SPAN(record->length);
+    }
+
+    /**< A record cut short before it was marked written leaves the rest to be written again */
+    file->end = offset;
+
+    for (size_t i = offset; i < CONFIG_APP_STORAGE_FILE_SIZE; i++) {
+        if (file->map[i] != FILE_STATE_EMPTY) {
+            memset(file->map + i, FILE_STATE_EMPTY, CONFIG_APP_STORAGE_FILE_SIZE - i);
+            break;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy the live records to a new file and rename it over the old one
+ */
+static esp_err_t app_storage_file_compact(app_storage_file_t *file)
+{
+    char path[PATH_MAX + 4];
+    app_storage_file_t compacted = *file;
+
+    snprintf(path, sizeof(path), "%s.new", file->path);
+    compacted.map = app_storage_file_map(path, &compacted.fd);
+    APP_STORAGE_ERROR_CHECK(!compacted.map, ESP_FAIL, "Map %s", path);
+
+    app_storage_file_format(&compacted);
+
+    for (size_t i = 0; i < file->num; i++) {
+        app_storage_file_record_t *record = app_storage_file_record(file, file->keys[i].offset);
+        size_t span = FILE_SPAN(record->length);
+
+        memcpy(compacted.map + compacted.end, record, span);
+        compacted.end += span;
+        g_file_stats.bytes_written += span;
+    }
+
+    if (msync(compacted.map, CONFIG_APP_STORAGE_FILE_SIZE, MS_SYNC) || rename(path, file->path)) {
+        munmap(compacted.map, CONFIG_APP_STORAGE_FILE_SIZE);
+        close(compacted.fd);
+        unlink(path);
+        APP_STORAGE_ERROR_CHECK(true, ESP_FAIL, "Replace %s", file->path);
+    }
+
+    /**< The keys point at their records in the order they were copied */
+    for (size_t i = 0, offset = FILE_ENTRY_SIZE; i < file->num; i++) {
+        size_t span = FILE_SPAN(app_storage_file_record(file, file->keys[i].offset)->length);
+        file->keys[i].offset = offset;
+        offset += span;
+    }
+
+    munmap(file->map, CONFIG_APP_STORAGE_FILE_SIZE);
+    close(file->fd);
+    compacted.num = file->num;
+    *file = compacted;
+    g_file_stats.compactions++;
+
+    return ESP_OK;
+}
+
+static esp_err_t app_storage_file_open(const char *name_space, const void *config, void **handle)
+{
+    const char *dir = config ? config : CONFIG_APP_STORAGE_FILE_DIR;
+    const app_storage_file_header_t *header = NULL;
+
+    APP_STORAGE_ERROR_CHECK(strlen(name_space) >= NVS_KEY_NAME_MAX_SIZE, ESP_ERR_NVS_KEY_TOO_LONG,
+                            "Namespace %s", name_space);
+
+    app_storage_file_t *file = calloc(1, sizeof(app_storage_file_t));
+    APP_STORAGE_ERROR_CHECK(!file, ESP_ERR_NO_MEM, "Allocate file");
+
+    snprintf(file->path, sizeof(file->path), "%s/%s.nvs", dir, name_space);
+    strncpy(file->name_space, name_space, NVS_KEY_NAME_MAX_SIZE - 1);
+    file->map = app_storage_file_map(file->path, &file->fd);
+
+    if (!file->map) {
+        free(file);
+        APP_STORAGE_ERROR_CHECK(true, ESP_FAIL, "Map %s/%s.nvs", dir, name_space);
+    }
+
+    /**< A new file, or one of another layout, starts empty as NVS does on ESP_ERR_NVS_NEW_VERSION_FOUND */
+    header = (const app_storage_file_header_t *)file->map;
+
+    if (header->magic != FILE_MAGIC || header->version != FILE_VERSION || header->size != CONFIG_APP_STORAGE_FILE_SIZE
+            || strncmp(header->name_space, name_space, NVS_KEY_NAME_MAX_SIZE)) {
+        ESP_LOGI(TAG, "Format %s", file->path);
+        app_storage_file_format(file);
+    }
+
+    esp_err_t ret = app_storage_file_scan(file);
+
+    if (ret != ESP_OK) {
+        munmap(file->map, CONFIG_APP_STORAGE_FILE_SIZE);
+        close(file->fd);
+        free(file->keys);
+        free(file);
+        return ret;
+    }
+
+    *handle = file;
+
+    return ESP_OK;
+}
+
+static void app_storage_file_close(void *handle)
+{
+    app_storage_file_t *file = handle;
+
+    msync(file->map, CONFIG_APP_STORAGE_FILE_SIZE, MS_SYNC);
+    munmap(file->map, CONFIG_APP_STORAGE_FILE_SIZE);
+    close(file->fd);
+    free(file->keys);
+    free(file);
+}
+
+static esp_err_t app_storage_file_set(void *handle, const char *key, const void *value, size_t length)
+{
+    app_storage_file_t *file = handle;
+    app_storage_file_key_t *entry = NULL;
+    char name[NVS_KEY_NAME_MAX_SIZE] = {0};
+    size_t span = FILE_SPAN(length);
+
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    if (span > CONFIG_APP_STORAGE_FILE_SIZE - FILE_ENTRY_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    /**< As NVS, a value the key already holds is not written again */
+    entry = app_storage_file_find(file, key);
+
+    if (entry) {
+        app_storage_file_record_t *record = app_storage_file_record(file, entry->offset);
+
+        if (record->length == length && !memcmp(record + 1, value, length)) {
+            return ESP_OK;
+        }
+    }
+
+    if (file->end + span > CONFIG_APP_STORAGE_FILE_SIZE) {
+        esp_err_t ret = app_storage_file_compact(file);
+        APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+    }
+
+    if (file->end + span > CONFIG_APP_STORAGE_FILE_SIZE) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    app_storage_file_record_t *record = app_storage_file_record(file, file->end);
+
+    strcpy(name, key);
+    memcpy(record + 1, value, length);
+    memcpy(record->key, name, NVS_KEY_NAME_MAX_SIZE);
+    memset(record->reserved, 0, sizeof(record->reserved));
+    record->length    = length;
+    record->crc       = app_storage_file_crc(name, value, length);
+    record->reserved2 = 0;
+    record->state     = FILE_STATE_WRITTEN;
+
+    esp_err_t ret = app_storage_file_index(file, name, file->end);
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+
+    file->end += span;
+    g_file_stats.sets++;
+    g_file_stats.bytes_written += span;
+
+    return ESP_OK;
+}
+
+static esp_err_t app_storage_file_get(void *handle, const char *key, void *value, size_t *length)
+{
+    app_storage_file_t *file = handle;
+    app_storage_file_key_t *entry = app_storage_file_find(file, key);
+
+    g_file_stats.gets++;
+
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    app_storage_file_record_t *record = app_storage_file_record(file, entry->offset);
+
+    if (value && *length < record->length) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    if (value) {
+        memcpy(value, record + 1, record->length);
+    }
+
+    *length = record->length;
+
+    return ESP_OK;
+}
+
+static esp_err_t app_storage_file_erase(void *handle, const char *key)
+{
+    app_storage_file_t *file = handle;
+    app_storage_file_key_t *entry = app_storage_file_find(file, key);
+
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    app_storage_file_mark_erased(file, entry->offset);
+    *entry = file->keys[--file->num];
+    g_file_stats.erases++;
+
+    return ESP_OK;
+}
+
+static esp_err_t app_storage_file_erase_all(void *handle)
+{
+    app_storage_file_t *file = handle;
+
+    for (size_t i = 0; i < file->num; i++) {
+        app_storage_file_mark_erased(file, file->keys[i].offset);
+    }
+
+    g_file_stats.erases += file->num;
+    file->num = 0;
+
+    return ESP_OK;
+}
+
+static esp_err_t app_storage_file_commit(void *handle)
+{
+    app_storage_file_t *file = handle;
+
+    /**< Written through the mapping already, this only starts the write back */
+    msync(file->map, CONFIG_APP_STORAGE_FILE_SIZE, MS_ASYNC);
+    g_file_stats.commits++;
+
+    return ESP_OK;
+}
+
+void app_storage_file_stats(app_storage_file_stats_t *stats)
+{
+    *stats = g_file_stats;
+}
+
+const app_storage_backend_t app_storage_backend_file = {
+    .name      = "file",
+    .open      = app_storage_file_open,
+    .close     = app_storage_file_close,
+    .set       = app_storage_file_set,
+    .get       = app_storage_file_get,
+    .erase     = app_storage_file_erase,
+    .erase_all = app_storage_file_erase_all,
+    .commit    = app_storage_file_commit,
+};
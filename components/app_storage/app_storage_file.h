@@ -0,0 +1,43 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief  What the file backend has done since the start, over all its namespaces
+ */
+typedef struct {
+    uint32_t sets;              /**< Values written, setting a key to the value it holds writes nothing */
+    uint32_t gets;
+    uint32_t erases;            /**< Keys erased, one by one or by an erase of all */
+    uint32_t commits;
+    uint32_t compactions;       /**< Files rewritten with only their live records */
+    uint64_t bytes_written;     /**< Records, state marks and compacted files */
+} app_storage_file_stats_t;
+
+/**
+ * @brief  Read the counters of the file backend
+ */
+void app_storage_file_stats(app_storage_file_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
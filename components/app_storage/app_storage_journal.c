@@ -0,0 +1,484 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "app_storage.h"
+#include "app_storage_journal.h"
+
+static const char *TAG = "app_storage_journal";
+
+/**
+ * The partition is a ring of sectors. A sector starts with a header holding
+ * its sequence number, the current sector is the valid one with the highest.
+ * Its first record is the whole record, each record after it is a delta of
+ * the runs of bytes changed from the one before, or the whole record again if
+ * that is shorter or its length changed. A record carries the sequence number
+ * following the one before it and a CRC, replay stops at the first record
+ * that is not erased flash and fails either, and the next append then moves
+ * to a new sector rather than write after it.
+ *
+ * Moving on writes the whole record first in the next sector, so the
+ * sectors before it are not needed anymore. If that record is torn, the
+ * replay falls back to the sector before. Erasing the next sector is left to
+ * app_storage_journal_compact(), an append only erases if it has not run.
+ */
+
+#define JOURNAL_MAGIC           (0x4c4e524a)    /**< "JRNL" */
+#define JOURNAL_VERSION         (1)
+#define JOURNAL_SECTOR_SIZE     (4096)
+#define JOURNAL_TYPE_SNAPSHOT   (0x01)
+#define JOURNAL_TYPE_DELTA      (0x02)
+#define JOURNAL_RUN_GAP         (2)     /**< Unchanged bytes a run of a delta takes in rather than start another */
+
+#define JOURNAL_SPAN(length)    ((sizeof(journal_record_header_t) + (length) + 3) & ~3)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;          /**< One more than the sector the journal moved from */
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t crc;               /**< Of the fields above */
+} journal_sector_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;             /**< Of the payload that follows, padded to 4 bytes with 0xff */
+    uint16_t reserved;
+    uint32_t sequence;          /**< One more than the record before it */
+    uint32_t crc;               /**< Of the fields above and the payload */
+} journal_record_header_t;
+
+struct app_storage_journal {
+    const esp_partition_t *partition;
+    SemaphoreHandle_t lock;
+    uint32_t sector_num;
+    uint32_t sector;            /**< Current sector, the last one if nothing was ever appended */
+    uint32_t sector_sequence;
+    uint32_t offset;            /**< Where the next record goes in the current sector */
+    uint32_t sequence;          /**< Of the last record */
+    bool torn;                  /**< The current sector ends in a torn record, the next append moves on */
+    bool next_erased;           /**< The sector after the current one is erased */
+    size_t length;              /**< Of the record, 0 if nothing was ever appended */
+    uint8_t record[APP_STORAGE_JOURNAL_RECORD_MAX];
+    app_storage_journal_stats_t stats;
+};
+
+static uint32_t journal_sector_crc(const journal_sector_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(journal_sector_header_t, crc));
+}
+
+static uint32_t journal_record_crc(const journal_record_header_t *header, const uint8_t *payload)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(journal_record_header_t, crc));
+    return esp_rom_crc32_le(crc, payload, header->length);
+}
+
+/**
+ * @brief Runs of offset, count and bytes changed from one record to the next
+ *
+ * @return Length of the delta, 0 if it is no shorter than the record
+ */
+static size_t journal_delta_encode(const uint8_t *from, const uint8_t *to, size_t length, uint8_t *delta)
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < length;) {
+        if (from[i] == to[i]) {
+            i++;
+            continue;
+        }
+
+        size_t end = i + 1;     /**< Past the last byte of the run changed */
+
+        for (size_t j = end; j < length && j <= end + JOURNAL_RUN_GAP; j++) {
+            end = (from[j] != to[j]) ? j + 1 : end;
+        }
+
+        if (size + 2 + end - i >= length) {
+            return 0;
+        }
+
+        delta[size]     = i;
+        delta[size + 1] = end - i;
+        memcpy(delta + size + 2, to + i, end - i);
+        size += 2 + end - i;
+        i = end;
+    }
+
+    return size;
+}
+
+static bool journal_delta_apply(uint8_t *record, size_t length, const uint8_t *delta, size_t size)
+{
+    size_t i = 0;
+
+    while (i + 2 <= size) {
+        size_t offset = delta[i];
+        size_t count  = delta[i + 1];
+
+        if (!count || i + 2 + count > size || offset + count > length) {
+            return false;
+        }
+
+        memcpy(record + offset, delta + i + 2, count);
+        i += 2 + count;
+    }
+
+    return i == size;
+}
+
+static esp_err_t journal_write(app_storage_journal_t *journal, uint32_t sector, uint32_t offset,
+                               const void *data, size_t size)
+{
+    journal->stats.bytes_written += size;
+    return esp_partition_write(journal->partition, sector * JOURNAL_SECTOR_SIZE + offset, data, size);
+}
+
+static esp_err_t journal_erase(app_storage_journal_t *journal, uint32_t sector)
+{
+    esp_err_t ret = esp_partition_erase_range(journal->partition, sector * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE);
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Erase sector %" PRIu32 " of %s", sector, journal->partition->label);
+
+    journal->stats.erases++;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Sequence number of a sector, false if its header is not valid
+ */
+static bool journal_sector_sequence(app_storage_journal_t *journal, uint32_t sector, uint32_t *sequence)
+{
+    journal_sector_header_t header;
+
+    if (esp_partition_read(journal->partition, sector * JOURNAL_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK
+            || header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION
+            || header.crc != journal_sector_crc(&header)) {
+        return false;
+    }
+
+    *sequence = header.sequence;
+
+    return true;
+}
+
+/**
+ * @brief Replay the records of a sector, false if its first record is not valid
+ */
+static bool journal_replay_sector(app_storage_journal_t *journal, uint32_t sector, uint32_t sector_sequence)
+{
+    uint8_t record[APP_STORAGE_JOURNAL_RECORD_MAX];
+    uint8_t payload[APP_STORAGE_JOURNAL_RECORD_MAX];
+    size_t length     = 0;
+    uint32_t sequence = 0;
+    uint32_t offset   = sizeof(journal_sector_header_t);
+    bool torn         = false;
+
+    while (offset + sizeof(journal_record_header_t) <= JOURNAL_SECTOR_SIZE) {
+        journal_record_header_t header;
+        uint8_t next[APP_STORAGE_JOURNAL_RECORD_MAX];
+        size_t address = sector * JOURNAL_SECTOR_SIZE + offset;
+
+        if (esp_partition_read(journal->partition, address, &header, sizeof(header)) != ESP_OK) {
+            torn = true;
+            break;
+        }
+
+        /**< Erased flash, the end of the sector */
+        const uint8_t *bytes = (const uint8_t *)&header;
+        size_t erased = 0;
+
+        while (erased < sizeof(header) && bytes[erased] == 0xff) {
+            erased++;
+        }
+
+        if (erased == sizeof(header)) {
+            break;
+        }
+
+        bool valid = header.length && header.length <= APP_STORAGE_JOURNAL_RECORD_MAX
+                     && offset + JOURNAL_SPAN(header.length) <= JOURNAL_SECTOR_SIZE
+                     && (!length || header.sequence == sequence + 1)
+                     && esp_partition_read(journal->partition, address + sizeof(header), payload, header.length) == ESP_OK
+                     && header.crc == journal_record_crc(&header, payload);
+
+        if (valid && header.type == JOURNAL_TYPE_SNAPSHOT) {
+            memcpy(next, payload, header.length);
+            length = header.length;
+        } else if (valid && header.type == JOURNAL_TYPE_DELTA && length) {
+            memcpy(next, record, length);
+            valid = journal_delta_apply(next, length, payload, header.length);
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            ESP_LOGW(TAG, "Drop torn record at %" PRIu32 " of sector %" PRIu32, offset, sector);
+            torn = true;
+            break;
+        }
+
+        memcpy(record, next, length);
+        sequence = header.sequence;
+        offset  += JOURNAL_SPAN(header.length);
+    }
+
+    if (!length) {
+        return false;
+    }
+
+    journal->sector          = sector;
+    journal->sector_sequence = sector_sequence;
+    journal->offset          = offset;
+    journal->sequence        = sequence;
+    journal->torn            = torn;
+    journal->length          = length;
+    memcpy(journal->record, record, length);
+
+    return true;
+}
+
+/**
+ * @brief Find the current sector and replay it, the newest sector with a valid first record
+ */
+static void journal_replay(app_storage_journal_t *journal)
+{
+    uint32_t below = UINT32_MAX;    /**< Sequence numbers of the sectors tried already start here */
+
+    for (;;) {
+        uint32_t newest  = 0;
+        uint32_t current = journal->sector_num;
+
+        for (uint32_t sector = 0; sector < journal->sector_num; sector++) {
+            uint32_t sequence;
+
+            if (journal_sector_sequence(journal, sector, &sequence) && sequence < below
+                    && (current == journal->sector_num || sequence > newest)) {
+                newest  = sequence;
+                current = sector;
+            }
+        }
+
+        if (current == journal->sector_num || journal_replay_sector(journal, current, newest)) {
+            return;
+        }
+
+        below = newest;
+    }
+}
+
+/**
+ * @brief Start the next sector with a whole record
+ */
+static esp_err_t journal_move(app_storage_journal_t *journal, const void *record, size_t span)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t sector = (journal->sector + 1) % journal->sector_num;
+    journal_sector_header_t header = {
+        .magic    = JOURNAL_MAGIC,
+        .sequence = journal->sector_sequence + 1,
+        .version  = JOURNAL_VERSION,
+        .reserved = UINT16_MAX,
+    };
+
+    header.crc = journal_sector_crc(&header);
+
+    if (!journal->next_erased) {
+        ret = journal_erase(journal, sector);
+        APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "");
+        journal->stats.inline_erases++;
+    }
+
+    /**< Erased or not, what it holds now is not known to be blank */
+    journal->next_erased = false;
+
+    ret = journal_write(journal, sector, 0, &header, sizeof(header));
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Write sector header");
+
+    ret = journal_write(journal, sector, sizeof(header), record, span);
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Write record");
+
+    journal->sector          = sector;
+    journal->sector_sequence = header.sequence;
+    journal->offset          = sizeof(header) + span;
+    journal->torn            = false;
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_journal_open(const char *label, app_storage_journal_t **journal)
+{
+    APP_STORAGE_PARAM_CHECK(label);
+    APP_STORAGE_PARAM_CHECK(journal);
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                       ESP_PARTITION_SUBTYPE_ANY, label);
+    APP_STORAGE_ERROR_CHECK(!partition, ESP_ERR_NOT_FOUND, "Find partition %s", label);
+    APP_STORAGE_ERROR_CHECK(partition->size % JOURNAL_SECTOR_SIZE || partition->size < 2 * JOURNAL_SECTOR_SIZE,
+                            ESP_ERR_INVALID_SIZE, "Size of partition %s", label);
+
+    app_storage_journal_t *opened = calloc(1, sizeof(app_storage_journal_t));
+    APP_STORAGE_ERROR_CHECK(!opened, ESP_ERR_NO_MEM, "calloc journal");
+
+    opened->lock = xSemaphoreCreateMutex();
+
+    if (!opened->lock) {
+        free(opened);
+        APP_STORAGE_ERROR_CHECK(true, ESP_ERR_NO_MEM, "xSemaphoreCreateMutex");
+    }
+
+    opened->partition  = partition;
+    opened->sector_num = partition->size / JOURNAL_SECTOR_SIZE;
+    opened->sector     = opened->sector_num - 1;
+
+    journal_replay(opened);
+    *journal = opened;
+
+    ESP_LOGD(TAG, "%s: sector %" PRIu32 ", record %" PRIu32 ", length %zu",
+             label, opened->sector, opened->sequence, opened->length);
+
+    return ESP_OK;
+}
+
+void app_storage_journal_close(app_storage_journal_t *journal)
+{
+    if (journal) {
+        vSemaphoreDelete(journal->lock);
+        free(journal);
+    }
+}
+
+esp_err_t app_storage_journal_append(app_storage_journal_t *journal, const void *record, size_t length)
+{
+    APP_STORAGE_PARAM_CHECK(journal);
+    APP_STORAGE_PARAM_CHECK(record);
+    APP_STORAGE_PARAM_CHECK(length > 0 && length <= APP_STORAGE_JOURNAL_RECORD_MAX);
+
+    esp_err_t ret = ESP_OK;
+    uint8_t buf[JOURNAL_SPAN(APP_STORAGE_JOURNAL_RECORD_MAX)];
+    journal_record_header_t *header = (journal_record_header_t *)buf;
+    uint8_t *payload = buf + sizeof(journal_record_header_t);
+
+    xSemaphoreTake(journal->lock, portMAX_DELAY);
+
+    if (length == journal->length && !memcmp(journal->record, record, length)) {
+        xSemaphoreGive(journal->lock);
+        return ESP_OK;
+    }
+
+    size_t size = (length == journal->length) ? journal_delta_encode(journal->record, record, length, payload) : 0;
+    bool move   = !journal->length || journal->torn
+                  || journal->offset + JOURNAL_SPAN(size ? size : length) > JOURNAL_SECTOR_SIZE;
+
+    uint8_t type = JOURNAL_TYPE_DELTA;
+
+    /**< A new sector starts with the whole record */
+    if (move || !size) {
+        memcpy(payload, record, length);
+        size = length;
+        type = JOURNAL_TYPE_SNAPSHOT;
+    }
+
+    size_t span = JOURNAL_SPAN(size);
+    memset(payload + size, 0xff, span - sizeof(journal_record_header_t) - size);
+    header->type     = type;
+    header->length   = size;
+    header->reserved = UINT16_MAX;
+    header->sequence = journal->sequence + 1;
+    header->crc      = journal_record_crc(header, payload);
+
+    if (move) {
+        ret = journal_move(journal, buf, span);
+    } else {
+        ret = journal_write(journal, journal->sector, journal->offset, buf, span);
+        journal->offset += (ret == ESP_OK) ? span : 0;
+    }
+
+    if (ret != ESP_OK) {
+        /**< What reached flash is not known, the next append starts a new sector */
+        journal->torn = true;
+        xSemaphoreGive(journal->lock);
+        APP_STORAGE_ERROR_CHECK(true, ret, "Append to %s", journal->partition->label);
+    }
+
+    journal->sequence = header->sequence;
+    journal->length   = length;
+    memcpy(journal->record, record, length);
+    journal->stats.appends++;
+    journal->stats.snapshots += (type == JOURNAL_TYPE_SNAPSHOT);
+    journal->stats.deltas    += (type == JOURNAL_TYPE_DELTA);
+
+    xSemaphoreGive(journal->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_journal_read(app_storage_journal_t *journal, void *record, size_t *length)
+{
+    APP_STORAGE_PARAM_CHECK(journal);
+    APP_STORAGE_PARAM_CHECK(record);
+    APP_STORAGE_PARAM_CHECK(length);
+
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(journal->lock, portMAX_DELAY);
+
+    if (!journal->length) {
+        ret = ESP_ERR_NOT_FOUND;
+    } else if (*length < journal->length) {
+        ret = ESP_ERR_INVALID_SIZE;
+    } else {
+        memcpy(record, journal->record, journal->length);
+        *length = journal->length;
+    }
+
+    xSemaphoreGive(journal->lock);
+
+    return ret;
+}
+
+esp_err_t app_storage_journal_compact(app_storage_journal_t *journal)
+{
+    APP_STORAGE_PARAM_CHECK(journal);
+
+    esp_err_t ret = ESP_OK;
+
+    xSemaphoreTake(journal->lock, portMAX_DELAY);
+
+    if (!journal->next_erased && (!journal->length || journal->torn || journal->offset >= JOURNAL_SECTOR_SIZE / 2)) {
+        ret = journal_erase(journal, (journal->sector + 1) % journal->sector_num);
+        journal->next_erased = (ret == ESP_OK);
+    }
+
+    xSemaphoreGive(journal->lock);
+
+    return ret;
+}
+
+void app_storage_journal_stats(app_storage_journal_t *journal, app_storage_journal_stats_t *stats)
+{
+    xSemaphoreTake(journal->lock, portMAX_DELAY);
+    *stats = journal->stats;
+    xSemaphoreGive(journal->lock);
+}
@@ -0,0 +1,123 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define APP_STORAGE_JOURNAL_RECORD_MAX  (128)   /**< Largest record a journal keeps */
+
+/**
+ * @brief  A journal of one small record, kept on a raw data partition
+ */
+typedef struct app_storage_journal app_storage_journal_t;
+
+/**
+ * @brief  What a journal has done since it was opened
+ */
+typedef struct {
+    uint32_t appends;           /**< Records written, appending the record the journal holds writes nothing */
+    uint32_t deltas;            /**< Appends written as the bytes changed from the previous record */
+    uint32_t snapshots;         /**< Appends written whole, the first one of each sector included */
+    uint32_t erases;            /**< Sectors erased */
+    uint32_t inline_erases;     /**< Sectors erased by an append, as app_storage_journal_compact() had not run */
+    uint64_t bytes_written;
+} app_storage_journal_stats_t;
+
+/**
+ * @brief Open the journal on a data partition and replay its newest record
+ *
+ * @note The partition holds two sectors or more. Each sector starts with the
+ *     whole record and appends what changed after it, each append with its
+ *     sequence number and CRC. A record torn by a power loss is dropped, the
+ *     one before it is read back.
+ *
+ * @param  label Label of the partition
+ * @param  journal The journal opened
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_FOUND, no such partition
+ *     - ESP_ERR_INVALID_SIZE, the partition is not a whole number of two sectors or more
+ *     - ESP_ERR_NO_MEM
+ */
+esp_err_t app_storage_journal_open(const char *label, app_storage_journal_t **journal);
+
+/**
+ * @brief Close a journal, what was appended is already on flash
+ */
+void app_storage_journal_close(app_storage_journal_t *journal);
+
+/**
+ * @brief Append a record, it replaces the one the journal holds
+ *
+ * @note Only the bytes changed from the previous record are written, no
+ *     sector is erased unless app_storage_journal_compact() has not made
+ *     room in time.
+ *
+ * @param  journal The journal
+ * @param  record The record
+ * @param  length Length of the record, 1 ~ APP_STORAGE_JOURNAL_RECORD_MAX bytes
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_INVALID_ARG
+ *     - others, writing flash failed, the journal still holds the previous record
+ */
+esp_err_t app_storage_journal_append(app_storage_journal_t *journal, const void *record, size_t length);
+
+/**
+ * @brief Read the record the journal holds
+ *
+ * @param  journal The journal
+ * @param  record Buffer for the record
+ * @param  length Size of the buffer, set to the length of the record
+ *
+ * @return
+ *     - ESP_OK
+ *     - ESP_ERR_NOT_FOUND, nothing was ever appended
+ *     - ESP_ERR_INVALID_SIZE, the buffer is too small for the record
+ */
+esp_err_t app_storage_journal_read(app_storage_journal_t *journal, void *record, size_t *length);
+
+/**
+ * @brief Erase the sector the journal moves to next, once the current one is half full
+ *
+ * @note Call it from a low priority task. An append finding the current
+ *     sector full then only writes the record to the erased sector, the
+ *     previous sectors are left to be erased in turn.
+ *
+ * @param  journal The journal
+ *
+ * @return
+ *     - ESP_OK, a sector was erased or there was nothing to do
+ *     - others, erasing flash failed
+ */
+esp_err_t app_storage_journal_compact(app_storage_journal_t *journal);
+
+/**
+ * @brief  Read the counters of a journal
+ */
+void app_storage_journal_stats(app_storage_journal_t *journal, app_storage_journal_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "app_storage.h"
+#include "app_storage_backend.h"
+
+static const char *TAG = "app_storage_nvs";
+
+/**
+ * The handle of the namespace is kept in the pointer app_storage holds
+ */
+
+static esp_err_t app_storage_nvs_open(const char *name_space, const void *config, void **handle)
+{
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t ret = nvs_flash_init();
+
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        // NVS partition was truncated and needs to be erased
+        // Retry nvs_flash_init
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+
+    ESP_ERROR_CHECK(ret);
+
+    /**< Open non-volatile storage with a given namespace from the default NVS partition */
+    ret = nvs_open(name_space, NVS_READWRITE, &nvs_handle);
+    APP_STORAGE_ERROR_CHECK(ret != ESP_OK, ret, "Open non-volatile storage");
+
+    *handle = (void *)(uintptr_t)nvs_handle;
+
+    return ESP_OK;
+}
+
+static void app_storage_nvs_close(void *handle)
+{
+    nvs_close((nvs_handle_t)(uintptr_t)handle);
+}
+
+static esp_err_t app_storage_nvs_set(void *handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set_blob((nvs_handle_t)(uintptr_t)handle, key, value, length);
+}
+
+static esp_err_t app_storage_nvs_get(void *handle, const char *key, void *value, size_t *length)
+{
+    return nvs_get_blob((nvs_handle_t)(uintptr_t)handle, key, value, length);
+}
+
+static esp_err_t app_storage_nvs_erase(void *handle, const char *key)
+{
+    return nvs_erase_key((nvs_handle_t)(uintptr_t)handle, key);
+}
+
+static esp_err_t app_storage_nvs_erase_all(void *handle)
+{
+    return nvs_erase_all((nvs_handle_t)(uintptr_t)handle);
+}
+
+static esp_err_t app_storage_nvs_commit(void *handle)
+{
+    return nvs_commit((nvs_handle_t)(uintptr_t)handle);
+}
+
+const app_storage_backend_t app_storage_backend_nvs = {
+    .name      = "nvs",
+    .open      = app_storage_nvs_open,
+    .close     = app_storage_nvs_close,
+    .set       = app_storage_nvs_set,
+    .get       = app_storage_nvs_get,
+    .erase     = app_storage_nvs_erase,
+    .erase_all = app_storage_nvs_erase_all,
+    .commit    = app_storage_nvs_commit,
+};
@@ -0,0 +1,323 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "app_storage.h"
+#include "app_storage_backend.h"
+#include "app_storage_file.h"
+#include "app_storage_journal.h"
+#include "partition_sim.h"
+#include "host_test.h"
+
+/**
+ * Cost of the logical updates the light driver makes, through app_storage
+ * on the file backend and through the journal on a simulated partition:
+ * updates a second on the host, and what reaches the backend for each. The
+ * byte counts follow the layout on flash, so they stand for the flash wear
+ * on target, compactions and sector erases included.
+ *
+ * The results are printed as CSV, and compared with a baseline of the same
+ * format: the bytes, writes, reads and commits must not grow. Updates a
+ * second are only reported, as they depend on the machine. Write a new
+ * baseline with a second argument.
+ */
+
+#define BENCH_UPDATES       (5000)
+#define BENCH_NAME_LEN      (24)
+#define BENCH_JOURNAL_LABEL "light_state"
+#define BENCH_CSV_HEADER    "update,updates,ops_per_s,bytes_written,bytes_per_update,writes,reads,commits,compactions"
+
+/**
+ * @brief What reached the backend so far
+ */
+typedef struct {
+    uint64_t bytes_written;
+    uint32_t writes;
+    uint32_t reads;
+    uint32_t commits;
+    uint32_t compactions;
+} bench_counts_t;
+
+typedef struct {
+    const char *name;
+    esp_err_t (*update)(int i);
+    void (*counts)(bench_counts_t *counts);
+} bench_storage_t;
+
+typedef struct {
+    char name[BENCH_NAME_LEN];
+    uint32_t updates;
+    uint32_t ops_per_s;
+    uint64_t bytes_written;
+    uint32_t bytes_per_update;  /**< Rounded up */
+    uint32_t writes;            /**< Values set or erased on the backend */
+    uint32_t reads;             /**< Values read from the backend */
+    uint32_t commits;
+    uint32_t compactions;       /**< Files rewritten, or sectors erased for the journal */
+} bench_result_t;
+
+/**< The sizes of light_status, the scene table and the schedule */
+static uint8_t g_status[24];
+static uint8_t g_scenes[200];
+static uint8_t g_schedule[64];
+static uint8_t g_large[1024];
+static app_storage_journal_t *g_journal = NULL;
+
+static void bench_file_counts(bench_counts_t *counts)
+{
+    app_storage_file_stats_t stats;
+
+    app_storage_file_stats(&stats);
+    counts->bytes_written = stats.bytes_written;
+    counts->writes        = stats.sets + stats.erases;
+    counts->reads         = stats.gets;
+    counts->commits       = stats.commits;
+    counts->compactions   = stats.compactions;
+}
+
+static void bench_journal_counts(bench_counts_t *counts)
+{
+    app_storage_journal_stats_t stats;
+
+    app_storage_journal_stats(g_journal, &stats);
+    counts->bytes_written = stats.bytes_written;
+    counts->writes        = stats.appends;
+    counts->reads         = 0;
+    counts->commits       = 0;
+    counts->compactions   = stats.erases;
+}
+
+static esp_err_t bench_set_status(int i)
+{
+    g_status[6] = i % 100;
+    return app_storage_set("light_status", g_status, sizeof(g_status));
+}
+
+static esp_err_t bench_set_status_same(int i)
+{
+    return app_storage_set("light_status", g_status, sizeof(g_status));
+}
+
+static esp_err_t bench_batch_3(int i)
+{
+    esp_err_t ret = app_storage_batch_begin();
+
+    g_status[6] = i % 100;
+    g_scenes[i % sizeof(g_scenes)]++;
+    g_schedule[0] = i;
+
+    ret = (ret == ESP_OK) ? app_storage_set("light_status", g_status, sizeof(g_status)) : ret;
+    ret = (ret == ESP_OK) ? app_storage_set("light_scene", g_scenes, sizeof(g_scenes)) : ret;
+    ret = (ret == ESP_OK) ? app_storage_set("light_sched", g_schedule, sizeof(g_schedule)) : ret;
+
+    return (app_storage_batch_commit() == ESP_OK) ? ret : ESP_FAIL;
+}
+
+/**< The same change as set_status, compacted after each append as the store task does */
+static esp_err_t bench_journal_status(int i)
+{
+    g_status[6] = i % 100;
+
+    esp_err_t ret = app_storage_journal_append(g_journal, g_status, sizeof(g_status));
+    return (ret == ESP_OK) ? app_storage_journal_compact(g_journal) : ret;
+}
+
+static esp_err_t bench_get_cached(int i)
+{
+    return app_storage_get("light_status", g_status, sizeof(g_status));
+}
+
+static esp_err_t bench_get_uncached(int i)
+{
+    return app_storage_get("large", g_large, sizeof(g_large));
+}
+
+static const bench_storage_t g_bench_updates[] = {
+    {"set_status", bench_set_status, bench_file_counts},
+    {"set_status_same", bench_set_status_same, bench_file_counts},
+    {"batch_3", bench_batch_3, bench_file_counts},
+    {"get_cached", bench_get_cached, bench_file_counts},
+    {"get_uncached", bench_get_uncached, bench_file_counts},
+    {"journal_status", bench_journal_status, bench_journal_counts},
+};
+
+static bench_result_t g_results[sizeof(g_bench_updates) / sizeof(g_bench_updates[0])];
+
+static uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static esp_err_t bench_run(const bench_storage_t *bench, bench_result_t *result)
+{
+    bench_counts_t before, after;
+
+    memset(result, 0, sizeof(bench_result_t));
+    strncpy(result->name, bench->name, BENCH_NAME_LEN - 1);
+    bench->counts(&before);
+    uint64_t start = host_time_ns();
+
+    for (int i = 0; i < BENCH_UPDATES; i++) {
+        esp_err_t ret = bench->update(i);
+
+        if (ret != ESP_OK) {
+            printf("%s update %d, ret: %d\n", bench->name, i, ret);
+            return ret;
+        }
+    }
+
+    uint64_t elapsed = host_time_ns() - start;
+    bench->counts(&after);
+
+    result->updates          = BENCH_UPDATES;
+    result->ops_per_s        = BENCH_UPDATES * 1000000000ULL / (elapsed ? elapsed : 1);
+    result->bytes_written    = after.bytes_written - before.bytes_written;
+    result->bytes_per_update = (result->bytes_written + BENCH_UPDATES - 1) / BENCH_UPDATES;
+    result->writes           = after.writes - before.writes;
+    result->reads            = after.reads - before.reads;
+    result->commits          = after.commits - before.commits;
+    result->compactions      = after.compactions - before.compactions;
+
+    return ESP_OK;
+}
+
+static void bench_print(FILE *out, const bench_result_t *result)
+{
+    fprintf(out, "%s,%" PRIu32 ",%" PRIu32 ",%" PRIu64 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+            result->name, result->updates, result->ops_per_s, result->bytes_written, result->bytes_per_update,
+            result->writes, result->reads, result->commits, result->compactions);
+}
+
+/**
+ * @brief Find the baseline of an update, false if the file has none
+ */
+static bool bench_baseline(const char *path, const char *name, bench_result_t *baseline)
+{
+    FILE *file = path ? fopen(path, "r") : NULL;
+    char line[256];
+    bool found = false;
+
+    while (file && !found && fgets(line, sizeof(line), file)) {
+        found = sscanf(line, "%23[^,],%" SCNu32 ",%" SCNu32 ",%" SCNu64 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32 ",%" SCNu32,
+                       baseline->name, &baseline->updates, &baseline->ops_per_s, &baseline->bytes_written,
+                       &baseline->bytes_per_update, &baseline->writes, &baseline->reads, &baseline->commits,
+                       &baseline->compactions) == 9
+                && !strcmp(baseline->name, name);
+    }
+
+    if (file) {
+        fclose(file);
+    }
+
+    return found;
+}
+
+static const char *g_baseline_path = NULL;
+static const char *g_output_path   = NULL;
+static char g_dir[] = "/tmp/app_storage_bench_XXXXXX";
+
+static void test_bench_storage(void)
+{
+    const size_t num = sizeof(g_bench_updates) / sizeof(g_bench_updates[0]);
+
+    TEST_ASSERT_TRUE(mkdtemp(g_dir));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_init_backend(&app_storage_backend_file, g_dir));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("large", g_large, sizeof(g_large)));
+
+    partition_sim_create(BENCH_JOURNAL_LABEL, 4 * PARTITION_SIM_SECTOR_SIZE);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_open(BENCH_JOURNAL_LABEL, &g_journal));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_compact(g_journal));
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, bench_run(g_bench_updates + i, g_results + i));
+    }
+
+    printf(BENCH_CSV_HEADER "\n");
+
+    for (size_t i = 0; i < num; i++) {
+        bench_print(stdout, g_results + i);
+    }
+
+    if (g_output_path) {
+        FILE *out = fopen(g_output_path, "w");
+        TEST_ASSERT_MESSAGE(out, "can not write the output file");
+        fprintf(out, BENCH_CSV_HEADER "\n");
+
+        for (size_t i = 0; i < num; i++) {
+            bench_print(out, g_results + i);
+        }
+
+        fclose(out);
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        const bench_result_t *result = g_results + i;
+        bench_result_t baseline;
+
+        if (!bench_baseline(g_baseline_path, result->name, &baseline)) {
+            printf("%s: no baseline\n", result->name);
+            continue;
+        }
+
+        /**< Counts do not depend on the machine, any growth is a regression */
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.bytes_written, result->bytes_written);
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.writes, result->writes);
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.reads, result->reads);
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.commits, result->commits);
+    }
+}
+
+/**
+ * Remove the namespace files, and a compaction left over, then the directory itself
+ */
+static void dir_remove(const char *dir)
+{
+    DIR *handle = opendir(dir);
+
+    if (!handle) {
+        return;
+    }
+
+    for (struct dirent *entry = readdir(handle); entry; entry = readdir(handle)) {
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+            unlinkat(dirfd(handle), entry->d_name, 0);
+        }
+    }
+
+    closedir(handle);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    g_baseline_path = (argc > 1) ? argv[1] : NULL;
+    g_output_path   = (argc > 2) ? argv[2] : NULL;
+
+    RUN_TEST(test_bench_storage);
+
+    dir_remove(g_dir);
+
+    return UNITY_END();
+}
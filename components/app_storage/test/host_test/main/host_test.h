@@ -0,0 +1,80 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/**
+ * The subset of the Unity assertions the host tests use, so the cases read
+ * like the on-target tests. A failed assertion returns from the test case.
+ */
+
+static int g_host_test_failures = 0;
+
+#define TEST_FAIL_MESSAGE(message) do { \
+        printf("%s:%d: FAIL: %s\n", __FILE__, __LINE__, message); \
+        g_host_test_failures++; \
+        return; \
+    } while (0)
+
+#define TEST_ASSERT_MESSAGE(condition, message) do { \
+        if (!(condition)) { \
+            TEST_FAIL_MESSAGE(message); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT(condition)       TEST_ASSERT_MESSAGE(condition, #condition)
+#define TEST_ASSERT_TRUE(condition)  TEST_ASSERT_MESSAGE(condition, #condition)
+#define TEST_ASSERT_FALSE(condition) TEST_ASSERT_MESSAGE(!(condition), "!(" #condition ")")
+
+#define TEST_ASSERT_EQUAL(expected, actual) do { \
+        int64_t __e = (int64_t)(expected), __a = (int64_t)(actual); \
+        if (__e != __a) { \
+            printf("%s:%d: FAIL: %s expected %" PRId64 " was %" PRId64 "\n", \
+                   __FILE__, __LINE__, #actual, __e, __a); \
+            g_host_test_failures++; \
+            return; \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_INT_WITHIN(delta, expected, actual) do { \
+        int64_t __e = (int64_t)(expected), __a = (int64_t)(actual); \
+        if (llabs(__a - __e) > (int64_t)(delta)) { \
+            printf("%s:%d: FAIL: %s expected %" PRId64 " +/- %" PRId64 " was %" PRId64 "\n", \
+                   __FILE__, __LINE__, #actual, __e, (int64_t)(delta), __a); \
+            g_host_test_failures++; \
+            return; \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_LESS_OR_EQUAL(threshold, actual) do { \
+        int64_t __t = (int64_t)(threshold), __a = (int64_t)(actual); \
+        if (__a > __t) { \
+            printf("%s:%d: FAIL: %s expected <= %" PRId64 " was %" PRId64 "\n", \
+                   __FILE__, __LINE__, #actual, __t, __a); \
+            g_host_test_failures++; \
+            return; \
+        } \
+    } while (0)
+
+#define RUN_TEST(func) do { \
+        int __failures = g_host_test_failures; \
+        func(); \
+        printf("%s: %s\n", #func, g_host_test_failures == __failures ? "PASS" : "FAIL"); \
+    } while (0)
+
+#define UNITY_END() (printf("%d failure(s)\n", g_host_test_failures), g_host_test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
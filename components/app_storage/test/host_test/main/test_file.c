@@ -0,0 +1,325 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "nvs.h"
+#include "app_storage_backend.h"
+#include "app_storage_file.h"
+#include "host_test.h"
+
+#define FILE_VALUE_LARGE    (1000)
+#define FILE_REWRITES       (100)
+
+static const app_storage_backend_t *g_backend = &app_storage_backend_file;
+static char g_dir[] = "/tmp/app_storage_test_XXXXXX";
+
+/**
+ * @brief The bytes of a namespace file, as a crash would leave them
+ */
+static uint8_t *file_read(const char *name_space)
+{
+    char path[256];
+    uint8_t *data = malloc(CONFIG_APP_STORAGE_FILE_SIZE);
+
+    snprintf(path, sizeof(path), "%s/%s.nvs", g_dir, name_space);
+    FILE *file = fopen(path, "rb");
+    size_t size = fread(data, 1, CONFIG_APP_STORAGE_FILE_SIZE, file);
+    fclose(file);
+
+    return (size == CONFIG_APP_STORAGE_FILE_SIZE) ? data : (free(data), NULL);
+}
+
+static void file_write(const char *name_space, const uint8_t *data)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s.nvs", g_dir, name_space);
+    FILE *file = fopen(path, "wb");
+    fwrite(data, 1, CONFIG_APP_STORAGE_FILE_SIZE, file);
+    fclose(file);
+}
+
+static void test_set_get(void)
+{
+    const uint32_t one = 1, two = 2;
+    uint32_t value = 0;
+    uint8_t small = 0;
+    size_t length = sizeof(value);
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("set_get", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->get(handle, "key", &value, &length));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key", &one, sizeof(one)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", &value, &length));
+    TEST_ASSERT_EQUAL(one, value);
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key", &two, sizeof(two)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", &value, &length));
+    TEST_ASSERT_EQUAL(two, value);
+
+    /**< As nvs_get_blob(), the length alone, and a buffer too small refused */
+    length = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", NULL, &length));
+    TEST_ASSERT_EQUAL(sizeof(two), length);
+    length = sizeof(small);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, g_backend->get(handle, "key", &small, &length));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_KEY_TOO_LONG, g_backend->set(handle, "a_key_of_16_char", &one, sizeof(one)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key_of_15_chars", &one, sizeof(one)));
+
+    g_backend->close(handle);
+}
+
+/**
+ * Values, erases and the namespace of a file are all there after it is opened again
+ */
+static void test_reopen(void)
+{
+    const char blob[] = "a blob longer than one entry of thirty-two bytes";
+    char value[sizeof(blob)];
+    size_t length = sizeof(value);
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("reopen", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "blob", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "gone", blob, 4));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->erase(handle, "gone"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->erase(handle, "gone"));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->commit(handle));
+    g_backend->close(handle);
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("reopen", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "blob", value, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(blob, value, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->get(handle, "gone", value, &length));
+    g_backend->close(handle);
+
+    /**< Another namespace is another file */
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("other", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->get(handle, "blob", value, &length));
+    g_backend->close(handle);
+}
+
+/**
+ * Setting a key to the value it holds writes nothing
+ */
+static void test_unchanged(void)
+{
+    const uint8_t status[20] = {1, 2, 3};
+    app_storage_file_stats_t before, after;
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("unchanged", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "status", status, sizeof(status)));
+
+    app_storage_file_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "status", status, sizeof(status)));
+    app_storage_file_stats(&after);
+    TEST_ASSERT_EQUAL(before.bytes_written, after.bytes_written);
+    TEST_ASSERT_EQUAL(before.sets, after.sets);
+
+    g_backend->close(handle);
+}
+
+static void test_erase_all(void)
+{
+    const uint8_t value = 1;
+    size_t length = sizeof(value);
+    uint8_t read;
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("erase_all", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "one", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "two", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->erase_all(handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->get(handle, "one", &read, &length));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->erase(handle, "two"));
+    g_backend->close(handle);
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("erase_all", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, g_backend->get(handle, "two", &read, &length));
+    g_backend->close(handle);
+}
+
+/**
+ * A crash while a key is set leaves its old value if the new record is torn, the new one if it is whole
+ */
+static void test_crash(void)
+{
+    uint8_t old_value[40], new_value[40], value[40];
+    size_t length = sizeof(value);
+    void *handle = NULL;
+
+    memset(old_value, 0x11, sizeof(old_value));
+    memset(new_value, 0x22, sizeof(new_value));
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("crash", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key", old_value, sizeof(old_value)));
+    g_backend->close(handle);
+    uint8_t *before = file_read("crash");
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("crash", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key", new_value, sizeof(new_value)));
+    g_backend->close(handle);
+    uint8_t *after = file_read("crash");
+    TEST_ASSERT_TRUE(before && after);
+
+    /**< The new record in place, the old one not erased yet */
+    uint8_t *crashed = malloc(CONFIG_APP_STORAGE_FILE_SIZE);
+    size_t last = 0;
+
+    for (size_t i = 0; i < CONFIG_APP_STORAGE_FILE_SIZE; i++) {
+        crashed[i] = (before[i] == 0xff) ? after[i] : before[i];
+        last = (before[i] == 0xff && after[i] != 0xff) ? i : last;
+    }
+
+    file_write("crash", crashed);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("crash", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", value, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(new_value, value, sizeof(value)));
+    g_backend->close(handle);
+
+    /**< The new record cut short, its value not all written */
+    crashed[last] = 0xff;
+    file_write("crash", crashed);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("crash", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", value, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(old_value, value, sizeof(value)));
+
+    /**< And the file goes on from there */
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "key", new_value, sizeof(new_value)));
+    g_backend->close(handle);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("crash", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "key", value, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(new_value, value, sizeof(value)));
+    g_backend->close(handle);
+
+    free(before);
+    free(after);
+    free(crashed);
+}
+
+/**
+ * Rewriting a large value fills the log, which is compacted without losing any key
+ */
+static void test_compaction(void)
+{
+    static uint8_t large[FILE_VALUE_LARGE], read[FILE_VALUE_LARGE];
+    const uint32_t small = 0x5a5a5a5a;
+    uint32_t value;
+    size_t length;
+    app_storage_file_stats_t before, after;
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("compaction", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "small", &small, sizeof(small)));
+    app_storage_file_stats(&before);
+
+    for (int i = 0; i < FILE_REWRITES; i++) {
+        memset(large, i, sizeof(large));
+        TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, "large", large, sizeof(large)));
+    }
+
+    app_storage_file_stats(&after);
+    TEST_ASSERT_TRUE(after.compactions > before.compactions);
+    g_backend->close(handle);
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("compaction", g_dir, &handle));
+    length = sizeof(read);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "large", read, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(large, read, sizeof(large)));
+    length = sizeof(value);
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->get(handle, "small", &value, &length));
+    TEST_ASSERT_EQUAL(small, value);
+    g_backend->close(handle);
+}
+
+/**
+ * A value larger than the file, or one more than the live keys leave room for, is refused
+ */
+static void test_full(void)
+{
+    static uint8_t large[FILE_VALUE_LARGE];
+    uint8_t *huge = calloc(1, CONFIG_APP_STORAGE_FILE_SIZE);
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    esp_err_t ret = ESP_OK;
+    int keys = 0;
+    void *handle = NULL;
+
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->open("full", g_dir, &handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_VALUE_TOO_LONG, g_backend->set(handle, "huge", huge, CONFIG_APP_STORAGE_FILE_SIZE));
+    free(huge);
+
+    while (ret == ESP_OK) {
+        snprintf(key, sizeof(key), "key%d", keys);
+        ret = g_backend->set(handle, key, large, sizeof(large));
+        keys += (ret == ESP_OK);
+    }
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, ret);
+    /**< After the file header, each takes an entry of header and its value in whole entries */
+    TEST_ASSERT_EQUAL((CONFIG_APP_STORAGE_FILE_SIZE - 32) / (32 + (FILE_VALUE_LARGE + 31) / 32 * 32), keys);
+
+    /**< Erasing one key makes room again */
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->erase(handle, "key0"));
+    TEST_ASSERT_EQUAL(ESP_OK, g_backend->set(handle, key, large, sizeof(large)));
+    g_backend->close(handle);
+}
+
+/**
+ * Remove the namespace files, and a compaction left over, then the directory itself
+ */
+static void dir_remove(const char *dir)
+{
+    DIR *handle = opendir(dir);
+
+    if (!handle) {
+        return;
+    }
+
+    for (struct dirent *entry = readdir(handle); entry; entry = readdir(handle)) {
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+            unlinkat(dirfd(handle), entry->d_name, 0);
+        }
+    }
+
+    closedir(handle);
+    rmdir(dir);
+}
+
+int main(void)
+{
+    if (!mkdtemp(g_dir)) {
+        perror(g_dir);
+        return EXIT_FAILURE;
+    }
+
+    RUN_TEST(test_set_get);
+    RUN_TEST(test_reopen);
+    RUN_TEST(test_unchanged);
+    RUN_TEST(test_erase_all);
+    RUN_TEST(test_crash);
+    RUN_TEST(test_compaction);
+    RUN_TEST(test_full);
+
+    dir_remove(g_dir);
+
+    return UNITY_END();
+}
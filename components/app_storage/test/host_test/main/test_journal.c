@@ -0,0 +1,249 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "app_storage_journal.h"
+#include "partition_sim.h"
+#include "host_test.h"
+
+#define JOURNAL_LABEL       "light_state"
+#define JOURNAL_SIZE        (4 * PARTITION_SIM_SECTOR_SIZE)
+#define JOURNAL_RECORD_LEN  (24)    /**< As light_status_t */
+#define JOURNAL_APPENDS     (20000)
+#define JOURNAL_REOPEN      (997)   /**< Appends between two reopens */
+#define JOURNAL_CUT_BASE    (240)   /**< Appends before the cut, a few short of moving to the next sector */
+#define JOURNAL_CUT_BYTES   (PARTITION_SIM_SECTOR_SIZE)     /**< Cuts over a whole sector, some fall in a move */
+
+/**
+ * @brief Change a record as the light state changes, mostly one byte, sometimes several
+ */
+static void record_step(uint8_t *record, uint32_t i)
+{
+    record[(i * 7) % JOURNAL_RECORD_LEN] = i;
+
+    if (i % 50 == 0) {
+        memset(record + 8, i, 8);
+    }
+}
+
+static app_storage_journal_t *journal_reopen(app_storage_journal_t *journal)
+{
+    app_storage_journal_close(journal);
+    journal = NULL;
+
+    return (app_storage_journal_open(JOURNAL_LABEL, &journal) == ESP_OK) ? journal : NULL;
+}
+
+static void test_open(void)
+{
+    app_storage_journal_t *journal = NULL;
+    uint8_t record[JOURNAL_RECORD_LEN];
+    size_t length = sizeof(record);
+
+    partition_sim_create(JOURNAL_LABEL, JOURNAL_SIZE);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, app_storage_journal_open("none", &journal));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_open(JOURNAL_LABEL, &journal));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, app_storage_journal_read(journal, record, &length));
+    app_storage_journal_close(journal);
+
+    /**< One sector leaves nowhere to move to */
+    partition_sim_create(JOURNAL_LABEL, PARTITION_SIM_SECTOR_SIZE);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, app_storage_journal_open(JOURNAL_LABEL, &journal));
+}
+
+/**
+ * The record appended last is read back, before and after a reopen, a change
+ * of one byte costs one small delta and no change costs nothing
+ */
+static void test_append(void)
+{
+    app_storage_journal_t *journal = NULL;
+    uint8_t record[JOURNAL_RECORD_LEN] = {0};
+    uint8_t read[JOURNAL_RECORD_LEN + 8];
+    size_t length = 0;
+    app_storage_journal_stats_t stats;
+    partition_sim_stats_t before, after;
+
+    partition_sim_create(JOURNAL_LABEL, JOURNAL_SIZE);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_open(JOURNAL_LABEL, &journal));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, record, sizeof(record)));
+
+    record[6] = 50;
+    partition_sim_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, record, sizeof(record)));
+    partition_sim_stats(&after);
+    TEST_ASSERT_EQUAL(16, after.bytes_written - before.bytes_written);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, record, sizeof(record)));
+    partition_sim_stats(&before);
+    TEST_ASSERT_EQUAL(after.bytes_written, before.bytes_written);
+
+    app_storage_journal_stats(journal, &stats);
+    TEST_ASSERT_EQUAL(2, stats.appends);
+    TEST_ASSERT_EQUAL(1, stats.snapshots);
+    TEST_ASSERT_EQUAL(1, stats.deltas);
+
+    journal = journal_reopen(journal);
+    TEST_ASSERT_TRUE(journal);
+    length = sizeof(read);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_read(journal, read, &length));
+    TEST_ASSERT_EQUAL(sizeof(record), length);
+    TEST_ASSERT_EQUAL(0, memcmp(record, read, sizeof(record)));
+
+    /**< A buffer too small is refused, a record of another length is written whole */
+    length = sizeof(record) - 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, app_storage_journal_read(journal, read, &length));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, record, 20));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, app_storage_journal_append(journal, record, APP_STORAGE_JOURNAL_RECORD_MAX + 1));
+
+    journal = journal_reopen(journal);
+    length = sizeof(read);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_read(journal, read, &length));
+    TEST_ASSERT_EQUAL(20, length);
+    app_storage_journal_close(journal);
+
+    partition_sim_stats(&after);
+    TEST_ASSERT_EQUAL(0, after.overwrites);
+}
+
+/**
+ * Appending around the ring of sectors, reopened now and then, with and
+ * without compaction: only a journal never compacted erases on append
+ */
+static void test_ring(void)
+{
+    for (int compact = 1; compact >= 0; compact--) {
+        app_storage_journal_t *journal = NULL;
+        uint8_t record[JOURNAL_RECORD_LEN] = {0};
+        uint8_t read[JOURNAL_RECORD_LEN];
+        uint32_t inline_erases = 0;
+        app_storage_journal_stats_t stats;
+        partition_sim_stats_t flash;
+
+        partition_sim_create(JOURNAL_LABEL, JOURNAL_SIZE);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_open(JOURNAL_LABEL, &journal));
+
+        /**< As its owner would, compacted once opened and after each append */
+        if (compact) {
+            TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_compact(journal));
+        }
+
+        for (uint32_t i = 1; i <= JOURNAL_APPENDS; i++) {
+            record_step(record, i);
+            TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, record, sizeof(record)));
+
+            if (compact) {
+                TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_compact(journal));
+            }
+
+            if (i % JOURNAL_REOPEN == 0) {
+                size_t length = sizeof(read);
+
+                app_storage_journal_stats(journal, &stats);
+                inline_erases += stats.inline_erases;
+                journal = journal_reopen(journal);
+                TEST_ASSERT_TRUE(journal);
+                TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_read(journal, read, &length));
+                TEST_ASSERT_EQUAL(0, memcmp(record, read, sizeof(record)));
+
+                if (compact) {
+                    TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_compact(journal));
+                }
+            }
+        }
+
+        app_storage_journal_stats(journal, &stats);
+        inline_erases += stats.inline_erases;
+        app_storage_journal_close(journal);
+        partition_sim_stats(&flash);
+
+        TEST_ASSERT_EQUAL(0, flash.overwrites);
+        TEST_ASSERT_TRUE(compact ? !inline_erases : inline_erases > 0);
+        printf("%s: %.1f bytes and %.4f sector erases an append\n", compact ? "compacted" : "not compacted",
+               (double)flash.bytes_written / JOURNAL_APPENDS, (double)flash.erases / JOURNAL_APPENDS);
+    }
+}
+
+/**
+ * A power cut at any byte of an append, moving to the next sector included,
+ * leaves the record before it or the one appended, and the journal goes on
+ */
+static void test_power_cut(void)
+{
+    for (uint32_t cut = 0; cut < JOURNAL_CUT_BYTES; cut++) {
+        app_storage_journal_t *journal = NULL;
+        uint8_t acked[JOURNAL_RECORD_LEN] = {0};
+        uint8_t pending[JOURNAL_RECORD_LEN];
+        uint8_t read[JOURNAL_RECORD_LEN];
+        size_t length = sizeof(read);
+        partition_sim_stats_t flash;
+
+        partition_sim_create(JOURNAL_LABEL, JOURNAL_SIZE);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_open(JOURNAL_LABEL, &journal));
+
+        for (uint32_t i = 1; i <= JOURNAL_CUT_BASE; i++) {
+            record_step(acked, i);
+            TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, acked, sizeof(acked)));
+            TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_compact(journal));
+        }
+
+        partition_sim_power_cut(cut);
+
+        for (uint32_t i = JOURNAL_CUT_BASE + 1;; i++) {
+            memcpy(pending, acked, sizeof(acked));
+            record_step(pending, i);
+
+            if (app_storage_journal_append(journal, pending, sizeof(pending)) != ESP_OK) {
+                break;
+            }
+
+            memcpy(acked, pending, sizeof(acked));
+            app_storage_journal_compact(journal);
+        }
+
+        partition_sim_power_on();
+        journal = journal_reopen(journal);
+        TEST_ASSERT_TRUE(journal);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_read(journal, read, &length));
+
+        if (memcmp(read, acked, sizeof(read)) && memcmp(read, pending, sizeof(read))) {
+            printf("cut after %" PRIu32 " bytes\n", cut);
+            TEST_FAIL_MESSAGE("neither the record before the cut nor the one appended");
+        }
+
+        record_step(read, cut);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_append(journal, read, sizeof(read)));
+        journal = journal_reopen(journal);
+        length  = sizeof(pending);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_journal_read(journal, pending, &length));
+        TEST_ASSERT_EQUAL(0, memcmp(read, pending, sizeof(read)));
+        app_storage_journal_close(journal);
+
+        partition_sim_stats(&flash);
+        TEST_ASSERT_EQUAL(0, flash.overwrites);
+    }
+}
+
+int main(void)
+{
+    RUN_TEST(test_open);
+    RUN_TEST(test_append);
+    RUN_TEST(test_ring);
+    RUN_TEST(test_power_cut);
+
+    return UNITY_END();
+}
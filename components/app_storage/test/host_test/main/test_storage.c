@@ -0,0 +1,449 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "nvs.h"
+#include "nvs_sim.h"
+#include "app_storage.h"
+#include "host_test.h"
+
+#define STORAGE_READS   (100)
+
+/**< Like light_status, a small blob read at boot and again on every recall */
+typedef struct {
+    uint8_t on;
+    uint8_t mode;
+    uint16_t hue;
+    uint8_t saturation;
+    uint8_t value;
+    uint8_t brightness;
+} test_status_t;
+
+static uint32_t storage_reads_since(const nvs_sim_stats_t *before)
+{
+    nvs_sim_stats_t after;
+
+    nvs_sim_stats(&after);
+
+    return after.reads - before->reads;
+}
+
+#define STORAGE_TASKS   (8)
+
+static pthread_barrier_t g_first_access;
+
+static void *storage_first_access(void *arg)
+{
+    uint8_t value;
+
+    pthread_barrier_wait(&g_first_access);
+    *(esp_err_t *)arg = app_storage_get("missing", &value, sizeof(value));
+
+    return NULL;
+}
+
+/**
+ * Tasks reaching app_storage together before it was initialised open it once
+ */
+static void test_first_access_race(void)
+{
+    pthread_t tasks[STORAGE_TASKS];
+    esp_err_t rets[STORAGE_TASKS];
+    nvs_sim_stats_t stats;
+
+    /**< Long enough for all of them to find the storage not open yet */
+    nvs_sim_open_delay(20 * 1000);
+    pthread_barrier_init(&g_first_access, NULL, STORAGE_TASKS);
+
+    for (int i = 0; i < STORAGE_TASKS; i++) {
+        pthread_create(tasks + i, NULL, storage_first_access, rets + i);
+    }
+
+    for (int i = 0; i < STORAGE_TASKS; i++) {
+        pthread_join(tasks[i], NULL);
+    }
+
+    pthread_barrier_destroy(&g_first_access);
+    nvs_sim_open_delay(0);
+    nvs_sim_stats(&stats);
+
+    TEST_ASSERT_EQUAL(1, stats.opens);
+
+    for (int i = 0; i < STORAGE_TASKS; i++) {
+        TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, rets[i]);
+    }
+}
+
+/**
+ * A value already in flash is read from it once, then from RAM
+ */
+static void test_read_once(void)
+{
+    const test_status_t saved = {1, 2, 240, 100, 80, 50};
+    test_status_t status;
+    nvs_handle_t handle;
+    nvs_sim_stats_t before;
+
+    /**< Written by an earlier boot */
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_init());
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(handle, "light_status", &saved, sizeof(saved)));
+
+    nvs_sim_stats(&before);
+
+    for (int i = 0; i < STORAGE_READS; i++) {
+        memset(&status, 0, sizeof(status));
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_status", &status, sizeof(status)));
+        TEST_ASSERT_EQUAL(0, memcmp(&saved, &status, sizeof(status)));
+    }
+
+    TEST_ASSERT_EQUAL(1, storage_reads_since(&before));
+}
+
+/**
+ * A write goes to flash, and the value written is read back without flash
+ */
+static void test_write_through(void)
+{
+    test_status_t status = {1, 1, 0, 0, 0, 100};
+    test_status_t flash;
+    size_t length = sizeof(flash);
+    nvs_handle_t handle;
+    nvs_sim_stats_t before;
+
+    nvs_sim_stats(&before);
+
+    for (int i = 0; i < 10; i++) {
+        status.brightness = i * 10;
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("light_status", &status, sizeof(status)));
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_status", &flash, sizeof(flash)));
+        TEST_ASSERT_EQUAL(status.brightness, flash.brightness);
+    }
+
+    TEST_ASSERT_EQUAL(0, storage_reads_since(&before));
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_blob(handle, "light_status", &flash, &length));
+    TEST_ASSERT_EQUAL(0, memcmp(&status, &flash, sizeof(status)));
+}
+
+/**
+ * A failed write leaves what flash holds, which is what is read next
+ */
+static void test_failed_write(void)
+{
+    const uint32_t kept = 0x12345678, lost = 0x9abcdef0;
+    uint32_t value = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("counter", &kept, sizeof(kept)));
+
+    nvs_sim_fail_write(0, ESP_ERR_NVS_NO_FREE_PAGES);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NO_FREE_PAGES, app_storage_set("counter", &lost, sizeof(lost)));
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("counter", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(kept, value);
+}
+
+/**
+ * Erasing a key or the namespace is seen by the next read
+ */
+static void test_erase(void)
+{
+    const uint8_t one = 1, two = 2;
+    uint8_t value = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("one", &one, sizeof(one)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("two", &two, sizeof(two)));
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase("one"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, app_storage_get("one", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase("one"));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("two", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(two, value);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, app_storage_get("two", &value, sizeof(value)));
+}
+
+/**
+ * A buffer too small is refused whether the value comes from flash or RAM, a larger one is fine
+ */
+static void test_buffer_length(void)
+{
+    const uint8_t blob[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t value[16] = {0};
+    nvs_handle_t handle;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("blob", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, app_storage_get("blob", value, 4));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("blob", value, sizeof(value)));
+    TEST_ASSERT_EQUAL(0, memcmp(blob, value, sizeof(blob)));
+
+    /**< Not cached, from flash */
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, app_storage_get("blob", value, 4));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("blob", value, sizeof(value)));
+}
+
+/**
+ * Past the size of the cache the key used least recently goes, a hot key stays
+ */
+static void test_eviction(void)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint32_t value;
+    nvs_sim_stats_t before;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE));
+
+    for (uint32_t i = 0; i <= CONFIG_APP_STORAGE_CACHE_NUM; i++) {
+        snprintf(key, sizeof(key), "key%" PRIu32, i);
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_set(key, &i, sizeof(i)));
+        TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("key0", &value, sizeof(value)));
+    }
+
+    /**< key1 was the oldest when the last key came in */
+    nvs_sim_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("key0", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(0, value);
+    TEST_ASSERT_EQUAL(0, storage_reads_since(&before));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("key1", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(1, value);
+    TEST_ASSERT_EQUAL(1, storage_reads_since(&before));
+}
+
+/**
+ * A value over the cache limit is always read from flash
+ */
+static void test_large_value(void)
+{
+    uint8_t blob[CONFIG_APP_STORAGE_CACHE_VALUE_MAX + 1];
+    uint8_t value[sizeof(blob)];
+    nvs_sim_stats_t before;
+
+    memset(blob, 0x5a, sizeof(blob));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("large", blob, sizeof(blob)));
+
+    nvs_sim_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("large", value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("large", value, sizeof(value)));
+    TEST_ASSERT_EQUAL(0, memcmp(blob, value, sizeof(blob)));
+    TEST_ASSERT_EQUAL(2, storage_reads_since(&before));
+}
+
+/**
+ * The keys of a batch are read back inside it, reach flash at the commit with one NVS commit, and bump the generation
+ */
+static void test_batch_commit(void)
+{
+    const test_status_t status = {1, 2, 120, 100, 100, 0};
+    const uint8_t scenes[12] = {1, 0, 3};
+    const uint16_t schedule[4] = {420, 3000, 1320, 2200};
+    test_status_t read;
+    uint32_t generation, before_generation;
+    nvs_sim_stats_t before, after;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&before_generation));
+    nvs_sim_stats(&before);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("light_status", &status, sizeof(status)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("light_scene", scenes, sizeof(scenes)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("light_sched", schedule, sizeof(schedule)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_status", &read, sizeof(read)));
+    TEST_ASSERT_EQUAL(0, memcmp(&status, &read, sizeof(read)));
+
+    nvs_sim_stats(&after);
+    TEST_ASSERT_EQUAL(before.writes, after.writes);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_commit());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, app_storage_batch_commit());
+
+    /**< The three keys and the marker twice */
+    nvs_sim_stats(&after);
+    TEST_ASSERT_EQUAL(1, after.commits - before.commits);
+    TEST_ASSERT_EQUAL(5, after.writes - before.writes);
+    TEST_ASSERT_EQUAL(0, after.reads - before.reads);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&generation));
+    TEST_ASSERT_EQUAL(before_generation + 1, generation);
+}
+
+/**
+ * A batch of one key is a plain write, with no marker
+ */
+static void test_batch_single_key(void)
+{
+    const uint8_t value = 7;
+    uint32_t generation, before_generation;
+    nvs_sim_stats_t before, after;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&before_generation));
+    nvs_sim_stats(&before);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("one", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("one", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_commit());
+
+    nvs_sim_stats(&after);
+    TEST_ASSERT_EQUAL(1, after.writes - before.writes);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&generation));
+    TEST_ASSERT_EQUAL(before_generation, generation);
+}
+
+/**
+ * A write failing in the middle of a batch leaves it torn until the next batch commits
+ */
+static void test_batch_torn(void)
+{
+    const uint8_t old_value = 1, new_value = 2;
+    uint8_t value;
+    uint32_t generation, before_generation;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &old_value, sizeof(old_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &old_value, sizeof(old_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&before_generation));
+
+    /**< The marker and the first key go through, the second fails */
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &new_value, sizeof(new_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &new_value, sizeof(new_value)));
+    nvs_sim_fail_write(2, ESP_ERR_NVS_NO_FREE_PAGES);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NO_FREE_PAGES, app_storage_batch_commit());
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, app_storage_batch_generation(&generation));
+    TEST_ASSERT_EQUAL(before_generation, generation);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("first", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(new_value, value);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("second", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(old_value, value);
+
+    /**< Writing the batch again repairs it */
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &new_value, sizeof(new_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &new_value, sizeof(new_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_commit());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&generation));
+    TEST_ASSERT_EQUAL(before_generation + 2, generation);
+}
+
+/**
+ * An aborted batch writes nothing, its staged erase included
+ */
+static void test_batch_abort(void)
+{
+    const uint8_t old_value = 1, new_value = 2;
+    uint8_t value;
+    nvs_sim_stats_t before, after;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &old_value, sizeof(old_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &old_value, sizeof(old_value)));
+    nvs_sim_stats(&before);
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &new_value, sizeof(new_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_erase("second"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, app_storage_get("second", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, app_storage_erase(CONFIG_RAINMAKER_APP_PARTITION_NAMESPACE));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_abort());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, app_storage_batch_abort());
+
+    nvs_sim_stats(&after);
+    TEST_ASSERT_EQUAL(before.writes, after.writes);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("first", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(old_value, value);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("second", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(old_value, value);
+}
+
+static volatile bool g_reader_done = false;
+
+static void *storage_reader(void *arg)
+{
+    uint8_t *values = arg;
+
+    app_storage_get("first", values, 1);
+    app_storage_get("second", values + 1, 1);
+    g_reader_done = true;
+
+    return NULL;
+}
+
+/**
+ * Another task reading during a batch waits for it, and never sees half of it
+ */
+static void test_batch_other_task(void)
+{
+    const uint8_t old_value = 1, new_value = 2;
+    uint8_t values[2] = {0};
+    pthread_t reader;
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &old_value, sizeof(old_value)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &old_value, sizeof(old_value)));
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("first", &new_value, sizeof(new_value)));
+    pthread_create(&reader, NULL, storage_reader, values);
+    usleep(20 * 1000);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_set("second", &new_value, sizeof(new_value)));
+    TEST_ASSERT_FALSE(g_reader_done);
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_commit());
+    pthread_join(reader, NULL);
+
+    TEST_ASSERT_EQUAL(new_value, values[0]);
+    TEST_ASSERT_EQUAL(new_value, values[1]);
+}
+
+/**
+ * The namespace was opened once for all of the above
+ */
+static void test_open_once(void)
+{
+    nvs_sim_stats_t stats;
+
+    nvs_sim_stats(&stats);
+
+    /**< By app_storage, and by the three tests reading or writing flash directly */
+    TEST_ASSERT_EQUAL(4, stats.opens);
+}
+
+int main(void)
+{
+    RUN_TEST(test_first_access_race);
+    RUN_TEST(test_read_once);
+    RUN_TEST(test_write_through);
+    RUN_TEST(test_failed_write);
+    RUN_TEST(test_erase);
+    RUN_TEST(test_buffer_length);
+    RUN_TEST(test_eviction);
+    RUN_TEST(test_large_value);
+    RUN_TEST(test_batch_commit);
+    RUN_TEST(test_batch_single_key);
+    RUN_TEST(test_batch_torn);
+    RUN_TEST(test_batch_abort);
+    RUN_TEST(test_batch_other_task);
+    RUN_TEST(test_open_once);
+
+    return UNITY_END();
+}
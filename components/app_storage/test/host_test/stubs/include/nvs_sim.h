@@ -0,0 +1,41 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Flash accesses of the simulated NVS since the start
+ */
+typedef struct {
+    uint32_t opens;         /**< nvs_open() */
+    uint32_t reads;         /**< nvs_get_blob(), each one a lookup in the page index */
+    uint32_t writes;        /**< nvs_set_blob(), nvs_erase_key() and nvs_erase_all() */
+    uint32_t commits;
+} nvs_sim_stats_t;
+
+void nvs_sim_stats(nvs_sim_stats_t *stats);
+
+/**
+ * @brief Let skip more nvs_set_blob() calls through, then fail the next one with ret
+ *     and leave the value in flash as it was, as a power cut would
+ */
+void nvs_sim_fail_write(uint32_t skip, esp_err_t ret);
+
+/**
+ * @brief Make nvs_open() take delay_us, as a first open scanning the flash does
+ */
+void nvs_sim_open_delay(uint32_t delay_us);
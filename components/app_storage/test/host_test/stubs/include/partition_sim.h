@@ -0,0 +1,50 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define PARTITION_SIM_SECTOR_SIZE   (4096)
+
+/**
+ * @brief Flash accesses of the simulated partition since it was created
+ */
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;            /**< Sectors */
+    uint32_t overwrites;        /**< Bytes written over something not erased, a bug on NOR flash */
+    uint64_t bytes_written;
+} partition_sim_stats_t;
+
+/**
+ * @brief Create the one data partition, erased, in place of any before it
+ */
+void partition_sim_create(const char *label, size_t size);
+
+void partition_sim_stats(partition_sim_stats_t *stats);
+
+/**
+ * @brief Cut the power once bytes more are written: the write crossing it
+ *     stops there and fails, and so do all writes and erases after it
+ */
+void partition_sim_power_cut(uint32_t bytes);
+
+/**
+ * @brief Power back on, flash keeps what it held at the cut
+ */
+void partition_sim_power_on(void);
@@ -0,0 +1,23 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <pthread.h>
+
+/* Tasks are threads here, a newlib lock is a mutex, and a zeroed one is unlocked */
+typedef pthread_mutex_t _lock_t;
+
+#define _lock_acquire(lock)  pthread_mutex_lock(lock)
+#define _lock_release(lock)  pthread_mutex_unlock(lock)
@@ -0,0 +1,207 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <unistd.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "nvs_sim.h"
+
+/**
+ * Blobs kept in RAM in fixed slots, one namespace per handle. Only the calls
+ * are counted, not the time flash would take.
+ */
+
+#define NVS_SIM_NAMESPACE_MAX   (4)
+#define NVS_SIM_KEY_MAX         (32)
+#define NVS_SIM_VALUE_MAX       (4000)
+
+typedef struct {
+    uint32_t handle;                    /**< 0 if the slot is free */
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t length;
+    uint8_t value[NVS_SIM_VALUE_MAX];
+} nvs_sim_entry_t;
+
+static char g_namespaces[NVS_SIM_NAMESPACE_MAX][NVS_KEY_NAME_MAX_SIZE];
+static nvs_sim_entry_t g_entries[NVS_SIM_KEY_MAX];
+static nvs_sim_stats_t g_stats;
+static esp_err_t g_fail_write     = ESP_OK;
+static uint32_t g_fail_write_skip = 0;
+static uint32_t g_open_delay_us   = 0;
+
+static nvs_sim_entry_t *nvs_sim_find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < NVS_SIM_KEY_MAX; i++) {
+        if (g_entries[i].handle == handle && !strncmp(g_entries[i].key, key, NVS_KEY_NAME_MAX_SIZE)) {
+            return g_entries + i;
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(g_entries, 0, sizeof(g_entries));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+
+    if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    if (g_open_delay_us) {
+        usleep(g_open_delay_us);
+    }
+
+    __atomic_add_fetch(&g_stats.opens, 1, __ATOMIC_RELAXED);
+
+    /**< Handles of one namespace are the same number, the index of the namespace plus one */
+    for (int i = 0; i < NVS_SIM_NAMESPACE_MAX; i++) {
+        if (!g_namespaces[i][0] || !strcmp(g_namespaces[i], name)) {
+            strcpy(g_namespaces[i], name);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    nvs_sim_entry_t *entry = NULL;
+
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    if (length > NVS_SIM_VALUE_MAX) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    g_stats.writes++;
+
+    if (g_fail_write != ESP_OK && !g_fail_write_skip--) {
+        esp_err_t ret = g_fail_write;
+        g_fail_write = ESP_OK;
+        return ret;
+    }
+
+    entry = nvs_sim_find(handle, key);
+
+    for (int i = 0; !entry && i < NVS_SIM_KEY_MAX; i++) {
+        entry = g_entries[i].handle ? NULL : g_entries + i;
+    }
+
+    if (!entry) {
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+
+    entry->handle = handle;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, length);
+    entry->length = length;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    nvs_sim_entry_t *entry = nvs_sim_find(handle, key);
+
+    g_stats.reads++;
+
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    if (out_value && *length < entry->length) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    if (out_value) {
+        memcpy(out_value, entry->value, entry->length);
+    }
+
+    *length = entry->length;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_sim_entry_t *entry = nvs_sim_find(handle, key);
+
+    g_stats.writes++;
+
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    memset(entry, 0, sizeof(nvs_sim_entry_t));
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    g_stats.writes++;
+
+    for (int i = 0; i < NVS_SIM_KEY_MAX; i++) {
+        if (g_entries[i].handle == handle) {
+            memset(g_entries + i, 0, sizeof(nvs_sim_entry_t));
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    g_stats.commits++;
+    return ESP_OK;
+}
+
+void nvs_sim_stats(nvs_sim_stats_t *stats)
+{
+    *stats = g_stats;
+}
+
+void nvs_sim_fail_write(uint32_t skip, esp_err_t ret)
+{
+    g_fail_write_skip = skip;
+    g_fail_write      = ret;
+}
+
+void nvs_sim_open_delay(uint32_t delay_us)
+{
+    g_open_delay_us = delay_us;
+}
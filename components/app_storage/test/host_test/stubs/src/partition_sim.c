@@ -0,0 +1,130 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "partition_sim.h"
+
+/**
+ * One data partition in RAM with the rules of NOR flash: an erase sets whole
+ * sectors to 0xff, a write only clears bits.
+ */
+
+static esp_partition_t g_partition;
+static uint8_t *g_flash = NULL;
+static partition_sim_stats_t g_stats;
+static bool g_power_cut       = false;
+static bool g_power_cut_armed = false;
+static uint32_t g_power_left  = 0;
+
+void partition_sim_create(const char *label, size_t size)
+{
+    free(g_flash);
+    g_flash = malloc(size);
+    memset(g_flash, 0xff, size);
+    memset(&g_stats, 0, sizeof(g_stats));
+    memset(&g_partition, 0, sizeof(g_partition));
+
+    g_partition.type       = ESP_PARTITION_TYPE_DATA;
+    g_partition.subtype    = 0x40;
+    g_partition.size       = size;
+    g_partition.erase_size = PARTITION_SIM_SECTOR_SIZE;
+    strncpy(g_partition.label, label, sizeof(g_partition.label) - 1);
+    partition_sim_power_on();
+}
+
+void partition_sim_stats(partition_sim_stats_t *stats)
+{
+    *stats = g_stats;
+}
+
+void partition_sim_power_cut(uint32_t bytes)
+{
+    g_power_cut_armed = true;
+    g_power_left      = bytes;
+}
+
+void partition_sim_power_on(void)
+{
+    g_power_cut       = false;
+    g_power_cut_armed = false;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    bool match = g_flash && type == g_partition.type
+                 && (subtype == ESP_PARTITION_SUBTYPE_ANY || subtype == g_partition.subtype)
+                 && (!label || !strcmp(label, g_partition.label));
+
+    return match ? &g_partition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(dst, g_flash + src_offset, size);
+    g_stats.reads++;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *data = src;
+
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (g_power_cut) {
+        return ESP_FAIL;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        if (g_power_cut_armed && !g_power_left--) {
+            g_power_cut = true;
+            return ESP_FAIL;
+        }
+
+        g_stats.overwrites += (data[i] & ~g_flash[dst_offset + i]) != 0;
+        g_flash[dst_offset + i] &= data[i];
+    }
+
+    g_stats.writes++;
+    g_stats.bytes_written += size;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (offset % PARTITION_SIM_SECTOR_SIZE || size % PARTITION_SIM_SECTOR_SIZE || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (g_power_cut) {
+        return ESP_FAIL;
+    }
+
+    memset(g_flash + offset, 0xff, size);
+    g_stats.erases += size / PARTITION_SIM_SECTOR_SIZE;
+
+    return ESP_OK;
+}
@@ -26,9 +26,14 @@ extern "C" {
 #define HW_TIMER_DIVIDER (16)                              /**< Hardware timer clock divider */
 #define HW_TIMER_BASE_CLK (80 * 1000000) // 80 MHz APB clock
 #define HW_TIMER_SCALE (HW_TIMER_BASE_CLK / HW_TIMER_DIVIDER) /**< Convert counter value to seconds */
-#define GAMMA_CORRECTION 0.8                               /**< Gamma curve parameter */
-#define GAMMA_TABLE_SIZE 256                               /**< Gamma table size, used for led fade*/
+#define GAMMA_TABLE_BITS (12)                              /**< Input precision of the gamma table */
+#define GAMMA_TABLE_SIZE ((1 << GAMMA_TABLE_BITS) + 1)     /**< Gamma table size, used for led fade*/
 #define DUTY_SET_CYCLE (20)                                /**< Set duty cycle */
+#define IOT_LED_EFFECT_CHANNEL_MAX (5)                     /**< Channels driven by one effect */
+#define IOT_LED_EFFECT_KEYFRAME_MAX (16)                   /**< Keyframes of one effect */
+#define IOT_LED_INSTANCE_MAX (4)                           /**< Instances sharing the fade timer */
+#define IOT_LED_STATS_BUCKETS (24)                         /**< Buckets of the fade ISR histograms */
+#define IOT_LED_STATS_LATE_US (1000)                       /**< Alarm latency counted as a late tick */
 
 /**
  * Macro which can be used to check the error code,
@@ -53,7 +58,88 @@ extern "C" {
     } while(0)
 
 /**
-  * @brief Initialize and set the ledc timer for the iot led
+ * @brief Handle of an iot led instance, see iot_led_create()
+ */
+typedef void *iot_led_handle_t;
+
+/**
+ * @brief How ramps are driven
+ */
+typedef enum {
+    IOT_LED_FADE_SOFTWARE = 0,  /**< The timer moves the duty every DUTY_SET_CYCLE */
+    IOT_LED_FADE_HARDWARE,      /**< Whole piecewise-linear segments of the gamma curve run on the LEDC fader */
+} iot_led_fade_mode_t;
+
+/**
+ * @brief Target of one channel for iot_led_set_channels()
+ */
+typedef struct {
+    ledc_channel_t channel;     /**< The ledc channel */
+    uint8_t value;              /**< The target output brightness (0 .. 255) */
+} iot_led_channel_target_t;
+
+/**
+ * @brief One keyframe of an effect, see IOT_LED_KEYFRAME_FADE() and IOT_LED_KEYFRAME_STEP()
+ */
+typedef struct {
+    uint32_t duration_us;       /**< Time from the previous keyframe to this one */
+    uint32_t rate;              /**< (2^32 / duration_us) to fade, 0 to step at once and hold */
+    uint8_t value[IOT_LED_EFFECT_CHANNEL_MAX];  /**< Brightness of each effect channel (0 .. 255) */
+} iot_led_keyframe_t;
+
+/**
+ * @brief Keyframe faded to in fade_ms, the rate is worked out by the compiler
+ */
+#define IOT_LED_KEYFRAME_FADE(fade_ms, ...) { \
+        .duration_us = (uint32_t)((fade_ms) * 1000ULL), \
+        .rate = (uint32_t)((1ULL << 32) / ((fade_ms) * 1000ULL)), \
+        .value = {__VA_ARGS__}, \
+    }
+
+/**
+ * @brief Keyframe stepped to at once and held for hold_ms
+ */
+#define IOT_LED_KEYFRAME_STEP(hold_ms, ...) { \
+        .duration_us = (uint32_t)((hold_ms) * 1000ULL), \
+        .rate = 0, \
+        .value = {__VA_ARGS__}, \
+    }
+
+/**
+ * @brief A multi-channel effect played by the timer ISR
+ */
+typedef struct {
+    const iot_led_keyframe_t *keyframes;    /**< Keyframes, played in order */
+    uint8_t keyframe_num;                   /**< Number of keyframes, at most IOT_LED_EFFECT_KEYFRAME_MAX */
+    uint8_t channel_num;                    /**< Number of channels, at most IOT_LED_EFFECT_CHANNEL_MAX */
+    ledc_channel_t channels[IOT_LED_EFFECT_CHANNEL_MAX];  /**< Channel of each value column */
+    uint16_t repeat;                        /**< Times to play the keyframes, 0 to loop until stopped */
+} iot_led_effect_t;
+
+/**
+ * @brief Fade timer interrupt statistics, see CONFIG_LIGHT_DRIVER_FADE_STATS
+ *
+ * Bucket n of a histogram counts values in [2^n, 2^(n+1)), bucket 0 also
+ * counts 0 and the last bucket everything above.
+ */
+typedef struct {
+    uint32_t isr_count;         /**< Fade timer interrupts */
+    uint32_t late_count;        /**< Interrupts entered more than IOT_LED_STATS_LATE_US after their alarm */
+    uint32_t dropped_ticks;     /**< Whole DUTY_SET_CYCLE periods lost by late interrupts */
+    uint32_t cycles_max;        /**< Longest interrupt, in CPU cycles */
+    uint32_t latency_max_us;    /**< Latest interrupt entry after its alarm, in us */
+    uint32_t cycles_hist[IOT_LED_STATS_BUCKETS];    /**< CPU cycles spent per interrupt */
+    uint32_t latency_hist[IOT_LED_STATS_BUCKETS];   /**< Delay from alarm to interrupt entry, in us */
+} iot_led_stats_t;
+
+/**
+  * @brief Create an iot led instance and set the ledc timer it drives
+  *
+  * @note Every instance is serviced by the same gptimer interrupt and uses the
+  *     same gamma table. Instances may use different ledc timers, e.g. to
+  *     run fixtures at different PWM frequencies, but not the same channels.
+  *     Instances sharing a ledc timer must set it to the same frequency and
+  *     duty resolution.
   *
   * @param timer_num The timer index of ledc timer group used for iot led
   *     This parameter can be one of LEDC_TIMER_x where x can be (0 .. 3) 
@@ -68,26 +154,29 @@ extern "C" {
   *
   * @param duty_resolution LEDC channel duty resolution
   *
-  * @return
-  *	    - ESP_OK if sucess
-  *     - MDF_ERR_INVALID_ARG Parameter error
-  *     - MDF_FAIL Can not find a proper pre-divider number base on the given frequency 
-  *         and the current duty_resolution.
+  * @return A handle to the created instance, or NULL if the ledc timer can not
+  *     be set, is set differently by another instance or IOT_LED_INSTANCE_MAX
+  *     instances exist already
 */
-esp_err_t iot_led_init(ledc_timer_t timer_num, ledc_mode_t speed_mode, uint32_t freq_hz, ledc_clk_cfg_t clk_cfg, ledc_timer_bit_t duty_resolution);
+iot_led_handle_t iot_led_create(ledc_timer_t timer_num, ledc_mode_t speed_mode, uint32_t freq_hz, ledc_clk_cfg_t clk_cfg, ledc_timer_bit_t duty_resolution);
 
 /**
-  * @brief DeInitializes the iot led and free resource
-  * 
+  * @brief Delete an iot led instance and free resource, the fade timer is
+  *     deleted with the last instance
+  *
+  * @param handle The instance to delete
+  *
   * @return
   *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL
 */
-esp_err_t iot_led_deinit();
+esp_err_t iot_led_delete(iot_led_handle_t handle);
 
 /**
   * @brief Set the ledc channel used by iot led and associate the gpio port used 
   *     for output
   * 
+  * @param handle The iot led instance
   * @param channel The ledc channel
   *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
   * @param gpio_num the ledc output gpio_num
@@ -98,31 +187,32 @@ esp_err_t iot_led_deinit();
   *         
   * @return
   *	    - ESP_OK if sucess
-  *     - MDF_ERR_INVALID_ARG Parameter error
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *     - ESP_ERR_INVALID_ARG Parameter error
+  *     - ESP_ERR_INVALID_STATE if another instance uses the channel
 */
-esp_err_t iot_led_regist_channel(ledc_channel_t channel, gpio_num_t gpio_num);
+esp_err_t iot_led_regist_channel(iot_led_handle_t handle, ledc_channel_t channel, gpio_num_t gpio_num);
 
 /**
   * @brief Returns the channel value 
   * @note before calling this function, you need to call iot_led_regist_channel() to
   *     set the channel
   * 
+  * @param handle The iot led instance
   * @param channel The ledc channel
   *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
   * @param dst The address where the channel value is stored
   * @return
   *     - ESP_OK if sucess
-  *	    - MDF_ERR_INVALID_ARG if dst is NULL
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *	    - ESP_ERR_INVALID_ARG if handle or dst is NULL
 */
-esp_err_t iot_led_get_channel(ledc_channel_t channel, uint8_t* dst);
+esp_err_t iot_led_get_channel(iot_led_handle_t handle, ledc_channel_t channel, uint8_t* dst);
 
 /**
   * @brief Set the fade state for the specified channel
   * @note before calling this function, you need to call iot_led_regist_channel() to
   *     set the channel
   * 
+  * @param handle The iot led instance
   * @param channel The ledc channel
   *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
   * @param value The target output brightness of iot led
@@ -130,15 +220,37 @@ esp_err_t iot_led_get_channel(ledc_channel_t channel, uint8_t* dst);
   * @param fade_ms The time from the current value to the target value
   * @return
   *	    - ESP_OK if sucess
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL
+*/
+esp_err_t iot_led_set_channel(iot_led_handle_t handle, ledc_channel_t channel, uint8_t value, uint32_t fade_ms);
+
+/**
+  * @brief Set the fade state of several channels at once
+  * @note before calling this function, you need to call iot_led_regist_channel() to
+  *     set the channels
+  *
+  * @param handle The iot led instance
+  * @param targets Channels and their target output brightness
+  * @param num Number of entries in targets, at most LEDC_CHANNEL_MAX
+  * @param fade_ms The time from the current values to the target values
+  *
+  * @note The targets are committed together and the timer applies them in the
+  *     same pass, so all channels start fading from their current values on
+  *     the same PWM period. Targets of other channels committed before and not
+  *     applied yet are kept.
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL or a channel is invalid
 */
-esp_err_t iot_led_set_channel(ledc_channel_t channel, uint8_t value, uint32_t fade_ms);
+esp_err_t iot_led_set_channels(iot_led_handle_t handle, const iot_led_channel_target_t *targets, size_t num, uint32_t fade_ms);
 
 /**
   * @brief Set the blink state or loop fade for the specified channel
   * @note before calling this function, you need to call iot_led_regist_channel() to
   *     set the channel
   *         
+  * @param handle The iot led instance
   * @param channel The ledc channel
   *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
   * @param value The output brightness of iot led
@@ -149,20 +261,89 @@ esp_err_t iot_led_set_channel(ledc_channel_t channel, uint8_t value, uint32_t fa
   *     0 for blink
   * @return
   *	    - ESP_OK if sucess
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL
 */
-esp_err_t iot_led_start_blink(ledc_channel_t channel, uint8_t value, uint32_t period_ms, bool fade_flag);
+esp_err_t iot_led_start_blink(iot_led_handle_t handle, ledc_channel_t channel, uint8_t value, uint32_t period_ms, bool fade_flag);
 
 /**
   * @brief Stop the blink state or loop fade for the specified channel
   * 
+  * @param handle The iot led instance
   * @param channel The ledc channel
   *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
   * @return
   *	    - ESP_OK if sucess
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL
+*/
+esp_err_t iot_led_stop_blink(iot_led_handle_t handle, ledc_channel_t channel);
+
+/**
+  * @brief Play a keyframe effect on several channels
+  * @note before calling this function, you need to call iot_led_regist_channel() to
+  *     set the channels
+  *
+  * @param handle The iot led instance
+  * @param effect The effect, its keyframes are copied and need not stay valid
+  *
+  * @note The first keyframe is faded to from the current values and every
+  *     loop restarts from the first keyframe. The timer ISR steps through the
+  *     keyframes on its own, so the effect keeps its timing whatever the tasks
+  *     are doing. One effect runs at a time per instance, channels of the
+  *     previous effect that are not part of this one stop where they are.
+  *     Setting a channel or stopping its blink takes it out of the effect.
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL, the effect is
+  *	      too large, a channel is invalid or the keyframes take no time
 */
-esp_err_t iot_led_stop_blink(ledc_channel_t channel);
+esp_err_t iot_led_start_effect(iot_led_handle_t handle, const iot_led_effect_t *effect);
+
+/**
+  * @brief Stop the running effect, its channels stop where they are
+  *
+  * @param handle The iot led instance
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL
+*/
+esp_err_t iot_led_stop_effect(iot_led_handle_t handle);
+
+/**
+  * @brief Select how ramps are driven for all channels
+  *
+  * @param handle The iot led instance
+  * @param mode IOT_LED_FADE_SOFTWARE (default) or IOT_LED_FADE_HARDWARE
+  *
+  * @note In hardware mode the timer only runs at segment boundaries, which are at
+  *     most 1/16 of the brightness range or LEDC_DUTY_NUM_LSCH0_V fader steps apart. Fades that
+  *     are already running switch at their next segment.
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL or mode is invalid
+*/
+esp_err_t iot_led_set_fade_mode(iot_led_handle_t handle, iot_led_fade_mode_t mode);
+
+/**
+  * @brief Enable or disable temporal dithering of a channel
+  *
+  * @param handle The iot led instance
+  * @param channel The ledc channel
+  *     This parameter can be LEDC_CHANNEL_x where x can be (0 .. 15)
+  * @param enable Drive the fractional part of the duty
+  *
+  * @note A dithered channel holds levels with the 4 fraction bits of the duty
+  *     register, which the LEDC spreads over PWM periods. While a software fade
+  *     moves less than one count per DUTY_SET_CYCLE, the residue below the
+  *     fraction is also carried from tick to tick. This adds resolution at deep
+  *     dim levels without lowering freq_hz.
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if handle is NULL or channel is invalid
+*/
+esp_err_t iot_led_set_dither(iot_led_handle_t handle, ledc_channel_t channel, bool enable);
 
 /**
   * @brief Set the specified gamma_table to control the fade effect, usually 
@@ -171,18 +352,62 @@ esp_err_t iot_led_stop_blink(ledc_channel_t channel);
   * @param gamma_table[GAMMA_TABLE_SIZE] Expected gamma table value
   *
   * @note  Gamma_table is the dimming curve used by the iot_led driver. 
-  *     The element type is uint16_t. Each element is treated as a binary 
-  *     fixed-point number. The decimal point is before the eighth bit 
-  *     and after the ninth bit, so the range of expressions can be 
-  *     0x00.00 ~ 0xff.ff. 
-  * @note default gamma_table is created in iot_led_init()
+  *     The element type is uint16_t. Element i is the duty, as a Q16 
+  *     fraction of full scale, at brightness i / (GAMMA_TABLE_SIZE - 1). 
+  *     The table is used in place and not copied, it must stay valid, 
+  *     e.g. a const table in flash.
+  * @note default gamma_table is generated at build time, see the 
+  *     Light Driver menu of menuconfig
   *
   * @return
   *	    - ESP_OK if sucess
-  *	    - MDF_ERR_NOT_INIT if lot_led_init() is not called yet
+  *	    - ESP_ERR_INVALID_ARG if gamma_table is NULL
 */
 esp_err_t iot_led_set_gamma_table(const uint16_t gamma_table[GAMMA_TABLE_SIZE]);
 
+/**
+  * @brief Duty of a brightness value on the dimming curve
+  *
+  * @param value Brightness (0 .. 255)
+  *
+  * @return Duty, as a Q16 fraction of full scale
+*/
+uint16_t iot_led_value_to_duty(uint8_t value);
+
+/**
+  * @brief Brightness value whose duty on the dimming curve is nearest a duty
+  *
+  * @note  Used to set channels whose outputs must keep a ratio in light,
+  *     e.g. the warm and cold white of a colour temperature
+  *
+  * @param duty Duty, as a Q16 fraction of full scale
+  *
+  * @return Brightness (0 .. 255)
+*/
+uint8_t iot_led_duty_to_value(uint16_t duty);
+
+/**
+  * @brief Read the fade timer interrupt statistics, shared by all instances
+  *
+  * @param stats Where the statistics are copied
+  * @param reset Clear the statistics once copied
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_INVALID_ARG if stats is NULL
+  *	    - ESP_ERR_NOT_SUPPORTED if CONFIG_LIGHT_DRIVER_FADE_STATS is disabled
+*/
+esp_err_t iot_led_get_stats(iot_led_stats_t *stats, bool reset);
+
+/**
+  * @brief Print the fade timer interrupt statistics to the console
+  *
+  * @return
+  *	    - ESP_OK if sucess
+  *	    - ESP_ERR_NOT_SUPPORTED if CONFIG_LIGHT_DRIVER_FADE_STATS is disabled
+*/
+esp_err_t iot_led_print_stats(void);
+
 #ifdef __cplusplus
 }
 #endif
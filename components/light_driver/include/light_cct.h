@@ -0,0 +1,107 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_CCT_H__
+#define __LIGHT_CCT_H__
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_CCT_TABLE_SIZE    (33)        /**< Entries of the mix table, evenly spaced in mired */
+#define LIGHT_CCT_KELVIN_MIN    (1000)      /**< Lowest colour temperature accepted */
+#define LIGHT_CCT_KELVIN_MAX    (20000)     /**< Highest colour temperature accepted */
+#define LIGHT_CCT_CHROMA_SCALE  (10000)     /**< Scale of the chromaticity coordinates */
+
+/**
+ * @brief Measured warm and cold white channels of one fixture
+ */
+typedef struct {
+    uint16_t warm_x;        /**< CIE 1931 x of the warm channel, times LIGHT_CCT_CHROMA_SCALE */
+    uint16_t warm_y;        /**< CIE 1931 y of the warm channel, times LIGHT_CCT_CHROMA_SCALE */
+    uint16_t cold_x;        /**< CIE 1931 x of the cold channel, times LIGHT_CCT_CHROMA_SCALE */
+    uint16_t cold_y;        /**< CIE 1931 y of the cold channel, times LIGHT_CCT_CHROMA_SCALE */
+    uint16_t warm_flux;     /**< Luminous flux of the warm channel at full duty, lm */
+    uint16_t cold_flux;     /**< Luminous flux of the cold channel at full duty, lm */
+    uint16_t rated_flux;    /**< Flux at full brightness, lm, the same for every fixture meant to match.
+                                 0 for the most this fixture reaches at every colour temperature */
+} light_cct_calibration_t;
+
+/**
+ * @brief Channel duties of a fixture over its colour temperature range
+ */
+typedef struct {
+    uint16_t mired_min;                     /**< Coldest colour temperature, first entry */
+    uint16_t mired_max;                     /**< Warmest colour temperature, last entry */
+    uint32_t index_scale;                   /**< Q16 entries per mired */
+    uint16_t flux;                          /**< Flux at full brightness, lm */
+    uint16_t warm[LIGHT_CCT_TABLE_SIZE];    /**< Q16 duty of the warm channel at full brightness */
+    uint16_t cold[LIGHT_CCT_TABLE_SIZE];    /**< Q16 duty of the cold channel at full brightness */
+} light_cct_table_t;
+
+/**
+ * @brief Expand a fixture calibration into its mix table
+ *
+ * @note Runs in floating point, once at init. The colour temperature of each
+ *     entry is reached on the line between the two channel chromaticities,
+ *     and every entry gives the same flux, rated_flux if the fixture can
+ *     reach it everywhere.
+ *
+ * @param calibration The measured channels
+ * @param table The table to fill
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_ARG if a channel has no flux or both have the same colour temperature
+ */
+esp_err_t light_cct_table_init(const light_cct_calibration_t *calibration, light_cct_table_t *table);
+
+/**
+ * @brief Channel duties of a colour temperature at full brightness
+ *
+ * @note A table read and a linear interpolation, a colour temperature out of
+ *     the fixture range is clamped to it
+ *
+ * @param table The mix table of the fixture
+ * @param kelvin Colour temperature, LIGHT_CCT_KELVIN_MIN ~ LIGHT_CCT_KELVIN_MAX
+ * @param warm Q16 duty of the warm channel
+ * @param cold Q16 duty of the cold channel
+ */
+void light_cct_mix(const light_cct_table_t *table, uint16_t kelvin, uint16_t *warm, uint16_t *cold);
+
+/**
+ * @brief Colour temperature and brightness of the duties of the two channels
+ *
+ * @param table The mix table of the fixture
+ * @param warm Q16 duty of the warm channel
+ * @param cold Q16 duty of the cold channel
+ * @param kelvin Colour temperature
+ * @param duty Q16 fraction of the full brightness duties at that temperature
+ */
+void light_cct_unmix(const light_cct_table_t *table, uint16_t warm, uint16_t cold, uint16_t *kelvin, uint16_t *duty);
+
+/**
+ * @brief Colour temperature of each end of the fixture range
+ */
+uint16_t light_cct_kelvin_min(const light_cct_table_t *table);
+uint16_t light_cct_kelvin_max(const light_cct_table_t *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_CCT_H__ */
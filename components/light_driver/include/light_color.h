@@ -0,0 +1,71 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_COLOR_H__
+#define __LIGHT_COLOR_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_COLOR_HUE_SCALE   (64)                            /**< Hue steps per degree */
+#define LIGHT_COLOR_HUE_SECTOR  (60 * LIGHT_COLOR_HUE_SCALE)    /**< Hue span between two primaries or secondaries */
+#define LIGHT_COLOR_HUE_MAX     (360 * LIGHT_COLOR_HUE_SCALE)   /**< One full turn, hue is below it */
+#define LIGHT_COLOR_MAX         (UINT16_MAX)                    /**< Full scale of the channels, saturation and value */
+
+/**
+ * @brief A colour in hue, saturation and value
+ */
+typedef struct {
+    uint16_t hue;           /**< 1/64 degree, 0 ~ LIGHT_COLOR_HUE_MAX - 1 */
+    uint16_t saturation;    /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t value;         /**< 0 ~ LIGHT_COLOR_MAX */
+} light_color_hsv_t;
+
+/**
+ * @brief A colour in red, green and blue
+ */
+typedef struct {
+    uint16_t red;           /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t green;         /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t blue;          /**< 0 ~ LIGHT_COLOR_MAX */
+} light_color_rgb_t;
+
+/**
+ * @brief Convert a colour from HSV to RGB, integer only
+ *
+ * @param hsv The colour to convert, a hue past one turn is wrapped
+ * @param rgb The colour in RGB
+ */
+void light_color_hsv_to_rgb(const light_color_hsv_t *hsv, light_color_rgb_t *rgb);
+
+/**
+ * @brief Convert a colour from RGB to HSV, integer only
+ *
+ * @note The value is the largest channel and is always exact. Converting back
+ *     to RGB lands within half a count of 8-bit channels, so a colour read
+ *     back from 8-bit LEDs is set again unchanged. A grey has hue 0.
+ *
+ * @param rgb The colour to convert
+ * @param hsv The colour in HSV
+ */
+void light_color_rgb_to_hsv(const light_color_rgb_t *rgb, light_color_hsv_t *hsv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_COLOR_H__ */
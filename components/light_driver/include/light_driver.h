@@ -16,6 +16,9 @@
 #define __LIGHT_DRIVER_H__
 
 #include "iot_led.h"
+#include "light_cct.h"
+#include "light_schedule.h"
+#include "light_power.h"
 
 #ifdef  __cplusplus
 extern "C" {
@@ -39,6 +42,25 @@ enum light_mode {
     MODE_BRIGHTNESS_DECREASE = 9,
 };
 
+/**
+ * @brief Built-in light effects, played by the iot_led timer
+ */
+typedef enum {
+    LIGHT_EFFECT_COLOR_LOOP = 0,  /**< Endless loop around the colour wheel */
+    LIGHT_EFFECT_CANDLE,          /**< Flickering warm light */
+    LIGHT_EFFECT_SUNRISE,         /**< Fifteen minutes from deep red to daylight, played once */
+    LIGHT_EFFECT_STROBE,          /**< White flashes at 10 Hz */
+    LIGHT_EFFECT_MAX,
+} light_effect_t;
+
+/**
+ * @brief Direction of a hold-to-dim ramp
+ */
+typedef enum {
+    LIGHT_DIM_DOWN = 0,           /**< Towards the lowest brightness, the light stays on */
+    LIGHT_DIM_UP,                 /**< Towards full brightness */
+} light_dim_direction_t;
+
 /**
  * @brief Light driven configuration
  */
@@ -53,6 +75,14 @@ typedef struct {
     uint32_t freq_hz;         /**< LEDC timer frequency (Hz) */
     ledc_clk_cfg_t clk_cfg;   /**< Clock srouce of LEDC */
     ledc_timer_bit_t duty_resolution;  /**< LEDC channel duty resolution */
+    ledc_timer_t timer_num;            /**< LEDC timer of the light, LEDC_TIMER_0 if not set */
+    iot_led_fade_mode_t fade_mode;     /**< Software stepped or hardware segment fades */
+    bool dither;                       /**< Dither the duty fraction of every channel */
+    const light_cct_calibration_t *cct_calibration;  /**< Warm and cold channels of the fixture, used unless one is
+                                                          saved by light_driver_set_cct_calibration(). NULL for
+                                                          nominal 2700 K and 6500 K channels of equal flux */
+    const light_power_config_t *power_limit;         /**< Current of the channels and budget of the supply, NULL for
+                                                          no limit */
 } light_driver_config_t;
 
 /**
@@ -75,6 +105,26 @@ esp_err_t light_driver_init(light_driver_config_t *config);
  */
 esp_err_t light_driver_deinit();
 
+/**
+ * @brief  Save the light state now if it has unsaved changes
+ *
+ * @note   Changes are saved by a background task once the light has been quiet
+ *         for CONFIG_LIGHT_DRIVER_STORE_QUIET_MS, and at the latest
+ *         CONFIG_LIGHT_DRIVER_STORE_MAX_DELAY_MS after the oldest unsaved one.
+ *         They are also saved by esp_restart() and light_driver_deinit(), call
+ *         this before any other way the power may go. The state, the scenes
+ *         and the schedule are written as one app_storage batch, or the state
+ *         is appended to its journal partition with
+ *         CONFIG_LIGHT_DRIVER_STATUS_JOURNAL. A batch torn by a power cut is
+ *         found by light_driver_init(), which erases its keys and starts from
+ *         the defaults rather than from a mix of two saves.
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_FAIL
+ */
+esp_err_t light_driver_flush(void);
+
 
 /**
  * @brief Set the fade time of the light
@@ -92,10 +142,18 @@ esp_err_t light_driver_config(uint32_t fade_period_ms, uint32_t blink_period_ms)
 /**
  * @brief  Set the status of the light
  *
+ * @note   Every light_driver_set_*, _fade_*, _breath_*, _effect_* and
+ *         light_driver_config() call only queues a command for the light
+ *         control task and returns, never blocking, from any task or interrupt.
+ *         The task carries the commands out in order. Colour and switch
+ *         commands are folded as they are queued, only the newest value of
+ *         each attribute reaches the LEDs and they never find the queue full.
+ *         The getters return the state the task last applied.
  *
  * @return
  *      - ESP_OK
- *      - MDF_ERR_INVALID_ARG
+ *      - ESP_ERR_INVALID_ARG
+ *      - ESP_ERR_INVALID_STATE if light_driver_init() was not called
  */
 esp_err_t light_driver_set_hue(uint16_t hue);
 esp_err_t light_driver_set_saturation(uint8_t saturation);
@@ -108,6 +166,135 @@ esp_err_t light_driver_set_switch(bool status);
 
 /**@}*/
 
+/**@{*/
+/**
+ * @brief  Set the white channels to a colour temperature in kelvin
+ *
+ * @note   The warm and cold duties come from the calibration of the fixture,
+ *         so fixtures of different batches give the same colour temperature
+ *         and flux for the same command. A colour temperature out of the range
+ *         of the fixture is clamped to it. color_temperature 0 ~ 100 spans the
+ *         same range in mired, from the coldest to the warmest.
+ *
+ * @param  kelvin     Colour temperature, LIGHT_CCT_KELVIN_MIN ~ LIGHT_CCT_KELVIN_MAX
+ * @param  brightness Brightness, 0 ~ 100
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ */
+esp_err_t light_driver_set_cct(uint16_t kelvin, uint8_t brightness);
+esp_err_t light_driver_set_kelvin(uint16_t kelvin);
+esp_err_t light_driver_get_cct(uint16_t *kelvin, uint8_t *brightness);
+uint16_t light_driver_get_kelvin();
+/**@}*/
+
+/**
+ * @brief  Save the measured warm and cold channels of this fixture and use them from now on
+ *
+ * @note   Meant to be called once, e.g. at the end of the production line,
+ *         the calibration is kept in flash and takes precedence over the one
+ *         of light_driver_config_t
+ *
+ * @param  calibration The measured channels
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ *      - ESP_FAIL
+ */
+esp_err_t light_driver_set_cct_calibration(const light_cct_calibration_t *calibration);
+
+/**
+ * @brief  Colour temperature range of the fixture
+ *
+ * @param  kelvin_min Warmest colour temperature
+ * @param  kelvin_max Coldest colour temperature
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ */
+esp_err_t light_driver_get_cct_range(uint16_t *kelvin_min, uint16_t *kelvin_max);
+
+/**@{*/
+/**
+ * @brief  Scenes, looks of the light recalled by their number
+ *
+ * @note   light_driver_scene_save() keeps the current look of the light
+ *         together with the channel targets it gives, recalling it fades every
+ *         channel straight to them in one step, whatever the light shows. The
+ *         scenes are queued like the setters and saved to flash as one blob
+ *         with the light state. Recalling an empty scene only logs a warning.
+ *
+ * @param  scene_id Scene number, below CONFIG_LIGHT_DRIVER_SCENE_NUM
+ * @param  fade_ms  Time a recall of the scene fades over
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ *      - ESP_ERR_INVALID_STATE if light_driver_init() was not called
+ *      - ESP_ERR_NO_MEM if the command queue is full
+ */
+esp_err_t light_driver_scene_save(uint8_t scene_id, uint32_t fade_ms);
+esp_err_t light_driver_scene_recall(uint8_t scene_id);
+esp_err_t light_driver_scene_delete(uint8_t scene_id);
+/**@}*/
+
+/**
+ * @brief  Follow a colour temperature and brightness curve over the day
+ *
+ * @note   The light follows the curve while it is on in white mode, fading to
+ *         each new output over CONFIG_LIGHT_DRIVER_SCHEDULE_PERIOD_MS. A manual
+ *         change holds until the output of the schedule next changes. The
+ *         points are saved to flash with the light state and followed again
+ *         after a restart, the output is not saved. Nothing happens until the
+ *         system clock is set, by SNTP or the application, and the time of day
+ *         is local time.
+ *
+ * @param  points Points of the day, see light_schedule_compile()
+ * @param  num    Number of points, 1 ~ LIGHT_SCHEDULE_POINT_MAX
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ *      - ESP_ERR_NO_MEM
+ *      - ESP_ERR_INVALID_STATE if light_driver_init() was not called
+ */
+esp_err_t light_driver_schedule_start(const light_schedule_point_t *points, size_t num);
+
+/**
+ * @brief  Stop following the schedule and forget it, the light stays where it is
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_STATE if light_driver_init() was not called
+ *      - ESP_ERR_NO_MEM if the command queue is full
+ */
+esp_err_t light_driver_schedule_stop(void);
+
+/**
+ * @brief  How often the output was scaled down to the power budget
+ *
+ * @note   The budget of light_driver_config_t::power_limit is checked on the
+ *         targets of all channels together each time one changes, as well as
+ *         on the peaks of breaths and on every keyframe of an effect. Over
+ *         it, all channels are scaled by the same factor so the colour is kept.
+ *
+ * @param  stats Where the counters are copied
+ * @param  reset Clear the counters once copied
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ */
+esp_err_t light_driver_get_power_stats(light_power_stats_t *stats, bool reset);
+
+/**
+ * @brief  Commands refused so far because the command queue was full, never colour or switch commands
+ */
+uint32_t light_driver_get_dropped(void);
+
 /**@{*/
 /**
  * @brief  Set the status of the light
@@ -144,6 +331,11 @@ esp_err_t light_driver_blink_stop();
 /**
  * @brief  Color gradient
  *
+ * @note   A fade takes over from wherever the running one has got to, any
+ *         other attribute that was fading stays where it is. Stopping a fade
+ *         leaves the light state at the point the fade had reached, at full
+ *         precision rather than read back from the 8-bit channels.
+ *
  * @return
  *      - ESP_OK
  *      - MDF_ERR_INVALID_ARG
@@ -154,6 +346,42 @@ esp_err_t light_driver_fade_warm(uint8_t color_temperature);
 esp_err_t light_driver_fade_stop();
 /**@}*/
 
+/**@{*/
+/**
+ * @brief  Dim while a button is held, the brightness ramps until stopped
+ *
+ * @note   The ramp is played by the fade timer, one command starts it and one
+ *         stops it. The rate is perceptual, the same number of percent each
+ *         second over the whole range. Dimming down stops at the lowest
+ *         brightness instead of turning the light off. The state is updated
+ *         and saved once, at the stop. Any other change of the light before
+ *         that ends the ramp and makes the stop do nothing.
+ *
+ * @param  direction LIGHT_DIM_UP or LIGHT_DIM_DOWN
+ * @param  rate Percent of the brightness range a second, 1 ~ 100
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ */
+esp_err_t light_driver_dim_start(light_dim_direction_t direction, uint8_t rate);
+esp_err_t light_driver_dim_stop(void);
+/**@}*/
+
+/**@{*/
+/**
+ * @brief  Play a built-in effect on all channels, stopping restores the saved state
+ *
+ * @note   The state of the light is not saved in nvs
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_ARG
+ */
+esp_err_t light_driver_effect_start(light_effect_t effect);
+esp_err_t light_driver_effect_stop();
+/**@}*/
+
 #ifdef __cplusplus
 }
 #endif
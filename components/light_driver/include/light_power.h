@@ -0,0 +1,77 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_POWER_H__
+#define __LIGHT_POWER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_POWER_CHANNEL_NUM     (5)
+#define LIGHT_POWER_DUTY_MAX        (UINT16_MAX)    /**< Full duty of a channel */
+
+/**
+ * @brief Current drawn by the channels of a fixture and what its supply gives
+ *
+ * The weights and the budget share one unit, mA for instance. A channel
+ * draws its weight at full duty and in proportion below it.
+ */
+typedef struct {
+    uint16_t weight[LIGHT_POWER_CHANNEL_NUM];   /**< Current of each channel at full duty */
+    uint32_t budget;                            /**< Largest total current, 0 for no limit */
+} light_power_config_t;
+
+/**
+ * @brief How often the budget was hit
+ */
+typedef struct {
+    uint32_t updates;       /**< Outputs checked against the budget */
+    uint32_t limited;       /**< Outputs scaled down to the budget */
+    uint32_t load_max;      /**< Highest total asked for, per mille of the budget */
+} light_power_stats_t;
+
+/**
+ * @brief Total current of the channels at the given duties
+ *
+ * @param config The fixture
+ * @param duty Duty of each channel, 0 ~ LIGHT_POWER_DUTY_MAX
+ *
+ * @return Total current in the unit of the weights, times LIGHT_POWER_DUTY_MAX
+ */
+uint64_t light_power_load(const light_power_config_t *config, const uint16_t duty[LIGHT_POWER_CHANNEL_NUM]);
+
+/**
+ * @brief Scale all channels down by the same factor if together they draw more than the budget
+ *
+ * @note The duties are rounded down, the total left never goes over the
+ *     budget. The ratio of the channels, so the colour, is kept.
+ *
+ * @param config The fixture
+ * @param duty Duty of each channel, scaled in place
+ * @param stats Counters to update, NULL if not needed
+ *
+ * @return true if the channels were scaled
+ */
+bool light_power_limit(const light_power_config_t *config, uint16_t duty[LIGHT_POWER_CHANNEL_NUM],
+                       light_power_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_POWER_H__ */
@@ -0,0 +1,66 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_QUEUE_H__
+#define __LIGHT_QUEUE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *light_queue_handle_t;
+
+/**
+ * @brief Create a bounded ring of fixed size items, pushed by any number of
+ *     producers and popped by one consumer
+ *
+ * @note Neither end ever blocks or takes a lock, a producer racing another
+ *     one for the same slot retries on the next. A slot claimed but not yet
+ *     written holds the consumer back until it is, items of each producer
+ *     come out in the order it pushed them.
+ *
+ * @param length Number of items, a power of two
+ * @param item_size Size of an item
+ *
+ * @return The queue, NULL if length is not a power of two or out of memory
+ */
+light_queue_handle_t light_queue_create(size_t length, size_t item_size);
+
+/**
+ * @brief Free a queue, no producer or consumer may use it any more
+ */
+void light_queue_delete(light_queue_handle_t handle);
+
+/**
+ * @brief Copy an item in, from any task or interrupt
+ *
+ * @return false if the queue is full
+ */
+bool light_queue_push(light_queue_handle_t handle, const void *item);
+
+/**
+ * @brief Copy the oldest item out, from the consumer only
+ *
+ * @return false if the queue is empty
+ */
+bool light_queue_pop(light_queue_handle_t handle, void *item);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_QUEUE_H__ */
@@ -0,0 +1,90 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_SCENE_H__
+#define __LIGHT_SCENE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_SCENE_VERSION     (1)     /**< Layout of light_scene_t in the blob, bump on any change */
+#define LIGHT_SCENE_CHANNEL_NUM (5)     /**< Red, green, blue, warm and cold */
+
+/**
+ * @brief A look of the light, its channel targets worked out when it was saved
+ */
+typedef struct {
+    uint8_t valid;              /**< 0 for an empty scene */
+    uint8_t mode;               /**< Mode the light is left in */
+    uint8_t on;
+    uint8_t saturation;
+    uint8_t value;
+    uint8_t color_temperature;
+    uint8_t brightness;
+    uint8_t channels[LIGHT_SCENE_CHANNEL_NUM];  /**< Channel targets, 0 ~ 255 */
+    uint16_t hue;
+    uint16_t kelvin;
+    uint32_t fade_ms;           /**< Time to fade from any look to this one */
+} light_scene_t;
+
+/**
+ * @brief Largest blob of a table of num scenes
+ */
+size_t light_scene_blob_size(size_t num);
+
+/**
+ * @brief Write a scene table into one versioned blob
+ *
+ * @note Empty scenes after the last one saved are left out, so the blob only
+ *     grows with the scenes in use
+ *
+ * @param scenes The table
+ * @param num Scenes of the table
+ * @param blob The buffer to write
+ * @param size Size of the buffer, set to the size of the blob
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_SIZE if the buffer is too small
+ */
+esp_err_t light_scene_pack(const light_scene_t *scenes, size_t num, void *blob, size_t *size);
+
+/**
+ * @brief Read a scene table back from its blob
+ *
+ * @note The table is left untouched if the blob is refused. Scenes of the
+ *     blob past num are dropped, scenes of the table past the blob are empty.
+ *
+ * @param scenes The table to fill
+ * @param num Scenes of the table
+ * @param blob The blob
+ * @param size Size of the blob, or of a larger buffer holding it
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_VERSION if the blob was written with another layout
+ *     - ESP_ERR_INVALID_SIZE if the blob is cut short
+ */
+esp_err_t light_scene_unpack(light_scene_t *scenes, size_t num, const void *blob, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_SCENE_H__ */
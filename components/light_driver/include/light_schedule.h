@@ -0,0 +1,140 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_SCHEDULE_H__
+#define __LIGHT_SCHEDULE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_SCHEDULE_VERSION      (1)     /**< Layout of light_schedule_point_t in the blob, bump on any change */
+#define LIGHT_SCHEDULE_POINT_MAX    (24)
+#define LIGHT_SCHEDULE_DAY_S        (24 * 60 * 60)
+
+/**
+ * @brief Colour temperature and brightness the light reaches at a time of day
+ */
+typedef struct {
+    uint32_t time_s;        /**< Seconds since midnight, below LIGHT_SCHEDULE_DAY_S */
+    uint16_t kelvin;        /**< LIGHT_CCT_KELVIN_MIN ~ LIGHT_CCT_KELVIN_MAX */
+    uint8_t brightness;     /**< 0 ~ 100 */
+} light_schedule_point_t;
+
+/**
+ * @brief A stretch between two points, as a start and a slope per second
+ */
+typedef struct {
+    uint32_t start_s;           /**< Seconds since midnight, past a day for the stretch after midnight */
+    int32_t mired;              /**< Q16 mired at start_s */
+    int32_t mired_slope;        /**< Q16 mired per second */
+    int32_t brightness;         /**< Q16 brightness at start_s */
+    int32_t brightness_slope;   /**< Q16 brightness per second */
+} light_schedule_segment_t;
+
+/**
+ * @brief A compiled schedule and where its evaluation has got to
+ */
+typedef struct {
+    light_schedule_segment_t segments[LIGHT_SCHEDULE_POINT_MAX];
+    uint8_t num;
+    uint8_t cursor;         /**< Segment of the last evaluation */
+    uint32_t last_s;        /**< Time of the last evaluation, on the time line of start_s */
+    uint16_t kelvin;        /**< Output last reported as changed */
+    uint8_t brightness;
+    bool started;           /**< An output was reported */
+} light_schedule_t;
+
+/**
+ * @brief Compile the points of a day into a schedule
+ *
+ * @note The points may come in any order. The curve is linear in mired and in
+ *     brightness between two points, and goes on from the last point of the
+ *     day to the first one past midnight. A single point holds all day.
+ *
+ * @param points The points, at distinct times
+ * @param num Number of points, 1 ~ LIGHT_SCHEDULE_POINT_MAX
+ * @param schedule The schedule to fill
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_ARG if a point is out of range or two share a time
+ */
+esp_err_t light_schedule_compile(const light_schedule_point_t *points, size_t num, light_schedule_t *schedule);
+
+/**
+ * @brief Evaluate a schedule at a time of day
+ *
+ * @note The cursor moves on from the segment of the last call, so a clock
+ *     going forwards costs no search. A time before the last one starts a
+ *     new day from the first segment.
+ *
+ * @param schedule The schedule
+ * @param time_s Seconds since midnight
+ * @param kelvin Colour temperature at time_s
+ * @param brightness Brightness at time_s
+ *
+ * @return true if the output differs from the one of the last call returning true
+ */
+bool light_schedule_step(light_schedule_t *schedule, uint32_t time_s, uint16_t *kelvin, uint8_t *brightness);
+
+/**
+ * @brief Largest blob of num points
+ */
+size_t light_schedule_blob_size(size_t num);
+
+/**
+ * @brief Write the points of a schedule into one versioned blob
+ *
+ * @note Only the num points given are written, with their padding zeroed
+ *
+ * @param points The points
+ * @param num Number of points, 0 ~ LIGHT_SCHEDULE_POINT_MAX
+ * @param blob The buffer to write
+ * @param size Size of the buffer, set to the size of the blob
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_ARG if num is past LIGHT_SCHEDULE_POINT_MAX
+ *     - ESP_ERR_INVALID_SIZE if the buffer is too small
+ */
+esp_err_t light_schedule_pack(const light_schedule_point_t *points, size_t num, void *blob, size_t *size);
+
+/**
+ * @brief Read the points of a schedule back from its blob
+ *
+ * @note The points are left untouched if the blob is refused
+ *
+ * @param points The points to fill, room for LIGHT_SCHEDULE_POINT_MAX
+ * @param num Set to the number of points read
+ * @param blob The blob
+ * @param size Size of the blob, or of a larger buffer holding it
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_VERSION if the blob was written with another layout
+ *     - ESP_ERR_INVALID_SIZE if the blob is cut short or holds too many points
+ */
+esp_err_t light_schedule_unpack(light_schedule_point_t *points, size_t *num, const void *blob, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_SCHEDULE_H__ */
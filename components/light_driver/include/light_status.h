@@ -0,0 +1,86 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef __LIGHT_STATUS_H__
+#define __LIGHT_STATUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIGHT_STATUS_VERSION        (2)     /**< Of the encoding, bump when the meaning of a field changes */
+#define LIGHT_STATUS_ENCODED_MAX    (32)    /**< Largest record, a raw record of version 1 included */
+
+/**
+ * @brief The state of the five-color light
+ */
+typedef struct {
+    uint8_t mode;
+    uint8_t on;
+    uint16_t hue;
+    uint8_t saturation;
+    uint8_t value;
+    uint8_t color_temperature;
+    uint8_t brightness;
+    uint32_t fade_period_ms;
+    uint32_t blink_period_ms;
+    uint16_t kelvin;            /**< Colour temperature, color_temperature in kelvin */
+} light_status_t;
+
+/**
+ * @brief Write the state into a compact versioned record
+ *
+ * @note The record is a version byte, a varint bitmap of the fields that are
+ *     not 0, then those fields as varints. A field added later takes the next
+ *     bit, older firmware skips it.
+ *
+ * @param status The state
+ * @param record The buffer to write
+ * @param size Size of the buffer, set to the size of the record
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_SIZE if the buffer is too small
+ */
+esp_err_t light_status_encode(const light_status_t *status, void *record, size_t *size);
+
+/**
+ * @brief Read the state back from its record, of this version or an older one
+ *
+ * @note The fields are decoded straight from the record. A record of an older
+ *     version goes through its migration hook, version 1 being the raw
+ *     light_status_t saved before the encoding. Fields the record does not
+ *     hold are 0. The state is left untouched if the record is refused.
+ *
+ * @param status The state to fill
+ * @param record The record
+ * @param size Size of the record, or of a larger buffer holding it
+ *
+ * @return
+ *     - ESP_OK if sucess
+ *     - ESP_ERR_INVALID_VERSION if the record was written by a newer version
+ *     - ESP_ERR_INVALID_SIZE if the record is cut short
+ *     - ESP_ERR_INVALID_ARG if a field is out of its range
+ */
+esp_err_t light_status_decode(light_status_t *status, const void *record, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /**< __LIGHT_STATUS_H__ */
@@ -15,48 +15,146 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include <sys/lock.h>
 #include "errno.h"
-#include "math.h"
 #include "esp_log.h"
+#include "esp_bit_defs.h"
 #include "soc/ledc_reg.h"
 #include "soc/ledc_struct.h"
+#include "freertos/FreeRTOS.h"
 #include "driver/gptimer.h"
 #include "driver/ledc.h"
+#include "esp_timer.h"
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+#include "esp_cpu.h"
+#endif
 #include "iot_led.h"
+#include "iot_led_gamma_table.h"
 
 #define LEDC_FADE_MARGIN      (10)
-#define LEDC_TIMER_PRECISION  (LEDC_TIMER_13_BIT)
-#define LEDC_VALUE_TO_DUTY(v) ((v) * ((1 << LEDC_TIMER_PRECISION)) / (UINT16_MAX))
-#define LEDC_FIXED_Q          (8)
+#define LEDC_LEVEL_MAX        (UINT16_MAX)
+#define LEDC_VALUE_TO_LEVEL(v) ((v) * 257)  /**< 0 ~ 255 to the full level range */
+#define LEDC_LEVEL_TO_VALUE(l) ((l) >> 8)
+#define LEDC_DUTY_FRAC_BITS   (4)       /**< Fraction bits of the duty register, spread over PWM periods by the LEDC */
+#define LEDC_DITHER_SHIFT     (16 - LEDC_DUTY_FRAC_BITS)  /**< Q16 duty bits below the register fraction */
+#define GAMMA_KNOT_SHIFT      (16 - GAMMA_TABLE_BITS)   /**< Level bits between two gamma knots */
+#define LEDC_FADE_Q           (16)      /**< Fade progress is a Q16 fraction of the fade duration */
+#define FADE_ALARM_MIN_US     (100)     /**< Shortest alarm delay, also the slack for a channel to be due */
+#define LEDC_HW_SEGMENT_SPAN  (LEDC_LEVEL_MAX / 16 + 1) /**< Level span of a hardware fade segment */
+#define LEDC_HW_SEGMENT_ERROR_SHIFT (5) /**< Error of a hardware fade segment allowed halfway, in 2^-n of the duty, one count at least */
+#define LEDC_HW_FADE_MAX      (LEDC_DUTY_NUM_LSCH0_V) /**< Limit of the duty_num, duty_cycle and duty_scale fields */
 
-#define FLOATINT_2_FIXED(X, Q)    ((int)((X) * (0x1U << (Q))))
-#define FIXED_2_FLOATING(X, Q)    ((int)((X) / (0x1U << (Q))))
-#define GET_FIXED_INTEGER_PART(X, Q) ((X) >> (Q))
-#define GET_FIXED_DECIMAL_PART(X, Q) ((X) & ((0x1U << (Q)) - 1))
+_Static_assert(GAMMA_TABLE_GENERATED_BITS == GAMMA_TABLE_BITS, "gamma table does not match GAMMA_TABLE_BITS");
 
+/**
+ * @brief Fade state of one channel
+ *
+ * A fade runs from `start` at `start_us` to `final` at `end_us`, the value in
+ * between is interpolated from the elapsed time, so the fade always ends on its
+ * deadline whatever the timer period is. `rate` is the Q32 reciprocal of the
+ * fade duration, which keeps the division out of the ISR.
+ *
+ * A non-zero `cycle_us` loops the channel between `peak` and 0, each phase
+ * lasting `cycle_us`, either as a ramp (`fade_flag`) or as a hold (blink).
+ * A channel of an effect instead takes each phase from column `column` of
+ * the keyframes of the running effect.
+ */
 typedef struct {
-    int cur;
-    int final;
-    int step;
-    int cycle;
-    size_t num;
+    int cur;            /**< Current level */
+    int start;          /**< Level at the start of the fade */
+    int final;          /**< Target level of the fade */
+    int peak;           /**< Upper level of a blink or breath loop */
+    int64_t start_us;   /**< Time the fade started */
+    int64_t end_us;     /**< Time the fade must reach `final` */
+    uint32_t rate;      /**< (2^32 / fade duration in us), 0 for a step */
+    uint32_t cycle_us;  /**< Duration of one loop phase, 0 if not looping */
+    uint32_t cycle_rate; /**< (2^32 / cycle_us) */
+    int64_t next_us;    /**< Time the timer has to service the channel again */
+    bool fade_flag;     /**< Ramp between phases instead of toggling */
+    uint16_t dither_err; /**< Duty below the register fraction carried to the next tick, Q16 */
+    bool effect;        /**< Driven by the running effect */
+    uint8_t column;     /**< Value column of the channel in the keyframes */
+    uint8_t frame;      /**< Keyframe the channel is fading to */
+    uint16_t repeat;    /**< Plays of the effect left, 0 to loop until stopped */
 } ledc_fade_data_t;
 
+typedef enum {
+    LEDC_FADE_CMD_SET = 0,  /**< Fade to `final` in `duration_us` */
+    LEDC_FADE_CMD_LOOP,     /**< Blink or breathe between `final` and 0 */
+    LEDC_FADE_CMD_FREEZE,   /**< Stop at the current value */
+    LEDC_FADE_CMD_EFFECT,   /**< Play column `column` of the bank effect */
+} ledc_fade_cmd_type_t;
+
+/**
+ * @brief New target of one channel, prepared by a setter and applied by the ISR
+ */
+typedef struct {
+    ledc_fade_cmd_type_t type;
+    int final;              /**< Target level, or loop peak */
+    uint32_t duration_us;   /**< Fade duration, or loop phase duration */
+    uint32_t rate;          /**< (2^32 / duration_us) */
+    bool fade_flag;
+    uint8_t column;
+} ledc_fade_cmd_t;
+
+/**
+ * @brief Keyframes of an effect, copied so the caller's table can go away
+ */
+typedef struct {
+    iot_led_keyframe_t keyframes[IOT_LED_EFFECT_KEYFRAME_MAX];
+    uint8_t keyframe_num;   /**< 0 if there is no effect */
+    uint16_t repeat;
+} ledc_effect_t;
+
+/**
+ * @brief A set of channel targets committed together
+ *
+ * Setters fill a bank in task context and publish it through `commit` with one
+ * atomic pointer store. The ISR takes it with one atomic exchange and applies
+ * every channel of `mask` with the same timestamp, so the ISR is the only
+ * writer of the fade state and a multi-channel change starts on the same period.
+ */
+typedef struct {
+    uint32_t mask;
+    ledc_fade_cmd_t cmd[LEDC_CHANNEL_MAX];
+    ledc_effect_t effect;   /**< New effect of the LEDC_FADE_CMD_EFFECT channels */
+} ledc_fade_bank_t;
+
 typedef struct {
     gptimer_handle_t handle;
 } hw_timer_idx_t;
 
 typedef struct {
     ledc_fade_data_t fade_data[LEDC_CHANNEL_MAX];
+    ledc_fade_bank_t bank[2];           /**< Double buffer of pending targets */
+    ledc_fade_bank_t *commit;           /**< Bank waiting for the ISR, NULL if none */
+    uint8_t free_bank;                  /**< Bank to fill when none is waiting */
+    ledc_effect_t effect;   /**< Effect the ISR is playing */
+    uint32_t effect_mask;   /**< Channels last given to an effect, kept by the setters */
+    uint32_t active_mask;   /**< Bit n is set while channel n is fading, looping or has a pending value */
+    uint32_t dither_mask;   /**< Bit n is set if channel n drives fractional duty */
+    iot_led_fade_mode_t fade_mode;
+    uint32_t duty_max;      /**< Full scale duty of the configured duty resolution */
+    uint32_t freq_hz;
     ledc_mode_t speed_mode;
     ledc_timer_t timer_num;
-    hw_timer_idx_t timer_id;
+    uint32_t channel_mask;  /**< Channels registered to the instance */
 } iot_light_t;
 
 static const char *TAG = "iot_light";
-static DRAM_ATTR iot_light_t *g_light_config = NULL;
-static DRAM_ATTR uint16_t *g_gamma_table = NULL;
+static DRAM_ATTR iot_light_t *g_lights[IOT_LED_INSTANCE_MAX] = {NULL};  /**< Instances, packed at the front */
+static DRAM_ATTR uint8_t g_light_num = 0;
+static DRAM_ATTR hw_timer_idx_t g_fade_timer = {NULL};
+static DRAM_ATTR const uint16_t *g_gamma_table = g_gamma_table_default;
 static DRAM_ATTR bool g_hw_timer_started = false;
+static DRAM_ATTR int64_t g_fade_alarm_us = 0;      /**< Time the armed alarm is due */
+static portMUX_TYPE g_fade_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static _lock_t g_light_lock;                        /**< Serialises the changes to the instances, their channels and the timer */
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+static DRAM_ATTR iot_led_stats_t g_fade_stats = {0};
+#endif
 
 /* ---------------- Timer helper ---------------- */
 static void iot_timer_create(hw_timer_idx_t *timer_id,
@@ -89,18 +187,57 @@ static void iot_timer_create(hw_timer_idx_t *timer_id,
     ESP_ERROR_CHECK(gptimer_enable(timer_id->handle));
 }
 
+/**
+ * @brief Start the timer, g_hw_timer_started has been set by the caller under g_fade_spinlock
+ */
 static void iot_timer_start(hw_timer_idx_t *timer_id)
 {
     ESP_ERROR_CHECK(gptimer_start(timer_id->handle));
-    g_hw_timer_started = true;
 }
 
-static void iot_timer_stop(hw_timer_idx_t *timer_id)
+/**
+ * @brief Stop the timer, which the ISR and iot_led_delete() may both do when the last instance goes
+ */
+static IRAM_ATTR void iot_timer_stop(hw_timer_idx_t *timer_id)
 {
-    ESP_ERROR_CHECK(gptimer_stop(timer_id->handle));
+    gptimer_stop(timer_id->handle);
     g_hw_timer_started = false;
 }
 
+/**
+ * @brief Program a one-shot alarm `delay_us` after the counter value `count`
+ */
+static IRAM_ATTR void iot_timer_set_alarm(hw_timer_idx_t *timer_id, uint64_t count, int64_t delay_us)
+{
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = count + ((delay_us > FADE_ALARM_MIN_US) ? delay_us : FADE_ALARM_MIN_US),
+    };
+    gptimer_set_alarm_action(timer_id->handle, &alarm_config);
+}
+
+/**
+ * @brief Make the fade timer run as soon as possible, starting it if `start`
+ *
+ * @note Called with g_light_lock held and outside g_fade_spinlock, after the
+ *     bank has been published. `start` is claimed under g_fade_spinlock, which
+ *     the ISR stops the timer under, so only one caller starts a stopped timer.
+ *     An alarm set just after the ISR stopped the timer is dropped, the ISR
+ *     had already taken the bank then.
+ */
+static void iot_timer_kick(hw_timer_idx_t *timer_id, bool start)
+{
+    uint64_t count = 0;
+
+    if (start) {
+        gptimer_set_raw_count(timer_id->handle, 0);
+        iot_timer_set_alarm(timer_id, 0, 0);
+        iot_timer_start(timer_id);
+    } else {
+        gptimer_get_raw_count(timer_id->handle, &count);
+        iot_timer_set_alarm(timer_id, count, 0);
+    }
+}
+
 /* ---------------- LEDC helpers ---------------- */
 static IRAM_ATTR esp_err_t iot_ledc_duty_config(ledc_mode_t speed_mode,
                                                 ledc_channel_t channel,
@@ -163,6 +300,7 @@ static IRAM_ATTR esp_err_t _iot_set_fade_with_step(ledc_mode_t speed_mode,
 }
 
 static IRAM_ATTR esp_err_t _iot_set_fade_with_time(ledc_mode_t speed_mode,
+                                                   ledc_timer_t timer_num,
                                                    ledc_channel_t channel,
                                                    uint32_t target_duty,
                                                    int max_fade_time_ms)
@@ -171,11 +309,11 @@ static IRAM_ATTR esp_err_t _iot_set_fade_with_time(ledc_mode_t speed_mode,
     uint32_t duty_cur = LEDC.channel_group[speed_mode].channel[channel].duty_rd.duty_read >> 4;
     uint32_t duty_delta = (target_duty > duty_cur) ? target_duty - duty_cur : duty_cur - target_duty;
 
-    // uint32_t timer_source_clk = LEDC.timer_group[speed_mode].timer[g_light_config->timer_num].conf.tick_sel;
+    // uint32_t timer_source_clk = LEDC.timer_group[speed_mode].timer[timer_num].conf.tick_sel;
     uint32_t timer_source_clk = LEDC_APB_CLK;
 
-    uint32_t duty_resolution = LEDC.timer_group[speed_mode].timer[g_light_config->timer_num].conf.duty_resolution;
-    uint32_t clock_divider = LEDC.timer_group[speed_mode].timer[g_light_config->timer_num].conf.clock_divider;
+    uint32_t duty_resolution = LEDC.timer_group[speed_mode].timer[timer_num].conf.duty_resolution;
+    uint32_t clock_divider = LEDC.timer_group[speed_mode].timer[timer_num].conf.clock_divider;
     uint32_t precision = (0x1U << duty_resolution);
 
     if (timer_source_clk == LEDC_APB_CLK) {
@@ -219,87 +357,504 @@ static IRAM_ATTR esp_err_t iot_ledc_set_duty(ledc_mode_t speed_mode,
                                              ledc_channel_t channel,
                                              uint32_t duty)
 {
-    return iot_ledc_duty_config(speed_mode, channel, -1, duty << 4, 1, 1, 1, 0);
+    return iot_ledc_duty_config(speed_mode, channel, -1, duty << LEDC_DUTY_FRAC_BITS, 1, 1, 1, 0);
+}
+
+static IRAM_ATTR esp_err_t iot_ledc_set_duty_frac(ledc_mode_t speed_mode,
+                                                  ledc_channel_t channel,
+                                                  uint32_t duty_frac)
+{
+    return iot_ledc_duty_config(speed_mode, channel, -1, duty_frac, 1, 1, 1, 0);
+}
+
+/**
+ * @brief Duty fraction of a level in Q16, interpolated between the two nearest gamma knots
+ */
+static IRAM_ATTR uint32_t gamma_level_to_q16(int level)
+{
+    /**< Stretch the level range onto the knots, LEDC_LEVEL_MAX lands on the last one */
+    uint32_t pos = (uint32_t)level + (((uint32_t)level + 0x8000) >> 16);
+    uint32_t index = pos >> GAMMA_KNOT_SHIFT;
+    uint32_t frac = pos & ((0x1U << GAMMA_KNOT_SHIFT) - 1);
+
+    int32_t cur = g_gamma_table[index];
+    int32_t next = (index < (GAMMA_TABLE_SIZE - 1)) ? g_gamma_table[index + 1] : cur;
+
+    return cur + ((next - cur) * (int32_t)frac >> GAMMA_KNOT_SHIFT);
+}
+
+/**
+ * @brief Duty of a level in Q16 of the duty resolution
+ */
+static IRAM_ATTR uint32_t gamma_level_to_duty_q16(const iot_light_t *light, int level)
+{
+    uint32_t duty_q16 = gamma_level_to_q16(level) * light->duty_max;
+
+    /**< Scale by 65536 / 65535 so the top of the table is the full duty */
+    return duty_q16 + (duty_q16 >> 16);
 }
 
-static void gamma_table_create(uint16_t *gamma_table, float correction)
+static IRAM_ATTR uint32_t gamma_value_to_duty(const iot_light_t *light, int level)
 {
-    for (int i = 0; i < GAMMA_TABLE_SIZE; i++) {
-        float value_tmp = (float)i / (GAMMA_TABLE_SIZE - 1);
-        value_tmp = powf(value_tmp, 1.0f / correction);
-        gamma_table[i] = (uint16_t)FLOATINT_2_FIXED((value_tmp * GAMMA_TABLE_SIZE), LEDC_FIXED_Q);
+    return (gamma_level_to_duty_q16(light, level) + (0x1U << 15)) >> 16;
+}
+
+/**
+ * @brief Hold a level, with the duty fraction on a dithered channel
+ */
+static IRAM_ATTR void fade_set_level(iot_light_t *light, ledc_channel_t channel, ledc_fade_data_t *fade_data, int level)
+{
+    ledc_mode_t speed_mode = light->speed_mode;
+
+    fade_data->dither_err = 0;
+
+    if (light->dither_mask & BIT(channel)) {
+        uint32_t duty_q16 = gamma_level_to_duty_q16(light, level);
+        iot_ledc_set_duty_frac(speed_mode, channel, (duty_q16 + (0x1U << (LEDC_DITHER_SHIFT - 1))) >> LEDC_DITHER_SHIFT);
+    } else {
+        iot_ledc_set_duty(speed_mode, channel, gamma_value_to_duty(light, level));
     }
-    if (gamma_table[255] == 0) {
-        gamma_table[255] = __UINT16_MAX__;
+}
+
+/**
+ * @brief Step a dithered channel to `level` for one tick
+ *
+ * The duty fraction is spread over PWM periods by the LEDC and what is below
+ * it is carried to the next tick (first order sigma-delta), so a ramp through
+ * the few lowest counts averages to the curve instead of stepping.
+ */
+static IRAM_ATTR void fade_dither_step(iot_light_t *light, ledc_channel_t channel, ledc_fade_data_t *fade_data, int level)
+{
+    uint32_t duty_q16 = gamma_level_to_duty_q16(light, level) + fade_data->dither_err;
+
+    fade_data->dither_err = duty_q16 & ((0x1U << LEDC_DITHER_SHIFT) - 1);
+    iot_ledc_set_duty_frac(light->speed_mode, channel, duty_q16 >> LEDC_DITHER_SHIFT);
+}
+
+static uint32_t fade_rate(uint32_t duration_us)
+{
+    return (duration_us > 1) ? (uint32_t)((1ULL << 32) / duration_us) : 0;
+}
+
+static IRAM_ATTR void fade_start(ledc_fade_data_t *fade_data, int start, int final,
+                                 int64_t start_us, uint32_t duration_us, uint32_t rate)
+{
+    fade_data->start    = start;
+    fade_data->final    = final;
+    fade_data->start_us = start_us;
+    fade_data->end_us   = start_us + duration_us;
+    fade_data->rate     = (start != final) ? rate : 0;
+}
+
+/**
+ * @brief Value of the fade at `now`, clamped to [start, final]
+ */
+static IRAM_ATTR int fade_value_at(const ledc_fade_data_t *fade_data, int64_t now)
+{
+    if (!fade_data->rate || now >= fade_data->end_us) {
+        return fade_data->final;
     }
+
+    if (now <= fade_data->start_us) {
+        return fade_data->start;
+    }
+
+    uint32_t progress = ((uint64_t)(now - fade_data->start_us) * fade_data->rate) >> (32 - LEDC_FADE_Q);
+    return fade_data->start + (int)(((int64_t)(fade_data->final - fade_data->start) * progress) >> LEDC_FADE_Q);
+}
+
+/**
+ * @brief Whether the channel moves on to another phase when its fade ends
+ */
+static IRAM_ATTR bool fade_is_phased(const ledc_fade_data_t *fade_data)
+{
+    return fade_data->cycle_us || fade_data->effect;
 }
 
-static IRAM_ATTR uint32_t gamma_value_to_duty(int value)
+/**
+ * @brief Start the fade to the next keyframe, at the end of the previous one
+ *
+ * @return false if the effect has been played `repeat` times, the channel then
+ *     holds the last keyframe
+ */
+static IRAM_ATTR bool fade_effect_next(iot_light_t *light, ledc_fade_data_t *fade_data)
 {
-    uint32_t tmp_q = GET_FIXED_INTEGER_PART(value, LEDC_FIXED_Q);
-    uint32_t tmp_r = GET_FIXED_DECIMAL_PART(value, LEDC_FIXED_Q);
+    const ledc_effect_t *effect = &light->effect;
+    uint8_t frame = fade_data->frame + 1;
+
+    if (frame >= effect->keyframe_num) {
+        if (fade_data->repeat && !--fade_data->repeat) {
+            fade_data->effect = false;
+            return false;
+        }
+
+        frame = 0;
+    }
 
-    uint16_t cur = LEDC_VALUE_TO_DUTY(g_gamma_table[tmp_q]);
-    uint16_t next = (tmp_q < (GAMMA_TABLE_SIZE - 1)) ? LEDC_VALUE_TO_DUTY(g_gamma_table[tmp_q + 1]) : cur;
-    return cur + (next - cur) * tmp_r / (0x1U << LEDC_FIXED_Q);
+    const iot_led_keyframe_t *keyframe = effect->keyframes + frame;
+    fade_data->frame = frame;
+    fade_start(fade_data, fade_data->final, LEDC_VALUE_TO_LEVEL(keyframe->value[fade_data->column]),
+               fade_data->end_us, keyframe->duration_us, keyframe->rate);
+
+    return true;
 }
 
-static bool IRAM_ATTR fade_timercb(gptimer_handle_t timer,
-                                   const gptimer_alarm_event_data_t *edata,
-                                   void *user_ctx)
+/**
+ * @brief Move a looping channel to the phase that contains `now`
+ */
+static IRAM_ATTR void fade_next_phase(iot_light_t *light, ledc_fade_data_t *fade_data, int64_t now)
 {
-    int idle_channel_num = 0;
-    for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++) {
-        ledc_fade_data_t *fade_data = g_light_config->fade_data + channel;
-        if (fade_data->num > 0) {
-            fade_data->num--;
-            if (fade_data->step) {
-                fade_data->cur += fade_data->step;
-                if (fade_data->num != 0) {
-                    _iot_set_fade_with_time(g_light_config->speed_mode,
-                                            channel,
-                                            gamma_value_to_duty(fade_data->cur),
-                                            DUTY_SET_CYCLE - LEDC_FADE_MARGIN);
-                } else {
-                    iot_ledc_set_duty(g_light_config->speed_mode,
-                                      channel,
-                                      gamma_value_to_duty(fade_data->cur));
-                }
-                _iot_update_duty(g_light_config->speed_mode, channel);
-            } else {
-                iot_ledc_set_duty(g_light_config->speed_mode,
-                                  channel,
-                                  gamma_value_to_duty(fade_data->cur));
-                _iot_update_duty(g_light_config->speed_mode, channel);
+    while (now >= fade_data->end_us) {
+        if (fade_data->effect) {
+            if (!fade_effect_next(light, fade_data)) {
+                break;
             }
-        } else if (fade_data->cycle) {
-            fade_data->num = fade_data->cycle - 1;
-            if (fade_data->step) {
-                fade_data->step *= -1;
-                fade_data->cur += fade_data->step;
-            } else {
-                fade_data->cur = (fade_data->cur == fade_data->final) ? 0 : fade_data->final;
+
+            continue;
+        }
+
+        int next = (fade_data->final == fade_data->peak) ? 0 : fade_data->peak;
+        fade_start(fade_data, fade_data->fade_flag ? fade_data->final : next, next,
+                   fade_data->end_us, fade_data->cycle_us, fade_data->cycle_rate);
+    }
+}
+
+/**
+ * @brief Time at which a running fade passes `value`
+ */
+static IRAM_ATTR int64_t fade_time_of(const ledc_fade_data_t *fade_data, int value)
+{
+    return fade_data->start_us + (int64_t)(value - fade_data->start)
+           * (fade_data->end_us - fade_data->start_us) / (fade_data->final - fade_data->start);
+}
+
+/**
+ * @brief Hand the next piece of a ramp to the LEDC fader in one go
+ *
+ * The level is linear in time and the gamma curve is close to a straight line
+ * over one LEDC_HW_SEGMENT_SPAN, so the ramp up to the next span boundary is
+ * run by the fader on its own as a straight line in duty. Near the bottom the
+ * curve bends too much for that, the segment is halved until its line is
+ * within 2^-LEDC_HW_SEGMENT_ERROR_SHIFT of the duty, or one count, of the curve
+ * halfway. The segment is shortened to fit
+ * duty_num, and a slope slower than one count per LEDC_HW_FADE_MAX periods is
+ * stepped one count per alarm instead.
+ *
+ * @return Time at which the segment ends and the channel is due again
+ */
+static IRAM_ATTR int64_t fade_hw_segment(iot_light_t *light, ledc_channel_t channel, ledc_fade_data_t *fade_data, int64_t now)
+{
+    ledc_mode_t speed_mode = light->speed_mode;
+    int cur = fade_data->cur;
+    int span = (fade_data->final > cur) ? LEDC_HW_SEGMENT_SPAN : -LEDC_HW_SEGMENT_SPAN;
+    int target = (fade_data->final > cur) ? (cur + 1) / LEDC_HW_SEGMENT_SPAN * LEDC_HW_SEGMENT_SPAN
+                                          : (cur + LEDC_HW_SEGMENT_SPAN - 2) / LEDC_HW_SEGMENT_SPAN * LEDC_HW_SEGMENT_SPAN;
+    int64_t end_us = now;
+
+    /**< Next span boundary past the current level, skipping one that is only a rounding error away */
+    while (end_us < now + DUTY_SET_CYCLE * 1000 && end_us < fade_data->end_us) {
+        target += span;
+        end_us = ((span > 0) ? target >= fade_data->final : target <= fade_data->final)
+                 ? fade_data->end_us : fade_time_of(fade_data, target);
+    }
+
+    uint32_t duty_cur = LEDC.channel_group[speed_mode].channel[channel].duty_rd.duty_read >> 4;
+
+    while (end_us - now > DUTY_SET_CYCLE * 1000) {
+        int64_t mid_us = now + (end_us - now) / 2;
+        int64_t line_q16 = (((int64_t)duty_cur << 16) + gamma_level_to_duty_q16(light, fade_value_at(fade_data, end_us))) / 2;
+        int64_t error_q16 = line_q16 - gamma_level_to_duty_q16(light, fade_value_at(fade_data, mid_us));
+        int64_t limit_q16 = MAX(line_q16 >> LEDC_HW_SEGMENT_ERROR_SHIFT, 1 << 16);
+
+        if (error_q16 < limit_q16 && error_q16 > -limit_q16) {
+            break;
+        }
+
+        end_us = mid_us;
+    }
+
+    uint32_t duty_target = gamma_value_to_duty(light, fade_value_at(fade_data, end_us));
+    uint32_t duty_delta = (duty_target > duty_cur) ? duty_target - duty_cur : duty_cur - duty_target;
+    uint32_t cycles = (uint64_t)(end_us - now) * light->freq_hz / 1000000;
+
+    /**< The curve is not a line, a segment cut in proportion may still be a count or two over */
+    for (uint32_t steps = MIN(cycles, duty_delta); steps > LEDC_HW_FADE_MAX; steps = MIN(cycles, duty_delta)) {
+        end_us = now + (end_us - now) * LEDC_HW_FADE_MAX / (steps + 1);
+        duty_target = gamma_value_to_duty(light, fade_value_at(fade_data, end_us));
+        duty_delta = (duty_target > duty_cur) ? duty_target - duty_cur : duty_cur - duty_target;
+        cycles = (uint64_t)(end_us - now) * light->freq_hz / 1000000;
+    }
+
+    if (!duty_delta || !cycles) {
+        iot_ledc_set_duty(speed_mode, channel, duty_target);
+        return end_us;
+    }
+
+    uint32_t dir = (duty_target > duty_cur) ? LEDC_DUTY_DIR_INCREASE : LEDC_DUTY_DIR_DECREASE;
+
+    if (cycles >= duty_delta) {
+        /**< Round the period per count, the next segment starts from wherever this one got to */
+        uint32_t cycle_num = (cycles + duty_delta / 2) / duty_delta;
+
+        if (cycle_num > LEDC_HW_FADE_MAX) {
+            /**< Too slow for the fader, move one count now and come back for the next */
+            fade_set_level(light, channel, fade_data, cur);
+            return now + (end_us - now) / duty_delta;
+        }
+
+        iot_ledc_duty_config(speed_mode, channel, -1, duty_cur << 4, dir, duty_delta, cycle_num, 1);
+    } else {
+        uint32_t scale = MIN(duty_delta / cycles, LEDC_HW_FADE_MAX);
+        iot_ledc_duty_config(speed_mode, channel, -1, duty_cur << 4, dir, cycles, 1, scale);
+    }
+
+    return end_us;
+}
+
+/**
+ * @brief Current value of a channel, following its loop phases
+ */
+static IRAM_ATTR int fade_current(iot_light_t *light, ledc_fade_data_t *fade_data, int channel, int64_t now)
+{
+    if (!(light->active_mask & BIT(channel))) {
+        return fade_data->cur;
+    }
+
+    if (fade_is_phased(fade_data) && now >= fade_data->end_us) {
+        fade_next_phase(light, fade_data, now);
+    }
+
+    return fade_value_at(fade_data, now);
+}
+
+/**
+ * @brief Apply a committed bank, every channel starts from where it is now
+ *
+ * All channels of the bank are settled on their current value before a new
+ * effect replaces the keyframes, a channel of the old effect is always in the
+ * bank of the new one.
+ */
+static IRAM_ATTR void fade_apply_bank(iot_light_t *light, const ledc_fade_bank_t *bank, int64_t now)
+{
+    uint32_t pending = bank->mask;
+
+    while (pending) {
+        int channel = __builtin_ctz(pending);
+        ledc_fade_data_t *fade_data = light->fade_data + channel;
+        pending &= pending - 1;
+
+        fade_data->cur = fade_current(light, fade_data, channel, now);
+        fade_data->cycle_us = 0;
+        fade_data->effect = false;
+    }
+
+    if (bank->effect.keyframe_num) {
+        memcpy(&light->effect, &bank->effect, sizeof(ledc_effect_t));
+    }
+
+    pending = bank->mask;
+
+    while (pending) {
+        int channel = __builtin_ctz(pending);
+        const ledc_fade_cmd_t *cmd = bank->cmd + channel;
+        ledc_fade_data_t *fade_data = light->fade_data + channel;
+        int cur = fade_data->cur;
+        pending &= pending - 1;
+
+        switch (cmd->type) {
+            case LEDC_FADE_CMD_SET:
+                fade_start(fade_data, cur, cmd->final, now, cmd->duration_us, cmd->rate);
+                break;
+
+            case LEDC_FADE_CMD_LOOP:
+                fade_data->peak       = cmd->final;
+                fade_data->fade_flag  = cmd->fade_flag;
+                fade_data->cycle_us   = cmd->duration_us;
+                fade_data->cycle_rate = cmd->rate;
+                fade_start(fade_data, cmd->final, cmd->fade_flag ? 0 : cmd->final, now, cmd->duration_us, cmd->rate);
+                break;
+
+            case LEDC_FADE_CMD_EFFECT: {
+                const iot_led_keyframe_t *keyframe = light->effect.keyframes;
+                fade_data->effect = true;
+                fade_data->column = cmd->column;
+                fade_data->frame  = 0;
+                fade_data->repeat = light->effect.repeat;
+                fade_start(fade_data, cur, LEDC_VALUE_TO_LEVEL(keyframe->value[cmd->column]),
+                           now, keyframe->duration_us, keyframe->rate);
+                break;
             }
-            _iot_set_fade_with_time(g_light_config->speed_mode,
-                                    channel,
-                                    gamma_value_to_duty(fade_data->cur),
-                                    DUTY_SET_CYCLE - LEDC_FADE_MARGIN);
-            _iot_update_duty(g_light_config->speed_mode, channel);
+
+            default:
+                fade_start(fade_data, cur, cur, now, 0, 0);
+                break;
+        }
+
+        fade_data->next_us = now;
+        light->active_mask |= BIT(channel);
+    }
+}
+
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+static IRAM_ATTR int fade_stats_bucket(uint32_t value)
+{
+    int bucket = value ? 31 - __builtin_clz(value) : 0;
+    return MIN(bucket, IOT_LED_STATS_BUCKETS - 1);
+}
+
+/**
+ * @brief Account the latency of an interrupt that entered at `now`
+ */
+static IRAM_ATTR void fade_stats_enter(int64_t now)
+{
+    uint32_t latency_us = (now > g_fade_alarm_us) ? now - g_fade_alarm_us : 0;
+
+    g_fade_stats.isr_count++;
+    g_fade_stats.latency_hist[fade_stats_bucket(latency_us)]++;
+    g_fade_stats.latency_max_us = MAX(g_fade_stats.latency_max_us, latency_us);
+
+    if (latency_us > IOT_LED_STATS_LATE_US) {
+        g_fade_stats.late_count++;
+        g_fade_stats.dropped_ticks += latency_us / (DUTY_SET_CYCLE * 1000);
+    }
+}
+
+static IRAM_ATTR void fade_stats_exit(uint32_t cycles)
+{
+    g_fade_stats.cycles_hist[fade_stats_bucket(cycles)]++;
+    g_fade_stats.cycles_max = MAX(g_fade_stats.cycles_max, cycles);
+}
+#endif
+
+/**
+ * @brief Service the channels of an instance that are due
+ *
+ * A committed bank is taken first. Only channels in active_mask are visited. A
+ * ramp is serviced every DUTY_SET_CYCLE, or at segment boundaries in
+ * IOT_LED_FADE_HARDWARE mode, and a blink hold only at its phase boundary.
+ *
+ * @return Earliest time a channel of the instance is due, INT64_MAX if none is active
+ */
+static IRAM_ATTR int64_t fade_service(iot_light_t *light, int64_t now)
+{
+    int64_t deadline = INT64_MAX;
+    ledc_fade_bank_t *bank = __atomic_exchange_n(&light->commit, NULL, __ATOMIC_ACQUIRE);
+
+    if (bank) {
+        fade_apply_bank(light, bank, now);
+    }
+
+    uint32_t pending = light->active_mask;
+
+    while (pending) {
+        int channel = __builtin_ctz(pending);
+        ledc_fade_data_t *fade_data = light->fade_data + channel;
+        pending &= pending - 1;
+
+        if (fade_data->next_us > now + FADE_ALARM_MIN_US) {
+            deadline = MIN(deadline, fade_data->next_us);
+            continue;
+        }
+
+        fade_data->cur = fade_current(light, fade_data, channel, now);
+
+        if (!fade_data->rate || now >= fade_data->end_us) {
+            /**< Land exactly on the value, then hold it until the next loop phase or retire */
+            fade_set_level(light, channel, fade_data, fade_data->cur);
+
+            if (!fade_is_phased(fade_data)) {
+                light->active_mask &= ~BIT(channel);
+            }
+
+            fade_data->next_us = fade_data->end_us;
+        } else if (light->fade_mode == IOT_LED_FADE_HARDWARE) {
+            fade_data->next_us = fade_hw_segment(light, channel, fade_data, now);
         } else {
-            idle_channel_num++;
+            /**< Let the hardware fader ramp towards the value due at the next tick */
+            int64_t remain_ms = (fade_data->end_us - now) / 1000;
+            int fade_ms = (remain_ms < DUTY_SET_CYCLE - LEDC_FADE_MARGIN) ? remain_ms : DUTY_SET_CYCLE - LEDC_FADE_MARGIN;
+
+            fade_data->next_us = MIN(now + DUTY_SET_CYCLE * 1000, fade_data->end_us);
+
+            int next = fade_value_at(fade_data, fade_data->next_us);
+            int32_t duty_step = gamma_level_to_duty_q16(light, next) - gamma_level_to_duty_q16(light, fade_data->cur);
+
+            if ((light->dither_mask & BIT(channel)) && abs(duty_step) < (1 << 16)) {
+                /**< Less than one count this tick, nothing for the fader to ramp */
+                fade_dither_step(light, channel, fade_data, fade_data->cur);
+            } else {
+                _iot_set_fade_with_time(light->speed_mode, light->timer_num, channel, gamma_value_to_duty(light, next), fade_ms);
+            }
         }
+
+        _iot_update_duty(light->speed_mode, channel);
+
+        if (light->active_mask & BIT(channel)) {
+            deadline = MIN(deadline, fade_data->next_us);
+        }
+    }
+
+    return deadline;
+}
+
+/**
+ * @brief Service every instance and rearm the alarm for the earliest next deadline
+ *
+ * All instances share this one timer, the timer is stopped once no channel of
+ * any instance is left. g_fade_spinlock is held throughout, so an instance can
+ * not be deleted while it is serviced.
+ */
+static bool IRAM_ATTR fade_timercb(gptimer_handle_t timer,
+                                   const gptimer_alarm_event_data_t *edata,
+                                   void *user_ctx)
+{
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+    uint32_t cycles = esp_cpu_get_cycle_count();
+#endif
+    int64_t now = esp_timer_get_time();
+    int64_t deadline = INT64_MAX;
+    bool committed = false;
+
+    portENTER_CRITICAL_ISR(&g_fade_spinlock);
+
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+    fade_stats_enter(now);
+#endif
+
+    for (int i = 0; i < g_light_num; i++) {
+        deadline = MIN(deadline, fade_service(g_lights[i], now));
+    }
+
+    for (int i = 0; i < g_light_num; i++) {
+        committed |= __atomic_load_n(&g_lights[i]->commit, __ATOMIC_ACQUIRE) != NULL;
     }
-    if (idle_channel_num >= LEDC_CHANNEL_MAX) {
-        iot_timer_stop(&g_light_config->timer_id);
+
+    if (committed) {
+        /**< A bank was published while the channels were serviced */
+        iot_timer_set_alarm(&g_fade_timer, edata->count_value, 0);
+        g_fade_alarm_us = MAX(g_fade_alarm_us + FADE_ALARM_MIN_US, now);
+    } else if (deadline == INT64_MAX) {
+        iot_timer_stop(&g_fade_timer);
+    } else {
+        /**< An alarm already in the past fires as soon as it is set */
+        iot_timer_set_alarm(&g_fade_timer, edata->count_value, deadline - now);
+        g_fade_alarm_us = MAX(g_fade_alarm_us + MAX(deadline - now, FADE_ALARM_MIN_US), now);
     }
-    return false; 
+
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+    fade_stats_exit(esp_cpu_get_cycle_count() - cycles);
+#endif
+
+    portEXIT_CRITICAL_ISR(&g_fade_spinlock);
+
+    return false;
 }
 
-esp_err_t iot_led_init(ledc_timer_t timer_num,
-                       ledc_mode_t speed_mode,
-                       uint32_t freq_hz,
-                       ledc_clk_cfg_t clk_cfg,
-                       ledc_timer_bit_t duty_resolution)
+iot_led_handle_t iot_led_create(ledc_timer_t timer_num,
+                                ledc_mode_t speed_mode,
+                                uint32_t freq_hz,
+                                ledc_clk_cfg_t clk_cfg,
+                                ledc_timer_bit_t duty_resolution)
 {
     esp_err_t ret;
     const ledc_timer_config_t ledc_time_config = {
@@ -309,98 +864,443 @@ esp_err_t iot_led_init(ledc_timer_t timer_num,
         .freq_hz = freq_hz,
         .clk_cfg = clk_cfg,
     };
+    iot_light_t *light = NULL;
+
+    _lock_acquire(&g_light_lock);
+
+    /**< g_light_num only changes under g_light_lock, the slot checked here is the one taken below */
+    if (g_light_num >= IOT_LED_INSTANCE_MAX) {
+        ESP_LOGE(TAG, "At most %d instances", IOT_LED_INSTANCE_MAX);
+        goto EXIT;
+    }
+
+    /**< Reconfiguring a timer in use would silently retime the channels of its instance */
+    for (int i = 0; i < g_light_num; i++) {
+        if (g_lights[i]->timer_num == timer_num && g_lights[i]->speed_mode == speed_mode
+                && (g_lights[i]->freq_hz != freq_hz || g_lights[i]->duty_max != (0x1U << duty_resolution))) {
+            ESP_LOGE(TAG, "LEDC timer %d runs at %" PRIu32 " Hz, %" PRIu32 " steps for another instance",
+                     timer_num, g_lights[i]->freq_hz, g_lights[i]->duty_max);
+            goto EXIT;
+        }
+    }
+
     ret = ledc_timer_config(&ledc_time_config);
-    if (ret != ESP_OK) return ret;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "ledc_timer_config, ret: %d", ret);
+        goto EXIT;
+    }
 
-    if (!g_gamma_table) {
-        g_gamma_table = calloc(GAMMA_TABLE_SIZE + 1, sizeof(uint16_t));
-        gamma_table_create(g_gamma_table, GAMMA_CORRECTION);
+    light = calloc(1, sizeof(iot_light_t));
+    if (!light) {
+        ESP_LOGE(TAG, "iot_light_t alloc failed");
+        goto EXIT;
     }
-    if (!g_light_config) {
-        g_light_config = calloc(1, sizeof(iot_light_t));
-        g_light_config->timer_num = timer_num;
-        g_light_config->speed_mode = speed_mode;
-        iot_timer_create(&g_light_config->timer_id, true, DUTY_SET_CYCLE, fade_timercb);
+
+    light->timer_num = timer_num;
+    light->speed_mode = speed_mode;
+    light->freq_hz = freq_hz;
+    light->duty_max = 0x1U << duty_resolution;
+
+    /**< The fade timer is shared by all instances */
+    if (!g_fade_timer.handle) {
+        iot_timer_create(&g_fade_timer, false, DUTY_SET_CYCLE, fade_timercb);
     }
-    return ESP_OK;
+
+    portENTER_CRITICAL(&g_fade_spinlock);
+    g_lights[g_light_num++] = light;
+    portEXIT_CRITICAL(&g_fade_spinlock);
+
+EXIT:
+    _lock_release(&g_light_lock);
+
+    return (iot_led_handle_t)light;
 }
 
-esp_err_t iot_led_deinit()
+esp_err_t iot_led_delete(iot_led_handle_t handle)
 {
-    if (g_gamma_table) free(g_gamma_table);
-    if (g_light_config) {
-        if (g_light_config->timer_id.handle) {
-            gptimer_stop(g_light_config->timer_id.handle);
-            gptimer_disable(g_light_config->timer_id.handle);
-            gptimer_del_timer(g_light_config->timer_id.handle);
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    bool last = false;
+
+    _lock_acquire(&g_light_lock);
+    portENTER_CRITICAL(&g_fade_spinlock);
+
+    for (int i = 0; i < g_light_num; i++) {
+        if (g_lights[i] == light) {
+            g_lights[i] = g_lights[--g_light_num];
+            g_lights[g_light_num] = NULL;
+            break;
         }
-        free(g_light_config);
     }
+
+    last = (g_light_num == 0);
+
+    portEXIT_CRITICAL(&g_fade_spinlock);
+
+    if (last && g_fade_timer.handle) {
+        iot_timer_stop(&g_fade_timer);
+        gptimer_disable(g_fade_timer.handle);
+        gptimer_del_timer(g_fade_timer.handle);
+        g_fade_timer.handle = NULL;
+    }
+
+    _lock_release(&g_light_lock);
+
+    free(light);
+
     return ESP_OK;
 }
 
-esp_err_t iot_led_regist_channel(ledc_channel_t channel, gpio_num_t gpio_num)
+esp_err_t iot_led_regist_channel(iot_led_handle_t handle, ledc_channel_t channel, gpio_num_t gpio_num)
 {
-    if (!g_light_config) return ESP_ERR_INVALID_ARG;
+    LIGHT_PARAM_CHECK(handle);
+    LIGHT_PARAM_CHECK(channel < LEDC_CHANNEL_MAX);
+    iot_light_t *light = (iot_light_t *)handle;
+    esp_err_t ret = ESP_OK;
+
+    _lock_acquire(&g_light_lock);
+
+    for (int i = 0; i < g_light_num; i++) {
+        if (g_lights[i] != light && g_lights[i]->speed_mode == light->speed_mode
+                && (g_lights[i]->channel_mask & BIT(channel))) {
+            ESP_LOGW(TAG, "<%s> channel %d is used by another instance", esp_err_to_name(ESP_ERR_INVALID_STATE), channel);
+            ret = ESP_ERR_INVALID_STATE;
+            goto EXIT;
+        }
+    }
+
     const ledc_channel_config_t ledc_ch_config = {
         .gpio_num = gpio_num,
         .channel = channel,
         .intr_type = LEDC_INTR_DISABLE,
-        .speed_mode = g_light_config->speed_mode,
-        .timer_sel = g_light_config->timer_num,
+        .speed_mode = light->speed_mode,
+        .timer_sel = light->timer_num,
     };
-    return ledc_channel_config(&ledc_ch_config);
+    ret = ledc_channel_config(&ledc_ch_config);
+
+    if (ret == ESP_OK) {
+        light->channel_mask |= BIT(channel);
+    }
+
+EXIT:
+    _lock_release(&g_light_lock);
+
+    return ret;
 }
 
-esp_err_t iot_led_get_channel(ledc_channel_t channel, uint8_t *dst)
+esp_err_t iot_led_get_channel(iot_led_handle_t handle, ledc_channel_t channel, uint8_t *dst)
 {
-    if (!g_light_config || !dst) return ESP_ERR_INVALID_ARG;
-    int cur = g_light_config->fade_data[channel].cur;
-    *dst = FIXED_2_FLOATING(cur, LEDC_FIXED_Q);
+    if (!handle || !dst || channel >= LEDC_CHANNEL_MAX) return ESP_ERR_INVALID_ARG;
+    iot_light_t *light = (iot_light_t *)handle;
+    int cur = light->fade_data[channel].cur;
+    *dst = LEDC_LEVEL_TO_VALUE(cur);
     return ESP_OK;
 }
 
-esp_err_t iot_led_set_channel(ledc_channel_t channel, uint8_t value, uint32_t fade_ms)
+/**
+ * @brief Get a bank to fill, taking g_light_lock and entering g_fade_spinlock
+ *
+ * A bank the ISR has not taken yet is reclaimed and amended, so earlier targets
+ * of other channels are kept. Otherwise the bank the ISR did not take last is
+ * reused, it can not be in use by the ISR.
+ */
+static ledc_fade_bank_t *fade_bank_begin(iot_light_t *light)
 {
-    if (!g_light_config) return ESP_ERR_INVALID_ARG;
-    ledc_fade_data_t *fade_data = g_light_config->fade_data + channel;
-    fade_data->final = FLOATINT_2_FIXED(value, LEDC_FIXED_Q);
-    fade_data->num = 100;
-    fade_data->step = abs(fade_data->cur - fade_data->final) / fade_data->num;
-    if (fade_data->cur > fade_data->final) fade_data->step *= -1;
-    fade_data->cycle = 0;
-    if (!g_hw_timer_started) {
-        iot_timer_start(&g_light_config->timer_id);
+    _lock_acquire(&g_light_lock);
+    portENTER_CRITICAL(&g_fade_spinlock);
+
+    ledc_fade_bank_t *bank = __atomic_exchange_n(&light->commit, NULL, __ATOMIC_ACQUIRE);
+
+    if (!bank) {
+        bank = light->bank + light->free_bank;
+        light->free_bank ^= 1;
+        bank->mask = 0;
+        bank->effect.keyframe_num = 0;
     }
+
+    return bank;
+}
+
+/**
+ * @brief Publish a bank filled after fade_bank_begin(), leave g_fade_spinlock,
+ *     then kick the timer and release g_light_lock
+ *
+ * The gptimer calls stay out of the critical section, they are neither in IRAM
+ * nor quick.
+ */
+static void fade_bank_commit(iot_light_t *light, ledc_fade_bank_t *bank)
+{
+    __atomic_store_n(&light->commit, bank, __ATOMIC_RELEASE);
+    g_fade_alarm_us = esp_timer_get_time() + FADE_ALARM_MIN_US;
+
+    bool start = !g_hw_timer_started;
+    g_hw_timer_started = true;
+
+    portEXIT_CRITICAL(&g_fade_spinlock);
+
+    iot_timer_kick(&g_fade_timer, start);
+    _lock_release(&g_light_lock);
+}
+
+esp_err_t iot_led_set_channels(iot_led_handle_t handle, const iot_led_channel_target_t *targets, size_t num, uint32_t fade_ms)
+{
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(targets);
+    LIGHT_PARAM_CHECK(num <= LEDC_CHANNEL_MAX);
+
+    for (size_t i = 0; i < num; i++) {
+        LIGHT_PARAM_CHECK(targets[i].channel < LEDC_CHANNEL_MAX);
+    }
+
+    uint32_t duration_us = (fade_ms < UINT32_MAX / 1000) ? fade_ms * 1000 : UINT32_MAX;
+    uint32_t rate = fade_rate(duration_us);
+    ledc_fade_bank_t *bank = fade_bank_begin(light);
+
+    for (size_t i = 0; i < num; i++) {
+        ledc_fade_cmd_t *cmd = bank->cmd + targets[i].channel;
+        cmd->type        = LEDC_FADE_CMD_SET;
+        cmd->final       = LEDC_VALUE_TO_LEVEL(targets[i].value);
+        cmd->duration_us = duration_us;
+        cmd->rate        = rate;
+        bank->mask |= BIT(targets[i].channel);
+        light->effect_mask &= ~BIT(targets[i].channel);
+    }
+
+    fade_bank_commit(light, bank);
+
     return ESP_OK;
 }
 
-esp_err_t iot_led_start_blink(ledc_channel_t channel, uint8_t value,
+esp_err_t iot_led_set_channel(iot_led_handle_t handle, ledc_channel_t channel, uint8_t value, uint32_t fade_ms)
+{
+    const iot_led_channel_target_t target = {
+        .channel = channel,
+        .value   = value,
+    };
+
+    return iot_led_set_channels(handle, &target, 1, fade_ms);
+}
+
+esp_err_t iot_led_start_blink(iot_led_handle_t handle, ledc_channel_t channel, uint8_t value,
                               uint32_t period_ms, bool fade_flag)
 {
-    if (!g_light_config) return ESP_ERR_INVALID_ARG;
-    ledc_fade_data_t *fade_data = g_light_config->fade_data + channel;
-    fade_data->final = fade_data->cur = FLOATINT_2_FIXED(value, LEDC_FIXED_Q);
-    fade_data->cycle = period_ms / 2 / DUTY_SET_CYCLE;
-    fade_data->num = fade_flag ? period_ms / 2 / DUTY_SET_CYCLE : 0;
-    fade_data->step = fade_flag ? fade_data->cur / fade_data->num * -1 : 0;
-    if (!g_hw_timer_started) {
-        iot_timer_start(&g_light_config->timer_id);
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(channel < LEDC_CHANNEL_MAX);
+
+    uint32_t cycle_us = (period_ms < UINT32_MAX / 1000) ? period_ms * 1000 / 2 : UINT32_MAX / 2;
+    uint32_t cycle_rate = fade_rate(cycle_us);
+    ledc_fade_bank_t *bank = fade_bank_begin(light);
+    ledc_fade_cmd_t *cmd = bank->cmd + channel;
+
+    cmd->type        = LEDC_FADE_CMD_LOOP;
+    cmd->final       = LEDC_VALUE_TO_LEVEL(value);
+    cmd->duration_us = cycle_us;
+    cmd->rate        = cycle_rate;
+    cmd->fade_flag   = fade_flag;
+    bank->mask |= BIT(channel);
+    light->effect_mask &= ~BIT(channel);
+
+    fade_bank_commit(light, bank);
+
+    return ESP_OK;
+}
+
+esp_err_t iot_led_stop_blink(iot_led_handle_t handle, ledc_channel_t channel)
+{
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(channel < LEDC_CHANNEL_MAX);
+
+    /**< Freeze the channel at its current value, a running fade is stopped as well */
+    ledc_fade_bank_t *bank = fade_bank_begin(light);
+    bank->cmd[channel].type = LEDC_FADE_CMD_FREEZE;
+    bank->mask |= BIT(channel);
+    light->effect_mask &= ~BIT(channel);
+    fade_bank_commit(light, bank);
+
+    return ESP_OK;
+}
+
+esp_err_t iot_led_start_effect(iot_led_handle_t handle, const iot_led_effect_t *effect)
+{
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(effect && effect->keyframes);
+    LIGHT_PARAM_CHECK(effect->keyframe_num > 0 && effect->keyframe_num <= IOT_LED_EFFECT_KEYFRAME_MAX);
+    LIGHT_PARAM_CHECK(effect->channel_num > 0 && effect->channel_num <= IOT_LED_EFFECT_CHANNEL_MAX);
+
+    uint64_t total_us = 0;
+
+    for (int i = 0; i < effect->keyframe_num; i++) {
+        total_us += effect->keyframes[i].duration_us;
+    }
+
+    for (int i = 0; i < effect->channel_num; i++) {
+        LIGHT_PARAM_CHECK(effect->channels[i] < LEDC_CHANNEL_MAX);
+    }
+
+    /**< The ISR would never catch up with a loop that takes no time */
+    LIGHT_PARAM_CHECK(total_us > 0);
+
+    ledc_fade_bank_t *bank = fade_bank_begin(light);
+
+    /**< Channels left from the previous effect stop where they are */
+    for (uint32_t pending = light->effect_mask; pending; pending &= pending - 1) {
+        int channel = __builtin_ctz(pending);
+        bank->cmd[channel].type = LEDC_FADE_CMD_FREEZE;
+        bank->mask |= BIT(channel);
+    }
+
+    light->effect_mask = 0;
+
+    for (int i = 0; i < effect->channel_num; i++) {
+        ledc_fade_cmd_t *cmd = bank->cmd + effect->channels[i];
+        cmd->type   = LEDC_FADE_CMD_EFFECT;
+        cmd->column = i;
+        bank->mask |= BIT(effect->channels[i]);
+        light->effect_mask |= BIT(effect->channels[i]);
+    }
+
+    memcpy(bank->effect.keyframes, effect->keyframes, effect->keyframe_num * sizeof(iot_led_keyframe_t));
+    bank->effect.keyframe_num = effect->keyframe_num;
+    bank->effect.repeat       = effect->repeat;
+
+    fade_bank_commit(light, bank);
+
+    return ESP_OK;
+}
+
+esp_err_t iot_led_stop_effect(iot_led_handle_t handle)
+{
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+
+    ledc_fade_bank_t *bank = fade_bank_begin(light);
+
+    for (uint32_t pending = light->effect_mask; pending; pending &= pending - 1) {
+        int channel = __builtin_ctz(pending);
+        bank->cmd[channel].type = LEDC_FADE_CMD_FREEZE;
+        bank->mask |= BIT(channel);
     }
+
+    light->effect_mask = 0;
+    fade_bank_commit(light, bank);
+
     return ESP_OK;
 }
 
-esp_err_t iot_led_stop_blink(ledc_channel_t channel)
+esp_err_t iot_led_set_fade_mode(iot_led_handle_t handle, iot_led_fade_mode_t mode)
 {
-    LIGHT_ERROR_CHECK(g_light_config == NULL, ESP_ERR_INVALID_ARG, "iot_led_init() must be called first");
-    ledc_fade_data_t *fade_data = g_light_config->fade_data + channel;
-    fade_data->cycle = fade_data->num = 0;
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(mode == IOT_LED_FADE_SOFTWARE || mode == IOT_LED_FADE_HARDWARE);
+
+    portENTER_CRITICAL(&g_fade_spinlock);
+    light->fade_mode = mode;
+    portEXIT_CRITICAL(&g_fade_spinlock);
 
     return ESP_OK;
 }
+
+esp_err_t iot_led_set_dither(iot_led_handle_t handle, ledc_channel_t channel, bool enable)
+{
+    LIGHT_PARAM_CHECK(handle);
+    iot_light_t *light = (iot_light_t *)handle;
+    LIGHT_PARAM_CHECK(channel < LEDC_CHANNEL_MAX);
+
+    portENTER_CRITICAL(&g_fade_spinlock);
+
+    if (enable) {
+        light->dither_mask |= BIT(channel);
+    } else {
+        light->dither_mask &= ~BIT(channel);
+    }
+
+    portEXIT_CRITICAL(&g_fade_spinlock);
+
+    return ESP_OK;
+}
+
 esp_err_t iot_led_set_gamma_table(const uint16_t gamma_table[GAMMA_TABLE_SIZE])
 {
-    LIGHT_ERROR_CHECK(g_gamma_table == NULL, ESP_ERR_INVALID_ARG, "iot_led_init() must be called first");
-    memcpy(g_gamma_table, gamma_table, GAMMA_TABLE_SIZE * sizeof(uint16_t));
+    LIGHT_PARAM_CHECK(gamma_table);
+    g_gamma_table = gamma_table;
+    return ESP_OK;
+}
+
+uint16_t iot_led_value_to_duty(uint8_t value)
+{
+    return gamma_level_to_q16(LEDC_VALUE_TO_LEVEL(value));
+}
+
+uint8_t iot_led_duty_to_value(uint16_t duty)
+{
+    int low = 0;
+    int high = UINT8_MAX;
+
+    /**< Lowest value reaching the duty, the curve is monotonic */
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (gamma_level_to_q16(LEDC_VALUE_TO_LEVEL(mid)) < duty) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low && duty - gamma_level_to_q16(LEDC_VALUE_TO_LEVEL(low - 1))
+            < gamma_level_to_q16(LEDC_VALUE_TO_LEVEL(low)) - duty) {
+        low--;
+    }
+
+    return low;
+}
+
+esp_err_t iot_led_get_stats(iot_led_stats_t *stats, bool reset)
+{
+#ifdef CONFIG_LIGHT_DRIVER_FADE_STATS
+    LIGHT_PARAM_CHECK(stats);
+
+    portENTER_CRITICAL(&g_fade_spinlock);
+
+    memcpy(stats, &g_fade_stats, sizeof(iot_led_stats_t));
+
+    if (reset) {
+        memset(&g_fade_stats, 0, sizeof(iot_led_stats_t));
+    }
+
+    portEXIT_CRITICAL(&g_fade_spinlock);
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t iot_led_print_stats(void)
+{
+    iot_led_stats_t stats;
+    esp_err_t ret = iot_led_get_stats(&stats, false);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    printf("fade isr: %" PRIu32 " calls, %" PRIu32 " late, %" PRIu32 " ticks dropped\n",
+           stats.isr_count, stats.late_count, stats.dropped_ticks);
+    printf("fade isr: max %" PRIu32 " cycles, max %" PRIu32 " us latency\n",
+           stats.cycles_max, stats.latency_max_us);
+    printf("%10s %10s %10s\n", "from", "cycles", "latency us");
+
+    for (int i = 0; i < IOT_LED_STATS_BUCKETS; i++) {
+        if (stats.cycles_hist[i] || stats.latency_hist[i]) {
+            printf("%10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n",
+                   i ? (uint32_t)1 << i : 0, stats.cycles_hist[i], stats.latency_hist[i]);
+        }
+    }
+
     return ESP_OK;
 }
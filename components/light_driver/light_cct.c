@@ -0,0 +1,191 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "light_cct.h"
+
+/**
+ * Two white channels mix to the chromaticities on the line between their
+ * own. The table holds, for colour temperatures evenly spaced in mired, the
+ * duties putting the mix on that temperature with the same flux everywhere.
+ * Mired is close to perceptually uniform, so linear interpolation between
+ * entries stays on the line to well below a visible step.
+ */
+
+#define CCT_MIRED_Q8_PER_KELVIN (256UL * 1000000)   /**< Mired in Q8 is this over the kelvin */
+#define CCT_BISECT_STEPS        (32)
+
+/**
+ * @brief Correlated colour temperature of a chromaticity in mired, McCamy's approximation
+ */
+static double cct_mired(double x, double y)
+{
+    double n = (x - 0.3320) / (y - 0.1858);
+    double kelvin = ((-449.0 * n + 3525.0) * n - 6823.3) * n + 5520.33;
+
+    return 1000000.0 / kelvin;
+}
+
+esp_err_t light_cct_table_init(const light_cct_calibration_t *calibration, light_cct_table_t *table)
+{
+    if (!calibration || !table || !calibration->warm_y || !calibration->cold_y
+            || !calibration->warm_flux || !calibration->cold_flux) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    double warm_x = (double)calibration->warm_x / LIGHT_CCT_CHROMA_SCALE;
+    double warm_y = (double)calibration->warm_y / LIGHT_CCT_CHROMA_SCALE;
+    double cold_x = (double)calibration->cold_x / LIGHT_CCT_CHROMA_SCALE;
+    double cold_y = (double)calibration->cold_y / LIGHT_CCT_CHROMA_SCALE;
+    double warm_mired = cct_mired(warm_x, warm_y);
+    double cold_mired = cct_mired(cold_x, cold_y);
+
+    if (cold_mired < 1000000.0 / LIGHT_CCT_KELVIN_MAX || warm_mired > 1000000.0 / LIGHT_CCT_KELVIN_MIN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /**< Keep the ends inside the line, rounding the range inwards */
+    table->mired_min = (uint16_t)cold_mired + 1;
+    table->mired_max = (uint16_t)warm_mired;
+
+    if (table->mired_max <= table->mired_min) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    table->index_scale = ((LIGHT_CCT_TABLE_SIZE - 1) << 16) / (table->mired_max - table->mired_min);
+
+    double cold_share[LIGHT_CCT_TABLE_SIZE];
+    double flux = calibration->rated_flux ? calibration->rated_flux : UINT16_MAX;
+    double flux_max = UINT16_MAX;
+
+    for (int i = 0; i < LIGHT_CCT_TABLE_SIZE; i++) {
+        double mired = table->mired_min + (double)(table->mired_max - table->mired_min) * i / (LIGHT_CCT_TABLE_SIZE - 1);
+        double warm_end = 0.0;
+        double cold_end = 1.0;
+
+        /**< Fraction of the way from the warm to the cold chromaticity, mired falls along it */
+        for (int step = 0; step < CCT_BISECT_STEPS; step++) {
+            double a = (warm_end + cold_end) / 2;
+
+            if (cct_mired(warm_x + a * (cold_x - warm_x), warm_y + a * (cold_y - warm_y)) > mired) {
+                warm_end = a;
+            } else {
+                cold_end = a;
+            }
+        }
+
+        /**< The mix weighs each chromaticity by X + Y + Z, flux over y */
+        double a = (warm_end + cold_end) / 2;
+        cold_share[i] = a * cold_y / (a * cold_y + (1.0 - a) * warm_y);
+
+        flux_max = MIN(flux_max, calibration->warm_flux / (1.0 - cold_share[i]));
+        flux_max = MIN(flux_max, calibration->cold_flux / cold_share[i]);
+    }
+
+    flux = MIN(flux, flux_max);
+    table->flux = (uint16_t)flux;
+
+    for (int i = 0; i < LIGHT_CCT_TABLE_SIZE; i++) {
+        double warm = (1.0 - cold_share[i]) * flux / calibration->warm_flux;
+        double cold = cold_share[i] * flux / calibration->cold_flux;
+
+        table->warm[i] = (uint16_t)(MIN(warm, 1.0) * UINT16_MAX + 0.5);
+        table->cold[i] = (uint16_t)(MIN(cold, 1.0) * UINT16_MAX + 0.5);
+    }
+
+    return ESP_OK;
+}
+
+void light_cct_mix(const light_cct_table_t *table, uint16_t kelvin, uint16_t *warm, uint16_t *cold)
+{
+    kelvin = MAX(kelvin, LIGHT_CCT_KELVIN_MIN);
+
+    uint32_t mired_q8 = (CCT_MIRED_Q8_PER_KELVIN + kelvin / 2) / kelvin;
+    mired_q8 = MAX(mired_q8, (uint32_t)table->mired_min << 8);
+
+    if (mired_q8 >= (uint32_t)table->mired_max << 8) {
+        *warm = table->warm[LIGHT_CCT_TABLE_SIZE - 1];
+        *cold = table->cold[LIGHT_CCT_TABLE_SIZE - 1];
+        return;
+    }
+
+    /**< Q24 entries, below (LIGHT_CCT_TABLE_SIZE - 1) << 24 */
+    uint32_t pos = (mired_q8 - ((uint32_t)table->mired_min << 8)) * table->index_scale;
+    uint32_t index = pos >> 24;
+    uint32_t frac = (pos >> 8) & 0xffff;
+
+    *warm = table->warm[index] + (((int64_t)table->warm[index + 1] - table->warm[index]) * frac >> 16);
+    *cold = table->cold[index] + (((int64_t)table->cold[index + 1] - table->cold[index]) * frac >> 16);
+}
+
+void light_cct_unmix(const light_cct_table_t *table, uint16_t warm, uint16_t cold, uint16_t *kelvin, uint16_t *duty)
+{
+    uint32_t total = (uint32_t)warm + cold;
+
+    if (!total) {
+        *duty = 0;
+        return;
+    }
+
+    /**< The cold share of the duties falls from the first entry to the last */
+    int low = 0;
+    int high = LIGHT_CCT_TABLE_SIZE - 1;
+
+#define CCT_COLDER_THAN(i) ((uint64_t)table->cold[i] * total > (uint64_t)cold * ((uint32_t)table->warm[i] + table->cold[i]))
+
+    if (!CCT_COLDER_THAN(low)) {
+        high = low;
+    } else if (CCT_COLDER_THAN(high)) {
+        low = high;
+    } else {
+        while (high - low > 1) {
+            int mid = (low + high) / 2;
+
+            if (CCT_COLDER_THAN(mid)) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+    }
+
+#undef CCT_COLDER_THAN
+
+    uint32_t share = ((uint64_t)cold << 16) / total;
+    uint32_t share_low = ((uint32_t)table->cold[low] << 16) / ((uint32_t)table->warm[low] + table->cold[low]);
+    uint32_t share_high = ((uint32_t)table->cold[high] << 16) / ((uint32_t)table->warm[high] + table->cold[high]);
+    uint32_t frac = (share_low > share_high) ? ((uint64_t)(share_low - MIN(share, share_low)) << 16) / (share_low - share_high) : 0;
+    frac = MIN(frac, 0xffff);
+
+    int32_t full_low = (int32_t)table->warm[low] + table->cold[low];
+    int32_t full_high = (int32_t)table->warm[high] + table->cold[high];
+    uint32_t full = full_low + (((int64_t)full_high - full_low) * frac >> 16);
+    uint32_t pos = ((uint32_t)low << 24) + (frac << 8);
+    uint32_t mired_q8 = ((uint32_t)table->mired_min << 8) + (pos + table->index_scale / 2) / table->index_scale;
+
+    *kelvin = (CCT_MIRED_Q8_PER_KELVIN + mired_q8 / 2) / mired_q8;
+    *duty = MIN(((uint64_t)total << 16) / full, UINT16_MAX);
+}
+
+uint16_t light_cct_kelvin_min(const light_cct_table_t *table)
+{
+    return (1000000UL + table->mired_max / 2) / table->mired_max;
+}
+
+uint16_t light_cct_kelvin_max(const light_cct_table_t *table)
+{
+    return (1000000UL + table->mired_min / 2) / table->mired_min;
+}
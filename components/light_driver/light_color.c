@@ -0,0 +1,112 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+
+#include "light_color.h"
+
+/**
+ * Within a 60 degree sector of the hue circle one channel is at the value,
+ * one at the value less the chroma, and the third ramps linearly between
+ * them. The tables below hold which channel plays which role in each sector,
+ * so both conversions are a lookup and one integer division.
+ */
+
+enum {
+    COLOR_ROLE_MAX = 0,     /**< At the value */
+    COLOR_ROLE_MIN,         /**< At the value less the chroma */
+    COLOR_ROLE_RISE,        /**< From MIN to MAX along the sector */
+    COLOR_ROLE_FALL,        /**< From MAX to MIN along the sector */
+};
+
+enum {
+    COLOR_RED = 0,
+    COLOR_GREEN,
+    COLOR_BLUE,
+};
+
+/**< Role of red, green and blue in each sector */
+static const uint8_t g_sector_roles[6][3] = {
+    {COLOR_ROLE_MAX,  COLOR_ROLE_RISE, COLOR_ROLE_MIN},     /**< Red to yellow */
+    {COLOR_ROLE_FALL, COLOR_ROLE_MAX,  COLOR_ROLE_MIN},     /**< Yellow to green */
+    {COLOR_ROLE_MIN,  COLOR_ROLE_MAX,  COLOR_ROLE_RISE},    /**< Green to cyan */
+    {COLOR_ROLE_MIN,  COLOR_ROLE_FALL, COLOR_ROLE_MAX},     /**< Cyan to blue */
+    {COLOR_ROLE_RISE, COLOR_ROLE_MIN,  COLOR_ROLE_MAX},     /**< Blue to magenta */
+    {COLOR_ROLE_MAX,  COLOR_ROLE_MIN,  COLOR_ROLE_FALL},    /**< Magenta to red */
+};
+
+/**
+ * Sector of a colour from its largest and smallest channel, bit 3 is set if
+ * the third channel falls along it
+ */
+#define SECTOR_FALL (0x08)
+
+static const uint8_t g_sector_of[3][3] = {
+    [COLOR_RED]   = {[COLOR_GREEN] = 5 | SECTOR_FALL, [COLOR_BLUE] = 0},
+    [COLOR_GREEN] = {[COLOR_RED] = 2, [COLOR_BLUE] = 1 | SECTOR_FALL},
+    [COLOR_BLUE]  = {[COLOR_RED] = 3 | SECTOR_FALL, [COLOR_GREEN] = 4},
+};
+
+void light_color_hsv_to_rgb(const light_color_hsv_t *hsv, light_color_rgb_t *rgb)
+{
+    uint32_t hue = hsv->hue % LIGHT_COLOR_HUE_MAX;
+    uint32_t sector = hue / LIGHT_COLOR_HUE_SECTOR;
+    uint32_t offset = hue - sector * LIGHT_COLOR_HUE_SECTOR;
+    uint32_t value = hsv->value;
+    uint32_t chroma = (value * hsv->saturation + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX;
+    uint32_t ramp = (chroma * offset + LIGHT_COLOR_HUE_SECTOR / 2) / LIGHT_COLOR_HUE_SECTOR;
+
+    const uint16_t level[] = {
+        [COLOR_ROLE_MAX]  = value,
+        [COLOR_ROLE_MIN]  = value - chroma,
+        [COLOR_ROLE_RISE] = value - chroma + ramp,
+        [COLOR_ROLE_FALL] = value - ramp,
+    };
+    const uint8_t *roles = g_sector_roles[sector];
+
+    rgb->red   = level[roles[COLOR_RED]];
+    rgb->green = level[roles[COLOR_GREEN]];
+    rgb->blue  = level[roles[COLOR_BLUE]];
+}
+
+void light_color_rgb_to_hsv(const light_color_rgb_t *rgb, light_color_hsv_t *hsv)
+{
+    const uint16_t channel[] = {rgb->red, rgb->green, rgb->blue};
+    int max = (channel[COLOR_GREEN] > channel[COLOR_RED]) ? COLOR_GREEN : COLOR_RED;
+    int min = (channel[COLOR_GREEN] > channel[COLOR_RED]) ? COLOR_RED : COLOR_GREEN;
+
+    max = (channel[COLOR_BLUE] > channel[max]) ? COLOR_BLUE : max;
+    min = (channel[COLOR_BLUE] < channel[min]) ? COLOR_BLUE : min;
+
+    uint32_t value = channel[max];
+    uint32_t delta = value - channel[min];
+
+    hsv->value = value;
+
+    if (!delta) {
+        hsv->hue = 0;
+        hsv->saturation = 0;
+        return;
+    }
+
+    /**< With two channels equal, the third is the one left out of max and min */
+    uint8_t sector = g_sector_of[max][min];
+    uint32_t mid = channel[3 - max - min];
+    uint32_t ramp = (sector & SECTOR_FALL) ? value - mid : mid - channel[min];
+    uint32_t hue = (sector & ~SECTOR_FALL) * LIGHT_COLOR_HUE_SECTOR
+                   + (ramp * LIGHT_COLOR_HUE_SECTOR + delta / 2) / delta;
+
+    hsv->hue = (hue < LIGHT_COLOR_HUE_MAX) ? hue : hue - LIGHT_COLOR_HUE_MAX;
+    hsv->saturation = (delta * LIGHT_COLOR_MAX + value / 2) / value;
+}
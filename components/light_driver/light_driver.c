@@ -14,29 +14,64 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include <time.h>
 
 #include "esp_log.h"
+#include "esp_bit_defs.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
 
 #include "light_driver.h"
+#include "light_color.h"
+#include "light_cct.h"
+#include "light_queue.h"
+#include "light_scene.h"
+#include "light_schedule.h"
+#include "light_power.h"
+#include "light_status.h"
 #include "app_storage.h"
+#ifdef CONFIG_LIGHT_DRIVER_STATUS_JOURNAL
+#include "app_storage_journal.h"
+#endif
 
 /**
- * @brief The state of the five-color light
+ * @brief Colour attributes of both modes at the precision of light_color
  */
 typedef struct {
-    uint8_t mode;
-    uint8_t on;
-    uint16_t hue;
-    uint8_t saturation;
-    uint8_t value;
-    uint8_t color_temperature;
-    uint8_t brightness;
-    uint32_t fade_period_ms;
-    uint32_t blink_period_ms;
-} light_status_t;
+    uint16_t hue;               /**< 1/LIGHT_COLOR_HUE_SCALE degree, 0 ~ LIGHT_COLOR_HUE_MAX */
+    uint16_t saturation;        /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t value;             /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t brightness;        /**< 0 ~ LIGHT_COLOR_MAX */
+    uint16_t kelvin;
+} light_state_t;
+
+/**
+ * @brief Where the light is and where it is fading to, kept by the control task
+ *
+ * @note This is the reference for every change of the light: a fade starts
+ *     from the state the running one has reached, and a stopped fade is left
+ *     where the model says it is, instead of reading the 8-bit channels back
+ *     and inverting the colour maths
+ */
+typedef struct {
+    light_state_t from;         /**< State at start_us */
+    light_state_t to;           /**< State the fade ends on, g_light_status at full precision */
+    int64_t start_us;
+    uint32_t duration_us;       /**< 0 once settled on to */
+} light_model_t;
+
+/**
+ * @brief Points of the running schedule, as saved
+ */
+typedef struct {
+    uint8_t num;
+    light_schedule_point_t points[LIGHT_SCHEDULE_POINT_MAX];
+} light_schedule_store_t;
 
 /**
  * @brief The channel of the five-color light
@@ -50,275 +85,2143 @@ enum light_channel {
 };
 
 #define LIGHT_STATUS_STORE_KEY   "light_status"
+#define LIGHT_CCT_STORE_KEY      "light_cct_cal"
+#define LIGHT_SCENE_STORE_KEY    "light_scenes"
+#define LIGHT_SCHEDULE_STORE_KEY "light_sched"
+#define LIGHT_SCHEDULE_YEAR_MIN  (2020)      /**< The clock is taken as not set before this year */
 #define LIGHT_FADE_PERIOD_MAX_MS (3 * 1000)
+#define LIGHT_DIM_MIN_PERCENT    (1)         /**< Dimming down stops here, it never turns the light off */
+#define LIGHT_STORE_TASK_STACK   (3 * 1024)
+#define LIGHT_STORE_TASK_PRIO    (tskIDLE_PRIORITY + 1)
+#define LIGHT_STORE_RETRY_MIN_MS (100)       /**< First retry of a failed save with no quiet period */
+#define LIGHT_STORE_RETRY_MAX_MS (60 * 1000) /**< Backoff of a save failing again and again */
+#define LIGHT_CTRL_TASK_STACK    (3 * 1024)
+#define LIGHT_CTRL_TASK_PRIO     (tskIDLE_PRIORITY + 5)
+
+#define LIGHT_PERCENT_TO_COLOR(x) (((uint32_t)(x) * LIGHT_COLOR_MAX + 50) / 100)
+#define LIGHT_COLOR_TO_PERCENT(x) (((uint32_t)(x) * 100 + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX)
+#define LIGHT_COLOR_TO_VALUE(x)   (((uint32_t)(x) * 255 + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX)
+#define LIGHT_KELVIN_TO_MIRED_Q8(x) ((256000000UL + (x) / 2) / (x))     /**< Its own inverse */
 
 static const char *TAG               = "light_driver";
 static light_status_t g_light_status = {0};
 static bool g_light_blink_flag       = false;
-static TimerHandle_t g_fade_timer    = NULL;
-static int g_fade_mode               = MODE_NONE;
-static uint16_t g_fade_hue           = 0;
+static iot_led_handle_t g_led        = NULL;
+static light_cct_table_t g_light_cct = {0};   /**< Warm and cold duties of the fixture over its colour temperatures */
+static light_model_t g_light_model   = {0};
+static bool g_light_dimming          = false;   /**< The model is on the ramp of light_driver_dim_start() */
+static light_schedule_t *g_light_schedule = NULL;   /**< Followed by the control task, NULL if none */
+static TickType_t g_light_schedule_tick   = 0;      /**< Tick of the last evaluation */
+
+/**< Nominal 2700 K and 6500 K channels of equal flux, for fixtures never calibrated */
+static const light_cct_calibration_t g_light_cct_nominal = {
+    .warm_x = 4578, .warm_y = 4101,
+    .cold_x = 3127, .cold_y = 3290,
+    .warm_flux = 1000, .cold_flux = 1000,
+};
 
-esp_err_t light_driver_init(light_driver_config_t *config)
+static light_status_t g_light_status_stored = {0};    /**< What the flash holds */
+#ifdef CONFIG_LIGHT_DRIVER_STATUS_JOURNAL
+static app_storage_journal_t *g_light_journal = NULL; /**< NULL if the state is kept in app_storage */
+#endif
+static bool g_light_store_dirty             = false;
+static bool g_light_scene_dirty             = false;
+static bool g_light_schedule_dirty          = false;
+static TickType_t g_light_store_dirty_tick  = 0;      /**< Tick of the oldest unsaved change */
+static TaskHandle_t g_light_store_task      = NULL;
+static portMUX_TYPE g_light_store_lock      = portMUX_INITIALIZER_UNLOCKED;
+
+/**< Written by the control task under g_light_store_lock, read by it without */
+static light_scene_t g_light_scenes[CONFIG_LIGHT_DRIVER_SCENE_NUM] = {0};
+
+/**< Points of the last schedule started, under g_light_store_lock, num is 0 once it is stopped */
+static light_schedule_store_t g_light_schedule_store = {0};
+
+/**< Only the control task drives the channels, the stats are also read by light_driver_get_power_stats() */
+static light_power_config_t g_light_power      = {0};  /**< Budget of the fixture, 0 for no limit */
+static light_power_stats_t g_light_power_stats = {0};
+static bool g_light_power_limited              = false; /**< The last output was scaled down */
+static uint8_t g_light_channels[LIGHT_POWER_CHANNEL_NUM] = {0};  /**< Target asked of each channel */
+static uint8_t g_light_output[LIGHT_POWER_CHANNEL_NUM]   = {0};  /**< Target each channel was given */
+static portMUX_TYPE g_light_power_lock         = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(CHANNEL_ID_COLD + 1 == LIGHT_POWER_CHANNEL_NUM, "the power limiter covers every channel");
+
+/**< Effect columns are red, green, blue, warm and cold */
+static const iot_led_keyframe_t g_color_loop_keyframes[] = {
+    IOT_LED_KEYFRAME_FADE(2000, 255, 0, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 255, 255, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 0, 255, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 0, 255, 255, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 0, 0, 255, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 255, 0, 255, 0, 0),
+};
+
+static const iot_led_keyframe_t g_candle_keyframes[] = {
+    IOT_LED_KEYFRAME_FADE(120, 40, 0, 0, 230, 0),
+    IOT_LED_KEYFRAME_FADE(80, 30, 0, 0, 180, 0),
+    IOT_LED_KEYFRAME_FADE(200, 45, 0, 0, 250, 0),
+    IOT_LED_KEYFRAME_FADE(60, 35, 0, 0, 200, 0),
+    IOT_LED_KEYFRAME_FADE(150, 40, 0, 0, 240, 0),
+    IOT_LED_KEYFRAME_FADE(90, 25, 0, 0, 160, 0),
+    IOT_LED_KEYFRAME_FADE(250, 42, 0, 0, 235, 0),
+    IOT_LED_KEYFRAME_FADE(70, 38, 0, 0, 210, 0),
+    IOT_LED_KEYFRAME_FADE(180, 45, 0, 0, 255, 0),
+    IOT_LED_KEYFRAME_FADE(100, 30, 0, 0, 190, 0),
+};
+
+static const iot_led_keyframe_t g_sunrise_keyframes[] = {
+    IOT_LED_KEYFRAME_FADE(120 * 1000, 30, 0, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(180 * 1000, 120, 20, 0, 40, 0),
+    IOT_LED_KEYFRAME_FADE(300 * 1000, 60, 10, 0, 200, 30),
+    IOT_LED_KEYFRAME_FADE(300 * 1000, 0, 0, 0, 200, 255),
+};
+
+static const iot_led_keyframe_t g_strobe_keyframes[] = {
+    IOT_LED_KEYFRAME_STEP(30, 0, 0, 0, 255, 255),
+    IOT_LED_KEYFRAME_STEP(70, 0, 0, 0, 0, 0),
+};
+
+static const iot_led_effect_t g_light_effects[LIGHT_EFFECT_MAX] = {
+#define LIGHT_EFFECT(frames, times) { \
+        .keyframes = frames, \
+        .keyframe_num = sizeof(frames) / sizeof(frames[0]), \
+        .channel_num = 5, \
+        .channels = {CHANNEL_ID_RED, CHANNEL_ID_GREEN, CHANNEL_ID_BLUE, CHANNEL_ID_WARM, CHANNEL_ID_COLD}, \
+        .repeat = times, \
+    }
+    [LIGHT_EFFECT_COLOR_LOOP] = LIGHT_EFFECT(g_color_loop_keyframes, 0),
+    [LIGHT_EFFECT_CANDLE]     = LIGHT_EFFECT(g_candle_keyframes, 0),
+    [LIGHT_EFFECT_SUNRISE]    = LIGHT_EFFECT(g_sunrise_keyframes, 1),
+    [LIGHT_EFFECT_STROBE]     = LIGHT_EFFECT(g_strobe_keyframes, 0),
+#undef LIGHT_EFFECT
+};
+
+static esp_err_t light_driver_control_init(void);
+static void light_driver_control_deinit(void);
+
+/**
+ * @brief Encode the light state and write it to its journal, or to app_storage without one
+ */
+static esp_err_t light_driver_status_save(const light_status_t *status)
 {
-    LIGHT_PARAM_CHECK(config);
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX];
+    size_t size = sizeof(record);
 
-    memset(&g_light_status, 0, sizeof(light_status_t));
+    esp_err_t ret = light_status_encode(status, record, &size);
+    LIGHT_ERROR_CHECK(ret != ESP_OK, ret, "light_status_encode, ret: %d", ret);
 
-    if (app_storage_get(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t)) != ESP_OK) {
-        ESP_LOGE(TAG, "Load light status failed");
-        memset(&g_light_status, 0, sizeof(light_status_t));
-        g_light_status.mode              = MODE_HSV;
-        g_light_status.on                = 1;
-        g_light_status.hue               = 360;
-        g_light_status.saturation        = 0;
-        g_light_status.value             = 100;
-        g_light_status.color_temperature = 0;
-        g_light_status.brightness        = 30;
-        g_light_status.fade_period_ms  = config->fade_period_ms;
-        g_light_status.blink_period_ms = config->blink_period_ms;
+#ifdef CONFIG_LIGHT_DRIVER_STATUS_JOURNAL
+    if (g_light_journal) {
+        return app_storage_journal_append(g_light_journal, record, size);
     }
+#endif
 
-    iot_led_init(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, config->freq_hz, config->clk_cfg, config->duty_resolution);
+    return app_storage_set(LIGHT_STATUS_STORE_KEY, record, size);
+}
 
-    iot_led_regist_channel(CHANNEL_ID_RED, config->gpio_red);
-    iot_led_regist_channel(CHANNEL_ID_GREEN, config->gpio_green);
-    iot_led_regist_channel(CHANNEL_ID_BLUE, config->gpio_blue);
-    iot_led_regist_channel(CHANNEL_ID_WARM, config->gpio_warm);
-    iot_led_regist_channel(CHANNEL_ID_COLD, config->gpio_cold);
+/**
+ * @brief Read the light state from its journal, or from app_storage if the journal has none
+ *
+ * @note A state saved by an older version is migrated, and saved in the
+ *     current encoding on its next change
+ */
+static esp_err_t light_driver_status_load(light_status_t *status)
+{
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX] = {0};
+    size_t length = sizeof(record);
 
-    ESP_LOGD(TAG, "hue: %d, saturation: %d, value: %d",
-             g_light_status.hue, g_light_status.saturation, g_light_status.value);
-    ESP_LOGD(TAG, "brightness: %d, color_temperature: %d",
-             g_light_status.brightness, g_light_status.color_temperature);
+#ifdef CONFIG_LIGHT_DRIVER_STATUS_JOURNAL
+
+    if (!g_light_journal && app_storage_journal_open(CONFIG_LIGHT_DRIVER_STATUS_JOURNAL_LABEL, &g_light_journal) != ESP_OK) {
+        ESP_LOGW(TAG, "No partition %s, the light state is kept in app_storage", CONFIG_LIGHT_DRIVER_STATUS_JOURNAL_LABEL);
+    }
+
+    if (g_light_journal && app_storage_journal_read(g_light_journal, record, &length) == ESP_OK) {
+        return light_status_decode(status, record, length);
+    }
+
+    /**< A state saved before the journal, it moves there on its first change */
+#endif
+
+    /**< The record is self-delimiting, or a raw state the zeroed buffer pads */
+    esp_err_t ret = app_storage_get(LIGHT_STATUS_STORE_KEY, record, length);
+    return (ret == ESP_OK) ? light_status_decode(status, record, length) : ret;
+}
+
+/**
+ * @brief Save the light state if it differs from what the flash holds
+ */
+static esp_err_t light_driver_flush_status(void)
+{
+    esp_err_t ret = ESP_OK;
+    light_status_t status;
+
+    portENTER_CRITICAL(&g_light_store_lock);
+
+    if (!g_light_store_dirty) {
+        portEXIT_CRITICAL(&g_light_store_lock);
+        return ESP_OK;
+    }
+
+    /**< A setter racing the copy marks the state dirty again after it */
+    g_light_store_dirty = false;
+    status = g_light_status;
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    if (!memcmp(&status, &g_light_status_stored, sizeof(light_status_t))) {
+        return ESP_OK;
+    }
+
+    ret = light_driver_status_save(&status);
+
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&g_light_store_lock);
+        g_light_store_dirty = true;
+        portEXIT_CRITICAL(&g_light_store_lock);
+    }
+
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_status_save, ret: %d", ret);
+
+    g_light_status_stored = status;
 
     return ESP_OK;
 }
 
-esp_err_t light_driver_deinit()
+/**
+ * @brief Save the scene table as one blob if a scene changed
+ */
+static esp_err_t light_driver_flush_scenes(void)
+{
+    esp_err_t ret = ESP_OK;
+    size_t size   = light_scene_blob_size(CONFIG_LIGHT_DRIVER_SCENE_NUM);
+
+    /**< Scenes rarely change, skip the allocation on the usual flush */
+    if (!g_light_scene_dirty) {
+        return ESP_OK;
+    }
+
+    uint8_t *blob = malloc(size);
+    LIGHT_ERROR_CHECK(!blob, ESP_ERR_NO_MEM, "malloc scene blob");
+
+    portENTER_CRITICAL(&g_light_store_lock);
+
+    if (!g_light_scene_dirty) {
+        portEXIT_CRITICAL(&g_light_store_lock);
+        free(blob);
+        return ESP_OK;
+    }
+
+    g_light_scene_dirty = false;
+    light_scene_pack(g_light_scenes, CONFIG_LIGHT_DRIVER_SCENE_NUM, blob, &size);
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    ret = app_storage_set(LIGHT_SCENE_STORE_KEY, blob, size);
+    free(blob);
+
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&g_light_store_lock);
+        g_light_scene_dirty = true;
+        portEXIT_CRITICAL(&g_light_store_lock);
+    }
+
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "app_storage_set, ret: %d", ret);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Save the points of the schedule started last, or erase them if it was stopped
+ */
+static esp_err_t light_driver_flush_schedule(void)
 {
     esp_err_t ret = ESP_OK;
+    light_schedule_store_t store;
+
+    portENTER_CRITICAL(&g_light_store_lock);
+
+    if (!g_light_schedule_dirty) {
+        portEXIT_CRITICAL(&g_light_store_lock);
+        return ESP_OK;
+    }
+
+    g_light_schedule_dirty = false;
+    store = g_light_schedule_store;
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    if (store.num) {
+        size_t size   = light_schedule_blob_size(store.num);
+        uint8_t *blob = malloc(size);
+
+        ret = blob ? light_schedule_pack(store.points, store.num, blob, &size) : ESP_ERR_NO_MEM;
+        ret = (ret == ESP_OK) ? app_storage_set(LIGHT_SCHEDULE_STORE_KEY, blob, size) : ret;
+        free(blob);
+    } else {
+        ret = app_storage_erase(LIGHT_SCHEDULE_STORE_KEY);
+    }
+
+    if (ret != ESP_OK) {
+        portENTER_CRITICAL(&g_light_store_lock);
+        g_light_schedule_dirty = true;
+        portEXIT_CRITICAL(&g_light_store_lock);
+    }
+
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "save %s, ret: %d", LIGHT_SCHEDULE_STORE_KEY, ret);
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_flush(void)
+{
+    light_status_t stored = g_light_status_stored;
+    bool scenes_dirty     = g_light_scene_dirty;
+    bool schedule_dirty   = g_light_schedule_dirty;
+
+    /**< The state, the scenes and the schedule reach flash together, with one
+     * NVS commit. A state kept in its journal is appended on its own, the
+     * batch only holds the scenes and the schedule then */
+    esp_err_t ret = app_storage_batch_begin();
+    LIGHT_ERROR_CHECK(ret != ESP_OK, ret, "app_storage_batch_begin, ret: %d", ret);
+
+    ret = light_driver_flush_status();
+
+    if (light_driver_flush_scenes() != ESP_OK) {
+        ret = ESP_FAIL;
+    }
 
-    iot_led_deinit();
+    if (light_driver_flush_schedule() != ESP_OK) {
+        ret = ESP_FAIL;
+    }
+
+    if (app_storage_batch_commit() != ESP_OK) {
+        /**< What reached flash is not known, all are written again next time */
+        portENTER_CRITICAL(&g_light_store_lock);
+        g_light_status_stored   = stored;
+        g_light_store_dirty     = true;
+        g_light_scene_dirty    |= scenes_dirty;
+        g_light_schedule_dirty |= schedule_dirty;
+        portEXIT_CRITICAL(&g_light_store_lock);
+        ret = ESP_FAIL;
+    }
 
     return ret;
 }
 
-esp_err_t light_driver_config(uint32_t fade_period_ms, uint32_t blink_period_ms)
+/**
+ * @brief Ticks to wait for more changes before saving
+ */
+static TickType_t light_driver_store_delay(void)
 {
-    g_light_status.fade_period_ms = fade_period_ms;
-    g_light_status.blink_period_ms = blink_period_ms;
+    TickType_t quiet = pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_STORE_QUIET_MS);
+    TickType_t max_delay = pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_STORE_MAX_DELAY_MS);
+
+    portENTER_CRITICAL(&g_light_store_lock);
+    TickType_t stale = xTaskGetTickCount() - g_light_store_dirty_tick;
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    if (stale >= max_delay) {
+        return 0;
+    }
+
+    return MIN(quiet, max_delay - stale);
+}
+
+/**
+ * @brief Save the light state once it has settled, off the tasks that change it
+ */
+static void light_driver_store_task(void *arg)
+{
+    TickType_t wait = portMAX_DELAY;
+    TickType_t retry = 0;               /**< Backoff of the last save, 0 if it succeeded */
+    TickType_t retry_tick = 0;
+
+    for (;;) {
+        if (ulTaskNotifyTake(pdTRUE, wait)) {
+            /**< Another change, restart the quiet period within the staleness bound */
+            wait = light_driver_store_delay();
+
+            /**< A failed save is not tried again before its backoff is over */
+            if (retry && xTaskGetTickCount() - retry_tick < retry) {
+                wait = MAX(wait, retry - (xTaskGetTickCount() - retry_tick));
+            }
+
+            if (wait) {
+                continue;
+            }
+        }
+
+        if (light_driver_flush() == ESP_OK) {
+            retry = 0;
+            wait  = portMAX_DELAY;
+        } else {
+            /**< Still dirty, nothing may change to wake the task again */
+            retry = retry ? MIN(retry * 2, pdMS_TO_TICKS(LIGHT_STORE_RETRY_MAX_MS))
+                    : MAX(pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_STORE_QUIET_MS), pdMS_TO_TICKS(LIGHT_STORE_RETRY_MIN_MS));
+            retry_tick = xTaskGetTickCount();
+            wait  = retry;
+        }
+
+#ifdef CONFIG_LIGHT_DRIVER_STATUS_JOURNAL
+        /**< Erase the next sector of the journal here, not in a later flush */
+        if (g_light_journal) {
+            app_storage_journal_compact(g_light_journal);
+        }
+#endif
+    }
+}
+
+static void light_driver_shutdown_handler(void)
+{
+    light_driver_flush();
+}
+
+/**
+ * @brief Mark the light state, the scenes or the schedule changed, the store task saves them later
+ */
+static void light_driver_store_mark(bool *dirty)
+{
+    portENTER_CRITICAL(&g_light_store_lock);
+
+    if (!g_light_store_dirty && !g_light_scene_dirty && !g_light_schedule_dirty) {
+        g_light_store_dirty_tick = xTaskGetTickCount();
+    }
+
+    *dirty = true;
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    if (g_light_store_task) {
+        xTaskNotifyGive(g_light_store_task);
+    }
+}
+
+static void light_driver_store(void)
+{
+    light_driver_store_mark(&g_light_store_dirty);
+}
+
+static void light_driver_store_scenes(void)
+{
+    light_driver_store_mark(&g_light_scene_dirty);
+}
+
+/**
+ * @brief Record the points of a schedule just started, or none once it is stopped, for the store task
+ */
+static void light_driver_store_schedule(const light_schedule_point_t *points, size_t num)
+{
+    portENTER_CRITICAL(&g_light_store_lock);
+    g_light_schedule_store.num = num;
+
+    if (num) {
+        memcpy(g_light_schedule_store.points, points, num * sizeof(light_schedule_point_t));
+    }
+
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    light_driver_store_mark(&g_light_schedule_dirty);
+}
+
+/**
+ * @brief Colour temperature of a color_temperature, 0 the coldest and 100 the warmest of the fixture
+ */
+static uint16_t light_driver_percent_to_kelvin(uint8_t color_temperature)
+{
+    uint32_t mired = g_light_cct.mired_min
+                     + ((uint32_t)(g_light_cct.mired_max - g_light_cct.mired_min) * color_temperature + 50) / 100;
+
+    return (1000000UL + mired / 2) / mired;
+}
+
+static uint8_t light_driver_kelvin_to_percent(uint16_t kelvin)
+{
+    uint32_t mired = (1000000UL + kelvin / 2) / kelvin;
+    mired = MAX(mired, g_light_cct.mired_min);
+    mired = MIN(mired, g_light_cct.mired_max);
+
+    uint32_t range = g_light_cct.mired_max - g_light_cct.mired_min;
+
+    return ((mired - g_light_cct.mired_min) * 100 + range / 2) / range;
+}
+
+/**
+ * @brief Red, green and blue channel values (0 ~ 255) of a state
+ */
+static void light_driver_state_rgb(const light_state_t *state, uint8_t *red, uint8_t *green, uint8_t *blue)
+{
+    const light_color_hsv_t hsv = {
+        .hue        = state->hue % LIGHT_COLOR_HUE_MAX,
+        .saturation = state->saturation,
+        .value      = state->value,
+    };
+    light_color_rgb_t rgb;
+
+    light_color_hsv_to_rgb(&hsv, &rgb);
+
+    *red   = LIGHT_COLOR_TO_VALUE(rgb.red);
+    *green = LIGHT_COLOR_TO_VALUE(rgb.green);
+    *blue  = LIGHT_COLOR_TO_VALUE(rgb.blue);
+}
+
+/**
+ * @brief Warm and cold channel values (0 ~ 255) of a state
+ *
+ * @note The calibrated duties are scaled by the duty of the brightness on the
+ *     dimming curve, so the two channels keep the ratio of their light
+ */
+static void light_driver_state_white(const light_state_t *state, uint8_t *warm, uint8_t *cold)
+{
+    uint16_t warm_duty, cold_duty;
+    uint32_t duty = iot_led_value_to_duty(LIGHT_COLOR_TO_VALUE(state->brightness));
+
+    light_cct_mix(&g_light_cct, state->kelvin, &warm_duty, &cold_duty);
+
+    *warm = iot_led_duty_to_value((warm_duty * duty + UINT16_MAX / 2) / UINT16_MAX);
+    *cold = iot_led_duty_to_value((cold_duty * duty + UINT16_MAX / 2) / UINT16_MAX);
+}
+
+/**
+ * @brief The saved light state at full precision
+ */
+static void light_driver_status_state(light_state_t *state)
+{
+    state->hue        = g_light_status.hue * LIGHT_COLOR_HUE_SCALE;
+    state->saturation = LIGHT_PERCENT_TO_COLOR(g_light_status.saturation);
+    state->value      = LIGHT_PERCENT_TO_COLOR(g_light_status.value);
+    state->brightness = LIGHT_PERCENT_TO_COLOR(g_light_status.brightness);
+    state->kelvin     = g_light_status.kelvin;
+}
+
+/**
+ * @brief State of the light at a time, along the running fade
+ *
+ * @note The iot_led fades are linear in time, and so are hue, saturation,
+ *     value and brightness along them. The colour temperature is taken
+ *     linear in mired, which the table mixes in.
+ */
+static void light_driver_model_at(int64_t now, light_state_t *state)
+{
+    const light_model_t *model = &g_light_model;
+
+    if (!model->duration_us || now >= model->start_us + model->duration_us) {
+        *state = model->to;
+        return;
+    }
+
+    uint32_t frac = ((uint64_t)MAX(now - model->start_us, 0) << 16) / model->duration_us;
+
+#define LIGHT_MODEL_LERP(a, b) ((a) + (int32_t)((((int64_t)(b) - (int64_t)(a)) * frac) >> 16))
+    uint32_t mired_q8 = LIGHT_MODEL_LERP(LIGHT_KELVIN_TO_MIRED_Q8(model->from.kelvin),
+                                         LIGHT_KELVIN_TO_MIRED_Q8(model->to.kelvin));
+
+    state->hue        = LIGHT_MODEL_LERP(model->from.hue, model->to.hue);
+    state->saturation = LIGHT_MODEL_LERP(model->from.saturation, model->to.saturation);
+    state->value      = LIGHT_MODEL_LERP(model->from.value, model->to.value);
+    state->brightness = LIGHT_MODEL_LERP(model->from.brightness, model->to.brightness);
+    state->kelvin     = LIGHT_KELVIN_TO_MIRED_Q8(mired_q8);
+#undef LIGHT_MODEL_LERP
+}
+
+/**
+ * @brief Fade the model to a new state from wherever the running fade has got to
+ */
+static void light_driver_model_retarget(const light_state_t *to, uint32_t fade_ms)
+{
+    int64_t now = esp_timer_get_time();
+    light_state_t from;
+
+    light_driver_model_at(now, &from);
+    g_light_model.from        = from;
+    g_light_model.to          = *to;
+    g_light_model.start_us    = now;
+    g_light_model.duration_us = (fade_ms < UINT32_MAX / 1000) ? fade_ms * 1000 : UINT32_MAX;
+    g_light_dimming           = false;
+}
+
+/**
+ * @brief Load the fixture calibration, saved in flash, else from the config, else nominal
+ */
+static esp_err_t light_driver_cct_init(const light_cct_calibration_t *config)
+{
+    esp_err_t ret = ESP_OK;
+    light_cct_calibration_t calibration;
+
+    if (app_storage_get(LIGHT_CCT_STORE_KEY, &calibration, sizeof(light_cct_calibration_t)) == ESP_OK
+            && light_cct_table_init(&calibration, &g_light_cct) == ESP_OK) {
+        return ESP_OK;
+    }
+
+    ret = light_cct_table_init(config ? config : &g_light_cct_nominal, &g_light_cct);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_cct_table_init, ret: %d", ret);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Erase the keys of the last batch if a power cut tore it, they may mix two saves
+ *
+ * @return true if the keys are still there and must not be read
+ */
+static bool light_driver_batch_torn(void)
+{
+    uint32_t generation = 0;
+
+    if (app_storage_batch_generation(&generation) != ESP_ERR_INVALID_STATE) {
+        return false;
+    }
+
+    ESP_LOGW(TAG, "Save after batch %" PRIu32 " torn, the light state, scenes and schedule are reset", generation);
+
+    /**< Erased together, the commit of a batch of more than one key clears the torn mark */
+    esp_err_t ret = app_storage_batch_begin();
+    LIGHT_ERROR_CHECK(ret != ESP_OK, true, "app_storage_batch_begin, ret: %d", ret);
+
+    app_storage_erase(LIGHT_STATUS_STORE_KEY);
+    app_storage_erase(LIGHT_SCENE_STORE_KEY);
+    app_storage_erase(LIGHT_SCHEDULE_STORE_KEY);
+
+    ret = app_storage_batch_commit();
+    LIGHT_ERROR_CHECK(ret != ESP_OK, true, "app_storage_batch_commit, ret: %d", ret);
+
+    return false;
+}
+
+/**
+ * @brief Load the scenes saved in flash, the table stays empty if there are none or another version saved them
+ */
+static void light_driver_scene_init(void)
+{
+    esp_err_t ret = ESP_OK;
+    size_t size   = light_scene_blob_size(CONFIG_LIGHT_DRIVER_SCENE_NUM);
+    uint8_t *blob = malloc(size);
+
+    memset(g_light_scenes, 0, sizeof(g_light_scenes));
+
+    if (!blob) {
+        ESP_LOGE(TAG, "malloc scene blob");
+        return;
+    }
+
+    if (app_storage_get(LIGHT_SCENE_STORE_KEY, blob, size) == ESP_OK) {
+        ret = light_scene_unpack(g_light_scenes, CONFIG_LIGHT_DRIVER_SCENE_NUM, blob, size);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Saved scenes not readable, ret: %d", ret);
+        }
+    }
+
+    free(blob);
+}
+
+/**
+ * @brief Compile the schedule saved in flash, the light follows none if there is none or it does not compile
+ */
+static void light_driver_schedule_init(void)
+{
+    esp_err_t ret = ESP_OK;
+    light_schedule_point_t points[LIGHT_SCHEDULE_POINT_MAX];
+    size_t size   = light_schedule_blob_size(LIGHT_SCHEDULE_POINT_MAX);
+    uint8_t *blob = calloc(1, size);
+    size_t num    = 0;
+
+    if (!blob) {
+        ESP_LOGE(TAG, "malloc schedule blob");
+        return;
+    }
+
+    /**< The buffer is zeroed, an empty value reads as a blob of no version */
+    if (app_storage_get(LIGHT_SCHEDULE_STORE_KEY, blob, size) == ESP_OK) {
+        ret = light_schedule_unpack(points, &num, blob, size);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Saved schedule not readable, ret: %d", ret);
+            num = 0;
+        }
+    }
+
+    free(blob);
+
+    if (!num) {
+        return;
+    }
+
+    g_light_schedule = malloc(sizeof(light_schedule_t));
+
+    if (!g_light_schedule) {
+        ESP_LOGE(TAG, "malloc light_schedule_t");
+        return;
+    }
+
+    ret = light_schedule_compile(points, num, g_light_schedule);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Saved schedule not readable, ret: %d", ret);
+        free(g_light_schedule);
+        g_light_schedule = NULL;
+        return;
+    }
+
+    g_light_schedule_tick = xTaskGetTickCount() - pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_SCHEDULE_PERIOD_MS);
+}
+
+esp_err_t light_driver_get_cct_range(uint16_t *kelvin_min, uint16_t *kelvin_max)
+{
+    LIGHT_PARAM_CHECK(kelvin_min);
+    LIGHT_PARAM_CHECK(kelvin_max);
+
+    *kelvin_min = light_cct_kelvin_min(&g_light_cct);
+    *kelvin_max = light_cct_kelvin_max(&g_light_cct);
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_init(light_driver_config_t *config)
+{
+    LIGHT_PARAM_CHECK(config);
+
+    esp_err_t ret = ESP_OK;
+
+    ret = light_driver_cct_init(config->cct_calibration);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_cct_init, ret: %d", ret);
+
+    memset(&g_light_status, 0, sizeof(light_status_t));
+
+    /**< Defaults for all of them if a torn save could not be cleared */
+    bool torn = light_driver_batch_torn();
+
+    if (torn || light_driver_status_load(&g_light_status) != ESP_OK) {
+        ESP_LOGE(TAG, "Load light status failed");
+        memset(&g_light_status, 0, sizeof(light_status_t));
+        g_light_status.mode              = MODE_HSV;
+        g_light_status.on                = 1;
+        g_light_status.hue               = 360;
+        g_light_status.saturation        = 0;
+        g_light_status.value             = 100;
+        g_light_status.color_temperature = 0;
+        g_light_status.brightness        = 30;
+        g_light_status.fade_period_ms  = config->fade_period_ms;
+        g_light_status.blink_period_ms = config->blink_period_ms;
+    }
+
+    /**< A state saved before the colour temperature was kept in kelvin */
+    if (!g_light_status.kelvin) {
+        g_light_status.kelvin = light_driver_percent_to_kelvin(g_light_status.color_temperature);
+    }
+
+    g_light_status_stored = g_light_status;
+    light_driver_status_state(&g_light_model.to);
+    g_light_model.duration_us = 0;
+
+    memset(g_light_scenes, 0, sizeof(g_light_scenes));
+
+    if (!torn) {
+        light_driver_scene_init();
+        light_driver_schedule_init();
+    }
+
+    memset(&g_light_power, 0, sizeof(light_power_config_t));
+    memset(g_light_channels, 0, sizeof(g_light_channels));
+    memset(g_light_output, 0, sizeof(g_light_output));
+    g_light_power_limited = false;
+
+    if (config->power_limit) {
+        g_light_power = *config->power_limit;
+    }
+
+    if (!g_light_store_task) {
+        BaseType_t task_ret = xTaskCreate(light_driver_store_task, "light_store", LIGHT_STORE_TASK_STACK,
+                                          NULL, LIGHT_STORE_TASK_PRIO, &g_light_store_task);
+        LIGHT_ERROR_CHECK(task_ret != pdPASS, ESP_ERR_NO_MEM, "xTaskCreate light_store");
+        esp_register_shutdown_handler(light_driver_shutdown_handler);
+    }
+
+    g_led = iot_led_create(config->timer_num, LEDC_LOW_SPEED_MODE, config->freq_hz, config->clk_cfg, config->duty_resolution);
+    LIGHT_ERROR_CHECK(g_led == NULL, ESP_FAIL, "iot_led_create failed");
+
+    iot_led_set_fade_mode(g_led, config->fade_mode);
+
+    iot_led_regist_channel(g_led, CHANNEL_ID_RED, config->gpio_red);
+    iot_led_regist_channel(g_led, CHANNEL_ID_GREEN, config->gpio_green);
+    iot_led_regist_channel(g_led, CHANNEL_ID_BLUE, config->gpio_blue);
+    iot_led_regist_channel(g_led, CHANNEL_ID_WARM, config->gpio_warm);
+    iot_led_regist_channel(g_led, CHANNEL_ID_COLD, config->gpio_cold);
+
+    for (int channel = CHANNEL_ID_RED; channel <= CHANNEL_ID_COLD; channel++) {
+        iot_led_set_dither(g_led, (ledc_channel_t)channel, config->dither);
+    }
+
+    ret = light_driver_control_init();
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_control_init, ret: %d", ret);
+
+    ESP_LOGD(TAG, "hue: %d, saturation: %d, value: %d",
+             g_light_status.hue, g_light_status.saturation, g_light_status.value);
+    ESP_LOGD(TAG, "brightness: %d, color_temperature: %d, kelvin: %d",
+             g_light_status.brightness, g_light_status.color_temperature, g_light_status.kelvin);
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_deinit()
+{
+    esp_err_t ret = ESP_OK;
+
+    light_driver_control_deinit();
+    light_driver_flush();
+
+    free(g_light_schedule);
+    g_light_schedule = NULL;
+
+    ret = iot_led_delete(g_led);
+    g_led = NULL;
+
+    return ret;
+}
+
+/**
+ * @brief Scale the values of all channels down to the power budget, keeping their ratio
+ */
+static bool light_driver_power_scale(uint8_t values[LIGHT_POWER_CHANNEL_NUM])
+{
+    uint16_t duty[LIGHT_POWER_CHANNEL_NUM];
+    bool limited = false;
+
+    if (!g_light_power.budget) {
+        return false;
+    }
+
+    /**< The current follows the duty, not the perceived brightness */
+    for (int channel = 0; channel < LIGHT_POWER_CHANNEL_NUM; channel++) {
+        duty[channel] = iot_led_value_to_duty(values[channel]);
+    }
+
+    portENTER_CRITICAL(&g_light_power_lock);
+    limited = light_power_limit(&g_light_power, duty, &g_light_power_stats);
+    portEXIT_CRITICAL(&g_light_power_lock);
+
+    if (!limited) {
+        return false;
+    }
+
+    for (int channel = 0; channel < LIGHT_POWER_CHANNEL_NUM; channel++) {
+        /**< Round down, the nearest value may draw more than the scaled duty */
+        uint8_t value = iot_led_duty_to_value(duty[channel]);
+        values[channel] = (value && iot_led_value_to_duty(value) > duty[channel]) ? value - 1 : value;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Give channels new targets, within the power budget
+ *
+ * @note The budget is checked on the targets of all channels, one left out
+ *     keeps the target it was last given. Starting or stopping to scale also
+ *     sends every other channel whose output moves. A fade between two outputs
+ *     within the budget stays within it, as all channels start and end together
+ *     and the duty is convex in the faded level.
+ */
+static esp_err_t light_driver_set_channels(const iot_led_channel_target_t *targets, size_t num, uint32_t fade_ms)
+{
+    iot_led_channel_target_t output[LIGHT_POWER_CHANNEL_NUM];
+    uint8_t values[LIGHT_POWER_CHANNEL_NUM];
+    size_t output_num = 0;
+    uint32_t mask     = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        g_light_channels[targets[i].channel] = targets[i].value;
+        mask |= BIT(targets[i].channel);
+    }
+
+    memcpy(values, g_light_channels, sizeof(values));
+    bool limited = light_driver_power_scale(values);
+
+    if (limited != g_light_power_limited) {
+        ESP_LOGI(TAG, "Output %s the power budget", limited ? "scaled down to" : "back within");
+        g_light_power_limited = limited;
+    }
+
+    for (int channel = 0; channel < LIGHT_POWER_CHANNEL_NUM; channel++) {
+        if ((mask & BIT(channel)) || values[channel] != g_light_output[channel]) {
+            output[output_num].channel = channel;
+            output[output_num].value   = values[channel];
+            g_light_output[channel]    = values[channel];
+            output_num++;
+        }
+    }
+
+    return iot_led_set_channels(g_led, output, output_num, fade_ms);
+}
+
+/**
+ * @brief Scale each keyframe of an effect down to the power budget
+ *
+ * @note Channels outside the effect count at their current target. An effect
+ *     played once holds its last keyframe, which becomes the target of its
+ *     channels.
+ */
+static void light_driver_power_scale_effect(iot_led_effect_t *effect, iot_led_keyframe_t *keyframes)
+{
+    uint8_t values[LIGHT_POWER_CHANNEL_NUM];
+
+    for (int i = 0; i < effect->keyframe_num; i++) {
+        memcpy(values, g_light_output, sizeof(values));
+
+        for (int column = 0; column < effect->channel_num; column++) {
+            values[effect->channels[column]] = keyframes[i].value[column];
+        }
+
+        if (effect->repeat == 1 && i == effect->keyframe_num - 1) {
+            memcpy(g_light_channels, values, sizeof(values));
+        }
+
+        light_driver_power_scale(values);
+
+        for (int column = 0; column < effect->channel_num; column++) {
+            keyframes[i].value[column] = values[effect->channels[column]];
+        }
+    }
+
+    if (effect->repeat == 1) {
+        memcpy(g_light_output, values, sizeof(values));
+    }
+
+    effect->keyframes = keyframes;
+}
+
+static esp_err_t light_driver_apply_config(uint32_t fade_period_ms, uint32_t blink_period_ms)
+{
+    g_light_status.fade_period_ms = fade_period_ms;
+    g_light_status.blink_period_ms = blink_period_ms;
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_rgb(uint8_t red, uint8_t green, uint8_t blue)
+{
+    esp_err_t ret = 0;
+    const iot_led_channel_target_t targets[] = {
+        {CHANNEL_ID_RED, red},
+        {CHANNEL_ID_GREEN, green},
+        {CHANNEL_ID_BLUE, blue},
+        {CHANNEL_ID_WARM, 0},
+        {CHANNEL_ID_COLD, 0},
+    };
+
+    ret = light_driver_set_channels(targets, 5, 0);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_hsv(uint16_t hue, uint8_t saturation, uint8_t value)
+{
+    esp_err_t ret    = ESP_OK;
+    light_state_t to = g_light_model.to;
+    uint8_t red      = 0;
+    uint8_t green    = 0;
+    uint8_t blue     = 0;
+
+    to.hue        = hue * LIGHT_COLOR_HUE_SCALE;
+    to.saturation = LIGHT_PERCENT_TO_COLOR(saturation);
+    to.value      = LIGHT_PERCENT_TO_COLOR(value);
+    light_driver_state_rgb(&to, &red, &green, &blue);
+
+    ESP_LOGV(TAG, "red: %d, green: %d, blue: %d", red, green, blue);
+
+    /**< The white channels are only turned off when switching from another mode */
+    const iot_led_channel_target_t targets[] = {
+        {CHANNEL_ID_RED, red},
+        {CHANNEL_ID_GREEN, green},
+        {CHANNEL_ID_BLUE, blue},
+        {CHANNEL_ID_WARM, 0},
+        {CHANNEL_ID_COLD, 0},
+    };
+
+    ret = light_driver_set_channels(targets, (g_light_status.mode != MODE_HSV) ? 5 : 3, g_light_status.fade_period_ms);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    g_light_status.mode       = MODE_HSV;
+    g_light_status.on         = 1;
+    g_light_status.hue        = hue;
+    g_light_status.value      = value;
+    g_light_status.saturation = saturation;
+
+    light_driver_model_retarget(&to, g_light_status.fade_period_ms);
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_get_hsv(uint16_t *hue, uint8_t *saturation, uint8_t *value)
+{
+    LIGHT_PARAM_CHECK(hue);
+    LIGHT_PARAM_CHECK(saturation);
+    LIGHT_PARAM_CHECK(value);
+
+    *hue        = g_light_status.hue;
+    *saturation = g_light_status.saturation;
+    *value      = g_light_status.value;
+
+    return ESP_OK;
+}
+
+uint16_t light_driver_get_hue()
+{
+    return g_light_status.hue;
+}
+
+uint8_t light_driver_get_saturation()
+{
+    return g_light_status.saturation;
+}
+
+uint8_t light_driver_get_value()
+{
+    return g_light_status.value;
+}
+
+uint8_t light_driver_get_mode()
+{
+    return g_light_status.mode;
+}
+
+/**
+ * @brief Set the white channels, color_temperature is kept as given rather than derived from kelvin
+ */
+static esp_err_t light_driver_apply_ctb(uint16_t kelvin, uint8_t color_temperature, uint8_t brightness, uint32_t fade_ms)
+{
+    esp_err_t ret    = ESP_OK;
+    light_state_t to = g_light_model.to;
+    uint8_t warm, cold;
+
+    to.kelvin     = kelvin;
+    to.brightness = LIGHT_PERCENT_TO_COLOR(brightness);
+    light_driver_state_white(&to, &warm, &cold);
+
+    /**< The colour channels are only turned off when switching from another mode */
+    const iot_led_channel_target_t targets[] = {
+        {CHANNEL_ID_COLD, cold},
+        {CHANNEL_ID_WARM, warm},
+        {CHANNEL_ID_RED, 0},
+        {CHANNEL_ID_GREEN, 0},
+        {CHANNEL_ID_BLUE, 0},
+    };
+
+    ret = light_driver_set_channels(targets, (g_light_status.mode != MODE_CTB) ? 5 : 2, fade_ms);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    g_light_status.mode              = MODE_CTB;
+    g_light_status.on                = 1;
+    g_light_status.brightness        = brightness;
+    g_light_status.color_temperature = color_temperature;
+    g_light_status.kelvin            = kelvin;
+
+    light_driver_model_retarget(&to, fade_ms);
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_get_ctb(uint8_t *color_temperature, uint8_t *brightness)
+{
+    LIGHT_PARAM_CHECK(color_temperature);
+    LIGHT_PARAM_CHECK(brightness);
+
+    *brightness        = g_light_status.brightness;
+    *color_temperature = g_light_status.color_temperature;
+
+    return ESP_OK;
+}
+
+esp_err_t light_driver_get_cct(uint16_t *kelvin, uint8_t *brightness)
+{
+    LIGHT_PARAM_CHECK(kelvin);
+    LIGHT_PARAM_CHECK(brightness);
+
+    *brightness = g_light_status.brightness;
+    *kelvin     = g_light_status.kelvin;
+
+    return ESP_OK;
+}
+
+uint16_t light_driver_get_kelvin()
+{
+    return g_light_status.kelvin;
+}
+
+uint8_t light_driver_get_color_temperature()
+{
+    return g_light_status.color_temperature;
+}
+
+uint8_t light_driver_get_brightness()
+{
+    return g_light_status.brightness;
+}
+
+static esp_err_t light_driver_apply_switch(bool on)
+{
+    esp_err_t ret     = ESP_OK;
+    g_light_status.on = on;
+
+    if (!g_light_status.on) {
+        const iot_led_channel_target_t targets[] = {
+            {CHANNEL_ID_RED, 0},
+            {CHANNEL_ID_GREEN, 0},
+            {CHANNEL_ID_BLUE, 0},
+            {CHANNEL_ID_COLD, 0},
+            {CHANNEL_ID_WARM, 0},
+        };
+
+        ret = light_driver_set_channels(targets, 5, g_light_status.fade_period_ms);
+        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_set_channels, ret: %d", ret);
+    } else {
+        switch (g_light_status.mode) {
+            case MODE_HSV:
+                g_light_status.value = (g_light_status.value) ? g_light_status.value : 100;
+                ret = light_driver_apply_hsv(g_light_status.hue, g_light_status.saturation, g_light_status.value);
+                LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_apply_hsv, ret: %d", ret);
+                break;
+
+            case MODE_CTB:
+                g_light_status.brightness = (g_light_status.brightness) ? g_light_status.brightness : 100;
+                ret = light_driver_apply_ctb(g_light_status.kelvin, g_light_status.color_temperature, g_light_status.brightness,
+                                             g_light_status.fade_period_ms);
+                LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_apply_ctb, ret: %d", ret);
+                break;
+
+            default:
+                ESP_LOGW(TAG, "This operation is not supported");
+                break;
+        }
+    }
+
+    light_driver_store();
+
+    return ESP_OK;
+}
+
+bool light_driver_get_switch()
+{
+    return g_light_status.on;
+}
+
+static esp_err_t light_driver_apply_breath_start(uint8_t red, uint8_t green, uint8_t blue)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t values[LIGHT_POWER_CHANNEL_NUM];
+
+    /**< Budget the peak of the breath, the white channels stay at their target */
+    memcpy(values, g_light_output, sizeof(values));
+    values[CHANNEL_ID_RED]   = red;
+    values[CHANNEL_ID_GREEN] = green;
+    values[CHANNEL_ID_BLUE]  = blue;
+    light_driver_power_scale(values);
+
+    ret = iot_led_start_blink(g_led, CHANNEL_ID_RED,
+                              values[CHANNEL_ID_RED], g_light_status.blink_period_ms, true);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
+    ret = iot_led_start_blink(g_led, CHANNEL_ID_GREEN,
+                              values[CHANNEL_ID_GREEN], g_light_status.blink_period_ms, true);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
+    ret = iot_led_start_blink(g_led, CHANNEL_ID_BLUE,
+                              values[CHANNEL_ID_BLUE], g_light_status.blink_period_ms, true);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
+
+    g_light_blink_flag = true;
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_breath_stop(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (g_light_blink_flag == false) {
+        return ESP_OK;
+    }
+
+    ret = iot_led_stop_blink(g_led, CHANNEL_ID_RED);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+
+    ret = iot_led_stop_blink(g_led, CHANNEL_ID_GREEN);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+
+    ret = iot_led_stop_blink(g_led, CHANNEL_ID_BLUE);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+
+    light_driver_apply_switch(true);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Fade time of a brightness change, the whole range takes LIGHT_FADE_PERIOD_MAX_MS
+ */
+static uint32_t light_driver_fade_period(uint16_t from, uint16_t to)
+{
+    return LIGHT_FADE_PERIOD_MAX_MS * (uint32_t)abs((int)to - (int)from) / LIGHT_COLOR_MAX;
+}
+
+/**
+ * @brief Value in HSV mode or brightness in white mode, the attribute a brightness change moves
+ */
+static uint16_t light_driver_state_level(const light_state_t *state)
+{
+    return (g_light_status.mode == MODE_HSV) ? state->value : state->brightness;
+}
+
+/**
+ * @brief Fade the channels of the mode to a new level from the state reached, the other attributes held
+ */
+static esp_err_t light_driver_fade_level(light_state_t *to, uint16_t level, uint32_t fade_ms)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (g_light_status.mode == MODE_HSV) {
+        uint8_t red, green, blue;
+
+        to->value = level;
+        light_driver_state_rgb(to, &red, &green, &blue);
+
+        const iot_led_channel_target_t targets[] = {
+            {CHANNEL_ID_RED, red},
+            {CHANNEL_ID_GREEN, green},
+            {CHANNEL_ID_BLUE, blue},
+        };
+
+        ret = light_driver_set_channels(targets, 3, fade_ms);
+    } else {
+        uint8_t warm, cold;
+
+        to->brightness = level;
+        light_driver_state_white(to, &warm, &cold);
+
+        const iot_led_channel_target_t targets[] = {
+            {CHANNEL_ID_COLD, cold},
+            {CHANNEL_ID_WARM, warm},
+        };
+
+        ret = light_driver_set_channels(targets, 2, fade_ms);
+    }
+
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    light_driver_model_retarget(to, fade_ms);
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_fade_brightness(uint8_t brightness)
+{
+    esp_err_t ret  = ESP_OK;
+    uint16_t level = LIGHT_PERCENT_TO_COLOR(brightness);
+    light_state_t to;
+
+    if (g_light_status.mode != MODE_HSV && g_light_status.mode != MODE_CTB) {
+        return ESP_OK;
+    }
+
+    /**< Any other fade running stops where it has got to */
+    light_driver_model_at(esp_timer_get_time(), &to);
+
+    ret = light_driver_fade_level(&to, level, light_driver_fade_period(light_driver_state_level(&to), level));
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_fade_level, ret: %d", ret);
+
+    if (g_light_status.mode == MODE_HSV) {
+        g_light_status.hue        = (to.hue + LIGHT_COLOR_HUE_SCALE / 2) / LIGHT_COLOR_HUE_SCALE;
+        g_light_status.saturation = LIGHT_COLOR_TO_PERCENT(to.saturation);
+        g_light_status.value      = brightness;
+    } else {
+        g_light_status.kelvin            = to.kelvin;
+        g_light_status.color_temperature = light_driver_kelvin_to_percent(to.kelvin);
+        g_light_status.brightness        = brightness;
+    }
+
+    light_driver_store();
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_fade_hue(uint16_t hue)
+{
+    esp_err_t ret = ESP_OK;
+    light_state_t to;
+
+    if (g_light_status.mode != MODE_HSV) {
+        const iot_led_channel_target_t targets[] = {
+            {CHANNEL_ID_WARM, 0},
+            {CHANNEL_ID_COLD, 0},
+        };
+
+        ret = light_driver_set_channels(targets, 2, 0);
+        LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+    }
+
+    /**< Sweep on from the hue a running fade has reached, not from the one it was heading to */
+    light_driver_model_at(esp_timer_get_time(), &to);
+    to.value = to.value ? to.value : LIGHT_COLOR_MAX;
+
+    uint32_t fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * 2 / 6;
+
+    /**< Sweep 60 degrees per fade_period_ms towards either end of the hue circle,
+         one keyframe per sector as the colour is linear within a sector */
+    iot_led_keyframe_t keyframes[360 / 60 + 1];
+    iot_led_effect_t effect = {
+        .keyframes    = keyframes,
+        .channel_num  = 3,
+        .channels     = {CHANNEL_ID_RED, CHANNEL_ID_GREEN, CHANNEL_ID_BLUE},
+        .repeat       = 1,
+    };
+    int hue_cur        = to.hue;
+    int hue_target     = (hue > 180) ? LIGHT_COLOR_HUE_MAX : 0;
+    uint64_t total_us  = 0;
+
+    while (hue_cur != hue_target && effect.keyframe_num < sizeof(keyframes) / sizeof(keyframes[0])) {
+        int hue_next = (hue_target > hue_cur) ? MIN((hue_cur / LIGHT_COLOR_HUE_SECTOR + 1) * LIGHT_COLOR_HUE_SECTOR, hue_target)
+                       : MAX((hue_cur - 1) / LIGHT_COLOR_HUE_SECTOR * LIGHT_COLOR_HUE_SECTOR, hue_target);
+        uint32_t step_us = MAX((uint64_t)fade_period_ms * 1000 * abs(hue_next - hue_cur) / LIGHT_COLOR_HUE_SECTOR, 1);
+        iot_led_keyframe_t *keyframe = keyframes + effect.keyframe_num++;
+
+        to.hue = hue_next;
+        light_driver_state_rgb(&to, keyframe->value + 0, keyframe->value + 1, keyframe->value + 2);
+        keyframe->duration_us = step_us;
+        keyframe->rate        = (uint32_t)((1ULL << 32) / keyframe->duration_us);
+        hue_cur   = hue_next;
+        total_us += step_us;
+    }
+
+    if (!effect.keyframe_num) {
+        return ESP_OK;
+    }
+
+    light_driver_power_scale_effect(&effect, keyframes);
+
+    ret = iot_led_start_effect(g_led, &effect);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_start_effect, ret: %d", ret);
+
+    g_light_status.mode       = MODE_HSV;
+    g_light_status.hue        = hue_target / LIGHT_COLOR_HUE_SCALE;
+    g_light_status.saturation = LIGHT_COLOR_TO_PERCENT(to.saturation);
+    g_light_status.value      = LIGHT_COLOR_TO_PERCENT(to.value);
+
+    light_driver_model_retarget(&to, total_us / 1000);
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_fade_warm(uint8_t color_temperature)
+{
+    esp_err_t ret = ESP_OK;
+    light_state_t to;
+
+    if (g_light_status.mode != MODE_CTB) {
+        const iot_led_channel_target_t targets[] = {
+            {CHANNEL_ID_RED, 0},
+            {CHANNEL_ID_GREEN, 0},
+            {CHANNEL_ID_BLUE, 0},
+        };
+
+        ret = light_driver_set_channels(targets, 3, g_light_status.fade_period_ms);
+        LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+    }
+
+    uint8_t warm, cold;
+
+    light_driver_model_at(esp_timer_get_time(), &to);
+    to.kelvin = light_driver_percent_to_kelvin(color_temperature);
+    light_driver_state_white(&to, &warm, &cold);
+
+    const iot_led_channel_target_t targets[] = {
+        {CHANNEL_ID_COLD, cold},
+        {CHANNEL_ID_WARM, warm},
+    };
+
+    ret = light_driver_set_channels(targets, 2, LIGHT_FADE_PERIOD_MAX_MS);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    g_light_status.mode              = MODE_CTB;
+    g_light_status.color_temperature = color_temperature;
+    g_light_status.kelvin            = to.kelvin;
+    g_light_status.brightness        = LIGHT_COLOR_TO_PERCENT(to.brightness);
+
+    light_driver_model_retarget(&to, LIGHT_FADE_PERIOD_MAX_MS);
+    light_driver_store();
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stop the channels where they are, the light state is taken from the model
+ */
+static esp_err_t light_driver_apply_fade_stop(void)
+{
+    esp_err_t ret = ESP_OK;
+    const ledc_channel_t rgb_channels[] = {CHANNEL_ID_RED, CHANNEL_ID_GREEN, CHANNEL_ID_BLUE};
+    const ledc_channel_t white_channels[] = {CHANNEL_ID_COLD, CHANNEL_ID_WARM};
+    const ledc_channel_t *channels = (g_light_status.mode != MODE_CTB) ? rgb_channels : white_channels;
+    size_t channel_num = (g_light_status.mode != MODE_CTB) ? 3 : 2;
+    light_state_t now;
+
+    ret = iot_led_stop_effect(g_led);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_effect, ret: %d", ret);
+
+    for (size_t i = 0; i < channel_num; i++) {
+        ret = iot_led_stop_blink(g_led, channels[i]);
+        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+    }
+
+    light_driver_model_at(esp_timer_get_time(), &now);
+    g_light_model.to          = now;
+    g_light_model.duration_us = 0;
+
+    if (g_light_status.mode != MODE_CTB) {
+        g_light_status.hue        = (now.hue + LIGHT_COLOR_HUE_SCALE / 2) / LIGHT_COLOR_HUE_SCALE;
+        g_light_status.saturation = LIGHT_COLOR_TO_PERCENT(now.saturation);
+        g_light_status.value      = LIGHT_COLOR_TO_PERCENT(now.value);
+    } else {
+        g_light_status.kelvin            = now.kelvin;
+        g_light_status.color_temperature = light_driver_kelvin_to_percent(now.kelvin);
+        g_light_status.brightness        = LIGHT_COLOR_TO_PERCENT(now.brightness);
+    }
+
+    light_driver_store();
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Ramp the level towards an end at a constant rate, the status and flash are only updated by the stop
+ */
+static esp_err_t light_driver_apply_dim_start(light_dim_direction_t direction, uint8_t rate)
+{
+    esp_err_t ret = ESP_OK;
+    light_state_t to;
+
+    if (!g_light_status.on || (g_light_status.mode != MODE_HSV && g_light_status.mode != MODE_CTB)) {
+        return ESP_OK;
+    }
+
+    light_driver_model_at(esp_timer_get_time(), &to);
+
+    /**< The fade is linear in level, so in perceived brightness, rate percent of the range a second */
+    uint16_t level   = (direction == LIGHT_DIM_UP) ? LIGHT_COLOR_MAX : LIGHT_PERCENT_TO_COLOR(LIGHT_DIM_MIN_PERCENT);
+    uint32_t fade_ms = (uint64_t)abs((int)level - (int)light_driver_state_level(&to)) * 100 * 1000
+                       / ((uint32_t)rate * LIGHT_COLOR_MAX);
+
+    ret = light_driver_fade_level(&to, level, fade_ms);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_fade_level, ret: %d", ret);
+
+    g_light_dimming = true;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Hold the level the ramp has reached, unless something else has changed the light since it started
+ */
+static esp_err_t light_driver_apply_dim_stop(void)
+{
+    if (!g_light_dimming) {
+        return ESP_OK;
+    }
+
+    g_light_dimming = false;
+
+    if (!g_light_status.on) {
+        return ESP_OK;
+    }
+
+    return light_driver_apply_fade_stop();
+}
+
+static esp_err_t light_driver_apply_effect_start(light_effect_t effect)
+{
+    esp_err_t ret = ESP_OK;
+
+    LIGHT_PARAM_CHECK(effect < LIGHT_EFFECT_MAX);
+
+    iot_led_keyframe_t keyframes[IOT_LED_EFFECT_KEYFRAME_MAX];
+    iot_led_effect_t scaled = g_light_effects[effect];
+
+    memcpy(keyframes, scaled.keyframes, scaled.keyframe_num * sizeof(iot_led_keyframe_t));
+    light_driver_power_scale_effect(&scaled, keyframes);
+
+    ret = iot_led_start_effect(g_led, &scaled);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_effect, ret: %d", ret);
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_effect_stop(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    ret = iot_led_stop_effect(g_led);
+    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_effect, ret: %d", ret);
+
+    light_driver_apply_switch(true);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Keep the current look of the light in a scene, with the channel targets it gives
+ */
+static esp_err_t light_driver_apply_scene_save(uint8_t scene_id, uint32_t fade_ms)
+{
+    light_scene_t scene = {
+        .valid             = true,
+        .mode              = g_light_status.mode,
+        .on                = g_light_status.on,
+        .saturation        = g_light_status.saturation,
+        .value             = g_light_status.value,
+        .color_temperature = g_light_status.color_temperature,
+        .brightness        = g_light_status.brightness,
+        .hue               = g_light_status.hue,
+        .kelvin            = g_light_status.kelvin,
+        .fade_ms           = fade_ms,
+    };
+
+    if (!scene.on) {
+        /**< All channels off, the colour is kept for the next switch on */
+    } else if (scene.mode == MODE_HSV) {
+        light_driver_state_rgb(&g_light_model.to, scene.channels + CHANNEL_ID_RED,
+                               scene.channels + CHANNEL_ID_GREEN, scene.channels + CHANNEL_ID_BLUE);
+    } else if (scene.mode == MODE_CTB) {
+        light_driver_state_white(&g_light_model.to, scene.channels + CHANNEL_ID_WARM, scene.channels + CHANNEL_ID_COLD);
+    } else {
+        ESP_LOGW(TAG, "Scene of mode %d not supported", scene.mode);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    portENTER_CRITICAL(&g_light_store_lock);
+    g_light_scenes[scene_id] = scene;
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    light_driver_store_scenes();
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Fade every channel straight to the targets of a scene
+ */
+static esp_err_t light_driver_apply_scene_recall(uint8_t scene_id)
+{
+    esp_err_t ret = ESP_OK;
+    const light_scene_t *scene = g_light_scenes + scene_id;
+
+    LIGHT_ERROR_CHECK(!scene->valid, ESP_ERR_NOT_FOUND, "Scene %d is empty", scene_id);
+
+    const iot_led_channel_target_t targets[] = {
+        {CHANNEL_ID_RED, scene->channels[CHANNEL_ID_RED]},
+        {CHANNEL_ID_GREEN, scene->channels[CHANNEL_ID_GREEN]},
+        {CHANNEL_ID_BLUE, scene->channels[CHANNEL_ID_BLUE]},
+        {CHANNEL_ID_WARM, scene->channels[CHANNEL_ID_WARM]},
+        {CHANNEL_ID_COLD, scene->channels[CHANNEL_ID_COLD]},
+    };
+
+    ret = light_driver_set_channels(targets, 5, scene->fade_ms);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_set_channels, ret: %d", ret);
+
+    g_light_status.mode              = scene->mode;
+    g_light_status.on                = scene->on;
+    g_light_status.hue               = scene->hue;
+    g_light_status.saturation        = scene->saturation;
+    g_light_status.value             = scene->value;
+    g_light_status.color_temperature = scene->color_temperature;
+    g_light_status.brightness        = scene->brightness;
+    g_light_status.kelvin            = scene->kelvin;
+
+    light_state_t to;
+    light_driver_status_state(&to);
+    light_driver_model_retarget(&to, scene->fade_ms);
+    light_driver_store();
+
+    return ESP_OK;
+}
+
+static esp_err_t light_driver_apply_scene_delete(uint8_t scene_id)
+{
+    if (!g_light_scenes[scene_id].valid) {
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&g_light_store_lock);
+    memset(g_light_scenes + scene_id, 0, sizeof(light_scene_t));
+    portEXIT_CRITICAL(&g_light_store_lock);
+
+    light_driver_store_scenes();
+
+    return ESP_OK;
+}
+
+/**
+ * Every change of the light is a command posted by the caller and carried out
+ * by the control task, the only one touching g_light_status and the LEDs.
+ * Colour and switch commands are folded as they are posted into the newest
+ * target of each attribute, so a burst from a remote slider costs one update
+ * of the channels and its last value is never dropped. The other commands go
+ * through a lock-free ring in order, the colour targets posted before one are
+ * pushed ahead of it as a single LIGHT_CMD_COLOR.
+ */
+
+enum light_cmd_type {
+    LIGHT_CMD_HSV = 0,          /**< Colour attributes of the HSV mode, turns the light on */
+    LIGHT_CMD_CTB,              /**< Colour attributes of the white mode, turns the light on */
+    LIGHT_CMD_SWITCH,
+    LIGHT_CMD_CONFIG,
+    LIGHT_CMD_RGB,
+    LIGHT_CMD_BREATH_START,
+    LIGHT_CMD_BREATH_STOP,
+    LIGHT_CMD_FADE_BRIGHTNESS,
+    LIGHT_CMD_FADE_HUE,
+    LIGHT_CMD_FADE_WARM,
+    LIGHT_CMD_FADE_STOP,
+    LIGHT_CMD_DIM_START,
+    LIGHT_CMD_DIM_STOP,
+    LIGHT_CMD_EFFECT_START,
+    LIGHT_CMD_EFFECT_STOP,
+    LIGHT_CMD_SCENE_SAVE,
+    LIGHT_CMD_SCENE_RECALL,
+    LIGHT_CMD_SCENE_DELETE,
+    LIGHT_CMD_CCT_TABLE,        /**< Swap in a new colour temperature table */
+    LIGHT_CMD_SCHEDULE,         /**< Swap in a new schedule, NULL to stop following one */
+    LIGHT_CMD_EXIT,             /**< Stop the control task and notify the waiter */
+    LIGHT_CMD_COLOR,            /**< Colour targets folded by light_driver_post() */
+};
+
+#define LIGHT_ATTR_HUE        BIT(0)
+#define LIGHT_ATTR_SATURATION BIT(1)
+#define LIGHT_ATTR_VALUE      BIT(2)
+#define LIGHT_ATTR_KELVIN     BIT(3)    /**< Given in kelvin, or as color_temperature if kelvin is 0 */
+#define LIGHT_ATTR_BRIGHTNESS BIT(4)
+
+typedef struct {
+    uint8_t type;
+    uint8_t attrs;              /**< LIGHT_ATTR_* set by a colour command */
+    uint8_t mode;               /**< Mode of the newest command folded into a LIGHT_CMD_COLOR, MODE_NONE if none */
+    bool on;
+    uint8_t saturation;
+    uint8_t value;
+    uint8_t color_temperature;
+    uint8_t brightness;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t scene_id;
+    uint8_t direction;          /**< light_dim_direction_t */
+    uint8_t rate;               /**< Dimming rate, percent a second */
+    uint16_t hue;
+    uint16_t kelvin;
+    union {
+        uint32_t fade_period_ms;
+        light_effect_t effect;
+        light_cct_table_t *table;
+        light_schedule_t *schedule;
+        TaskHandle_t waiter;
+    };
+    uint32_t blink_period_ms;
+} light_cmd_t;
+
+/**
+ * @brief Newest target of each colour attribute, folded from the commands posted so far
+ */
+typedef struct {
+    light_cmd_t color;          /**< attrs of every colour command folded in, and their newest values */
+    uint8_t mode;               /**< Mode of the newest colour command, MODE_NONE if none */
+    bool switched;              /**< The newest command deciding on or off, in on */
+} light_pending_t;
+
+static light_queue_handle_t g_light_cmd_queue = NULL;
+static TaskHandle_t g_light_ctrl_task          = NULL;
+static volatile uint32_t g_light_cmd_dropped   = 0;     /**< Commands refused by a full ring */
+
+/**< Colour targets posted after everything in the ring, pushes to the ring and takes of it are under g_light_cmd_lock */
+static light_pending_t g_light_cmd_color       = {0};
+static portMUX_TYPE g_light_cmd_lock           = portMUX_INITIALIZER_UNLOCKED;
+
+static void light_driver_fold(light_pending_t *pending, const light_cmd_t *cmd)
+{
+    light_cmd_t *color = &pending->color;
+
+    if (cmd->type == LIGHT_CMD_SWITCH) {
+        pending->switched = true;
+        color->on = cmd->on;
+        return;
+    }
+
+    if (cmd->attrs & LIGHT_ATTR_HUE) {
+        color->hue = cmd->hue;
+    }
+
+    if (cmd->attrs & LIGHT_ATTR_SATURATION) {
+        color->saturation = cmd->saturation;
+    }
+
+    if (cmd->attrs & LIGHT_ATTR_VALUE) {
+        color->value = cmd->value;
+    }
+
+    if (cmd->attrs & LIGHT_ATTR_KELVIN) {
+        color->kelvin = cmd->kelvin;
+        color->color_temperature = cmd->color_temperature;
+    }
+
+    if (cmd->attrs & LIGHT_ATTR_BRIGHTNESS) {
+        color->brightness = cmd->brightness;
+    }
+
+    color->attrs |= cmd->attrs;
+    pending->mode = (cmd->type == LIGHT_CMD_HSV) ? MODE_HSV : MODE_CTB;
+    pending->switched = true;
+    color->on = true;
+}
+
+/**
+ * @brief Move the folded colour targets into one LIGHT_CMD_COLOR, inside g_light_cmd_lock
+ *
+ * @return false if no colour command was posted since the last one
+ */
+static bool light_driver_seal(light_cmd_t *cmd)
+{
+    if (!g_light_cmd_color.switched) {
+        return false;
+    }
+
+    *cmd = g_light_cmd_color.color;
+    cmd->type = LIGHT_CMD_COLOR;
+    cmd->mode = g_light_cmd_color.mode;
+    memset(&g_light_cmd_color, 0, sizeof(light_pending_t));
+
+    return true;
+}
+
+/**
+ * @brief Carry out the folded colour commands, as their last one would have left the light
+ */
+static void light_driver_apply_pending(light_pending_t *pending)
+{
+    esp_err_t ret = ESP_OK;
+    const light_cmd_t *color = &pending->color;
+
+    if (!pending->switched) {
+        return;
+    }
+
+    /**< Attributes of the mode not shown are only saved */
+    if (color->attrs & LIGHT_ATTR_HUE) {
+        g_light_status.hue = color->hue;
+    }
+
+    if (color->attrs & LIGHT_ATTR_SATURATION) {
+        g_light_status.saturation = color->saturation;
+    }
+
+    if (color->attrs & LIGHT_ATTR_VALUE) {
+        g_light_status.value = color->value;
+    }
+
+    if (color->attrs & LIGHT_ATTR_KELVIN) {
+        g_light_status.kelvin = color->kelvin ? color->kelvin : light_driver_percent_to_kelvin(color->color_temperature);
+        g_light_status.color_temperature = color->kelvin ? light_driver_kelvin_to_percent(color->kelvin) : color->color_temperature;
+    }
+
+    if (color->attrs & LIGHT_ATTR_BRIGHTNESS) {
+        g_light_status.brightness = color->brightness;
+    }
+
+    if (!color->on) {
+        g_light_status.mode = (pending->mode != MODE_NONE) ? pending->mode : g_light_status.mode;
+        ret = light_driver_apply_switch(false);
+    } else if (pending->mode == MODE_HSV) {
+        ret = light_driver_apply_hsv(g_light_status.hue, g_light_status.saturation, g_light_status.value);
+    } else if (pending->mode == MODE_CTB) {
+        ret = light_driver_apply_ctb(g_light_status.kelvin, g_light_status.color_temperature, g_light_status.brightness,
+                                     g_light_status.fade_period_ms);
+    } else {
+        ret = light_driver_apply_switch(true);
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Apply colour, mode: %d, on: %d, ret: %d", pending->mode, color->on, ret);
+    }
+
+    light_driver_store();
+    memset(pending, 0, sizeof(light_pending_t));
+}
+
+static esp_err_t light_driver_apply_cmd(const light_cmd_t *cmd)
+{
+    switch (cmd->type) {
+        case LIGHT_CMD_COLOR: {
+            light_pending_t pending = {
+                .color    = *cmd,
+                .mode     = cmd->mode,
+                .switched = true,
+            };
+            light_driver_apply_pending(&pending);
+            return ESP_OK;
+        }
+
+        case LIGHT_CMD_CONFIG:
+            return light_driver_apply_config(cmd->fade_period_ms, cmd->blink_period_ms);
+
+        case LIGHT_CMD_RGB:
+            return light_driver_apply_rgb(cmd->red, cmd->green, cmd->blue);
+
+        case LIGHT_CMD_BREATH_START:
+            return light_driver_apply_breath_start(cmd->red, cmd->green, cmd->blue);
+
+        case LIGHT_CMD_BREATH_STOP:
+            return light_driver_apply_breath_stop();
+
+        case LIGHT_CMD_FADE_BRIGHTNESS:
+            return light_driver_apply_fade_brightness(cmd->brightness);
+
+        case LIGHT_CMD_FADE_HUE:
+            return light_driver_apply_fade_hue(cmd->hue);
+
+        case LIGHT_CMD_FADE_WARM:
+            return light_driver_apply_fade_warm(cmd->color_temperature);
+
+        case LIGHT_CMD_FADE_STOP:
+            return light_driver_apply_fade_stop();
+
+        case LIGHT_CMD_DIM_START:
+            return light_driver_apply_dim_start(cmd->direction, cmd->rate);
+
+        case LIGHT_CMD_DIM_STOP:
+            return light_driver_apply_dim_stop();
+
+        case LIGHT_CMD_EFFECT_START:
+            return light_driver_apply_effect_start(cmd->effect);
+
+        case LIGHT_CMD_EFFECT_STOP:
+            return light_driver_apply_effect_stop();
+
+        case LIGHT_CMD_SCENE_SAVE:
+            return light_driver_apply_scene_save(cmd->scene_id, cmd->fade_period_ms);
+
+        case LIGHT_CMD_SCENE_RECALL:
+            return light_driver_apply_scene_recall(cmd->scene_id);
+
+        case LIGHT_CMD_SCENE_DELETE:
+            return light_driver_apply_scene_delete(cmd->scene_id);
+
+        case LIGHT_CMD_CCT_TABLE:
+            g_light_cct = *cmd->table;
+            free(cmd->table);
+            return ESP_OK;
+
+        case LIGHT_CMD_SCHEDULE:
+            free(g_light_schedule);
+            g_light_schedule = cmd->schedule;
+            g_light_schedule_tick = xTaskGetTickCount() - pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_SCHEDULE_PERIOD_MS);
+            return ESP_OK;
+
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+/**
+ * @brief Ticks until the schedule is evaluated again
+ */
+static TickType_t light_driver_schedule_wait(void)
+{
+    TickType_t period  = pdMS_TO_TICKS(CONFIG_LIGHT_DRIVER_SCHEDULE_PERIOD_MS);
+    TickType_t elapsed = xTaskGetTickCount() - g_light_schedule_tick;
+
+    if (!g_light_schedule) {
+        return portMAX_DELAY;
+    }
+
+    return (elapsed >= period) ? 0 : period - elapsed;
+}
+
+/**
+ * @brief Fade to the output of the schedule if it has changed, only while the light shows white
+ *
+ * @note The output is not saved, the schedule gives it again after a restart
+ */
+static void light_driver_schedule_run(void)
+{
+    esp_err_t ret = ESP_OK;
+    time_t now    = time(NULL);
+    struct tm tm;
+    uint16_t kelvin;
+    uint8_t brightness;
+
+    g_light_schedule_tick = xTaskGetTickCount();
+    localtime_r(&now, &tm);
+
+    /**< Wait for the clock to be set, by SNTP or the app */
+    if (tm.tm_year + 1900 < LIGHT_SCHEDULE_YEAR_MIN || !g_light_status.on || g_light_status.mode != MODE_CTB) {
+        return;
+    }
+
+    if (!light_schedule_step(g_light_schedule, tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec, &kelvin, &brightness)) {
+        return;
+    }
+
+    /**< Fade over the period, the light moves on continuously to the next output */
+    ret = light_driver_apply_ctb(kelvin, light_driver_kelvin_to_percent(kelvin), brightness,
+                                 CONFIG_LIGHT_DRIVER_SCHEDULE_PERIOD_MS);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Apply schedule, kelvin: %d, brightness: %d, ret: %d", kelvin, brightness, ret);
+    }
+}
+
+/**
+ * @brief Take the oldest command of the ring, or the folded colour targets once it is empty
+ *
+ * @note The colour targets are newer than anything in the ring, the ring is
+ *     checked empty under the lock they are taken with
+ */
+static bool light_driver_take(light_cmd_t *cmd)
+{
+    portENTER_CRITICAL(&g_light_cmd_lock);
+    bool taken = light_queue_pop(g_light_cmd_queue, cmd) || light_driver_seal(cmd);
+    portEXIT_CRITICAL(&g_light_cmd_lock);
 
-    return ESP_OK;
+    return taken;
 }
 
-esp_err_t light_driver_set_rgb(uint8_t red, uint8_t green, uint8_t blue)
+static void light_driver_control_task(void *arg)
 {
-    esp_err_t ret = 0;
-
-    ret = iot_led_set_channel(CHANNEL_ID_RED, red, 0);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    light_cmd_t cmd;
 
-    ret = iot_led_set_channel(CHANNEL_ID_GREEN, green, 0);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, light_driver_schedule_wait());
 
-    ret = iot_led_set_channel(CHANNEL_ID_BLUE, blue, 0);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+        if (g_light_schedule && !light_driver_schedule_wait()) {
+            light_driver_schedule_run();
+        }
 
-    ret = iot_led_set_channel(CHANNEL_ID_WARM, 0, 0);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+        while (light_driver_take(&cmd)) {
+            if (cmd.type == LIGHT_CMD_EXIT) {
+                g_light_ctrl_task = NULL;
+                xTaskNotifyGive(cmd.waiter);
+                vTaskDelete(NULL);
+            }
 
-    ret = iot_led_set_channel(CHANNEL_ID_COLD, 0, 0);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+            esp_err_t ret = light_driver_apply_cmd(&cmd);
 
-    return ESP_OK;
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Apply command %d, ret: %d", cmd.type, ret);
+            }
+        }
+    }
 }
 
-static esp_err_t light_driver_hsv2rgb(uint16_t hue, uint8_t saturation, uint8_t value,
-                                      uint8_t *red, uint8_t *green, uint8_t *blue)
+/**
+ * @brief Hand a command to the control task, never blocks
+ */
+static esp_err_t light_driver_post(const light_cmd_t *cmd)
 {
-    hue = hue % 360;
-    uint16_t hi = (hue / 60) % 6;
-    uint16_t F = 100 * hue / 60 - 100 * hi;
-    uint16_t P = value * (100 - saturation) / 100;
-    uint16_t Q = value * (10000 - F * saturation) / 10000;
-    uint16_t T = value * (10000 - saturation * (100 - F)) / 10000;
+    LIGHT_ERROR_CHECK(!g_light_ctrl_task, ESP_ERR_INVALID_STATE, "light_driver_init not called");
 
-    switch (hi) {
-        case 0:
-            *red   = value;
-            *green = T;
-            *blue  = P;
-            break;
+    bool in_isr = xPortInIsrContext();
+    bool pushed = true;
+    light_cmd_t color;
 
-        case 1:
-            *red   = Q;
-            *green = value;
-            *blue  = P;
-            break;
+    portENTER_CRITICAL_SAFE(&g_light_cmd_lock);
+
+    if (cmd->type == LIGHT_CMD_HSV || cmd->type == LIGHT_CMD_CTB || cmd->type == LIGHT_CMD_SWITCH) {
+        /**< A superseded target is overwritten, the newest one is never dropped */
+        light_driver_fold(&g_light_cmd_color, cmd);
+    } else {
+        /**< The command sees the colour targets posted before it, they stay folded if there is no room */
+        light_pending_t folded = g_light_cmd_color;
 
-        case 2:
-            *red   = P;
-            *green = value;
-            *blue  = T;
-            break;
+        if (light_driver_seal(&color) && !light_queue_push(g_light_cmd_queue, &color)) {
+            g_light_cmd_color = folded;
+            pushed = false;
+        }
 
-        case 3:
-            *red   = P;
-            *green = Q;
-            *blue  = value;
-            break;
+        pushed = pushed && light_queue_push(g_light_cmd_queue, cmd);
+    }
 
-        case 4:
-            *red   = T;
-            *green = P;
-            *blue  = value;
-            break;
+    portEXIT_CRITICAL_SAFE(&g_light_cmd_lock);
 
-        case 5:
-            *red   = value;
-            *green = P;
-            *blue  = Q;
-            break;
+    if (!pushed) {
+        g_light_cmd_dropped++;
 
-        default:
-            return ESP_FAIL;
+        if (!in_isr) {
+            ESP_LOGW(TAG, "Command queue full, command %d dropped", cmd->type);
+        }
+
+        return ESP_ERR_NO_MEM;
     }
 
-    *red   = *red * 255 / 100;
-    *green = *green * 255 / 100;
-    *blue  = *blue * 255 / 100;
+    if (in_isr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(g_light_ctrl_task, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotifyGive(g_light_ctrl_task);
+    }
 
     return ESP_OK;
 }
 
-static void light_driver_rgb2hsv(uint16_t red, uint16_t green, uint16_t blue,
-                                 uint16_t *h, uint8_t *s, uint8_t *v)
+static esp_err_t light_driver_control_init(void)
 {
-    double hue, saturation, value;
-    double m_max = MAX(red, MAX(green, blue));
-    double m_min = MIN(red, MIN(green, blue));
-    double m_delta = m_max - m_min;
+    if (g_light_ctrl_task) {
+        return ESP_OK;
+    }
 
-    value = m_max / 255.0;
+    if (!g_light_cmd_queue) {
+        g_light_cmd_queue = light_queue_create(CONFIG_LIGHT_DRIVER_CMD_QUEUE_LEN, sizeof(light_cmd_t));
+        LIGHT_ERROR_CHECK(!g_light_cmd_queue, ESP_ERR_NO_MEM, "light_queue_create");
+    }
 
-    if (m_delta == 0) {
-        hue = 0;
-        saturation = 0;
-    } else {
-        saturation = m_delta / m_max;
+    BaseType_t task_ret = xTaskCreate(light_driver_control_task, "light_ctrl", LIGHT_CTRL_TASK_STACK,
+                                      NULL, LIGHT_CTRL_TASK_PRIO, &g_light_ctrl_task);
+    LIGHT_ERROR_CHECK(task_ret != pdPASS, ESP_ERR_NO_MEM, "xTaskCreate light_ctrl");
 
-        if (red == m_max) {
-            hue = (green - blue) / m_delta;
-        } else if (green == m_max) {
-            hue = 2 + (blue - red) / m_delta;
-        } else {
-            hue = 4 + (red - green) / m_delta;
-        }
+    return ESP_OK;
+}
 
-        hue = hue * 60;
+/**
+ * @brief Let the control task carry out the commands already posted, then stop it
+ */
+static void light_driver_control_deinit(void)
+{
+    if (!g_light_ctrl_task) {
+        return;
+    }
 
-        if (hue < 0) {
-            hue = hue + 360;
-        }
+    light_cmd_t cmd = {
+        .type   = LIGHT_CMD_EXIT,
+        .waiter = xTaskGetCurrentTaskHandle(),
+    };
+
+    /**< The exit has to get through, wait for room rather than drop it */
+    while (light_driver_post(&cmd) == ESP_ERR_NO_MEM) {
+        vTaskDelay(1);
     }
 
-    *h = (int)(hue + 0.5);
-    *s = (int)(saturation * 100 + 0.5);
-    *v = (int)(value * 100 + 0.5);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 }
 
-esp_err_t light_driver_set_hsv(uint16_t hue, uint8_t saturation, uint8_t value)
+uint32_t light_driver_get_dropped(void)
 {
-    LIGHT_PARAM_CHECK(hue <= 360);
-    LIGHT_PARAM_CHECK(saturation <= 100);
-    LIGHT_PARAM_CHECK(value <= 100);
+    return g_light_cmd_dropped;
+}
 
-    esp_err_t ret = ESP_OK;
-    uint8_t red   = 0;
-    uint8_t green = 0;
-    uint8_t blue  = 0;
+esp_err_t light_driver_set_cct_calibration(const light_cct_calibration_t *calibration)
+{
+    LIGHT_PARAM_CHECK(calibration);
 
-    ret = light_driver_hsv2rgb(hue, saturation, value, &red, &green, &blue);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_hsv2rgb, ret: %d", ret);
+    esp_err_t ret = ESP_OK;
+    light_cct_table_t table;
 
-    ESP_LOGV(TAG, "red: %d, green: %d, blue: %d", red, green, blue);
+    ret = light_cct_table_init(calibration, &table);
+    LIGHT_ERROR_CHECK(ret < 0, ret, "light_cct_table_init, ret: %d", ret);
 
-    ret = iot_led_set_channel(CHANNEL_ID_RED, red, g_light_status.fade_period_ms);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    if (calibration->rated_flux && table.flux < calibration->rated_flux) {
+        ESP_LOGW(TAG, "Fixture reaches %d lm at every colour temperature, below the rated %d lm",
+                 table.flux, calibration->rated_flux);
+    }
 
-    ret = iot_led_set_channel(CHANNEL_ID_GREEN, green, g_light_status.fade_period_ms);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    ret = app_storage_set(LIGHT_CCT_STORE_KEY, calibration, sizeof(light_cct_calibration_t));
+    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
 
-    ret = iot_led_set_channel(CHANNEL_ID_BLUE, blue, g_light_status.fade_period_ms);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    /**< The control task reads the table, it swaps it in between two commands */
+    light_cmd_t cmd = {
+        .type  = LIGHT_CMD_CCT_TABLE,
+        .table = malloc(sizeof(light_cct_table_t)),
+    };
+    LIGHT_ERROR_CHECK(!cmd.table, ESP_ERR_NO_MEM, "malloc light_cct_table_t");
+    *cmd.table = table;
 
-    if (g_light_status.mode != MODE_HSV) {
-        ret = iot_led_set_channel(CHANNEL_ID_WARM, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    ret = light_driver_post(&cmd);
 
-        ret = iot_led_set_channel(CHANNEL_ID_COLD, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    if (ret != ESP_OK) {
+        free(cmd.table);
     }
 
-    g_light_status.mode       = MODE_HSV;
-    g_light_status.on         = 1;
-    g_light_status.hue        = hue;
-    g_light_status.value      = value;
-    g_light_status.saturation = saturation;
-
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
-
-    return ESP_OK;
+    return ret;
 }
 
-esp_err_t light_driver_set_hue(uint16_t hue)
+esp_err_t light_driver_config(uint32_t fade_period_ms, uint32_t blink_period_ms)
 {
-    return light_driver_set_hsv(hue, g_light_status.saturation, g_light_status.value);
-}
+    const light_cmd_t cmd = {
+        .type            = LIGHT_CMD_CONFIG,
+        .fade_period_ms  = fade_period_ms,
+        .blink_period_ms = blink_period_ms,
+    };
 
-esp_err_t light_driver_set_saturation(uint8_t saturation)
-{
-    return light_driver_set_hsv(g_light_status.hue, saturation, g_light_status.value);
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_set_value(uint8_t value)
+esp_err_t light_driver_set_rgb(uint8_t red, uint8_t green, uint8_t blue)
 {
-    return light_driver_set_hsv(g_light_status.hue, g_light_status.saturation, value);
+    const light_cmd_t cmd = {
+        .type  = LIGHT_CMD_RGB,
+        .red   = red,
+        .green = green,
+        .blue  = blue,
+    };
+
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_get_hsv(uint16_t *hue, uint8_t *saturation, uint8_t *value)
+esp_err_t light_driver_set_hsv(uint16_t hue, uint8_t saturation, uint8_t value)
 {
-    LIGHT_PARAM_CHECK(hue);
-    LIGHT_PARAM_CHECK(saturation);
-    LIGHT_PARAM_CHECK(value);
+    LIGHT_PARAM_CHECK(hue <= 360);
+    LIGHT_PARAM_CHECK(saturation <= 100);
+    LIGHT_PARAM_CHECK(value <= 100);
 
-    *hue        = g_light_status.hue;
-    *saturation = g_light_status.saturation;
-    *value      = g_light_status.value;
+    const light_cmd_t cmd = {
+        .type       = LIGHT_CMD_HSV,
+        .attrs      = LIGHT_ATTR_HUE | LIGHT_ATTR_SATURATION | LIGHT_ATTR_VALUE,
+        .hue        = hue,
+        .saturation = saturation,
+        .value      = value,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-uint16_t light_driver_get_hue()
+esp_err_t light_driver_set_hue(uint16_t hue)
 {
-    return g_light_status.hue;
-}
+    LIGHT_PARAM_CHECK(hue <= 360);
 
-uint8_t light_driver_get_saturation()
-{
-    return g_light_status.saturation;
+    const light_cmd_t cmd = {
+        .type  = LIGHT_CMD_HSV,
+        .attrs = LIGHT_ATTR_HUE,
+        .hue   = hue,
+    };
+
+    return light_driver_post(&cmd);
 }
 
-uint8_t light_driver_get_value()
+esp_err_t light_driver_set_saturation(uint8_t saturation)
 {
-    return g_light_status.value;
+    LIGHT_PARAM_CHECK(saturation <= 100);
+
+    const light_cmd_t cmd = {
+        .type       = LIGHT_CMD_HSV,
+        .attrs      = LIGHT_ATTR_SATURATION,
+        .saturation = saturation,
+    };
+
+    return light_driver_post(&cmd);
 }
 
-uint8_t light_driver_get_mode()
+esp_err_t light_driver_set_value(uint8_t value)
 {
-    return g_light_status.mode;
+    LIGHT_PARAM_CHECK(value <= 100);
+
+    const light_cmd_t cmd = {
+        .type  = LIGHT_CMD_HSV,
+        .attrs = LIGHT_ATTR_VALUE,
+        .value = value,
+    };
+
+    return light_driver_post(&cmd);
 }
 
 esp_err_t light_driver_set_ctb(uint8_t color_temperature, uint8_t brightness)
@@ -326,402 +2229,282 @@ esp_err_t light_driver_set_ctb(uint8_t color_temperature, uint8_t brightness)
     LIGHT_PARAM_CHECK(brightness <= 100);
     LIGHT_PARAM_CHECK(color_temperature <= 100);
 
-    esp_err_t ret = ESP_OK;
-    uint8_t warm_tmp = color_temperature * brightness / 100;
-    uint8_t cold_tmp = (100 - color_temperature) * brightness / 100;
-    warm_tmp         = warm_tmp < 15 ? warm_tmp : 14 + warm_tmp * 86 / 100;
-    cold_tmp         = cold_tmp < 15 ? cold_tmp : 14 + cold_tmp * 86 / 100;
-
-    ret = iot_led_set_channel(CHANNEL_ID_COLD,
-                              cold_tmp * 255 / 100, g_light_status.fade_period_ms);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-
-    ret = iot_led_set_channel(CHANNEL_ID_WARM,
-                              warm_tmp * 255 / 100, g_light_status.fade_period_ms);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-
-    if (g_light_status.mode != MODE_CTB) {
-        ret = iot_led_set_channel(CHANNEL_ID_RED, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_GREEN, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_BLUE, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-    }
-
-    g_light_status.mode              = MODE_CTB;
-    g_light_status.on                = 1;
-    g_light_status.brightness        = brightness;
-    g_light_status.color_temperature = color_temperature;
+    const light_cmd_t cmd = {
+        .type              = LIGHT_CMD_CTB,
+        .attrs             = LIGHT_ATTR_KELVIN | LIGHT_ATTR_BRIGHTNESS,
+        .color_temperature = color_temperature,
+        .brightness        = brightness,
+    };
 
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
-
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
 esp_err_t light_driver_set_color_temperature(uint8_t color_temperature)
 {
-    return light_driver_set_ctb(color_temperature, g_light_status.brightness);
+    LIGHT_PARAM_CHECK(color_temperature <= 100);
+
+    const light_cmd_t cmd = {
+        .type              = LIGHT_CMD_CTB,
+        .attrs             = LIGHT_ATTR_KELVIN,
+        .color_temperature = color_temperature,
+    };
+
+    return light_driver_post(&cmd);
 }
 
 esp_err_t light_driver_set_brightness(uint8_t brightness)
 {
-    return light_driver_set_ctb(g_light_status.color_temperature, brightness);
+    LIGHT_PARAM_CHECK(brightness <= 100);
+
+    const light_cmd_t cmd = {
+        .type       = LIGHT_CMD_CTB,
+        .attrs      = LIGHT_ATTR_BRIGHTNESS,
+        .brightness = brightness,
+    };
+
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_get_ctb(uint8_t *color_temperature, uint8_t *brightness)
+esp_err_t light_driver_set_cct(uint16_t kelvin, uint8_t brightness)
 {
-    LIGHT_PARAM_CHECK(color_temperature);
-    LIGHT_PARAM_CHECK(brightness);
+    LIGHT_PARAM_CHECK(brightness <= 100);
+    LIGHT_PARAM_CHECK(kelvin >= LIGHT_CCT_KELVIN_MIN && kelvin <= LIGHT_CCT_KELVIN_MAX);
 
-    *brightness        = g_light_status.brightness;
-    *color_temperature = g_light_status.color_temperature;
+    const light_cmd_t cmd = {
+        .type       = LIGHT_CMD_CTB,
+        .attrs      = LIGHT_ATTR_KELVIN | LIGHT_ATTR_BRIGHTNESS,
+        .kelvin     = kelvin,
+        .brightness = brightness,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-uint8_t light_driver_get_color_temperature()
+esp_err_t light_driver_set_kelvin(uint16_t kelvin)
 {
-    return g_light_status.color_temperature;
-}
+    LIGHT_PARAM_CHECK(kelvin >= LIGHT_CCT_KELVIN_MIN && kelvin <= LIGHT_CCT_KELVIN_MAX);
 
-uint8_t light_driver_get_brightness()
-{
-    return g_light_status.brightness;
+    const light_cmd_t cmd = {
+        .type   = LIGHT_CMD_CTB,
+        .attrs  = LIGHT_ATTR_KELVIN,
+        .kelvin = kelvin,
+    };
+
+    return light_driver_post(&cmd);
 }
 
 esp_err_t light_driver_set_switch(bool on)
 {
-    esp_err_t ret     = ESP_OK;
-    g_light_status.on = on;
-
-    if (!g_light_status.on) {
-        ret = iot_led_set_channel(CHANNEL_ID_RED, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_GREEN, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_BLUE, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_COLD, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_set_channel, ret: %d", ret);
-
-        ret = iot_led_set_channel(CHANNEL_ID_WARM, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_set_channel, ret: %d", ret);
-
-    } else {
-        switch (g_light_status.mode) {
-            case MODE_HSV:
-                g_light_status.value = (g_light_status.value) ? g_light_status.value : 100;
-                ret = light_driver_set_hsv(g_light_status.hue, g_light_status.saturation, g_light_status.value);
-                LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_set_hsv, ret: %d", ret);
-                break;
-
-            case MODE_CTB:
-                g_light_status.brightness = (g_light_status.brightness) ? g_light_status.brightness : 100;
-                ret = light_driver_set_ctb(g_light_status.color_temperature, g_light_status.brightness);
-                LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "light_driver_set_ctb, ret: %d", ret);
-                break;
-
-            default:
-                ESP_LOGW(TAG, "This operation is not supported");
-                break;
-        }
-    }
-
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "app_storage_set, ret: %d", ret);
+    const light_cmd_t cmd = {
+        .type = LIGHT_CMD_SWITCH,
+        .on   = on,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-bool light_driver_get_switch()
+esp_err_t light_driver_breath_start(uint8_t red, uint8_t green, uint8_t blue)
 {
-    return g_light_status.on;
+    const light_cmd_t cmd = {
+        .type  = LIGHT_CMD_BREATH_START,
+        .red   = red,
+        .green = green,
+        .blue  = blue,
+    };
+
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_breath_start(uint8_t red, uint8_t green, uint8_t blue)
+esp_err_t light_driver_breath_stop()
 {
-    esp_err_t ret = ESP_OK;
-
-    ret = iot_led_start_blink(CHANNEL_ID_RED,
-                              red, g_light_status.blink_period_ms, true);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
-    ret = iot_led_start_blink(CHANNEL_ID_GREEN,
-                              green, g_light_status.blink_period_ms, true);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
-    ret = iot_led_start_blink(CHANNEL_ID_BLUE,
-                              blue, g_light_status.blink_period_ms, true);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_start_blink, ret: %d", ret);
+    const light_cmd_t cmd = {.type = LIGHT_CMD_BREATH_STOP};
 
-    g_light_blink_flag = true;
-
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_breath_stop()
+esp_err_t light_driver_fade_brightness(uint8_t brightness)
 {
-    esp_err_t ret = ESP_OK;
-
-    if (g_light_blink_flag == false) {
-        return ESP_OK;
-    }
+    LIGHT_PARAM_CHECK(brightness <= 100);
 
-    ret = iot_led_stop_blink(CHANNEL_ID_RED);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+    const light_cmd_t cmd = {
+        .type       = LIGHT_CMD_FADE_BRIGHTNESS,
+        .brightness = brightness,
+    };
 
-    ret = iot_led_stop_blink(CHANNEL_ID_GREEN);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+    return light_driver_post(&cmd);
+}
 
-    ret = iot_led_stop_blink(CHANNEL_ID_BLUE);
-    LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+esp_err_t light_driver_fade_hue(uint16_t hue)
+{
+    LIGHT_PARAM_CHECK(hue <= 360);
 
-    light_driver_set_switch(true);
+    const light_cmd_t cmd = {
+        .type = LIGHT_CMD_FADE_HUE,
+        .hue  = hue,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_fade_brightness(uint8_t brightness)
+esp_err_t light_driver_fade_warm(uint8_t color_temperature)
 {
-    esp_err_t ret = ESP_OK;
-    g_fade_mode   = MODE_ON;
-    uint32_t fade_period_ms = 0;
+    LIGHT_PARAM_CHECK(color_temperature <= 100);
 
-    if (g_light_status.mode == MODE_HSV) {
-        uint8_t red   = 0;
-        uint8_t green = 0;
-        uint8_t blue  = 0;
-
-        ret = light_driver_hsv2rgb(g_light_status.hue, g_light_status.saturation, g_light_status.value, &red, &green, &blue);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "light_driver_hsv2rgb, ret: %d", ret);
-
-        if (brightness != 0) {
-            ret = iot_led_get_channel((ledc_channel_t)CHANNEL_ID_RED, &red);
-            LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-            ret = iot_led_get_channel((ledc_channel_t)CHANNEL_ID_GREEN, &green);
-            LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-            ret = iot_led_get_channel((ledc_channel_t)CHANNEL_ID_BLUE, &blue);
-            LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-
-            uint8_t max_color       = MAX(MAX(red, green), blue);
-            uint8_t change_value    = brightness * 255 / 100 - max_color;
-            fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * change_value / 255;
-        } else {
-            fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * MAX(MAX(red, green), blue) / 255;
-            red   = 0;
-        }
+    const light_cmd_t cmd = {
+        .type              = LIGHT_CMD_FADE_WARM,
+        .color_temperature = color_temperature,
+    };
 
-        g_light_status.value = brightness;
-        light_driver_hsv2rgb(g_light_status.hue, g_light_status.saturation, g_light_status.value, &red, &green, &blue);
+    return light_driver_post(&cmd);
+}
 
-        ret = iot_led_set_channel(CHANNEL_ID_RED, red, fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+esp_err_t light_driver_fade_stop()
+{
+    const light_cmd_t cmd = {.type = LIGHT_CMD_FADE_STOP};
 
-        ret = iot_led_set_channel(CHANNEL_ID_GREEN, green, fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    return light_driver_post(&cmd);
+}
 
-        ret = iot_led_set_channel(CHANNEL_ID_BLUE, blue, fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+esp_err_t light_driver_dim_start(light_dim_direction_t direction, uint8_t rate)
+{
+    LIGHT_PARAM_CHECK(direction == LIGHT_DIM_DOWN || direction == LIGHT_DIM_UP);
+    LIGHT_PARAM_CHECK(rate > 0 && rate <= 100);
 
-    } else if (g_light_status.mode == MODE_CTB) {
-        uint8_t warm_tmp = 0;
-        uint8_t cold_tmp = 0;
-        fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * g_light_status.brightness / 100;
+    const light_cmd_t cmd = {
+        .type      = LIGHT_CMD_DIM_START,
+        .direction = direction,
+        .rate      = rate,
+    };
 
-        if (brightness != 0) {
-            uint8_t change_value = brightness - g_light_status.brightness;
-            warm_tmp = g_light_status.color_temperature;
-            cold_tmp = (brightness - g_light_status.color_temperature);
-            fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * change_value / 100;
-        }
+    return light_driver_post(&cmd);
+}
 
-        ret = iot_led_set_channel(CHANNEL_ID_COLD,
-                                  cold_tmp * 255 / 100, fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+esp_err_t light_driver_dim_stop(void)
+{
+    const light_cmd_t cmd = {.type = LIGHT_CMD_DIM_STOP};
 
-        ret = iot_led_set_channel(CHANNEL_ID_WARM,
-                                  warm_tmp * 255 / 100, fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    return light_driver_post(&cmd);
+}
 
-        g_light_status.brightness = brightness;
-    }
+esp_err_t light_driver_effect_start(light_effect_t effect)
+{
+    LIGHT_PARAM_CHECK(effect < LIGHT_EFFECT_MAX);
 
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
+    const light_cmd_t cmd = {
+        .type   = LIGHT_CMD_EFFECT_START,
+        .effect = effect,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-static void light_fade_timer_stop()
+esp_err_t light_driver_effect_stop()
 {
-    if (!g_fade_timer) {
-        return ;
-    }
+    const light_cmd_t cmd = {.type = LIGHT_CMD_EFFECT_STOP};
 
-    if (!xTimerStop(g_fade_timer, portMAX_DELAY)) {
-        ESP_LOGW(TAG, "xTimerStop timer: %p", g_fade_timer);
-    }
-
-    if (!xTimerDelete(g_fade_timer, portMAX_DELAY)) {
-        ESP_LOGW(TAG, "xTimerDelete timer: %p", g_fade_timer);
-    }
-
-    g_fade_timer = NULL;
+    return light_driver_post(&cmd);
 }
 
-static void light_fade_timer_cb(TimerHandle_t xTimer)
+esp_err_t light_driver_scene_save(uint8_t scene_id, uint32_t fade_ms)
 {
-    uint8_t red   = 0;
-    uint8_t green = 0;
-    uint8_t blue  = 0;
-    uint32_t fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * 2 / 6;
-    int variety = (g_fade_hue > 180) ? 60 : -60;
-
-    if (g_light_status.hue >= 360 || g_light_status.hue <= 0) {
-        light_fade_timer_stop();
-    }
+    LIGHT_PARAM_CHECK(scene_id < CONFIG_LIGHT_DRIVER_SCENE_NUM);
 
-    g_light_status.hue = g_light_status.hue >= 360 ? 360 : g_light_status.hue + variety;
-    g_light_status.hue = g_light_status.hue <= 60 ? 0 : g_light_status.hue + variety;
-   
-    light_driver_hsv2rgb(g_light_status.hue, g_light_status.saturation, g_light_status.value, &red, &green, &blue);
+    const light_cmd_t cmd = {
+        .type           = LIGHT_CMD_SCENE_SAVE,
+        .scene_id       = scene_id,
+        .fade_period_ms = fade_ms,
+    };
 
-    iot_led_set_channel(CHANNEL_ID_RED, red, fade_period_ms);
-    iot_led_set_channel(CHANNEL_ID_GREEN, green, fade_period_ms);
-    iot_led_set_channel(CHANNEL_ID_BLUE, blue, fade_period_ms);
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_fade_hue(uint16_t hue)
+esp_err_t light_driver_scene_recall(uint8_t scene_id)
 {
-    esp_err_t ret = ESP_OK;
-    g_fade_mode   = MODE_HSV;
-    g_fade_hue    = hue;
-
-    light_fade_timer_stop();
-
-    if (g_light_status.mode != MODE_HSV) {
-        ret = iot_led_set_channel(CHANNEL_ID_WARM, 0, 0);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    LIGHT_PARAM_CHECK(scene_id < CONFIG_LIGHT_DRIVER_SCENE_NUM);
 
-        ret = iot_led_set_channel(CHANNEL_ID_COLD, 0, 0);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-    }
+    const light_cmd_t cmd = {
+        .type     = LIGHT_CMD_SCENE_RECALL,
+        .scene_id = scene_id,
+    };
 
-    g_light_status.mode     = MODE_HSV;
-    g_light_status.value    = (g_light_status.value == 0) ? 100 : g_light_status.value;
-    uint32_t fade_period_ms = LIGHT_FADE_PERIOD_MAX_MS * 2 / 6;
+    return light_driver_post(&cmd);
+}
 
-    light_fade_timer_cb(NULL);
+esp_err_t light_driver_scene_delete(uint8_t scene_id)
+{
+    LIGHT_PARAM_CHECK(scene_id < CONFIG_LIGHT_DRIVER_SCENE_NUM);
 
-    g_fade_timer = xTimerCreate("light_timer", fade_period_ms,
-                                true, NULL, light_fade_timer_cb);
-    xTimerStart(g_fade_timer, 0);
+    const light_cmd_t cmd = {
+        .type     = LIGHT_CMD_SCENE_DELETE,
+        .scene_id = scene_id,
+    };
 
-    return ESP_OK;
+    return light_driver_post(&cmd);
 }
 
-esp_err_t light_driver_fade_warm(uint8_t color_temperature)
+esp_err_t light_driver_schedule_start(const light_schedule_point_t *points, size_t num)
 {
+    LIGHT_PARAM_CHECK(points);
+    LIGHT_PARAM_CHECK(num && num <= LIGHT_SCHEDULE_POINT_MAX);
+
     esp_err_t ret = ESP_OK;
-    g_fade_mode   = MODE_CTB;
 
-    if (g_light_status.mode != MODE_CTB) {
-        ret = iot_led_set_channel(CHANNEL_ID_RED, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    /**< The control task evaluates the schedule, it swaps it in between two commands */
+    light_cmd_t cmd = {
+        .type     = LIGHT_CMD_SCHEDULE,
+        .schedule = malloc(sizeof(light_schedule_t)),
+    };
+    LIGHT_ERROR_CHECK(!cmd.schedule, ESP_ERR_NO_MEM, "malloc light_schedule_t");
 
-        ret = iot_led_set_channel(CHANNEL_ID_GREEN, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    ret = light_schedule_compile(points, num, cmd.schedule);
 
-        ret = iot_led_set_channel(CHANNEL_ID_BLUE, 0, g_light_status.fade_period_ms);
-        LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    if (ret != ESP_OK) {
+        free(cmd.schedule);
+        ESP_LOGE(TAG, "light_schedule_compile, ret: %d", ret);
+        return ret;
     }
 
-    uint8_t warm_tmp =  color_temperature * g_light_status.brightness / 100;
-    uint8_t cold_tmp = (100 - color_temperature) * g_light_status.brightness / 100;
+    ret = light_driver_post(&cmd);
 
-    ret = iot_led_set_channel(CHANNEL_ID_COLD, cold_tmp * 255 / 100, LIGHT_FADE_PERIOD_MAX_MS);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
-
-    ret = iot_led_set_channel(CHANNEL_ID_WARM, warm_tmp * 255 / 100, LIGHT_FADE_PERIOD_MAX_MS);
-    LIGHT_ERROR_CHECK(ret < 0, ret, "iot_led_set_channel, ret: %d", ret);
+    if (ret != ESP_OK) {
+        free(cmd.schedule);
+        return ret;
+    }
 
-    g_light_status.mode              = MODE_CTB;
-    g_light_status.color_temperature = color_temperature;
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
+    /**< The schedule runs now, the store task saves it with the next state */
+    light_driver_store_schedule(points, num);
 
     return ESP_OK;
 }
 
-esp_err_t light_driver_fade_stop()
+esp_err_t light_driver_schedule_stop(void)
 {
     esp_err_t ret = ESP_OK;
+    const light_cmd_t cmd = {
+        .type     = LIGHT_CMD_SCHEDULE,
+        .schedule = NULL,
+    };
 
-    light_fade_timer_stop();
-
-    if (g_light_status.mode != MODE_CTB) {
-        uint16_t hue       = 0;
-        uint8_t saturation = 0;
-        uint8_t value      = 0;
-
-        ret = iot_led_stop_blink(CHANNEL_ID_RED);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
-
-        ret = iot_led_stop_blink(CHANNEL_ID_GREEN);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
-
-        ret = iot_led_stop_blink(CHANNEL_ID_BLUE);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
-
-        uint8_t red, green, blue;
-
-        ret = iot_led_get_channel(CHANNEL_ID_RED, &red);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-        ret = iot_led_get_channel(CHANNEL_ID_GREEN, &green);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-        ret = iot_led_get_channel(CHANNEL_ID_BLUE, &blue);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-
-        light_driver_rgb2hsv(red, green, blue, &hue, &saturation, &value);
-
-        g_light_status.hue   = (g_fade_mode == MODE_HSV) ? hue : g_light_status.hue;
-        g_light_status.value = (g_fade_mode == MODE_OFF || g_fade_mode == MODE_ON) ? value : g_light_status.value;
-    } else {
-        uint8_t color_temperature = 0;
-        uint8_t brightness        = 0;
-
-        ret = iot_led_stop_blink(CHANNEL_ID_COLD);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
-
-        ret = iot_led_stop_blink(CHANNEL_ID_WARM);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_stop_blink, ret: %d", ret);
+    ret = light_driver_post(&cmd);
+    LIGHT_ERROR_CHECK(ret != ESP_OK, ret, "light_driver_post, ret: %d", ret);
 
-        uint8_t warm_tmp, cold_tmp;
-        uint8_t tmp;
+    light_driver_store_schedule(NULL, 0);
 
-        ret = iot_led_get_channel(CHANNEL_ID_WARM, &tmp);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-        warm_tmp = (int32_t)tmp * 100 / 255;
+    return ESP_OK;
+}
 
-        ret = iot_led_get_channel(CHANNEL_ID_COLD, &tmp);
-        LIGHT_ERROR_CHECK(ret < 0, ESP_FAIL, "iot_led_get_channel, ret: %d", ret);
-        cold_tmp = (int32_t)tmp * 100 / 255;
+esp_err_t light_driver_get_power_stats(light_power_stats_t *stats, bool reset)
+{
+    LIGHT_PARAM_CHECK(stats);
 
-        color_temperature = (!warm_tmp) ? 0 : 100 / (cold_tmp / warm_tmp + 1);
-        brightness        = (!color_temperature) ? cold_tmp : warm_tmp * 100 / color_temperature;
+    portENTER_CRITICAL(&g_light_power_lock);
+    *stats = g_light_power_stats;
 
-        g_light_status.brightness        = (g_fade_mode == MODE_OFF || g_fade_mode == MODE_ON) ? brightness : g_light_status.brightness;
-        g_light_status.color_temperature = (g_fade_mode == MODE_CTB) ? color_temperature : g_light_status.color_temperature;
+    if (reset) {
+        memset(&g_light_power_stats, 0, sizeof(light_power_stats_t));
     }
 
-    ret = app_storage_set(LIGHT_STATUS_STORE_KEY, &g_light_status, sizeof(light_status_t));
-    LIGHT_ERROR_CHECK(ret < 0, ret, "app_storage_set, ret: %d", ret);
+    portEXIT_CRITICAL(&g_light_power_lock);
 
-    g_fade_mode = MODE_NONE;
     return ESP_OK;
 }
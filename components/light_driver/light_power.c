@@ -0,0 +1,65 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "light_power.h"
+
+/**
+ * The load is the sum of weight * duty, the budget is compared in the same
+ * scale as budget * LIGHT_POWER_DUTY_MAX. Over it, every duty is multiplied
+ * by one Q16 gain of budget / load and rounded down, so the scaled total is
+ * at most the budget.
+ */
+
+uint64_t light_power_load(const light_power_config_t *config, const uint16_t duty[LIGHT_POWER_CHANNEL_NUM])
+{
+    uint64_t load = 0;
+
+    for (int i = 0; i < LIGHT_POWER_CHANNEL_NUM; i++) {
+        load += (uint32_t)config->weight[i] * duty[i];
+    }
+
+    return load;
+}
+
+bool light_power_limit(const light_power_config_t *config, uint16_t duty[LIGHT_POWER_CHANNEL_NUM],
+                       light_power_stats_t *stats)
+{
+    uint64_t load  = light_power_load(config, duty);
+    uint64_t limit = (uint64_t)config->budget * LIGHT_POWER_DUTY_MAX;
+    bool limited   = config->budget && load > limit;
+
+    if (stats) {
+        stats->updates++;
+        stats->limited += limited;
+
+        if (config->budget) {
+            stats->load_max = MAX(stats->load_max, (uint32_t)MIN(load * 1000 / limit, UINT32_MAX));
+        }
+    }
+
+    if (!limited) {
+        return false;
+    }
+
+    uint32_t gain = (limit << 16) / load;  /**< Below 1 in Q16 */
+
+    for (int i = 0; i < LIGHT_POWER_CHANNEL_NUM; i++) {
+        duty[i] = ((uint32_t)duty[i] * gain) >> 16;
+    }
+
+    return true;
+}
@@ -0,0 +1,134 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "light_queue.h"
+
+/**
+ * Every slot carries a sequence number telling whose turn it is. A slot at
+ * position pos is free for the producer claiming pos when its sequence is
+ * pos, and holds an item for the consumer when it is pos + 1. The consumer
+ * hands it back for the next lap by setting it to pos + length.
+ */
+
+typedef struct {
+    _Atomic uint32_t sequence;
+    uint32_t item[];            /**< item_size bytes, word aligned */
+} light_queue_slot_t;
+
+typedef struct {
+    _Atomic uint32_t tail;      /**< Next position a producer claims */
+    uint32_t head;              /**< Next position the consumer reads, consumer only */
+    uint32_t mask;              /**< length - 1 */
+    size_t item_size;
+    size_t slot_size;
+    uint8_t *slots;
+} light_queue_t;
+
+static inline light_queue_slot_t *queue_slot(light_queue_t *queue, uint32_t pos)
+{
+    return (light_queue_slot_t *)(queue->slots + (pos & queue->mask) * queue->slot_size);
+}
+
+light_queue_handle_t light_queue_create(size_t length, size_t item_size)
+{
+    if (!length || (length & (length - 1)) || length > UINT32_MAX / 2 || !item_size) {
+        return NULL;
+    }
+
+    light_queue_t *queue = calloc(1, sizeof(light_queue_t));
+
+    if (!queue) {
+        return NULL;
+    }
+
+    queue->mask      = length - 1;
+    queue->item_size = item_size;
+    queue->slot_size = sizeof(light_queue_slot_t) + ((item_size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1));
+    queue->slots     = calloc(length, queue->slot_size);
+
+    if (!queue->slots) {
+        free(queue);
+        return NULL;
+    }
+
+    for (uint32_t pos = 0; pos < length; pos++) {
+        atomic_init(&queue_slot(queue, pos)->sequence, pos);
+    }
+
+    atomic_init(&queue->tail, 0);
+
+    return queue;
+}
+
+void light_queue_delete(light_queue_handle_t handle)
+{
+    light_queue_t *queue = (light_queue_t *)handle;
+
+    if (queue) {
+        free(queue->slots);
+        free(queue);
+    }
+}
+
+bool light_queue_push(light_queue_handle_t handle, const void *item)
+{
+    light_queue_t *queue = (light_queue_t *)handle;
+    uint32_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    light_queue_slot_t *slot;
+
+    for (;;) {
+        slot = queue_slot(queue, pos);
+        int32_t lap = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - pos);
+
+        if (lap == 0) {
+            /**< Free for this position, claim it unless another producer did first */
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (lap < 0) {
+            /**< Still holding the item of the previous lap */
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->item, item, queue->item_size);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+bool light_queue_pop(light_queue_handle_t handle, void *item)
+{
+    light_queue_t *queue = (light_queue_t *)handle;
+    uint32_t pos = queue->head;
+    light_queue_slot_t *slot = queue_slot(queue, pos);
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1) {
+        return false;
+    }
+
+    memcpy(item, slot->item, queue->item_size);
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+    queue->head = pos + 1;
+
+    return true;
+}
@@ -0,0 +1,87 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "light_scene.h"
+
+/**
+ * The blob is a header followed by the scenes as they are in RAM. The header
+ * gives the layout version and the size of a scene, so a blob written by
+ * another version of the driver is refused instead of misread.
+ */
+
+typedef struct {
+    uint8_t version;            /**< LIGHT_SCENE_VERSION of the writer */
+    uint8_t scene_size;         /**< sizeof(light_scene_t) of the writer */
+    uint16_t scene_num;         /**< Scenes following the header */
+} light_scene_blob_t;
+
+size_t light_scene_blob_size(size_t num)
+{
+    return sizeof(light_scene_blob_t) + num * sizeof(light_scene_t);
+}
+
+esp_err_t light_scene_pack(const light_scene_t *scenes, size_t num, void *blob, size_t *size)
+{
+    size_t used = num;
+
+    while (used && !scenes[used - 1].valid) {
+        used--;
+    }
+
+    if (*size < light_scene_blob_size(used)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const light_scene_blob_t header = {
+        .version    = LIGHT_SCENE_VERSION,
+        .scene_size = sizeof(light_scene_t),
+        .scene_num  = used,
+    };
+
+    memcpy(blob, &header, sizeof(light_scene_blob_t));
+    memcpy((uint8_t *)blob + sizeof(light_scene_blob_t), scenes, used * sizeof(light_scene_t));
+    *size = light_scene_blob_size(used);
+
+    return ESP_OK;
+}
+
+esp_err_t light_scene_unpack(light_scene_t *scenes, size_t num, const void *blob, size_t size)
+{
+    light_scene_blob_t header;
+
+    if (size < sizeof(light_scene_blob_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(&header, blob, sizeof(light_scene_blob_t));
+
+    if (header.version != LIGHT_SCENE_VERSION || header.scene_size != sizeof(light_scene_t)) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    if (size < light_scene_blob_size(header.scene_num)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t used = MIN(num, header.scene_num);
+
+    memcpy(scenes, (const uint8_t *)blob + sizeof(light_scene_blob_t), used * sizeof(light_scene_t));
+    memset(scenes + used, 0, (num - used) * sizeof(light_scene_t));
+
+    return ESP_OK;
+}
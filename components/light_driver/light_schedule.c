@@ -0,0 +1,193 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "light_schedule.h"
+#include "light_cct.h"
+
+/**
+ * The day is cut into one segment per point, each running to the next point
+ * and the last one to the first point past midnight. Segments keep their
+ * start value and slope, an evaluation is a multiply-add on the segment of
+ * the cursor. The time line starts at the first point, so a time of day
+ * before it is taken a day later and falls in the last segment.
+ */
+
+#define SCHEDULE_MIRED_Q16  (1000000ULL << 16)  /**< Mired in Q16 is this over the kelvin */
+
+/**
+ * The blob is a header followed by the points in use. As for the scenes, the
+ * header gives the layout version and the size of a point, so a blob of
+ * another version of the driver is refused instead of misread.
+ */
+
+typedef struct {
+    uint8_t version;            /**< LIGHT_SCHEDULE_VERSION of the writer */
+    uint8_t point_size;         /**< sizeof(light_schedule_point_t) of the writer */
+    uint16_t point_num;         /**< Points following the header */
+} light_schedule_blob_t;
+
+esp_err_t light_schedule_compile(const light_schedule_point_t *points, size_t num, light_schedule_t *schedule)
+{
+    light_schedule_point_t sorted[LIGHT_SCHEDULE_POINT_MAX];
+
+    if (!points || !schedule || !num || num > LIGHT_SCHEDULE_POINT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        const light_schedule_point_t *point = points + i;
+        size_t j = i;
+
+        if (point->time_s >= LIGHT_SCHEDULE_DAY_S || point->brightness > 100
+                || point->kelvin < LIGHT_CCT_KELVIN_MIN || point->kelvin > LIGHT_CCT_KELVIN_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        for (; j > 0 && sorted[j - 1].time_s > point->time_s; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+
+        if (j > 0 && sorted[j - 1].time_s == point->time_s) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        sorted[j] = *point;
+    }
+
+    memset(schedule, 0, sizeof(light_schedule_t));
+    schedule->num = num;
+
+    for (size_t i = 0; i < num; i++) {
+        const light_schedule_point_t *start = sorted + i;
+        const light_schedule_point_t *end = sorted + (i + 1) % num;
+        light_schedule_segment_t *segment = schedule->segments + i;
+        int64_t duration = (i + 1 < num) ? end->time_s - start->time_s : end->time_s + LIGHT_SCHEDULE_DAY_S - start->time_s;
+        int32_t mired_start = (SCHEDULE_MIRED_Q16 + start->kelvin / 2) / start->kelvin;
+        int32_t mired_end = (SCHEDULE_MIRED_Q16 + end->kelvin / 2) / end->kelvin;
+        int32_t brightness_delta = ((int32_t)end->brightness - start->brightness) << 16;
+
+        segment->start_s          = start->time_s;
+        segment->mired            = mired_start;
+        segment->brightness       = (int32_t)start->brightness << 16;
+        segment->mired_slope      = ((int64_t)(mired_end - mired_start) * 2 + (mired_end > mired_start ? duration : -duration)) / (2 * duration);
+        segment->brightness_slope = ((int64_t)brightness_delta * 2 + (brightness_delta > 0 ? duration : -duration)) / (2 * duration);
+    }
+
+    return ESP_OK;
+}
+
+bool light_schedule_step(light_schedule_t *schedule, uint32_t time_s, uint16_t *kelvin, uint8_t *brightness)
+{
+    const light_schedule_segment_t *segments = schedule->segments;
+    uint32_t now_s = time_s % LIGHT_SCHEDULE_DAY_S;
+
+    if (now_s < segments[0].start_s) {
+        now_s += LIGHT_SCHEDULE_DAY_S;
+    }
+
+    if (now_s < schedule->last_s) {
+        schedule->cursor = 0;
+    }
+
+    while (schedule->cursor + 1 < schedule->num && now_s >= segments[schedule->cursor + 1].start_s) {
+        schedule->cursor++;
+    }
+
+    schedule->last_s = now_s;
+
+    const light_schedule_segment_t *segment = segments + schedule->cursor;
+    int64_t elapsed = now_s - segment->start_s;
+    int64_t mired = segment->mired + segment->mired_slope * elapsed;
+    int64_t level = segment->brightness + segment->brightness_slope * elapsed;
+
+    mired = MAX(mired, 1);
+    *kelvin = MIN(MAX((SCHEDULE_MIRED_Q16 + mired / 2) / mired, LIGHT_CCT_KELVIN_MIN), LIGHT_CCT_KELVIN_MAX);
+    *brightness = MIN(MAX((level + 0x8000) >> 16, 0), 100);
+
+    if (schedule->started && *kelvin == schedule->kelvin && *brightness == schedule->brightness) {
+        return false;
+    }
+
+    schedule->started    = true;
+    schedule->kelvin     = *kelvin;
+    schedule->brightness = *brightness;
+
+    return true;
+}
+
+size_t light_schedule_blob_size(size_t num)
+{
+    return sizeof(light_schedule_blob_t) + num * sizeof(light_schedule_point_t);
+}
+
+esp_err_t light_schedule_pack(const light_schedule_point_t *points, size_t num, void *blob, size_t *size)
+{
+    if (num > LIGHT_SCHEDULE_POINT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (*size < light_schedule_blob_size(num)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const light_schedule_blob_t header = {
+        .version    = LIGHT_SCHEDULE_VERSION,
+        .point_size = sizeof(light_schedule_point_t),
+        .point_num  = num,
+    };
+    uint8_t *point = (uint8_t *)blob + sizeof(light_schedule_blob_t);
+
+    memcpy(blob, &header, sizeof(light_schedule_blob_t));
+    memset(point, 0, num * sizeof(light_schedule_point_t));
+
+    /**< Field by field, the padding of the points never reaches the flash */
+    for (size_t i = 0; i < num; i++, point += sizeof(light_schedule_point_t)) {
+        memcpy(point + offsetof(light_schedule_point_t, time_s), &points[i].time_s, sizeof(points[i].time_s));
+        memcpy(point + offsetof(light_schedule_point_t, kelvin), &points[i].kelvin, sizeof(points[i].kelvin));
+        memcpy(point + offsetof(light_schedule_point_t, brightness), &points[i].brightness, sizeof(points[i].brightness));
+    }
+
+    *size = light_schedule_blob_size(num);
+
+    return ESP_OK;
+}
+
+esp_err_t light_schedule_unpack(light_schedule_point_t *points, size_t *num, const void *blob, size_t size)
+{
+    light_schedule_blob_t header;
+
+    if (size < sizeof(light_schedule_blob_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(&header, blob, sizeof(light_schedule_blob_t));
+
+    if (header.version != LIGHT_SCHEDULE_VERSION || header.point_size != sizeof(light_schedule_point_t)) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    if (header.point_num > LIGHT_SCHEDULE_POINT_MAX || size < light_schedule_blob_size(header.point_num)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(points, (const uint8_t *)blob + sizeof(light_schedule_blob_t), header.point_num * sizeof(light_schedule_point_t));
+    *num = header.point_num;
+
+    return ESP_OK;
+}
@@ -0,0 +1,278 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "light_status.h"
+
+/**
+ * A record starts with LIGHT_STATUS_TAG and its version, then the bitmap of
+ * the fields it holds and the fields in the order of their bits, all
+ * unsigned LEB128 varints. The raw struct of version 1 has no tag, its first
+ * byte is the mode and always below it.
+ *
+ * Adding a field only adds a bit: a newer record read by older firmware has
+ * the bits it does not know skipped, an older record read by newer firmware
+ * leaves the new field 0. A field changing its meaning bumps
+ * LIGHT_STATUS_VERSION, and the decoder of the version before moves to
+ * g_light_status_migrations.
+ */
+
+#define LIGHT_STATUS_TAG        (0x80)
+#define LIGHT_STATUS_VARINT_MAX (5)     /**< Bytes of the largest uint32_t */
+
+#define LIGHT_STATUS_FIELD(name) {offsetof(light_status_t, name), sizeof(((light_status_t *)0)->name)}
+
+typedef struct {
+    uint8_t offset;
+    uint8_t size;               /**< 1, 2 or 4 bytes */
+} light_status_field_t;
+
+/**< Bit i of the bitmap is field i, fields are only ever added at the end */
+static const light_status_field_t g_light_status_fields[] = {
+    LIGHT_STATUS_FIELD(mode),
+    LIGHT_STATUS_FIELD(on),
+    LIGHT_STATUS_FIELD(hue),
+    LIGHT_STATUS_FIELD(saturation),
+    LIGHT_STATUS_FIELD(value),
+    LIGHT_STATUS_FIELD(color_temperature),
+    LIGHT_STATUS_FIELD(brightness),
+    LIGHT_STATUS_FIELD(fade_period_ms),
+    LIGHT_STATUS_FIELD(blink_period_ms),
+    LIGHT_STATUS_FIELD(kelvin),
+};
+
+#define LIGHT_STATUS_FIELD_NUM  (sizeof(g_light_status_fields) / sizeof(g_light_status_fields[0]))
+
+/**
+ * @brief light_status_t as it was saved raw before the encoding, never to change
+ */
+typedef struct {
+    uint8_t mode;
+    uint8_t on;
+    uint16_t hue;
+    uint8_t saturation;
+    uint8_t value;
+    uint8_t color_temperature;
+    uint8_t brightness;
+    uint32_t fade_period_ms;
+    uint32_t blink_period_ms;
+    uint16_t kelvin;            /**< Missing from the records saved before it was added */
+} light_status_v1_t;
+
+_Static_assert(LIGHT_STATUS_ENCODED_MAX >= sizeof(light_status_v1_t), "raw record of version 1");
+
+static esp_err_t light_status_migrate_v1(light_status_t *status, const uint8_t *record, size_t size)
+{
+    light_status_v1_t raw = {0};
+
+    if (size < offsetof(light_status_v1_t, kelvin)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(&raw, record, MIN(size, sizeof(light_status_v1_t)));
+
+    status->mode              = raw.mode;
+    status->on                = raw.on;
+    status->hue               = raw.hue;
+    status->saturation        = raw.saturation;
+    status->value             = raw.value;
+    status->color_temperature = raw.color_temperature;
+    status->brightness        = raw.brightness;
+    status->fade_period_ms    = raw.fade_period_ms;
+    status->blink_period_ms   = raw.blink_period_ms;
+    status->kelvin            = raw.kelvin;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Decode a record of an older version into the state of this one
+ */
+typedef esp_err_t (*light_status_migrate_t)(light_status_t *status, const uint8_t *record, size_t size);
+
+/**< By version */
+static const light_status_migrate_t g_light_status_migrations[LIGHT_STATUS_VERSION] = {
+    [1] = light_status_migrate_v1,
+};
+
+static size_t light_status_varint_put(uint8_t *data, uint32_t value)
+{
+    size_t size = 0;
+
+    do {
+        data[size++] = (value & 0x7f) | ((value > 0x7f) ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+
+    return size;
+}
+
+static bool light_status_varint_get(const uint8_t *data, size_t size, size_t *offset, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (int i = 0; i < LIGHT_STATUS_VARINT_MAX && *offset < size; i++) {
+        uint8_t byte = data[(*offset)++];
+
+        /**< Bits past the 32 of a uint32_t */
+        if (i == LIGHT_STATUS_VARINT_MAX - 1 && byte > 0x0f) {
+            return false;
+        }
+
+        result |= (uint32_t)(byte & 0x7f) << (7 * i);
+
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t light_status_field_get(const light_status_t *status, const light_status_field_t *field)
+{
+    const uint8_t *data = (const uint8_t *)status + field->offset;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+
+    switch (field->size) {
+        case 1:
+            memcpy(&u8, data, 1);
+            return u8;
+
+        case 2:
+            memcpy(&u16, data, 2);
+            return u16;
+
+        default:
+            memcpy(&u32, data, 4);
+            return u32;
+    }
+}
+
+static bool light_status_field_set(light_status_t *status, const light_status_field_t *field, uint32_t value)
+{
+    uint8_t *data = (uint8_t *)status + field->offset;
+    uint8_t u8    = value;
+    uint16_t u16  = value;
+
+    switch (field->size) {
+        case 1:
+            memcpy(data, &u8, 1);
+            return value <= UINT8_MAX;
+
+        case 2:
+            memcpy(data, &u16, 2);
+            return value <= UINT16_MAX;
+
+        default:
+            memcpy(data, &value, 4);
+            return true;
+    }
+}
+
+esp_err_t light_status_encode(const light_status_t *status, void *record, size_t *size)
+{
+    uint8_t fields[LIGHT_STATUS_FIELD_NUM * LIGHT_STATUS_VARINT_MAX];
+    uint8_t header[1 + LIGHT_STATUS_VARINT_MAX];
+    size_t fields_size = 0;
+    size_t header_size = 0;
+    uint32_t bitmap    = 0;
+
+    for (size_t i = 0; i < LIGHT_STATUS_FIELD_NUM; i++) {
+        uint32_t value = light_status_field_get(status, g_light_status_fields + i);
+
+        if (value) {
+            bitmap |= 1UL << i;
+            fields_size += light_status_varint_put(fields + fields_size, value);
+        }
+    }
+
+    header[header_size++] = LIGHT_STATUS_TAG | LIGHT_STATUS_VERSION;
+    header_size += light_status_varint_put(header + header_size, bitmap);
+
+    if (*size < header_size + fields_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(record, header, header_size);
+    memcpy((uint8_t *)record + header_size, fields, fields_size);
+    *size = header_size + fields_size;
+
+    return ESP_OK;
+}
+
+esp_err_t light_status_decode(light_status_t *status, const void *record, size_t size)
+{
+    const uint8_t *data = record;
+    light_status_t decoded = {0};
+    size_t offset   = 1;
+    uint32_t bitmap = 0;
+
+    if (!size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t version = (data[0] & LIGHT_STATUS_TAG) ? data[0] & ~LIGHT_STATUS_TAG : 1;
+
+    if (version > LIGHT_STATUS_VERSION || (version < LIGHT_STATUS_VERSION && !g_light_status_migrations[version])) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    if (version < LIGHT_STATUS_VERSION) {
+        esp_err_t ret = g_light_status_migrations[version](&decoded, data, size);
+
+        if (ret == ESP_OK) {
+            *status = decoded;
+        }
+
+        return ret;
+    }
+
+    if (!light_status_varint_get(data, size, &offset, &bitmap)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (size_t i = 0; i < 32; i++) {
+        uint32_t value = 0;
+
+        if (!(bitmap & (1UL << i))) {
+            continue;
+        }
+
+        if (!light_status_varint_get(data, size, &offset, &value)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        /**< A field of a newer version, skipped */
+        if (i >= LIGHT_STATUS_FIELD_NUM) {
+            continue;
+        }
+
+        if (!light_status_field_set(&decoded, g_light_status_fields + i, value)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    *status = decoded;
+
+    return ESP_OK;
+}
@@ -0,0 +1,304 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "light_driver.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+/**
+ * Latency of the public API of the light driver, from the call until the
+ * control task has applied the command and every task waits again. The
+ * driver runs on the simulated LEDC and on a RAM backed app_storage, with
+ * the write-behind delays set out of reach so the flash writes only happen
+ * in the flush that is measured on its own.
+ *
+ * The results are printed as CSV, and compared with a baseline of the same
+ * format: allocations and flash writes must not grow, the p99 latencies only
+ * fail above the baseline by more than the given tolerance, as they depend
+ * on the machine. Write a new baseline with a third argument.
+ */
+
+#define BENCH_CALLS         (2000)
+#define BENCH_SETTLE_US     (50 * 1000)     /**< Virtual time the fades run between two calls, not measured */
+#define BENCH_NAME_LEN      (24)
+#define BENCH_CSV_HEADER    "api,calls,call_p50_ns,call_p99_ns,e2e_p50_ns,e2e_p99_ns,allocs,nvs_writes"
+
+typedef struct {
+    const char *name;
+    void (*prepare)(int i);     /**< Run before the call and not measured, NULL if none */
+    esp_err_t (*call)(int i);
+} bench_api_t;
+
+typedef struct {
+    char name[BENCH_NAME_LEN];
+    uint32_t calls;
+    uint64_t call_p50_ns;       /**< Until the API returns */
+    uint64_t call_p99_ns;
+    uint64_t e2e_p50_ns;        /**< Until the command is applied */
+    uint64_t e2e_p99_ns;
+    uint32_t allocs;            /**< Over all calls */
+    uint32_t nvs_writes;        /**< Over all calls */
+} bench_result_t;
+
+/**< Allocations made by the driver, counted through the linker's --wrap */
+static bool g_alloc_counting   = false;
+static uint32_t g_alloc_count  = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_alloc_count += g_alloc_counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size)
+{
+    g_alloc_count += g_alloc_counting;
+    return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    g_alloc_count += g_alloc_counting;
+    return __real_realloc(ptr, size);
+}
+
+static esp_err_t bench_set_hsv(int i)
+{
+    return light_driver_set_hsv(i * 37 % 360, 50 + i % 50, 20 + i % 80);
+}
+
+static esp_err_t bench_set_ctb(int i)
+{
+    return light_driver_set_ctb(i % 101, 10 + i % 90);
+}
+
+static esp_err_t bench_fade_brightness(int i)
+{
+    return light_driver_fade_brightness((i % 2) ? 90 : 10);
+}
+
+static esp_err_t bench_set_switch(int i)
+{
+    return light_driver_set_switch(i % 2);
+}
+
+static void bench_dirty(int i)
+{
+    light_driver_set_hsv(i % 360, 100, 100);
+    rtos_sim_run_idle();
+}
+
+static esp_err_t bench_flush(int i)
+{
+    return light_driver_flush();
+}
+
+static const bench_api_t g_bench_apis[] = {
+    {"set_hsv", NULL, bench_set_hsv},
+    {"set_ctb", NULL, bench_set_ctb},
+    {"fade_brightness", NULL, bench_fade_brightness},
+    {"set_switch", NULL, bench_set_switch},
+    {"flush", bench_dirty, bench_flush},
+};
+
+static bench_result_t g_results[sizeof(g_bench_apis) / sizeof(g_bench_apis[0])];
+static uint64_t g_call_ns[BENCH_CALLS];
+static uint64_t g_e2e_ns[BENCH_CALLS];
+
+static uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_compare_ns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(uint64_t *ns, size_t num, int percent)
+{
+    qsort(ns, num, sizeof(uint64_t), bench_compare_ns);
+    return ns[num * percent / 100];
+}
+
+static void bench_print(FILE *out, const bench_result_t *result)
+{
+    fprintf(out, "%s,%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu32 ",%" PRIu32 "\n",
+            result->name, result->calls, result->call_p50_ns, result->call_p99_ns,
+            result->e2e_p50_ns, result->e2e_p99_ns, result->allocs, result->nvs_writes);
+}
+
+static esp_err_t bench_run(const bench_api_t *api, bench_result_t *result)
+{
+    app_storage_sim_stats_t before, after;
+
+    memset(result, 0, sizeof(bench_result_t));
+    strncpy(result->name, api->name, BENCH_NAME_LEN - 1);
+
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        if (api->prepare) {
+            api->prepare(i);
+        }
+
+        app_storage_sim_stats(&before);
+        uint32_t allocs = g_alloc_count;
+        g_alloc_counting = true;
+
+        uint64_t start = host_time_ns();
+        esp_err_t ret = api->call(i);
+        uint64_t returned = host_time_ns();
+        rtos_sim_run_idle();
+        uint64_t applied = host_time_ns();
+
+        g_alloc_counting = false;
+        app_storage_sim_stats(&after);
+
+        if (ret != ESP_OK) {
+            printf("%s call %d, ret: %d\n", api->name, i, ret);
+            return ret;
+        }
+
+        g_call_ns[i] = returned - start;
+        g_e2e_ns[i]  = applied - start;
+        result->allocs     += g_alloc_count - allocs;
+        result->nvs_writes += after.writes - before.writes;
+
+        sim_advance_us(BENCH_SETTLE_US);
+    }
+
+    result->calls       = BENCH_CALLS;
+    result->call_p50_ns = bench_percentile(g_call_ns, BENCH_CALLS, 50);
+    result->call_p99_ns = bench_percentile(g_call_ns, BENCH_CALLS, 99);
+    result->e2e_p50_ns  = bench_percentile(g_e2e_ns, BENCH_CALLS, 50);
+    result->e2e_p99_ns  = bench_percentile(g_e2e_ns, BENCH_CALLS, 99);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Find the baseline of an API, false if the file has none
+ */
+static bool bench_baseline(const char *path, const char *name, bench_result_t *baseline)
+{
+    FILE *file = path ? fopen(path, "r") : NULL;
+    char line[256];
+    bool found = false;
+
+    while (file && !found && fgets(line, sizeof(line), file)) {
+        found = sscanf(line, "%23[^,],%" SCNu32 ",%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%" SCNu32 ",%" SCNu32,
+                       baseline->name, &baseline->calls, &baseline->call_p50_ns, &baseline->call_p99_ns,
+                       &baseline->e2e_p50_ns, &baseline->e2e_p99_ns, &baseline->allocs, &baseline->nvs_writes) == 8
+                && !strcmp(baseline->name, name);
+    }
+
+    if (file) {
+        fclose(file);
+    }
+
+    return found;
+}
+
+static const char *g_baseline_path = NULL;
+static uint32_t g_tolerance_pct    = 0;
+static const char *g_output_path   = NULL;
+
+static void test_bench_api(void)
+{
+    const light_driver_config_t config = {
+        .gpio_red        = 0,
+        .gpio_green      = 1,
+        .gpio_blue       = 2,
+        .gpio_cold       = 3,
+        .gpio_warm       = 4,
+        .fade_period_ms  = 500,
+        .blink_period_ms = 2000,
+        .freq_hz         = 5000,
+        .clk_cfg         = LEDC_USE_APB_CLK,
+        .duty_resolution = LEDC_TIMER_13_BIT,
+    };
+    const size_t num = sizeof(g_bench_apis) / sizeof(g_bench_apis[0]);
+
+    sim_reset();
+    app_storage_sim_reset();
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_init((light_driver_config_t *)&config));
+    rtos_sim_run_idle();
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, bench_run(g_bench_apis + i, g_results + i));
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_deinit());
+
+    printf(BENCH_CSV_HEADER "\n");
+
+    for (size_t i = 0; i < num; i++) {
+        bench_print(stdout, g_results + i);
+    }
+
+    if (g_output_path) {
+        FILE *out = fopen(g_output_path, "w");
+        TEST_ASSERT_MESSAGE(out, "can not write the output file");
+        fprintf(out, BENCH_CSV_HEADER "\n");
+
+        for (size_t i = 0; i < num; i++) {
+            bench_print(out, g_results + i);
+        }
+
+        fclose(out);
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        const bench_result_t *result = g_results + i;
+        bench_result_t baseline;
+
+        if (!bench_baseline(g_baseline_path, result->name, &baseline)) {
+            printf("%s: no baseline\n", result->name);
+            continue;
+        }
+
+        /**< Counts do not depend on the machine, any growth is a regression */
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.allocs, result->allocs);
+        TEST_ASSERT_LESS_OR_EQUAL(baseline.nvs_writes, result->nvs_writes);
+
+        if (g_tolerance_pct) {
+            TEST_ASSERT_LESS_OR_EQUAL(baseline.call_p99_ns * (100 + g_tolerance_pct) / 100, result->call_p99_ns);
+            TEST_ASSERT_LESS_OR_EQUAL(baseline.e2e_p99_ns * (100 + g_tolerance_pct) / 100, result->e2e_p99_ns);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_baseline_path = (argc > 1) ? argv[1] : NULL;
+    g_tolerance_pct = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    g_output_path   = (argc > 3) ? argv[3] : NULL;
+
+    RUN_TEST(test_bench_api);
+
+    return UNITY_END();
+}
@@ -0,0 +1,106 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Microbenchmark of the colour engine, over every 8-bit colour each way,
+ * and of the colour temperature mix
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "light_color.h"
+#include "light_cct.h"
+#include "host_test.h"
+
+#define BENCH_COLOR_NUM (1 << 24)
+
+static volatile uint32_t g_bench_sink;    /**< Keeps the conversions from being optimised out */
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void test_bench_rgb_to_hsv(void)
+{
+    uint32_t sum = 0;
+    uint64_t start_ns = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_COLOR_NUM; i++) {
+        light_color_rgb_t rgb = {(i >> 16) * 257, ((i >> 8) & 0xff) * 257, (i & 0xff) * 257};
+        light_color_hsv_t hsv;
+
+        light_color_rgb_to_hsv(&rgb, &hsv);
+        sum += hsv.hue + hsv.saturation + hsv.value;
+    }
+
+    uint64_t spent_ns = bench_now_ns() - start_ns;
+    g_bench_sink = sum;
+    printf("light_color_rgb_to_hsv: %.2f ns per colour\n", (double)spent_ns / BENCH_COLOR_NUM);
+}
+
+static void test_bench_hsv_to_rgb(void)
+{
+    uint32_t sum = 0;
+    uint64_t start_ns = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_COLOR_NUM; i++) {
+        light_color_hsv_t hsv = {i % LIGHT_COLOR_HUE_MAX, (i >> 8) | 0xff, (i >> 12) | 0xff};
+        light_color_rgb_t rgb;
+
+        light_color_hsv_to_rgb(&hsv, &rgb);
+        sum += rgb.red + rgb.green + rgb.blue;
+    }
+
+    uint64_t spent_ns = bench_now_ns() - start_ns;
+    g_bench_sink = sum;
+    printf("light_color_hsv_to_rgb: %.2f ns per colour\n", (double)spent_ns / BENCH_COLOR_NUM);
+}
+
+static void test_bench_cct_mix(void)
+{
+    static const light_cct_calibration_t calibration = {
+        .warm_x = 4578, .warm_y = 4101, .cold_x = 3127, .cold_y = 3290,
+        .warm_flux = 800, .cold_flux = 900,
+    };
+    light_cct_table_t table;
+    uint32_t sum = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&calibration, &table));
+
+    uint64_t start_ns = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_COLOR_NUM; i++) {
+        uint16_t warm, cold;
+
+        light_cct_mix(&table, 2000 + (i & 0x1fff), &warm, &cold);
+        sum += warm + cold;
+    }
+
+    uint64_t spent_ns = bench_now_ns() - start_ns;
+    g_bench_sink = sum;
+    printf("light_cct_mix: %.2f ns per colour temperature\n", (double)spent_ns / BENCH_COLOR_NUM);
+}
+
+int main(void)
+{
+    RUN_TEST(test_bench_rgb_to_hsv);
+    RUN_TEST(test_bench_hsv_to_rgb);
+    RUN_TEST(test_bench_cct_mix);
+
+    return UNITY_END();
+}
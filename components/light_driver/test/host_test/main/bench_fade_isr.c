@@ -0,0 +1,130 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Microbenchmark of the fade timer ISR
+ *
+ * Every scenario drives all channels of one instance for BENCH_RUN_MS of
+ * virtual time. The number of interrupts is deterministic and is checked
+ * against a budget, so a change making the engine wake up more often fails.
+ * The host time spent per interrupt is reported, and is checked too when a
+ * budget in nanoseconds is given on the command line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "iot_led.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+#define BENCH_CHANNEL_NUM   IOT_LED_EFFECT_CHANNEL_MAX
+#define BENCH_RUN_MS        (60 * 1000)
+#define BENCH_FADE_MS       (5000)
+
+typedef struct {
+    const char *name;
+    iot_led_fade_mode_t mode;
+    bool dither;
+    bool effect;
+    uint32_t alarm_budget;      /**< Most interrupts the scenario may take */
+} bench_scenario_t;
+
+static const iot_led_keyframe_t g_bench_keyframes[] = {
+    IOT_LED_KEYFRAME_FADE(2000, 255, 0, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 0, 255, 0, 0, 0),
+    IOT_LED_KEYFRAME_FADE(2000, 0, 0, 255, 0, 0),
+    IOT_LED_KEYFRAME_STEP(500, 0, 0, 0, 255, 255),
+    IOT_LED_KEYFRAME_FADE(1500, 10, 10, 10, 10, 10),
+};
+
+static const iot_led_effect_t g_bench_effect = {
+    .keyframes = g_bench_keyframes,
+    .keyframe_num = sizeof(g_bench_keyframes) / sizeof(g_bench_keyframes[0]),
+    .channel_num = BENCH_CHANNEL_NUM,
+    .channels = {LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2, LEDC_CHANNEL_3, LEDC_CHANNEL_4},
+    .repeat = 0,
+};
+
+/**
+ * Software fades wake up every DUTY_SET_CYCLE, the budget leaves room for the
+ * commits of the new targets between the fades
+ */
+static const bench_scenario_t g_bench_scenarios[] = {
+    {"software", IOT_LED_FADE_SOFTWARE, false, false, BENCH_RUN_MS / DUTY_SET_CYCLE + 100},
+    {"hardware", IOT_LED_FADE_HARDWARE, false, false, BENCH_RUN_MS / DUTY_SET_CYCLE / 3},
+    {"dither", IOT_LED_FADE_SOFTWARE, true, false, BENCH_RUN_MS / DUTY_SET_CYCLE + 100},
+    {"effect", IOT_LED_FADE_SOFTWARE, false, true, BENCH_RUN_MS / DUTY_SET_CYCLE + 100},
+};
+
+static uint64_t g_isr_budget_ns = 0;
+
+static void bench_run(const bench_scenario_t *scenario)
+{
+    sim_reset();
+    iot_led_handle_t led = iot_led_create(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, 5000,
+                                          LEDC_USE_APB_CLK, LEDC_TIMER_13_BIT);
+    iot_led_set_fade_mode(led, scenario->mode);
+    for (int i = 0; i < BENCH_CHANNEL_NUM; i++) {
+        iot_led_regist_channel(led, (ledc_channel_t)i, i);
+        iot_led_set_dither(led, (ledc_channel_t)i, scenario->dither);
+    }
+
+    if (scenario->effect) {
+        iot_led_start_effect(led, &g_bench_effect);
+        sim_advance_us(BENCH_RUN_MS * 1000LL);
+    } else {
+        for (int ms = 0; ms < BENCH_RUN_MS; ms += BENCH_FADE_MS) {
+            iot_led_channel_target_t targets[BENCH_CHANNEL_NUM];
+            for (int i = 0; i < BENCH_CHANNEL_NUM; i++) {
+                targets[i].channel = (ledc_channel_t)i;
+                targets[i].value = (ms / BENCH_FADE_MS + i) % 2 ? 255 : 3 * i;
+            }
+            iot_led_set_channels(led, targets, BENCH_CHANNEL_NUM, BENCH_FADE_MS - 2 * DUTY_SET_CYCLE);
+            sim_advance_us(BENCH_FADE_MS * 1000LL);
+        }
+    }
+
+    gptimer_sim_isr_time_t time;
+    gptimer_sim_isr_time(&time);
+    iot_led_delete(led);
+
+    uint64_t avg_ns = time.count ? time.total_ns / time.count : 0;
+    printf("%-10s %8" PRIu32 " %8" PRIu32 " %10" PRIu64 " %10" PRIu64 "\n", scenario->name,
+           time.count, scenario->alarm_budget, avg_ns, time.max_ns);
+
+    TEST_ASSERT_LESS_OR_EQUAL(scenario->alarm_budget, time.count);
+    if (g_isr_budget_ns) {
+        TEST_ASSERT_LESS_OR_EQUAL(g_isr_budget_ns, avg_ns);
+    }
+}
+
+static void test_bench_fade_isr(void)
+{
+    printf("%-10s %8s %8s %10s %10s\n", "scenario", "isr", "budget", "avg ns", "max ns");
+    for (int i = 0; i < sizeof(g_bench_scenarios) / sizeof(g_bench_scenarios[0]); i++) {
+        bench_run(&g_bench_scenarios[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        g_isr_budget_ns = strtoull(argv[1], NULL, 0);
+    }
+
+    RUN_TEST(test_bench_fade_isr);
+
+    return UNITY_END();
+}
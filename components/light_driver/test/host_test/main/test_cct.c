@@ -0,0 +1,176 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <sys/param.h>
+#include "light_cct.h"
+#include "host_test.h"
+
+#define CCT_MIRED_TOLERANCE (1.0)       /**< Largest error of the mixed colour temperature, mired */
+#define CCT_FLUX_TOLERANCE  (0.005)     /**< Largest relative error of the mixed flux */
+
+/**< A 2700 K and a 6500 K channel, and a second batch of the same fixture binned apart */
+static const light_cct_calibration_t g_batch_a = {
+    .warm_x = 4578, .warm_y = 4101, .cold_x = 3127, .cold_y = 3290,
+    .warm_flux = 800, .cold_flux = 900, .rated_flux = 700,
+};
+
+static const light_cct_calibration_t g_batch_b = {
+    .warm_x = 4620, .warm_y = 4080, .cold_x = 3090, .cold_y = 3240,
+    .warm_flux = 760, .cold_flux = 980, .rated_flux = 700,
+};
+
+/**
+ * @brief Colour temperature in mired and flux of the light the two channels give at their duties
+ */
+static void cct_measure(const light_cct_calibration_t *calibration, uint16_t warm, uint16_t cold,
+                        double *mired, double *flux)
+{
+    double warm_y = (double)calibration->warm_y / LIGHT_CCT_CHROMA_SCALE;
+    double cold_y = (double)calibration->cold_y / LIGHT_CCT_CHROMA_SCALE;
+    double warm_lm = (double)warm / UINT16_MAX * calibration->warm_flux;
+    double cold_lm = (double)cold / UINT16_MAX * calibration->cold_flux;
+    double warm_sum = warm_lm / warm_y;
+    double cold_sum = cold_lm / cold_y;
+    double x = (warm_sum * calibration->warm_x + cold_sum * calibration->cold_x) / (warm_sum + cold_sum) / LIGHT_CCT_CHROMA_SCALE;
+    double y = (warm_sum * calibration->warm_y + cold_sum * calibration->cold_y) / (warm_sum + cold_sum) / LIGHT_CCT_CHROMA_SCALE;
+    double n = (x - 0.3320) / (y - 0.1858);
+
+    *mired = 1000000.0 / (((-449.0 * n + 3525.0) * n - 6823.3) * n + 5520.33);
+    *flux = warm_lm + cold_lm;
+}
+
+static void test_invalid_calibration(void)
+{
+    light_cct_table_t table;
+    light_cct_calibration_t calibration = g_batch_a;
+
+    calibration.cold_flux = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_cct_table_init(&calibration, &table));
+
+    calibration = g_batch_a;
+    calibration.cold_x = calibration.warm_x;
+    calibration.cold_y = calibration.warm_y;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_cct_table_init(&calibration, &table));
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&g_batch_a, &table));
+    TEST_ASSERT_INT_WITHIN(30, 2700, light_cct_kelvin_min(&table));
+    TEST_ASSERT_INT_WITHIN(30, 6500, light_cct_kelvin_max(&table));
+}
+
+/**
+ * Every colour temperature of the range mixes to itself at the rated flux
+ */
+static void test_mix_hits_kelvin_and_flux(void)
+{
+    light_cct_table_t table;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&g_batch_a, &table));
+    TEST_ASSERT_EQUAL(700, table.flux);
+
+    for (int kelvin = light_cct_kelvin_min(&table) + 1; kelvin < light_cct_kelvin_max(&table); kelvin++) {
+        uint16_t warm, cold;
+        double mired, flux;
+
+        light_cct_mix(&table, kelvin, &warm, &cold);
+        cct_measure(&g_batch_a, warm, cold, &mired, &flux);
+
+        if (fabs(mired - 1000000.0 / kelvin) > CCT_MIRED_TOLERANCE || fabs(flux - 700) > 700 * CCT_FLUX_TOLERANCE) {
+            printf("%d K mixed to %.1f K at %.1f lm\n", kelvin, 1000000.0 / mired, flux);
+            TEST_FAIL_MESSAGE("mix off the colour temperature or the flux");
+        }
+    }
+
+    uint16_t warm, cold;
+    light_cct_mix(&table, LIGHT_CCT_KELVIN_MIN, &warm, &cold);
+    TEST_ASSERT_EQUAL(table.warm[LIGHT_CCT_TABLE_SIZE - 1], warm);
+    TEST_ASSERT_EQUAL(table.cold[LIGHT_CCT_TABLE_SIZE - 1], cold);
+    light_cct_mix(&table, LIGHT_CCT_KELVIN_MAX, &warm, &cold);
+    TEST_ASSERT_EQUAL(table.warm[0], warm);
+    TEST_ASSERT_EQUAL(table.cold[0], cold);
+}
+
+/**
+ * Two batches binned apart give the same light for the same command
+ */
+static void test_batches_match(void)
+{
+    light_cct_table_t table_a, table_b;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&g_batch_a, &table_a));
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&g_batch_b, &table_b));
+
+    int kelvin_min = MAX(light_cct_kelvin_min(&table_a), light_cct_kelvin_min(&table_b)) + 1;
+    int kelvin_max = MIN(light_cct_kelvin_max(&table_a), light_cct_kelvin_max(&table_b));
+
+    for (int kelvin = kelvin_min; kelvin < kelvin_max; kelvin += 10) {
+        uint16_t warm, cold;
+        double mired_a, flux_a, mired_b, flux_b;
+
+        light_cct_mix(&table_a, kelvin, &warm, &cold);
+        cct_measure(&g_batch_a, warm, cold, &mired_a, &flux_a);
+        light_cct_mix(&table_b, kelvin, &warm, &cold);
+        cct_measure(&g_batch_b, warm, cold, &mired_b, &flux_b);
+
+        if (fabs(mired_a - mired_b) > 2 * CCT_MIRED_TOLERANCE || fabs(flux_a - flux_b) > 700 * 2 * CCT_FLUX_TOLERANCE) {
+            printf("%d K: %.1f K %.1f lm against %.1f K %.1f lm\n", kelvin,
+                   1000000.0 / mired_a, flux_a, 1000000.0 / mired_b, flux_b);
+            TEST_FAIL_MESSAGE("batches do not match");
+        }
+    }
+}
+
+/**
+ * Duties read back from the channels give the colour temperature and brightness they were set to
+ */
+static void test_unmix_round_trip(void)
+{
+    light_cct_table_t table;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_cct_table_init(&g_batch_b, &table));
+
+    for (int kelvin = light_cct_kelvin_min(&table); kelvin <= light_cct_kelvin_max(&table); kelvin += 7) {
+        for (uint32_t duty = 0x1000; duty <= UINT16_MAX; duty += 0x1000) {
+            uint16_t warm, cold, out_kelvin, out_duty;
+
+            light_cct_mix(&table, kelvin, &warm, &cold);
+            warm = (warm * duty + UINT16_MAX / 2) / UINT16_MAX;
+            cold = (cold * duty + UINT16_MAX / 2) / UINT16_MAX;
+            light_cct_unmix(&table, warm, cold, &out_kelvin, &out_duty);
+
+            if (fabs(1000000.0 / out_kelvin - 1000000.0 / kelvin) > CCT_MIRED_TOLERANCE
+                    || abs((int)out_duty - (int)duty) > (int)(UINT16_MAX * CCT_FLUX_TOLERANCE)) {
+                printf("%d K at %" PRIu32 " came back as %d K at %d\n", kelvin, duty, out_kelvin, out_duty);
+                TEST_FAIL_MESSAGE("unmix off the mix");
+            }
+        }
+    }
+
+    uint16_t kelvin = 1234, duty = 1;
+    light_cct_unmix(&table, 0, 0, &kelvin, &duty);
+    TEST_ASSERT_EQUAL(1234, kelvin);
+    TEST_ASSERT_EQUAL(0, duty);
+}
+
+int main(void)
+{
+    RUN_TEST(test_invalid_calibration);
+    RUN_TEST(test_mix_hits_kelvin_and_flux);
+    RUN_TEST(test_batches_match);
+    RUN_TEST(test_unmix_round_trip);
+
+    return UNITY_END();
+}
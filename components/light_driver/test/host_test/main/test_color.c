@@ -0,0 +1,198 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/param.h>
+#include "light_color.h"
+#include "host_test.h"
+
+#define COLOR_8BIT_TO_16(x)   ((x) * 257)
+#define COLOR_16_TO_8BIT(x)   (((x) * 255 + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX)
+#define COLOR_PERCENT_TO_16(x) (((x) * LIGHT_COLOR_MAX + 50) / 100)
+#define COLOR_16_TO_PERCENT(x) (((x) * 100 + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX)
+#define COLOR_GRID_STEP       (3855)    /**< 18 steps over the saturation and value range */
+
+static uint32_t chroma_of(const light_color_hsv_t *hsv)
+{
+    return ((uint32_t)hsv->value * hsv->saturation + LIGHT_COLOR_MAX / 2) / LIGHT_COLOR_MAX;
+}
+
+static int hue_distance(int a, int b)
+{
+    int distance = abs(a - b);
+    return (distance > LIGHT_COLOR_HUE_MAX / 2) ? LIGHT_COLOR_HUE_MAX - distance : distance;
+}
+
+static void test_primaries(void)
+{
+    static const struct {
+        uint16_t degree;
+        light_color_rgb_t rgb;
+    } primaries[] = {
+        {0,   {LIGHT_COLOR_MAX, 0, 0}},
+        {60,  {LIGHT_COLOR_MAX, LIGHT_COLOR_MAX, 0}},
+        {120, {0, LIGHT_COLOR_MAX, 0}},
+        {180, {0, LIGHT_COLOR_MAX, LIGHT_COLOR_MAX}},
+        {240, {0, 0, LIGHT_COLOR_MAX}},
+        {300, {LIGHT_COLOR_MAX, 0, LIGHT_COLOR_MAX}},
+        {360, {LIGHT_COLOR_MAX, 0, 0}},
+    };
+
+    for (int i = 0; i < sizeof(primaries) / sizeof(primaries[0]); i++) {
+        light_color_hsv_t hsv = {primaries[i].degree * LIGHT_COLOR_HUE_SCALE, LIGHT_COLOR_MAX, LIGHT_COLOR_MAX};
+        light_color_rgb_t rgb;
+
+        light_color_hsv_to_rgb(&hsv, &rgb);
+        TEST_ASSERT_EQUAL(primaries[i].rgb.red, rgb.red);
+        TEST_ASSERT_EQUAL(primaries[i].rgb.green, rgb.green);
+        TEST_ASSERT_EQUAL(primaries[i].rgb.blue, rgb.blue);
+
+        light_color_rgb_to_hsv(&rgb, &hsv);
+        TEST_ASSERT_EQUAL(primaries[i].degree % 360 * LIGHT_COLOR_HUE_SCALE, hsv.hue);
+        TEST_ASSERT_EQUAL(LIGHT_COLOR_MAX, hsv.saturation);
+        TEST_ASSERT_EQUAL(LIGHT_COLOR_MAX, hsv.value);
+    }
+
+    light_color_rgb_t grey = {1000, 1000, 1000};
+    light_color_hsv_t hsv;
+    light_color_rgb_to_hsv(&grey, &hsv);
+    TEST_ASSERT_EQUAL(0, hsv.hue);
+    TEST_ASSERT_EQUAL(0, hsv.saturation);
+    TEST_ASSERT_EQUAL(1000, hsv.value);
+}
+
+/**
+ * Every 8-bit colour read back from the LEDs and set again is unchanged
+ */
+static void test_rgb8_round_trip_is_exact(void)
+{
+    uint32_t max_error = 0;
+
+    for (int red = 0; red < 256; red++) {
+        for (int green = 0; green < 256; green++) {
+            for (int blue = 0; blue < 256; blue++) {
+                light_color_rgb_t rgb = {COLOR_8BIT_TO_16(red), COLOR_8BIT_TO_16(green), COLOR_8BIT_TO_16(blue)};
+                light_color_rgb_t out;
+                light_color_hsv_t hsv;
+
+                light_color_rgb_to_hsv(&rgb, &hsv);
+                light_color_hsv_to_rgb(&hsv, &out);
+
+                max_error = MAX(max_error, abs(out.red - rgb.red));
+                max_error = MAX(max_error, abs(out.green - rgb.green));
+                max_error = MAX(max_error, abs(out.blue - rgb.blue));
+
+                if (COLOR_16_TO_8BIT(out.red) != red || COLOR_16_TO_8BIT(out.green) != green
+                        || COLOR_16_TO_8BIT(out.blue) != blue) {
+                    printf("rgb %d %d %d came back as %d %d %d\n", red, green, blue,
+                           COLOR_16_TO_8BIT(out.red), COLOR_16_TO_8BIT(out.green), COLOR_16_TO_8BIT(out.blue));
+                    TEST_FAIL_MESSAGE("8-bit colour not recovered");
+                }
+            }
+        }
+    }
+
+    printf("largest 16-bit channel error of an 8-bit round trip: %" PRIu32 "\n", max_error);
+}
+
+/**
+ * HSV to RGB and back keeps the value, and loses hue and saturation only to
+ * the resolution the chroma and value leave in the channels
+ */
+static void test_hsv_round_trip_error(void)
+{
+    for (uint32_t saturation = 0; saturation <= LIGHT_COLOR_MAX; saturation += COLOR_GRID_STEP) {
+        for (uint32_t value = 0; value <= LIGHT_COLOR_MAX; value += COLOR_GRID_STEP) {
+            for (uint32_t hue = 0; hue < LIGHT_COLOR_HUE_MAX; hue++) {
+                light_color_hsv_t hsv = {hue, saturation, value};
+                light_color_hsv_t out;
+                light_color_rgb_t rgb;
+
+                light_color_hsv_to_rgb(&hsv, &rgb);
+                light_color_rgb_to_hsv(&rgb, &out);
+                TEST_ASSERT_EQUAL(value, out.value);
+
+                uint32_t chroma = chroma_of(&hsv);
+
+                if (!chroma) {
+                    continue;
+                }
+
+                /**< Each count of the ramping channel spans HUE_SECTOR / chroma of hue */
+                int hue_bound = (chroma >= LIGHT_COLOR_HUE_SECTOR) ? 0 : LIGHT_COLOR_HUE_SECTOR / (2 * chroma) + 1;
+                TEST_ASSERT_LESS_OR_EQUAL(hue_bound, hue_distance(hue, out.hue));
+                TEST_ASSERT_INT_WITHIN((LIGHT_COLOR_MAX / 2 + value) / value, saturation, out.saturation);
+            }
+        }
+    }
+}
+
+/**
+ * The degree and percent state of the driver survives a round trip through
+ * the 16-bit channels, hue once the colour has a chroma to carry it
+ */
+static void test_driver_units_round_trip(void)
+{
+    uint32_t hue_lost = 0;
+
+    for (int degree = 0; degree < 360; degree++) {
+        for (int saturation = 0; saturation <= 100; saturation++) {
+            for (int value = 0; value <= 100; value++) {
+                light_color_hsv_t hsv = {
+                    degree * LIGHT_COLOR_HUE_SCALE, COLOR_PERCENT_TO_16(saturation), COLOR_PERCENT_TO_16(value)
+                };
+                light_color_hsv_t out;
+                light_color_rgb_t rgb;
+
+                light_color_hsv_to_rgb(&hsv, &rgb);
+                light_color_rgb_to_hsv(&rgb, &out);
+
+                TEST_ASSERT_EQUAL(value, COLOR_16_TO_PERCENT(out.value));
+
+                if (!value) {
+                    continue;
+                }
+
+                TEST_ASSERT_EQUAL(saturation, COLOR_16_TO_PERCENT(out.saturation));
+
+                if (!saturation) {
+                    continue;
+                }
+
+                int out_degree = (out.hue + LIGHT_COLOR_HUE_SCALE / 2) / LIGHT_COLOR_HUE_SCALE % 360;
+
+                if (out_degree != degree) {
+                    /**< Half a degree of hue needs 60 counts of chroma */
+                    TEST_ASSERT(chroma_of(&hsv) < LIGHT_COLOR_HUE_SECTOR / LIGHT_COLOR_HUE_SCALE);
+                    hue_lost++;
+                }
+            }
+        }
+    }
+
+    printf("colours with too little chroma to keep their degree of hue: %" PRIu32 " of %d\n",
+           hue_lost, 360 * 100 * 100);
+}
+
+int main(void)
+{
+    RUN_TEST(test_primaries);
+    RUN_TEST(test_rgb8_round_trip_is_exact);
+    RUN_TEST(test_hsv_round_trip_error);
+    RUN_TEST(test_driver_units_round_trip);
+
+    return UNITY_END();
+}
@@ -0,0 +1,242 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "app_storage.h"
+#include "light_driver.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+/**
+ * The light driver on the simulated LEDC, with the command queue of
+ * CONFIG_LIGHT_DRIVER_CMD_QUEUE_LEN. The control task only runs when the
+ * test lets it with rtos_sim_run_idle(), so every command of a case is
+ * queued before the task takes the first one.
+ */
+
+#define TEST_QUEUE_LEN  (CONFIG_LIGHT_DRIVER_CMD_QUEUE_LEN)
+#define TEST_BURST      (4 * TEST_QUEUE_LEN)
+
+static bool s_driver_running = false; /**< A failed case returns before its deinit */
+
+/**
+ * @brief Start the driver on what app_storage holds
+ */
+static void driver_start(void)
+{
+    const light_driver_config_t config = {
+        .gpio_red        = 0,
+        .gpio_green      = 1,
+        .gpio_blue       = 2,
+        .gpio_cold       = 3,
+        .gpio_warm       = 4,
+        .fade_period_ms  = 0,
+        .blink_period_ms = 2000,
+        .freq_hz         = 5000,
+        .clk_cfg         = LEDC_USE_APB_CLK,
+        .duty_resolution = LEDC_TIMER_13_BIT,
+    };
+
+    sim_reset();
+    light_driver_init((light_driver_config_t *)&config);
+    s_driver_running = true;
+    rtos_sim_run_idle();
+}
+
+static void driver_teardown(void)
+{
+    light_driver_deinit();
+    s_driver_running = false;
+}
+
+/**
+ * @brief Start the driver on an empty app_storage
+ */
+static void driver_setup(void)
+{
+    if (s_driver_running) {
+        driver_teardown();
+    }
+
+    app_storage_sim_reset();
+    driver_start();
+}
+
+/**
+ * A burst of colour targets longer than the queue is never refused, the
+ * newest target of each attribute is the one applied
+ */
+static void test_color_burst_keeps_newest(void)
+{
+    driver_setup();
+    uint32_t dropped = light_driver_get_dropped();
+
+    for (int i = 0; i < TEST_BURST; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hue(i));
+        TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_saturation(100 - i % 50));
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_value(60));
+    rtos_sim_run_idle();
+
+    TEST_ASSERT_EQUAL(TEST_BURST - 1, light_driver_get_hue());
+    TEST_ASSERT_EQUAL(100 - (TEST_BURST - 1) % 50, light_driver_get_saturation());
+    TEST_ASSERT_EQUAL(60, light_driver_get_value());
+    TEST_ASSERT_TRUE(light_driver_get_switch());
+    TEST_ASSERT_EQUAL(dropped, light_driver_get_dropped());
+
+    driver_teardown();
+}
+
+/**
+ * A command queued between colour targets sees the ones before it and not
+ * the ones after it
+ */
+static void test_color_order_around_commands(void)
+{
+    driver_setup();
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hsv(10, 100, 100));
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_scene_save(0, 0));
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hue(200));
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_switch(false));
+    rtos_sim_run_idle();
+
+    TEST_ASSERT_EQUAL(200, light_driver_get_hue());
+    TEST_ASSERT_FALSE(light_driver_get_switch());
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_scene_recall(0));
+    rtos_sim_run_idle();
+
+    TEST_ASSERT_EQUAL(10, light_driver_get_hue());
+    TEST_ASSERT_TRUE(light_driver_get_switch());
+
+    driver_teardown();
+}
+
+/**
+ * With the queue full of other commands, colour targets still get through
+ * and come after them
+ */
+static void test_color_with_queue_full(void)
+{
+    driver_setup();
+    uint32_t dropped = light_driver_get_dropped();
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hsv(10, 100, 100));
+
+    /**< The first save takes a slot for the colour targets before it as well */
+    for (int i = 0; i < TEST_QUEUE_LEN - 1; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, light_driver_scene_save(0, 0));
+    }
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, light_driver_scene_save(1, 0));
+    TEST_ASSERT_EQUAL(dropped + 1, light_driver_get_dropped());
+
+    for (int i = 0; i < TEST_BURST; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hue(i));
+    }
+
+    rtos_sim_run_idle();
+    TEST_ASSERT_EQUAL(TEST_BURST - 1, light_driver_get_hue());
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_scene_recall(0));
+    rtos_sim_run_idle();
+    TEST_ASSERT_EQUAL(10, light_driver_get_hue());
+
+    driver_teardown();
+}
+
+/**
+ * A schedule is saved as a blob of the points in use only, and read back
+ */
+static void test_schedule_saved_as_blob(void)
+{
+    const light_schedule_point_t points[] = {
+        {7 * 3600, 3000, 60},
+        {12 * 3600, 6500, 100},
+        {22 * 3600, 2200, 5},
+    };
+    const size_t num = sizeof(points) / sizeof(points[0]);
+    light_schedule_point_t loaded[LIGHT_SCHEDULE_POINT_MAX];
+    uint8_t blob[64];
+    size_t loaded_num = 0;
+
+    TEST_ASSERT(light_schedule_blob_size(num) <= sizeof(blob));
+
+    driver_setup();
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_schedule_start(points, num));
+    rtos_sim_run_idle();
+    driver_teardown();
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, app_storage_get("light_sched", blob, light_schedule_blob_size(num) - 1));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_sched", blob, light_schedule_blob_size(num)));
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_unpack(loaded, &loaded_num, blob, light_schedule_blob_size(num)));
+    TEST_ASSERT_EQUAL(num, loaded_num);
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT_EQUAL(points[i].time_s, loaded[i].time_s);
+        TEST_ASSERT_EQUAL(points[i].kelvin, loaded[i].kelvin);
+        TEST_ASSERT_EQUAL(points[i].brightness, loaded[i].brightness);
+    }
+}
+
+/**
+ * The keys of a torn save are erased at start, the light starts from its
+ * defaults and the torn mark is cleared
+ */
+static void test_torn_batch_discarded(void)
+{
+    const light_schedule_point_t point = {9 * 3600, 4000, 70};
+    uint8_t blob[64];
+    uint32_t generation = 0;
+
+    driver_setup();
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_set_hsv(120, 50, 50));
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_scene_save(0, 0));
+    TEST_ASSERT_EQUAL(ESP_OK, light_driver_schedule_start(&point, 1));
+    rtos_sim_run_idle();
+    driver_teardown();
+
+    /**< Without a tear, all of them come back */
+    driver_start();
+    TEST_ASSERT_EQUAL(120, light_driver_get_hue());
+    driver_teardown();
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_scenes", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_get("light_sched", blob, sizeof(blob)));
+
+    app_storage_sim_tear();
+    driver_start();
+
+    TEST_ASSERT_EQUAL(ESP_OK, app_storage_batch_generation(&generation));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, app_storage_get("light_scenes", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, app_storage_get("light_sched", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(360, light_driver_get_hue());
+    TEST_ASSERT_EQUAL(0, light_driver_get_saturation());
+
+    driver_teardown();
+}
+
+int main(void)
+{
+    RUN_TEST(test_color_burst_keeps_newest);
+    RUN_TEST(test_color_order_around_commands);
+    RUN_TEST(test_color_with_queue_full);
+    RUN_TEST(test_schedule_saved_as_blob);
+    RUN_TEST(test_torn_batch_discarded);
+
+    return UNITY_END();
+}
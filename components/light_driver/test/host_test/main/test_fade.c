@@ -0,0 +1,351 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/param.h>
+#include "iot_led.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+#define TEST_CHANNEL      LEDC_CHANNEL_0
+#define TEST_FREQ_HZ      (5000)
+#define TEST_RESOLUTION   LEDC_TIMER_13_BIT
+#define TEST_FREQ_HZ_FINE (2000)     /**< PWM of the 14-bit duty checks */
+#define TEST_FADE_MS      (1000)
+#define TEST_SAMPLE_MS    (5)
+#define TEST_SETTLE_US    (10 * 1000)
+#define TEST_LONG_FADE_MS (300 * 1000)
+
+#define TEST_COUNT_Q4     (1 << 4)   /**< One duty count in the Q4 duty register */
+
+static uint32_t g_ref_duty_q4[256];  /**< Duty of each value set without a fade */
+
+static iot_led_handle_t light_setup_timer(iot_led_fade_mode_t mode, bool dither,
+                                          uint32_t freq_hz, ledc_timer_bit_t resolution)
+{
+    sim_reset();
+    iot_led_handle_t led = iot_led_create(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, freq_hz,
+                                          LEDC_USE_APB_CLK, resolution);
+    iot_led_regist_channel(led, TEST_CHANNEL, 5);
+    iot_led_set_fade_mode(led, mode);
+    iot_led_set_dither(led, TEST_CHANNEL, dither);
+    return led;
+}
+
+static iot_led_handle_t light_setup(iot_led_fade_mode_t mode, bool dither)
+{
+    return light_setup_timer(mode, dither, TEST_FREQ_HZ, TEST_RESOLUTION);
+}
+
+static void light_teardown(iot_led_handle_t led)
+{
+    iot_led_delete(led);
+}
+
+static void ref_duty_init(bool dither)
+{
+    iot_led_handle_t led = light_setup(IOT_LED_FADE_SOFTWARE, dither);
+
+    for (int value = 0; value < 256; value++) {
+        iot_led_set_channel(led, TEST_CHANNEL, value, 0);
+        sim_advance_us(TEST_SETTLE_US);
+        g_ref_duty_q4[value] = ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL);
+    }
+
+    light_teardown(led);
+}
+
+/**
+ * Value a linear fade from `from` to `to` over `fade_ms` has reached at `ms`,
+ * rounded towards `from` or towards `to`
+ */
+static int fade_value_at(int from, int to, int fade_ms, int ms, bool toward_to)
+{
+    if (ms <= 0) {
+        return from;
+    }
+    if (ms >= fade_ms) {
+        return to;
+    }
+
+    int delta = abs(to - from) * ms;
+    delta = toward_to ? (delta + fade_ms - 1) / fade_ms : delta / fade_ms;
+    return to > from ? from + delta : from - delta;
+}
+
+/**
+ * Sample a fade and check every duty lies on the dimming curve between the
+ * values the fade should have reached `slack_ms` before and after, give or
+ * take `slack_q4`
+ */
+static void check_fade(iot_led_handle_t led, int from, int to, int fade_ms, int slack_ms, uint32_t slack_q4)
+{
+    int64_t start_us = sim_now_us();
+    iot_led_set_channel(led, TEST_CHANNEL, to, fade_ms);
+
+    for (int ms = TEST_SAMPLE_MS; ms <= fade_ms + 2 * DUTY_SET_CYCLE; ms += TEST_SAMPLE_MS) {
+        sim_run_until(start_us + ms * 1000);
+        uint32_t duty = ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL);
+        uint32_t early = g_ref_duty_q4[fade_value_at(from, to, fade_ms, ms - slack_ms, false)];
+        uint32_t late = g_ref_duty_q4[fade_value_at(from, to, fade_ms, ms + slack_ms, true)];
+        uint32_t low = MIN(early, late) - MIN(MIN(early, late), slack_q4);
+        uint32_t high = MAX(early, late) + slack_q4;
+
+        if (duty < low || duty > high) {
+            printf("duty %" PRIu32 " at %d ms of %d -> %d, expected %" PRIu32 " ~ %" PRIu32 "\n",
+                   duty, ms, from, to, low, high);
+            TEST_FAIL_MESSAGE("fade is off the dimming curve");
+        }
+    }
+
+    TEST_ASSERT_EQUAL(g_ref_duty_q4[to], ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL));
+}
+
+/**
+ * Check the recorded waveform only moves towards the target
+ */
+static void check_monotonic(int direction)
+{
+    size_t count = 0;
+    const ledc_sim_sample_t *trace = ledc_sim_trace(LEDC_LOW_SPEED_MODE, TEST_CHANNEL, &count);
+
+    TEST_ASSERT(count > 1);
+    for (size_t i = 1; i < count; i++) {
+        int64_t step = (int64_t)trace[i].duty_q4 - trace[i - 1].duty_q4;
+        if (step * direction < 0) {
+            printf("duty %" PRIu32 " -> %" PRIu32 " at %" PRId64 " us\n",
+                   trace[i - 1].duty_q4, trace[i].duty_q4, trace[i].time_us);
+            TEST_FAIL_MESSAGE("fade is not monotonic");
+        }
+    }
+}
+
+static void fade_accuracy(iot_led_fade_mode_t mode, bool dither, int slack_ms, uint32_t slack_q4)
+{
+    ref_duty_init(dither);
+    iot_led_handle_t led = light_setup(mode, dither);
+
+    check_fade(led, 0, 255, TEST_FADE_MS, slack_ms, slack_q4);
+    check_fade(led, 255, 0, TEST_FADE_MS, slack_ms, slack_q4);
+    check_fade(led, 0, 100, TEST_FADE_MS / 4, slack_ms, slack_q4);
+    check_fade(led, 100, 30, 3 * TEST_FADE_MS, slack_ms, slack_q4);
+
+    light_teardown(led);
+}
+
+/**
+ * Duty of a fade from `from` to `to` over `fade_ms`, sampled every second
+ */
+static void long_fade_trace(iot_led_fade_mode_t mode, uint32_t freq_hz, ledc_timer_bit_t resolution,
+                            int from, int to, int fade_ms, uint32_t *duty_q4)
+{
+    iot_led_handle_t led = light_setup_timer(mode, false, freq_hz, resolution);
+
+    iot_led_set_channel(led, TEST_CHANNEL, from, 0);
+    sim_advance_us(TEST_SETTLE_US);
+
+    int64_t start_us = sim_now_us();
+    iot_led_set_channel(led, TEST_CHANNEL, to, fade_ms);
+
+    for (int s = 1; s < fade_ms / 1000; s++) {
+        sim_run_until(start_us + s * 1000000LL);
+        duty_q4[s] = ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL);
+    }
+
+    light_teardown(led);
+}
+
+/**
+ * A long hardware fade follows the software one within 1/16 of the duty, down
+ * to the bottom of the curve where a segment has to be short to stay on it
+ */
+static void check_long_fade(uint32_t freq_hz, ledc_timer_bit_t resolution, int from, int to, int fade_ms)
+{
+    static uint32_t software_q4[TEST_LONG_FADE_MS / 1000];
+    static uint32_t hardware_q4[TEST_LONG_FADE_MS / 1000];
+
+    long_fade_trace(IOT_LED_FADE_SOFTWARE, freq_hz, resolution, from, to, fade_ms, software_q4);
+    long_fade_trace(IOT_LED_FADE_HARDWARE, freq_hz, resolution, from, to, fade_ms, hardware_q4);
+
+    for (int s = 1; s < fade_ms / 1000; s++) {
+        uint32_t slack = software_q4[s] / 16 + 2 * TEST_COUNT_Q4;
+
+        if (hardware_q4[s] + slack < software_q4[s] || hardware_q4[s] > software_q4[s] + slack) {
+            printf("duty %" PRIu32 " at %d s of %d -> %d, software fade at %" PRIu32 "\n",
+                   hardware_q4[s], s, from, to, software_q4[s]);
+            TEST_FAIL_MESSAGE("hardware fade is off the software fade");
+        }
+    }
+}
+
+static void fade_monotonic(iot_led_fade_mode_t mode, bool dither)
+{
+    iot_led_handle_t led = light_setup(mode, dither);
+
+    ledc_sim_trace_clear();
+    iot_led_set_channel(led, TEST_CHANNEL, 255, 3 * TEST_FADE_MS);
+    sim_advance_us((3 * TEST_FADE_MS + 2 * DUTY_SET_CYCLE) * 1000);
+    check_monotonic(1);
+
+    ledc_sim_trace_clear();
+    iot_led_set_channel(led, TEST_CHANNEL, 0, 3 * TEST_FADE_MS);
+    sim_advance_us((3 * TEST_FADE_MS + 2 * DUTY_SET_CYCLE) * 1000);
+    check_monotonic(-1);
+
+    light_teardown(led);
+}
+
+static void test_software_fade_accuracy(void)
+{
+    fade_accuracy(IOT_LED_FADE_SOFTWARE, false, DUTY_SET_CYCLE, 0);
+}
+
+static void test_hardware_fade_accuracy(void)
+{
+    /**< The LEDC fader steps whole counts, a segment may lag a couple of ticks */
+    fade_accuracy(IOT_LED_FADE_HARDWARE, false, 2 * DUTY_SET_CYCLE, TEST_COUNT_Q4);
+
+    check_long_fade(TEST_FREQ_HZ, TEST_RESOLUTION, 255, 0, TEST_LONG_FADE_MS);
+    check_long_fade(TEST_FREQ_HZ, TEST_RESOLUTION, 0, 255, TEST_LONG_FADE_MS);
+
+    /**< Segments of a finer duty are cut to the 1023 counts the fader takes */
+    check_long_fade(TEST_FREQ_HZ_FINE, LEDC_TIMER_14_BIT, 255, 0, TEST_LONG_FADE_MS);
+    check_long_fade(TEST_FREQ_HZ_FINE, LEDC_TIMER_14_BIT, 0, 255, TEST_LONG_FADE_MS);
+}
+
+static void test_dithered_fade_accuracy(void)
+{
+    /**< Sigma-delta output is within a count of the curve, on average on it */
+    fade_accuracy(IOT_LED_FADE_SOFTWARE, true, DUTY_SET_CYCLE, TEST_COUNT_Q4);
+}
+
+static void test_software_fade_monotonic(void)
+{
+    fade_monotonic(IOT_LED_FADE_SOFTWARE, false);
+}
+
+static void test_hardware_fade_monotonic(void)
+{
+    fade_monotonic(IOT_LED_FADE_HARDWARE, false);
+}
+
+static void test_dithered_fade_monotonic(void)
+{
+    fade_monotonic(IOT_LED_FADE_SOFTWARE, true);
+}
+
+/**
+ * A new target taken mid-fade starts from the duty output at that time
+ */
+static void test_fade_retarget_is_continuous(void)
+{
+    iot_led_handle_t led = light_setup(IOT_LED_FADE_SOFTWARE, false);
+
+    iot_led_set_channel(led, TEST_CHANNEL, 255, TEST_FADE_MS);
+    sim_advance_us(TEST_FADE_MS * 1000 / 2);
+    uint32_t before = ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL);
+
+    ledc_sim_trace_clear();
+    iot_led_set_channel(led, TEST_CHANNEL, 0, TEST_FADE_MS);
+    sim_advance_us((TEST_FADE_MS + 2 * DUTY_SET_CYCLE) * 1000);
+    check_monotonic(-1);
+
+    size_t count = 0;
+    const ledc_sim_sample_t *trace = ledc_sim_trace(LEDC_LOW_SPEED_MODE, TEST_CHANNEL, &count);
+    TEST_ASSERT(count > 1);
+    TEST_ASSERT_LESS_OR_EQUAL(before, trace[0].duty_q4);
+    TEST_ASSERT_EQUAL(0, ledc_sim_duty_q4(LEDC_LOW_SPEED_MODE, TEST_CHANNEL));
+
+    light_teardown(led);
+}
+
+/**
+ * The hardware fader only needs the timer at the segment knots
+ */
+static void test_hardware_fade_alarm_budget(void)
+{
+    iot_led_handle_t led = light_setup(IOT_LED_FADE_SOFTWARE, false);
+    iot_led_set_channel(led, TEST_CHANNEL, 255, 10 * TEST_FADE_MS);
+    sim_advance_us((10 * TEST_FADE_MS + 2 * DUTY_SET_CYCLE) * 1000);
+    uint32_t software = gptimer_sim_alarm_count();
+    light_teardown(led);
+
+    led = light_setup(IOT_LED_FADE_HARDWARE, false);
+    iot_led_set_channel(led, TEST_CHANNEL, 255, 10 * TEST_FADE_MS);
+    sim_advance_us((10 * TEST_FADE_MS + 2 * DUTY_SET_CYCLE) * 1000);
+    uint32_t hardware = gptimer_sim_alarm_count();
+    light_teardown(led);
+
+    printf("alarms for a %d ms ramp: software %" PRIu32 ", hardware %" PRIu32 "\n",
+           10 * TEST_FADE_MS, software, hardware);
+    TEST_ASSERT_LESS_OR_EQUAL(10 * TEST_FADE_MS / DUTY_SET_CYCLE + 2, software);
+    TEST_ASSERT_LESS_OR_EQUAL(software / 4, hardware);
+}
+
+/**
+ * A second instance may share a ledc timer, but not retime it
+ */
+static void test_shared_timer_keeps_config(void)
+{
+    iot_led_handle_t led = light_setup(IOT_LED_FADE_SOFTWARE, false);
+    uint32_t period_ns = ledc_sim_pwm_period_ns(LEDC_LOW_SPEED_MODE, TEST_CHANNEL);
+
+    TEST_ASSERT_FALSE(iot_led_create(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, TEST_FREQ_HZ / 5,
+                                     LEDC_USE_APB_CLK, TEST_RESOLUTION));
+    TEST_ASSERT_FALSE(iot_led_create(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, TEST_FREQ_HZ,
+                                     LEDC_USE_APB_CLK, LEDC_TIMER_10_BIT));
+    TEST_ASSERT_EQUAL(period_ns, ledc_sim_pwm_period_ns(LEDC_LOW_SPEED_MODE, TEST_CHANNEL));
+
+    iot_led_handle_t same = iot_led_create(LEDC_TIMER_0, LEDC_LOW_SPEED_MODE, TEST_FREQ_HZ,
+                                           LEDC_USE_APB_CLK, TEST_RESOLUTION);
+    iot_led_handle_t other = iot_led_create(LEDC_TIMER_1, LEDC_LOW_SPEED_MODE, TEST_FREQ_HZ / 5,
+                                            LEDC_USE_APB_CLK, LEDC_TIMER_10_BIT);
+    TEST_ASSERT_TRUE(same);
+    TEST_ASSERT_TRUE(other);
+    TEST_ASSERT_EQUAL(period_ns, ledc_sim_pwm_period_ns(LEDC_LOW_SPEED_MODE, TEST_CHANNEL));
+
+    iot_led_delete(other);
+    iot_led_delete(same);
+    light_teardown(led);
+}
+
+/**
+ * The inverse of the dimming curve finds every value back from its duty
+ */
+static void test_duty_to_value_inverts_curve(void)
+{
+    for (int value = 0; value <= UINT8_MAX; value++) {
+        TEST_ASSERT_EQUAL(value, iot_led_duty_to_value(iot_led_value_to_duty(value)));
+    }
+
+    TEST_ASSERT_EQUAL(0, iot_led_duty_to_value(0));
+    TEST_ASSERT_EQUAL(UINT8_MAX, iot_led_duty_to_value(UINT16_MAX));
+}
+
+int main(void)
+{
+    RUN_TEST(test_software_fade_accuracy);
+    RUN_TEST(test_hardware_fade_accuracy);
+    RUN_TEST(test_dithered_fade_accuracy);
+    RUN_TEST(test_software_fade_monotonic);
+    RUN_TEST(test_hardware_fade_monotonic);
+    RUN_TEST(test_dithered_fade_monotonic);
+    RUN_TEST(test_fade_retarget_is_continuous);
+    RUN_TEST(test_hardware_fade_alarm_budget);
+    RUN_TEST(test_shared_timer_keeps_config);
+    RUN_TEST(test_duty_to_value_inverts_curve);
+
+    return UNITY_END();
+}
@@ -0,0 +1,122 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "light_power.h"
+#include "host_test.h"
+
+#define POWER_RANDOM_RUNS   (100000)
+
+/**< 350 mA channels, the warm and cold ones of a higher current LED, on a supply sized for 60% of the sum */
+static const light_power_config_t g_fixture = {
+    .weight = {350, 350, 350, 700, 700},
+    .budget = (350 * 3 + 700 * 2) * 60 / 100,
+};
+
+/**
+ * Full white on every channel comes down to the budget, each channel by the same factor
+ */
+static void test_full_white(void)
+{
+    uint16_t duty[LIGHT_POWER_CHANNEL_NUM] = {UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX};
+    light_power_stats_t stats = {0};
+
+    TEST_ASSERT_TRUE(light_power_limit(&g_fixture, duty, &stats));
+    TEST_ASSERT_TRUE(light_power_load(&g_fixture, duty) <= (uint64_t)g_fixture.budget * LIGHT_POWER_DUTY_MAX);
+
+    for (int i = 0; i < LIGHT_POWER_CHANNEL_NUM; i++) {
+        TEST_ASSERT_EQUAL(duty[0], duty[i]);
+    }
+
+    /**< 60% of full duty, to the rounding of the gain */
+    TEST_ASSERT_TRUE(abs((int)duty[0] - UINT16_MAX * 60 / 100) <= 2);
+    TEST_ASSERT_EQUAL(1, stats.updates);
+    TEST_ASSERT_EQUAL(1, stats.limited);
+    TEST_ASSERT_EQUAL(1666, stats.load_max);
+}
+
+/**
+ * A load within the budget or a fixture without one is left alone
+ */
+static void test_within_budget(void)
+{
+    const light_power_config_t unlimited = {.weight = {350, 350, 350, 700, 700}};
+    uint16_t duty[LIGHT_POWER_CHANNEL_NUM] = {UINT16_MAX, UINT16_MAX, UINT16_MAX, 0, 0};
+    uint16_t before[LIGHT_POWER_CHANNEL_NUM];
+    light_power_stats_t stats = {0};
+
+    memcpy(before, duty, sizeof(duty));
+    TEST_ASSERT_FALSE(light_power_limit(&g_fixture, duty, &stats));
+    TEST_ASSERT_EQUAL(0, memcmp(before, duty, sizeof(duty)));
+
+    duty[3] = duty[4] = UINT16_MAX;
+    memcpy(before, duty, sizeof(duty));
+    TEST_ASSERT_FALSE(light_power_limit(&unlimited, duty, &stats));
+    TEST_ASSERT_EQUAL(0, memcmp(before, duty, sizeof(duty)));
+
+    TEST_ASSERT_EQUAL(2, stats.updates);
+    TEST_ASSERT_EQUAL(0, stats.limited);
+    TEST_ASSERT_EQUAL(1050 * 1000 / 1470, stats.load_max);
+}
+
+/**
+ * Any mix never ends up over the budget, and keeps the ratio of its channels
+ */
+static void test_random_mixes(void)
+{
+    light_power_stats_t stats = {0};
+
+    srand(18);
+
+    for (int run = 0; run < POWER_RANDOM_RUNS; run++) {
+        uint16_t duty[LIGHT_POWER_CHANNEL_NUM];
+        uint16_t before[LIGHT_POWER_CHANNEL_NUM];
+        int top = 0;
+
+        for (int i = 0; i < LIGHT_POWER_CHANNEL_NUM; i++) {
+            duty[i] = rand() & UINT16_MAX;
+            top = (duty[i] > duty[top]) ? i : top;
+        }
+
+        memcpy(before, duty, sizeof(duty));
+        uint64_t load = light_power_load(&g_fixture, duty);
+        bool limited = light_power_limit(&g_fixture, duty, &stats);
+
+        TEST_ASSERT_EQUAL(load > (uint64_t)g_fixture.budget * LIGHT_POWER_DUTY_MAX, limited);
+        TEST_ASSERT_TRUE(light_power_load(&g_fixture, duty) <= (uint64_t)g_fixture.budget * LIGHT_POWER_DUTY_MAX);
+
+        /**< Each channel keeps its share of the brightest one, to one step of rounding */
+        for (int i = 0; i < LIGHT_POWER_CHANNEL_NUM && duty[top]; i++) {
+            double want = (double)before[i] / before[top];
+            double got  = (double)duty[i] / duty[top];
+            TEST_ASSERT_TRUE(got - want < 2.0 / duty[top] && want - got < 2.0 / duty[top]);
+        }
+    }
+
+    TEST_ASSERT_EQUAL(POWER_RANDOM_RUNS, stats.updates);
+    printf("%" PRIu32 " of %d random mixes limited, worst %" PRIu32 " per mille of the budget\n",
+           stats.limited, POWER_RANDOM_RUNS, stats.load_max);
+}
+
+int main(void)
+{
+    RUN_TEST(test_full_white);
+    RUN_TEST(test_within_budget);
+    RUN_TEST(test_random_mixes);
+
+    return UNITY_END();
+}
@@ -0,0 +1,153 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "light_queue.h"
+#include "host_test.h"
+
+#define QUEUE_PRODUCER_NUM  (4)
+#define QUEUE_ITEM_NUM      (200000)    /**< Items pushed by each producer */
+#define QUEUE_LENGTH        (16)
+
+typedef struct {
+    uint16_t producer;
+    uint32_t seq;
+    uint8_t  pad[5];                /**< Not a multiple of a word */
+} queue_item_t;
+
+typedef struct {
+    light_queue_handle_t queue;
+    uint16_t producer;
+    uint32_t full_count;
+} queue_producer_t;
+
+static void test_create_rejects_bad_length(void)
+{
+    TEST_ASSERT(light_queue_create(0, 4) == NULL);
+    TEST_ASSERT(light_queue_create(12, 4) == NULL);
+    TEST_ASSERT(light_queue_create(16, 0) == NULL);
+
+    light_queue_handle_t queue = light_queue_create(16, 4);
+    TEST_ASSERT(queue != NULL);
+    light_queue_delete(queue);
+}
+
+/**
+ * A full queue refuses the push instead of waiting, and works on after wrapping many times
+ */
+static void test_full_and_wrap(void)
+{
+    light_queue_handle_t queue = light_queue_create(4, sizeof(queue_item_t));
+    queue_item_t item = {0};
+
+    TEST_ASSERT(queue != NULL);
+    TEST_ASSERT_FALSE(light_queue_pop(queue, &item));
+
+    for (uint32_t lap = 0; lap < 1000; lap++) {
+        for (uint32_t i = 0; i < 4; i++) {
+            item.seq = lap * 4 + i;
+            TEST_ASSERT_TRUE(light_queue_push(queue, &item));
+        }
+
+        item.seq = UINT32_MAX;
+        TEST_ASSERT_FALSE(light_queue_push(queue, &item));
+
+        for (uint32_t i = 0; i < 4; i++) {
+            TEST_ASSERT_TRUE(light_queue_pop(queue, &item));
+            TEST_ASSERT_EQUAL(lap * 4 + i, item.seq);
+        }
+
+        TEST_ASSERT_FALSE(light_queue_pop(queue, &item));
+    }
+
+    light_queue_delete(queue);
+}
+
+static void *queue_producer(void *arg)
+{
+    queue_producer_t *producer = (queue_producer_t *)arg;
+    queue_item_t item = {.producer = producer->producer};
+
+    for (item.seq = 0; item.seq < QUEUE_ITEM_NUM; item.seq++) {
+        while (!light_queue_push(producer->queue, &item)) {
+            producer->full_count++;
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Producers on several threads lose no item, and each one's items come out in order
+ */
+static void test_producers_race(void)
+{
+    light_queue_handle_t queue = light_queue_create(QUEUE_LENGTH, sizeof(queue_item_t));
+    pthread_t threads[QUEUE_PRODUCER_NUM];
+    queue_producer_t producers[QUEUE_PRODUCER_NUM];
+    uint32_t next_seq[QUEUE_PRODUCER_NUM] = {0};
+    uint32_t full_count = 0;
+
+    TEST_ASSERT(queue != NULL);
+
+    for (int i = 0; i < QUEUE_PRODUCER_NUM; i++) {
+        producers[i] = (queue_producer_t) {
+            .queue = queue, .producer = i,
+        };
+        pthread_create(threads + i, NULL, queue_producer, producers + i);
+    }
+
+    for (uint32_t received = 0; received < QUEUE_PRODUCER_NUM * QUEUE_ITEM_NUM;) {
+        queue_item_t item;
+
+        if (!light_queue_pop(queue, &item)) {
+            sched_yield();
+            continue;
+        }
+
+        if (item.producer >= QUEUE_PRODUCER_NUM || item.seq != next_seq[item.producer]) {
+            printf("producer %d item %" PRIu32 " out of order\n", item.producer, item.seq);
+            TEST_FAIL_MESSAGE("item lost or reordered");
+        }
+
+        next_seq[item.producer]++;
+        received++;
+    }
+
+    for (int i = 0; i < QUEUE_PRODUCER_NUM; i++) {
+        pthread_join(threads[i], NULL);
+        full_count += producers[i].full_count;
+    }
+
+    queue_item_t item;
+    TEST_ASSERT_FALSE(light_queue_pop(queue, &item));
+    printf("%d producers pushed %d items each, queue found full %" PRIu32 " times\n",
+           QUEUE_PRODUCER_NUM, QUEUE_ITEM_NUM, full_count);
+
+    light_queue_delete(queue);
+}
+
+int main(void)
+{
+    RUN_TEST(test_create_rejects_bad_length);
+    RUN_TEST(test_full_and_wrap);
+    RUN_TEST(test_producers_race);
+
+    return UNITY_END();
+}
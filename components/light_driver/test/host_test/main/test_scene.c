@@ -0,0 +1,136 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "light_scene.h"
+#include "host_test.h"
+
+#define SCENE_NUM   (16)
+
+static uint8_t g_blob[4 + SCENE_NUM * sizeof(light_scene_t)];
+
+static light_scene_t scene_make(uint16_t hue, uint32_t fade_ms)
+{
+    light_scene_t scene = {
+        .valid = 1, .mode = 2, .on = 1, .saturation = 80, .value = 60,
+        .hue = hue, .fade_ms = fade_ms,
+        .channels = {(uint8_t)hue, 20, 30, 0, 0},
+    };
+
+    return scene;
+}
+
+/**
+ * A table comes back as it was, and only the scenes up to the last one saved are written
+ */
+static void test_round_trip(void)
+{
+    light_scene_t scenes[SCENE_NUM] = {0};
+    light_scene_t loaded[SCENE_NUM];
+    size_t size = sizeof(g_blob);
+
+    TEST_ASSERT_EQUAL(20, sizeof(light_scene_t));
+    TEST_ASSERT_EQUAL(sizeof(g_blob), light_scene_blob_size(SCENE_NUM));
+
+    scenes[0] = scene_make(120, 500);
+    scenes[3] = scene_make(240, 2000);
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_pack(scenes, SCENE_NUM, g_blob, &size));
+    TEST_ASSERT_EQUAL(light_scene_blob_size(4), size);
+
+    memset(loaded, 0xa5, sizeof(loaded));
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_unpack(loaded, SCENE_NUM, g_blob, size));
+    TEST_ASSERT_EQUAL(0, memcmp(scenes, loaded, sizeof(scenes)));
+
+    /**< An empty table is the header alone, and empties a table read from it */
+    memset(scenes, 0, sizeof(scenes));
+    size = sizeof(g_blob);
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_pack(scenes, SCENE_NUM, g_blob, &size));
+    TEST_ASSERT_EQUAL(light_scene_blob_size(0), size);
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_unpack(loaded, SCENE_NUM, g_blob, size));
+    TEST_ASSERT_EQUAL(0, memcmp(scenes, loaded, sizeof(scenes)));
+}
+
+/**
+ * A blob of another layout or cut short is refused, and leaves the table alone
+ */
+static void test_refuse_foreign_blob(void)
+{
+    light_scene_t scenes[SCENE_NUM] = {0};
+    light_scene_t loaded[SCENE_NUM];
+    light_scene_t before[SCENE_NUM];
+    size_t size = sizeof(g_blob);
+
+    scenes[1] = scene_make(60, 100);
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_pack(scenes, SCENE_NUM, g_blob, &size));
+
+    memset(loaded, 0x5a, sizeof(loaded));
+    memcpy(before, loaded, sizeof(loaded));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_scene_unpack(loaded, SCENE_NUM, g_blob, size - 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_scene_unpack(loaded, SCENE_NUM, g_blob, 3));
+
+    g_blob[0] = LIGHT_SCENE_VERSION + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, light_scene_unpack(loaded, SCENE_NUM, g_blob, size));
+    g_blob[0] = LIGHT_SCENE_VERSION;
+    g_blob[1] = sizeof(light_scene_t) + 4;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, light_scene_unpack(loaded, SCENE_NUM, g_blob, size));
+
+    TEST_ASSERT_EQUAL(0, memcmp(before, loaded, sizeof(loaded)));
+
+    /**< A buffer too small to pack into */
+    size = light_scene_blob_size(1);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_scene_pack(scenes, SCENE_NUM, g_blob, &size));
+}
+
+/**
+ * A table of another capacity keeps the scenes that fit
+ */
+static void test_capacity_change(void)
+{
+    light_scene_t scenes[SCENE_NUM] = {0};
+    light_scene_t small[4];
+    light_scene_t large[SCENE_NUM];
+    size_t size = sizeof(g_blob);
+
+    for (int i = 0; i < SCENE_NUM; i += 2) {
+        scenes[i] = scene_make(i * 20, i * 100);
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_pack(scenes, SCENE_NUM, g_blob, &size));
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_unpack(small, 4, g_blob, size));
+    TEST_ASSERT_EQUAL(0, memcmp(scenes, small, sizeof(small)));
+
+    size = sizeof(g_blob);
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_pack(small, 4, g_blob, &size));
+    memset(large, 0xa5, sizeof(large));
+    TEST_ASSERT_EQUAL(ESP_OK, light_scene_unpack(large, SCENE_NUM, g_blob, sizeof(g_blob)));
+    TEST_ASSERT_EQUAL(0, memcmp(small, large, sizeof(small)));
+
+    for (int i = 4; i < SCENE_NUM; i++) {
+        TEST_ASSERT_EQUAL(0, large[i].valid);
+        TEST_ASSERT_EQUAL(0, large[i].fade_ms);
+    }
+}
+
+int main(void)
+{
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_refuse_foreign_blob);
+    RUN_TEST(test_capacity_change);
+
+    return UNITY_END();
+}
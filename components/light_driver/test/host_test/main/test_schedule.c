@@ -0,0 +1,240 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "light_schedule.h"
+#include "host_test.h"
+
+#define SCHEDULE_MIRED_TOLERANCE        (1.0)   /**< Largest error of the colour temperature, mired */
+#define SCHEDULE_BRIGHTNESS_TOLERANCE   (1)     /**< Largest error of the brightness */
+#define SCHEDULE_STEP_S                 (10)
+
+#define HOUR(h, m) ((h) * 3600 + (m) * 60)
+
+/**< A daylight curve, given out of order */
+static const light_schedule_point_t g_daylight[] = {
+    {HOUR(22, 0), 2200, 5},
+    {HOUR(7, 0), 3000, 60},
+    {HOUR(12, 30), 6500, 100},
+    {HOUR(18, 0), 4000, 80},
+    {HOUR(6, 0), 2200, 5},
+    {HOUR(20, 0), 2700, 40},
+};
+
+/**
+ * @brief The curve in floating point, linear in mired and brightness between the points
+ */
+static void schedule_reference(const light_schedule_point_t *points, size_t num, uint32_t time_s,
+                               double *mired, double *brightness)
+{
+    const light_schedule_point_t *before = NULL;
+    const light_schedule_point_t *after = NULL;
+    const light_schedule_point_t *first = points;
+    const light_schedule_point_t *last = points;
+
+    for (size_t i = 0; i < num; i++) {
+        if (points[i].time_s <= time_s && (!before || points[i].time_s > before->time_s)) {
+            before = points + i;
+        }
+
+        if (points[i].time_s > time_s && (!after || points[i].time_s < after->time_s)) {
+            after = points + i;
+        }
+
+        first = (points[i].time_s < first->time_s) ? points + i : first;
+        last = (points[i].time_s > last->time_s) ? points + i : last;
+    }
+
+    /**< Across midnight, from the latest point to the earliest one */
+    before = before ? before : last;
+    after = after ? after : first;
+
+    double span = (double)after->time_s - before->time_s;
+    double elapsed = (double)time_s - before->time_s;
+    span += (span <= 0) ? LIGHT_SCHEDULE_DAY_S : 0;
+    elapsed += (elapsed < 0) ? LIGHT_SCHEDULE_DAY_S : 0;
+
+    double frac = elapsed / span;
+    *mired = 1e6 / before->kelvin + (1e6 / after->kelvin - 1e6 / before->kelvin) * frac;
+    *brightness = before->brightness + ((double)after->brightness - before->brightness) * frac;
+}
+
+static void test_compile_rejects(void)
+{
+    light_schedule_t schedule;
+    light_schedule_point_t points[2] = {{HOUR(8, 0), 3000, 50}, {HOUR(20, 0), 2700, 20}};
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_compile(points, 2, &schedule));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_compile(points, 0, &schedule));
+
+    points[1].time_s = points[0].time_s;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_compile(points, 2, &schedule));
+    points[1].time_s = LIGHT_SCHEDULE_DAY_S;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_compile(points, 2, &schedule));
+    points[1].time_s = HOUR(20, 0);
+    points[1].brightness = 101;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_compile(points, 2, &schedule));
+    points[1].brightness = 20;
+    points[1].kelvin = 500;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_compile(points, 2, &schedule));
+}
+
+/**
+ * Stepping through two days follows the curve, and reports a change exactly when the output changes
+ */
+static void test_follows_curve(void)
+{
+    const size_t num = sizeof(g_daylight) / sizeof(g_daylight[0]);
+    light_schedule_t schedule;
+    uint16_t last_kelvin = 0;
+    uint8_t last_brightness = 0;
+    uint32_t changes = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_compile(g_daylight, num, &schedule));
+
+    for (uint32_t t = 0; t < 2 * LIGHT_SCHEDULE_DAY_S; t += SCHEDULE_STEP_S) {
+        uint32_t time_s = t % LIGHT_SCHEDULE_DAY_S;
+        uint16_t kelvin;
+        uint8_t brightness;
+        double mired, level;
+
+        bool changed = light_schedule_step(&schedule, time_s, &kelvin, &brightness);
+        schedule_reference(g_daylight, num, time_s, &mired, &level);
+
+        if (fabs(1e6 / kelvin - mired) > SCHEDULE_MIRED_TOLERANCE
+                || fabs(brightness - level) > SCHEDULE_BRIGHTNESS_TOLERANCE) {
+            printf("%02d:%02d:%02d gave %d K %d%%, curve %.0f K %.1f%%\n", time_s / 3600, time_s / 60 % 60,
+                   time_s % 60, kelvin, brightness, 1e6 / mired, level);
+            TEST_FAIL_MESSAGE("off the curve");
+        }
+
+        TEST_ASSERT_EQUAL(t == 0 || kelvin != last_kelvin || brightness != last_brightness, changed);
+        changes += changed;
+        last_kelvin = kelvin;
+        last_brightness = brightness;
+    }
+
+    printf("%" PRIu32 " changes reported over %d steps\n", changes, 2 * LIGHT_SCHEDULE_DAY_S / SCHEDULE_STEP_S);
+}
+
+/**
+ * A clock set back or jumping ahead gives what a fresh schedule gives
+ */
+static void test_clock_jumps(void)
+{
+    const size_t num = sizeof(g_daylight) / sizeof(g_daylight[0]);
+    const uint32_t times[] = {HOUR(23, 0), HOUR(3, 0), HOUR(12, 45), HOUR(6, 30), HOUR(6, 30), HOUR(21, 59), HOUR(0, 0)};
+    light_schedule_t schedule;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_compile(g_daylight, num, &schedule));
+
+    for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        light_schedule_t fresh;
+        uint16_t kelvin, fresh_kelvin;
+        uint8_t brightness, fresh_brightness;
+
+        TEST_ASSERT_EQUAL(ESP_OK, light_schedule_compile(g_daylight, num, &fresh));
+        light_schedule_step(&schedule, times[i], &kelvin, &brightness);
+        light_schedule_step(&fresh, times[i], &fresh_kelvin, &fresh_brightness);
+        TEST_ASSERT_EQUAL(fresh_kelvin, kelvin);
+        TEST_ASSERT_EQUAL(fresh_brightness, brightness);
+    }
+}
+
+static void test_single_point_holds(void)
+{
+    const light_schedule_point_t point = {HOUR(9, 0), 4000, 70};
+    light_schedule_t schedule;
+    uint16_t kelvin;
+    uint8_t brightness;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_compile(&point, 1, &schedule));
+    TEST_ASSERT_TRUE(light_schedule_step(&schedule, HOUR(1, 0), &kelvin, &brightness));
+    TEST_ASSERT_EQUAL(4000, kelvin);
+    TEST_ASSERT_EQUAL(70, brightness);
+
+    for (uint32_t t = 0; t < LIGHT_SCHEDULE_DAY_S; t += 60) {
+        TEST_ASSERT_FALSE(light_schedule_step(&schedule, t, &kelvin, &brightness));
+    }
+}
+
+/**
+ * Only the points in use are written, without their padding, and a blob of
+ * another layout, cut short or holding too many points is refused
+ */
+static void test_blob(void)
+{
+    const size_t num = sizeof(g_daylight) / sizeof(g_daylight[0]);
+    light_schedule_point_t loaded[LIGHT_SCHEDULE_POINT_MAX];
+    uint8_t blob[4 + LIGHT_SCHEDULE_POINT_MAX * sizeof(light_schedule_point_t)];
+    size_t size = sizeof(blob);
+    size_t loaded_num = 0;
+
+    TEST_ASSERT_EQUAL(sizeof(blob), light_schedule_blob_size(LIGHT_SCHEDULE_POINT_MAX));
+
+    memset(blob, 0xa5, sizeof(blob));
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_pack(g_daylight, num, blob, &size));
+    TEST_ASSERT_EQUAL(light_schedule_blob_size(num), size);
+
+    for (size_t i = 0; i < num; i++) {
+        const uint8_t *point = blob + 4 + i * sizeof(light_schedule_point_t);
+
+        for (size_t j = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t); j < sizeof(light_schedule_point_t); j++) {
+            TEST_ASSERT_EQUAL(0, point[j]);
+        }
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_schedule_unpack(loaded, &loaded_num, blob, size));
+    TEST_ASSERT_EQUAL(num, loaded_num);
+
+    for (size_t i = 0; i < num; i++) {
+        TEST_ASSERT_EQUAL(g_daylight[i].time_s, loaded[i].time_s);
+        TEST_ASSERT_EQUAL(g_daylight[i].kelvin, loaded[i].kelvin);
+        TEST_ASSERT_EQUAL(g_daylight[i].brightness, loaded[i].brightness);
+    }
+
+    loaded_num = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_schedule_unpack(loaded, &loaded_num, blob, size - 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_schedule_unpack(loaded, &loaded_num, blob, 3));
+
+    blob[0] = LIGHT_SCHEDULE_VERSION + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, light_schedule_unpack(loaded, &loaded_num, blob, size));
+    blob[0] = LIGHT_SCHEDULE_VERSION;
+    blob[1] = sizeof(light_schedule_point_t) + 4;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, light_schedule_unpack(loaded, &loaded_num, blob, size));
+    blob[1] = sizeof(light_schedule_point_t);
+    blob[2] = LIGHT_SCHEDULE_POINT_MAX + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_schedule_unpack(loaded, &loaded_num, blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(0, loaded_num);
+
+    /**< Too many points, or a buffer too small to pack into */
+    size = sizeof(blob);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_schedule_pack(g_daylight, LIGHT_SCHEDULE_POINT_MAX + 1, blob, &size));
+    size = light_schedule_blob_size(num - 1);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_schedule_pack(g_daylight, num, blob, &size));
+}
+
+int main(void)
+{
+    RUN_TEST(test_compile_rejects);
+    RUN_TEST(test_follows_curve);
+    RUN_TEST(test_clock_jumps);
+    RUN_TEST(test_single_point_holds);
+    RUN_TEST(test_blob);
+
+    return UNITY_END();
+}
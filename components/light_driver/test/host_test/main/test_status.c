@@ -0,0 +1,164 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "light_status.h"
+#include "host_test.h"
+
+#define STATUS_RANDOM_RUNS  (100000)
+
+static const light_status_t g_typical = {
+    .mode = 3, .on = 1, .hue = 360, .saturation = 0, .value = 100, .color_temperature = 40,
+    .brightness = 30, .fade_period_ms = 800, .blink_period_ms = 1000, .kelvin = 4200,
+};
+
+static bool status_equal(const light_status_t *a, const light_status_t *b)
+{
+    return a->mode == b->mode && a->on == b->on && a->hue == b->hue && a->saturation == b->saturation
+           && a->value == b->value && a->color_temperature == b->color_temperature
+           && a->brightness == b->brightness && a->fade_period_ms == b->fade_period_ms
+           && a->blink_period_ms == b->blink_period_ms && a->kelvin == b->kelvin;
+}
+
+/**
+ * A state comes back as it was, in fewer bytes than the raw struct, and a state of all 0 is the header alone
+ */
+static void test_round_trip(void)
+{
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX];
+    size_t size = sizeof(record);
+    light_status_t decoded;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_encode(&g_typical, record, &size));
+    TEST_ASSERT_EQUAL(16, size);
+    TEST_ASSERT_TRUE(size < sizeof(light_status_t));
+
+    memset(&decoded, 0xa5, sizeof(decoded));
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, size));
+    TEST_ASSERT_TRUE(status_equal(&g_typical, &decoded));
+
+    /**< A buffer larger than the record, as app_storage_get() fills it */
+    memset(record + size, 0, sizeof(record) - size);
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, sizeof(record)));
+    TEST_ASSERT_TRUE(status_equal(&g_typical, &decoded));
+
+    const light_status_t off = {0};
+    size = sizeof(record);
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_encode(&off, record, &size));
+    TEST_ASSERT_EQUAL(2, size);
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, size));
+    TEST_ASSERT_TRUE(status_equal(&off, &decoded));
+
+    size = 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_status_encode(&g_typical, record, &size));
+}
+
+/**
+ * Every field at its largest fits LIGHT_STATUS_ENCODED_MAX, and random states round trip
+ */
+static void test_random(void)
+{
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX];
+    size_t size = sizeof(record);
+    light_status_t status, decoded;
+
+    memset(&status, 0xff, sizeof(status));
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_encode(&status, record, &size));
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, size));
+    TEST_ASSERT_TRUE(status_equal(&status, &decoded));
+
+    srand(25);
+
+    for (int run = 0; run < STATUS_RANDOM_RUNS; run++) {
+        uint8_t *bytes = (uint8_t *)&status;
+
+        for (size_t i = 0; i < sizeof(status); i++) {
+            bytes[i] = (rand() % 3) ? rand() : 0;
+        }
+
+        size = sizeof(record);
+        TEST_ASSERT_EQUAL(ESP_OK, light_status_encode(&status, record, &size));
+        TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, size));
+        TEST_ASSERT_TRUE(status_equal(&status, &decoded));
+    }
+}
+
+/**
+ * The raw struct saved before the encoding is migrated, kelvin included or not
+ */
+static void test_migrate_raw(void)
+{
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX] = {0};
+    light_status_t decoded;
+
+    /**< light_status_t still has the layout of version 1 */
+    memcpy(record, &g_typical, sizeof(light_status_t));
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, sizeof(light_status_t)));
+    TEST_ASSERT_TRUE(status_equal(&g_typical, &decoded));
+
+    /**< Saved before kelvin was added */
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, record, 16));
+    TEST_ASSERT_EQUAL(0, decoded.kelvin);
+    TEST_ASSERT_EQUAL(g_typical.blink_period_ms, decoded.blink_period_ms);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_status_decode(&decoded, record, 15));
+}
+
+/**
+ * A field added by a newer version is skipped, a newer version is refused,
+ * and a record cut short or out of range leaves the state untouched
+ */
+static void test_refused(void)
+{
+    /**< Mode 2 and field 12 of 300 */
+    const uint8_t newer_field[] = {0x80 | LIGHT_STATUS_VERSION, 0x81, 0x20, 0x02, 0xac, 0x02};
+    const uint8_t newer_version[] = {0x80 | (LIGHT_STATUS_VERSION + 1), 0x00};
+    const uint8_t out_of_range[] = {0x80 | LIGHT_STATUS_VERSION, 0x01, 0xac, 0x02};
+    uint8_t record[LIGHT_STATUS_ENCODED_MAX];
+    size_t size = sizeof(record);
+    light_status_t decoded;
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_decode(&decoded, newer_field, sizeof(newer_field)));
+    TEST_ASSERT_EQUAL(2, decoded.mode);
+    TEST_ASSERT_EQUAL(0, decoded.kelvin);
+
+    decoded = g_typical;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION, light_status_decode(&decoded, newer_version, sizeof(newer_version)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, light_status_decode(&decoded, out_of_range, sizeof(out_of_range)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_status_decode(&decoded, record, 0));
+
+    TEST_ASSERT_EQUAL(ESP_OK, light_status_encode(&g_typical, record, &size));
+
+    for (size_t cut = 1; cut < size; cut++) {
+        light_status_t before = decoded;
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, light_status_decode(&decoded, record, cut));
+        TEST_ASSERT_TRUE(status_equal(&before, &decoded));
+    }
+
+    TEST_ASSERT_TRUE(status_equal(&g_typical, &decoded));
+}
+
+int main(void)
+{
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_random);
+    RUN_TEST(test_migrate_raw);
+    RUN_TEST(test_refused);
+
+    return UNITY_END();
+}
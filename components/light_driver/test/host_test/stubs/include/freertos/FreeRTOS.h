@@ -0,0 +1,42 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/param.h>
+
+/* Tasks of rtos_sim.c run one at a time and never preempt each other, the ISR runs synchronously from sim_run_until() */
+typedef struct {
+    int owner;
+} portMUX_TYPE;
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux)      ((void)(mux))
+#define portEXIT_CRITICAL(mux)       ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)  ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)   ((void)(mux))
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux))
+#define portEXIT_CRITICAL_SAFE(mux)  ((void)(mux))
+#define portYIELD_FROM_ISR(woken)    ((void)(woken))
+#define portMAX_DELAY                ((TickType_t)0xffffffffUL)
+
+#define pdFALSE                      (0)
+#define pdTRUE                       (1)
+#define pdPASS                       (pdTRUE)
+#define pdMS_TO_TICKS(ms)            ((TickType_t)(ms))     /**< 1 kHz tick */
@@ -0,0 +1,142 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "driver/ledc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Virtual time of the host simulator
+ *
+ * Nothing moves until the test advances the time: due gptimer alarms then
+ * call their ISR in order, and the LEDC channels latch their registers and
+ * run the hardware fader up to the time of each event.
+ */
+
+/**
+ * @brief One point of the recorded duty waveform
+ */
+typedef struct {
+    int64_t time_us;    /**< Virtual time the duty changed at */
+    uint32_t duty_q4;   /**< Duty counter with its four fractional bits */
+} ledc_sim_sample_t;
+
+/**
+ * @brief Wall clock spent in the alarm callbacks
+ */
+typedef struct {
+    uint32_t count;     /**< Callbacks run */
+    uint64_t total_ns;  /**< Host time spent in them */
+    uint64_t max_ns;    /**< Longest callback */
+} gptimer_sim_isr_time_t;
+
+/**
+ * @brief Reset the virtual time, the timers and the LEDC block
+ */
+void sim_reset(void);
+
+/**
+ * @brief Current virtual time
+ */
+int64_t sim_now_us(void);
+
+/**
+ * @brief Run the due alarms up to `time_us` and stop there
+ */
+void sim_run_until(int64_t time_us);
+
+/**
+ * @brief Run the due alarms for `delta_us` from now
+ */
+void sim_advance_us(int64_t delta_us);
+
+/**
+ * @brief Alarms fired since sim_reset()
+ */
+uint32_t gptimer_sim_alarm_count(void);
+
+/**
+ * @brief Delay every ISR by `latency_us` after its alarm
+ */
+void gptimer_sim_set_isr_latency(int64_t latency_us);
+
+/**
+ * @brief Host time spent in the alarm callbacks since sim_reset()
+ */
+void gptimer_sim_isr_time(gptimer_sim_isr_time_t *time);
+
+/**
+ * @brief Duty output by the channel, integer part and with the fraction
+ */
+uint32_t ledc_sim_duty(ledc_mode_t speed_mode, ledc_channel_t channel);
+uint32_t ledc_sim_duty_q4(ledc_mode_t speed_mode, ledc_channel_t channel);
+
+/**
+ * @brief PWM period of the timer the channel is bound to
+ */
+uint32_t ledc_sim_pwm_period_ns(ledc_mode_t speed_mode, ledc_channel_t channel);
+
+/**
+ * @brief Waveform recorded since the last ledc_sim_trace_clear()
+ *
+ * @param count Number of samples returned
+ */
+const ledc_sim_sample_t *ledc_sim_trace(ledc_mode_t speed_mode, ledc_channel_t channel, size_t *count);
+void ledc_sim_trace_clear(void);
+
+/**
+ * @brief Times the channel latched new duty registers
+ */
+uint32_t ledc_sim_latch_count(ledc_mode_t speed_mode, ledc_channel_t channel);
+
+/**
+ * @brief Accesses of the RAM backed app_storage
+ */
+typedef struct {
+    uint32_t reads;     /**< app_storage_get() calls */
+    uint32_t writes;    /**< app_storage_set() calls, and erases of a key that was set */
+    uint64_t bytes;     /**< Bytes written */
+} app_storage_sim_stats_t;
+
+/**
+ * @brief Let the other tasks run until every one of them waits
+ *
+ * Tasks run one at a time, the caller gets the CPU back once none is ready.
+ */
+void rtos_sim_run_idle(void);
+
+/**
+ * @brief Accesses of app_storage since app_storage_sim_reset()
+ */
+void app_storage_sim_stats(app_storage_sim_stats_t *stats);
+
+/**
+ * @brief Forget every key and clear the counters
+ */
+void app_storage_sim_reset(void);
+
+/**
+ * @brief Report the last batch torn, as a power cut in its commit would, until the next commit
+ */
+void app_storage_sim_tear(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include <stdint.h>
+
+/* Register layout mirrors the subset of the ESP32-C3 LEDC block used by iot_led.c */
+typedef volatile struct ledc_dev_s {
+    struct {
+        struct {
+            union {
+                struct {
+                    uint32_t timer_sel: 2;
+                    uint32_t sig_out_en: 1;
+                    uint32_t idle_lv: 1;
+                    uint32_t low_speed_update: 1;
+                    uint32_t reserved: 27;
+                };
+                uint32_t val;
+            } conf0;
+            union {
+                struct {
+                    uint32_t hpoint: 14;
+                    uint32_t reserved: 18;
+                };
+                uint32_t val;
+            } hpoint;
+            union {
+                struct {
+                    uint32_t duty: 19;
+                    uint32_t reserved: 13;
+                };
+                uint32_t val;
+            } duty;
+            union {
+                struct {
+                    uint32_t duty_scale: 10;
+                    uint32_t duty_cycle: 10;
+                    uint32_t duty_num: 10;
+                    uint32_t duty_inc: 1;
+                    uint32_t duty_start: 1;
+                };
+                uint32_t val;
+            } conf1;
+            union {
+                struct {
+                    uint32_t duty_read: 19;
+                    uint32_t reserved: 13;
+                };
+                uint32_t val;
+            } duty_rd;
+        } channel[8];
+    } channel_group[2];
+    struct {
+        struct {
+            union {
+                struct {
+                    uint32_t duty_resolution: 4;
+                    uint32_t clock_divider: 18;
+                    uint32_t pause: 1;
+                    uint32_t rst: 1;
+                    uint32_t tick_sel: 1;
+                    uint32_t low_speed_update: 1;
+                    uint32_t reserved: 6;
+                };
+                uint32_t val;
+            } conf;
+        } timer[4];
+    } timer_group[2];
+} ledc_dev_t;
+
+extern ledc_dev_t LEDC;
@@ -0,0 +1,154 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <string.h>
+#include "app_storage.h"
+#include "host_sim.h"
+
+/**
+ * Keys kept in RAM, in fixed slots so the store allocates nothing that a
+ * benchmark would count
+ */
+
+#define APP_STORAGE_SIM_KEY_MAX     (8)
+#define APP_STORAGE_SIM_VALUE_MAX   (1024)
+
+typedef struct {
+    char key[16];
+    size_t length;      /**< 0 if the slot is free */
+    uint8_t value[APP_STORAGE_SIM_VALUE_MAX];
+} app_storage_sim_entry_t;
+
+static app_storage_sim_entry_t g_entries[APP_STORAGE_SIM_KEY_MAX];
+static app_storage_sim_stats_t g_stats;
+static uint32_t g_generation;
+static bool g_torn;             /**< Cleared by any commit, the sim does not count the keys of a batch */
+
+static app_storage_sim_entry_t *app_storage_sim_find(const char *key)
+{
+    for (int i = 0; i < APP_STORAGE_SIM_KEY_MAX; i++) {
+        if (g_entries[i].length && !strncmp(g_entries[i].key, key, sizeof(g_entries[i].key))) {
+            return g_entries + i;
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t app_storage_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t app_storage_set(const char *key, const void *value, size_t length)
+{
+    app_storage_sim_entry_t *entry = NULL;
+
+    if (!key || !value || !length || length > APP_STORAGE_SIM_VALUE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    entry = app_storage_sim_find(key);
+
+    for (int i = 0; !entry && i < APP_STORAGE_SIM_KEY_MAX; i++) {
+        entry = g_entries[i].length ? NULL : g_entries + i;
+    }
+
+    if (!entry) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    g_stats.writes++;
+    g_stats.bytes += length;
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_get(const char *key, void *value, size_t length)
+{
+    app_storage_sim_entry_t *entry = key ? app_storage_sim_find(key) : NULL;
+
+    g_stats.reads++;
+
+    if (!entry) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /**< As nvs_get_blob(), a buffer too small for the value is refused */
+    if (length < entry->length) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(value, entry->value, entry->length);
+
+    return ESP_OK;
+}
+
+esp_err_t app_storage_erase(const char *key)
+{
+    app_storage_sim_entry_t *entry = key ? app_storage_sim_find(key) : NULL;
+
+    if (entry) {
+        entry->length = 0;
+        g_stats.writes++;
+    }
+
+    return ESP_OK;
+}
+
+/**< Writes go straight to the RAM keys, a batch only groups them */
+esp_err_t app_storage_batch_begin(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_commit(void)
+{
+    g_torn = false;
+    g_generation++;
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_abort(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t app_storage_batch_generation(uint32_t *generation)
+{
+    *generation = g_generation;
+    return g_torn ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
+
+void app_storage_sim_tear(void)
+{
+    g_torn = true;
+}
+
+void app_storage_sim_stats(app_storage_sim_stats_t *stats)
+{
+    *stats = g_stats;
+}
+
+void app_storage_sim_reset(void)
+{
+    memset(g_entries, 0, sizeof(g_entries));
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_generation = 0;
+    g_torn       = false;
+}
@@ -0,0 +1,260 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/param.h>
+#include "driver/gptimer.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "host_sim.h"
+
+#define GPTIMER_SIM_MAX 4
+
+struct gptimer_t {
+    bool used;
+    bool enabled;
+    bool running;
+    bool armed;
+    bool auto_reload;
+    uint64_t alarm_count;
+    uint64_t reload_count;
+    uint64_t count_base;    /**< Count value at time_base */
+    int64_t time_base;
+    gptimer_alarm_cb_t on_alarm;
+    void *user_data;
+};
+
+void ledc_sim_advance(double now_us);
+void ledc_sim_reset(void);
+
+static struct gptimer_t s_timer[GPTIMER_SIM_MAX];
+static int64_t s_now_us;
+static uint32_t s_alarm_count;
+static int64_t s_isr_latency_us;
+static gptimer_sim_isr_time_t s_isr_time;
+
+static uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void gptimer_sim_set_isr_latency(int64_t latency_us)
+{
+    s_isr_latency_us = latency_us;
+}
+
+void gptimer_sim_isr_time(gptimer_sim_isr_time_t *time)
+{
+    *time = s_isr_time;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)host_time_ns();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return s_now_us;
+}
+
+int64_t sim_now_us(void)
+{
+    return s_now_us;
+}
+
+uint32_t gptimer_sim_alarm_count(void)
+{
+    return s_alarm_count;
+}
+
+void sim_reset(void)
+{
+    memset(s_timer, 0, sizeof(s_timer));
+    s_now_us = 0;
+    s_alarm_count = 0;
+    s_isr_latency_us = 0;
+    memset(&s_isr_time, 0, sizeof(s_isr_time));
+    ledc_sim_reset();
+}
+
+static uint64_t timer_count(struct gptimer_t *t)
+{
+    return t->running ? t->count_base + (uint64_t)(s_now_us - t->time_base) : t->count_base;
+}
+
+/* Virtual time at which the armed alarm of `t` fires, or INT64_MAX */
+static int64_t timer_deadline(struct gptimer_t *t)
+{
+    if (!t->used || !t->running || !t->armed || !t->on_alarm) {
+        return INT64_MAX;
+    }
+    uint64_t count = timer_count(t);
+    if (t->alarm_count <= count) {
+        return s_now_us;
+    }
+    return s_now_us + (int64_t)(t->alarm_count - count);
+}
+
+void sim_run_until(int64_t time_us)
+{
+    for (;;) {
+        struct gptimer_t *next = NULL;
+        int64_t deadline = INT64_MAX;
+        for (int i = 0; i < GPTIMER_SIM_MAX; i++) {
+            int64_t d = timer_deadline(&s_timer[i]);
+            if (d < deadline) {
+                deadline = d;
+                next = &s_timer[i];
+            }
+        }
+        if (!next || deadline > time_us) {
+            break;
+        }
+
+        ledc_sim_advance((double)deadline);
+        s_now_us = deadline;
+
+        gptimer_alarm_event_data_t edata = {
+            .count_value = timer_count(next),
+            .alarm_value = next->alarm_count,
+        };
+        if (next->auto_reload) {
+            next->count_base = next->reload_count;
+            next->time_base = s_now_us;
+        } else {
+            next->armed = false;
+        }
+        s_alarm_count++;
+        s_now_us += s_isr_latency_us;
+
+        uint64_t start_ns = host_time_ns();
+        next->on_alarm(next, &edata, next->user_data);
+        uint64_t spent_ns = host_time_ns() - start_ns;
+        s_isr_time.count++;
+        s_isr_time.total_ns += spent_ns;
+        s_isr_time.max_ns = MAX(s_isr_time.max_ns, spent_ns);
+    }
+    /**< An ISR delayed by the injected latency may have run past the end */
+    s_now_us = MAX(s_now_us, time_us);
+    ledc_sim_advance((double)s_now_us);
+}
+
+void sim_advance_us(int64_t delta_us)
+{
+    sim_run_until(s_now_us + delta_us);
+}
+
+esp_err_t gptimer_new_timer(const gptimer_config_t *config, gptimer_handle_t *ret_timer)
+{
+    if (!config || !ret_timer || config->resolution_hz != 1000000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < GPTIMER_SIM_MAX; i++) {
+        if (!s_timer[i].used) {
+            memset(&s_timer[i], 0, sizeof(s_timer[i]));
+            s_timer[i].used = true;
+            *ret_timer = &s_timer[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t gptimer_del_timer(gptimer_handle_t timer)
+{
+    if (!timer || timer->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->used = false;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_set_raw_count(gptimer_handle_t timer, uint64_t value)
+{
+    timer->count_base = value;
+    timer->time_base = s_now_us;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_get_raw_count(gptimer_handle_t timer, uint64_t *value)
+{
+    *value = timer_count(timer);
+    return ESP_OK;
+}
+
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t *cbs, void *user_data)
+{
+    if (timer->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->on_alarm = cbs->on_alarm;
+    timer->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t *config)
+{
+    if (config) {
+        timer->alarm_count = config->alarm_count;
+        timer->reload_count = config->reload_count;
+        timer->auto_reload = config->flags.auto_reload_on_alarm;
+        timer->armed = true;
+    } else {
+        timer->armed = false;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gptimer_enable(gptimer_handle_t timer)
+{
+    if (timer->enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_disable(gptimer_handle_t timer)
+{
+    if (!timer->enabled || timer->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_start(gptimer_handle_t timer)
+{
+    if (!timer->enabled || timer->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->time_base = s_now_us;
+    timer->running = true;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_stop(gptimer_handle_t timer)
+{
+    if (!timer->enabled || !timer->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->count_base = timer_count(timer);
+    timer->running = false;
+    return ESP_OK;
+}
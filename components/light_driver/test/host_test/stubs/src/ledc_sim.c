@@ -0,0 +1,179 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdlib.h>
+#include "soc/ledc_struct.h"
+#include "driver/ledc.h"
+#include "host_sim.h"
+
+ledc_dev_t LEDC;
+
+typedef struct {
+    bool active;
+    uint32_t duty_q4;
+    bool inc;
+    uint32_t num_left;
+    uint32_t cycle;
+    uint32_t scale;
+    double next_step_us;
+    uint32_t latches;
+    ledc_sim_sample_t *trace;
+    size_t trace_len;
+    size_t trace_cap;
+} ledc_sim_channel_t;
+
+static ledc_sim_channel_t s_channel[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static double s_last_us;
+
+static void trace_push(ledc_sim_channel_t *ch, int64_t t, uint32_t duty_q4)
+{
+    if (ch->trace_len && ch->trace[ch->trace_len - 1].duty_q4 == duty_q4) {
+        return;
+    }
+    if (ch->trace_len == ch->trace_cap) {
+        ch->trace_cap = ch->trace_cap ? ch->trace_cap * 2 : 256;
+        ch->trace = realloc(ch->trace, ch->trace_cap * sizeof(ledc_sim_sample_t));
+    }
+    ch->trace[ch->trace_len].time_us = t;
+    ch->trace[ch->trace_len].duty_q4 = duty_q4;
+    ch->trace_len++;
+}
+
+static double pwm_period_us(int mode, int channel)
+{
+    int timer = LEDC.channel_group[mode].channel[channel].conf0.timer_sel;
+    uint32_t res = LEDC.timer_group[mode].timer[timer].conf.duty_resolution;
+    uint32_t div = LEDC.timer_group[mode].timer[timer].conf.clock_divider;
+    if (!div) {
+        return 100.0;
+    }
+    return (double)div / 256.0 * (double)(1U << res) / (LEDC_APB_CLK_HZ / 1e6);
+}
+
+uint32_t ledc_sim_pwm_period_ns(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return (uint32_t)(pwm_period_us(speed_mode, channel) * 1000.0);
+}
+
+/* Latch pending register writes, then run the hardware fader up to `now_us` */
+void ledc_sim_advance(double now_us)
+{
+    for (int mode = 0; mode < LEDC_SPEED_MODE_MAX; mode++) {
+        for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++) {
+            ledc_sim_channel_t *ch = &s_channel[mode][channel];
+            typeof(LEDC.channel_group[0].channel[0]) *reg = &LEDC.channel_group[mode].channel[channel];
+            double period = pwm_period_us(mode, channel);
+
+            if (reg->conf1.duty_start || reg->conf0.low_speed_update) {
+                if (reg->conf1.duty_start) {
+                    ch->duty_q4 = reg->duty.duty;
+                    ch->inc = reg->conf1.duty_inc;
+                    ch->num_left = reg->conf1.duty_num;
+                    ch->cycle = reg->conf1.duty_cycle ? reg->conf1.duty_cycle : 1;
+                    ch->scale = reg->conf1.duty_scale;
+                    ch->next_step_us = s_last_us + period * ch->cycle;
+                    ch->active = ch->num_left > 0 && ch->scale > 0;
+                    ch->latches++;
+                }
+                reg->conf1.duty_start = 0;
+                reg->conf0.low_speed_update = 0;
+                trace_push(ch, (int64_t)s_last_us, ch->duty_q4);
+            }
+
+            while (ch->active && ch->next_step_us <= now_us) {
+                uint32_t delta = ch->scale << 4;
+                if (ch->inc) {
+                    ch->duty_q4 += delta;
+                } else {
+                    ch->duty_q4 = ch->duty_q4 > delta ? ch->duty_q4 - delta : 0;
+                }
+                trace_push(ch, (int64_t)ch->next_step_us, ch->duty_q4);
+                ch->next_step_us += period * ch->cycle;
+                if (--ch->num_left == 0) {
+                    ch->active = false;
+                }
+            }
+            reg->duty_rd.duty_read = ch->duty_q4;
+        }
+    }
+    s_last_us = now_us;
+}
+
+void ledc_sim_reset(void)
+{
+    for (int mode = 0; mode < LEDC_SPEED_MODE_MAX; mode++) {
+        for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++) {
+            free(s_channel[mode][channel].trace);
+        }
+    }
+    memset(s_channel, 0, sizeof(s_channel));
+    memset((void *)&LEDC, 0, sizeof(LEDC));
+    s_last_us = 0;
+}
+
+uint32_t ledc_sim_duty_q4(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return s_channel[speed_mode][channel].duty_q4;
+}
+
+uint32_t ledc_sim_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return s_channel[speed_mode][channel].duty_q4 >> 4;
+}
+
+uint32_t ledc_sim_latch_count(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return s_channel[speed_mode][channel].latches;
+}
+
+const ledc_sim_sample_t *ledc_sim_trace(ledc_mode_t speed_mode, ledc_channel_t channel, size_t *count)
+{
+    *count = s_channel[speed_mode][channel].trace_len;
+    return s_channel[speed_mode][channel].trace;
+}
+
+void ledc_sim_trace_clear(void)
+{
+    for (int mode = 0; mode < LEDC_SPEED_MODE_MAX; mode++) {
+        for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++) {
+            s_channel[mode][channel].trace_len = 0;
+        }
+    }
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    if (!timer_conf || !timer_conf->freq_hz || timer_conf->duty_resolution >= LEDC_TIMER_BIT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint64_t div = ((uint64_t)LEDC_APB_CLK_HZ << 8) / timer_conf->freq_hz / (1U << timer_conf->duty_resolution);
+    if (div < 256 || div >= (1U << 18)) {
+        return ESP_FAIL;
+    }
+    LEDC.timer_group[timer_conf->speed_mode].timer[timer_conf->timer_num].conf.duty_resolution = timer_conf->duty_resolution;
+    LEDC.timer_group[timer_conf->speed_mode].timer[timer_conf->timer_num].conf.clock_divider = div;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    if (!ledc_conf || ledc_conf->channel >= LEDC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    LEDC.channel_group[ledc_conf->speed_mode].channel[ledc_conf->channel].conf0.timer_sel = ledc_conf->timer_sel;
+    LEDC.channel_group[ledc_conf->speed_mode].channel[ledc_conf->channel].duty.duty = ledc_conf->duty << 4;
+    LEDC.channel_group[ledc_conf->speed_mode].channel[ledc_conf->channel].conf1.duty_start = 1;
+    return ESP_OK;
+}
@@ -0,0 +1,232 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "host_sim.h"
+
+/**
+ * Tasks are host threads running one at a time, as on one core without
+ * preemption: a task runs while it holds g_cpu and only gives it up to wait
+ * for a notification, to delay or when it is deleted. The thread of main() is
+ * a task as well, taking the CPU on its first call, and lets the others run
+ * with rtos_sim_run_idle(). Ticks are milliseconds of the host clock, not of
+ * the virtual time.
+ */
+
+typedef struct {
+    pthread_cond_t wake;
+    uint32_t notify;        /**< Notification value */
+    bool waiting;           /**< Not ready, in ulTaskNotifyTake() or vTaskDelay() */
+    bool notifiable;        /**< A notification ends the wait */
+    TaskFunction_t func;
+    void *arg;
+} rtos_sim_task_t;
+
+static pthread_mutex_t g_cpu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_idle = PTHREAD_COND_INITIALIZER;
+static int g_ready           = 0;   /**< Tasks created and not waiting, main() not counted */
+static rtos_sim_task_t g_main_task;
+static __thread rtos_sim_task_t *t_self = NULL;
+
+static rtos_sim_task_t *rtos_sim_self(void)
+{
+    if (!t_self) {
+        pthread_mutex_lock(&g_cpu);
+        pthread_cond_init(&g_main_task.wake, NULL);
+        t_self = &g_main_task;
+    }
+
+    return t_self;
+}
+
+static void rtos_sim_ready(rtos_sim_task_t *task, int delta)
+{
+    if (task != &g_main_task) {
+        g_ready += delta;
+        pthread_cond_broadcast(&g_idle);
+    }
+}
+
+/**
+ * @brief Give up the CPU for `ticks`, or until notified if `notifiable`, and get it back
+ */
+static void rtos_sim_wait(rtos_sim_task_t *self, TickType_t ticks, bool notifiable)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += ticks / 1000 + ((ticks % 1000) * 1000000L + deadline.tv_nsec) / 1000000000L;
+    deadline.tv_nsec  = ((ticks % 1000) * 1000000L + deadline.tv_nsec) % 1000000000L;
+
+    self->waiting    = true;
+    self->notifiable = notifiable;
+    rtos_sim_ready(self, -1);
+
+    while (self->waiting) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&self->wake, &g_cpu);
+        } else if (pthread_cond_timedwait(&self->wake, &g_cpu, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    /**< Timed out, a notification has made the task ready already */
+    if (self->waiting) {
+        self->waiting = false;
+        rtos_sim_ready(self, 1);
+    }
+}
+
+static void *rtos_sim_entry(void *arg)
+{
+    rtos_sim_task_t *self = arg;
+
+    pthread_mutex_lock(&g_cpu);
+    t_self = self;
+    self->func(self->arg);
+    vTaskDelete(NULL);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack_depth, void *arg,
+                       BaseType_t priority, TaskHandle_t *handle)
+{
+    rtos_sim_task_t *task = calloc(1, sizeof(rtos_sim_task_t));
+    pthread_t thread;
+
+    rtos_sim_self();
+
+    if (!task) {
+        return pdFALSE;
+    }
+
+    pthread_cond_init(&task->wake, NULL);
+    task->func = func;
+    task->arg  = arg;
+
+    if (pthread_create(&thread, NULL, rtos_sim_entry, task)) {
+        free(task);
+        return pdFALSE;
+    }
+
+    pthread_detach(thread);
+    rtos_sim_ready(task, 1);
+
+    if (handle) {
+        *handle = task;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    rtos_sim_task_t *self = rtos_sim_self();
+
+    /**< Only a task deleting itself is simulated */
+    if (task && task != self) {
+        abort();
+    }
+
+    rtos_sim_ready(self, -1);
+    pthread_mutex_unlock(&g_cpu);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    rtos_sim_wait(rtos_sim_self(), ticks, false);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return rtos_sim_self();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    rtos_sim_task_t *self = rtos_sim_self();
+
+    if (!self->notify && ticks) {
+        rtos_sim_wait(self, ticks, true);
+    }
+
+    uint32_t value = self->notify;
+
+    if (value) {
+        self->notify = clear ? 0 : value - 1;
+    }
+
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    rtos_sim_task_t *task = handle;
+
+    rtos_sim_self();
+    task->notify++;
+
+    if (task->waiting && task->notifiable) {
+        task->waiting = false;
+        rtos_sim_ready(task, 1);
+        pthread_cond_signal(&task->wake);
+    }
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+
+    if (woken) {
+        *woken = pdTRUE;
+    }
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    return ESP_OK;
+}
+
+void rtos_sim_run_idle(void)
+{
+    rtos_sim_self();
+
+    while (g_ready) {
+        pthread_cond_wait(&g_idle, &g_cpu);
+    }
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Generate the default dimming curve of iot_led.
+
+The table maps a 12-bit lightness to a Q16 duty fraction. It has one knot more
+than the input range so the last segment can be interpolated up to full scale.
+iot_led scales the fraction to the duty resolution the LEDC timer runs at.
+"""
+
+import argparse
+
+TABLE_BITS = 12
+TABLE_SIZE = (1 << TABLE_BITS) + 1
+DUTY_MAX = 0xFFFF
+
+
+def cie1931(lightness):
+    """Relative luminance for a CIE 1931 lightness in [0, 1]."""
+    l_star = lightness * 100.0
+    if l_star <= 8.0:
+        return l_star / 903.3
+    return ((l_star + 16.0) / 116.0) ** 3
+
+
+def build_table(curve, gamma):
+    table = []
+    for i in range(TABLE_SIZE):
+        x = i / float(TABLE_SIZE - 1)
+        y = cie1931(x) if curve == 'cie1931' else x ** gamma
+        table.append(min(DUTY_MAX, int(round(y * DUTY_MAX))))
+    table[-1] = DUTY_MAX
+    return table
+
+
+def write_header(path, curve, gamma, table):
+    name = 'CIE 1931 lightness' if curve == 'cie1931' else 'gamma %.2f' % gamma
+    with open(path, 'w') as f:
+        f.write('/* Generated by gen_gamma_table.py, do not edit */\n')
+        f.write('#pragma once\n\n')
+        f.write('#include <stdint.h>\n\n')
+        f.write('#define GAMMA_TABLE_GENERATED_BITS (%d)\n\n' % TABLE_BITS)
+        f.write('/**< Default dimming curve, %s, Q16 duty fraction */\n' % name)
+        f.write('static const uint16_t g_gamma_table_default[%d] = {\n' % TABLE_SIZE)
+        for i in range(0, TABLE_SIZE, 8):
+            f.write('    ' + ', '.join('0x%04x' % v for v in table[i:i + 8]) + ',\n')
+        f.write('};\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--curve', choices=['cie1931', 'gamma'], default='cie1931')
+    parser.add_argument('--gamma', type=int, default=125,
+                        help='Exponent of the gamma curve, x100')
+    parser.add_argument('--output', required=True)
+    args = parser.parse_args()
+
+    gamma = args.gamma / 100.0
+    write_header(args.output, args.curve, gamma, build_table(args.curve, gamma))
+
+
+if __name__ == '__main__':
+    main()